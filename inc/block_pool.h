@@ -0,0 +1,130 @@
+#pragma once
+//
+// Fixed size block allocator with per thread caches
+//
+// Every BlockPool<size> is a single pool shared by all users of that block size. Freed blocks
+// go to a cache owned by the freeing thread (on vm cores, this is a per core cache). Past a
+// limit, they are handed to a shared list in batches. A thread with an empty cache takes the
+// whole shared list, which avoids the ABA problem of popping single blocks.
+//
+// Blocks may be freed on a different thread than the one that allocated them. Memory is only
+// returned to the system when a thread exits or the process ends.
+//
+#include <atomic>
+#include <cstddef>
+#include <new>
+
+namespace Eople
+{
+
+template <size_t block_size>
+class BlockPool
+{
+public:
+  static void* Allocate()
+  {
+    Cache& cache = LocalCache();
+    Block* block;
+    if( cache.returned )
+    {
+      block = cache.returned;
+      cache.returned = block->next;
+      --cache.returned_count;
+      return block;
+    }
+    if( !cache.blocks )
+    {
+      cache.blocks = Shared().blocks.exchange(nullptr, std::memory_order_acquire);
+      if( !cache.blocks )
+      {
+        return ::operator new(size);
+      }
+    }
+    block = cache.blocks;
+    cache.blocks = block->next;
+    return block;
+  }
+
+  static void Free( void* memory )
+  {
+    const size_t batch_size = 64;
+
+    Cache& cache = LocalCache();
+    Block* block = (Block*)memory;
+    block->next = cache.returned;
+    cache.returned_tail = cache.returned ? cache.returned_tail : block;
+    cache.returned = block;
+    if( ++cache.returned_count < batch_size )
+    {
+      return;
+    }
+
+    auto &shared = Shared().blocks;
+    Block* top = shared.load(std::memory_order_relaxed);
+    do
+    {
+      cache.returned_tail->next = top;
+    } while( !shared.compare_exchange_weak(top, cache.returned, std::memory_order_release, std::memory_order_relaxed) );
+    cache.returned = nullptr;
+    cache.returned_tail = nullptr;
+    cache.returned_count = 0;
+  }
+
+  // return a block straight to the system, for use when thread local caches may be gone
+  static void Release( void* memory )
+  {
+    ::operator delete(memory);
+  }
+
+private:
+  struct Block
+  {
+    Block* next;
+  };
+
+  static const size_t size = block_size < sizeof(Block) ? sizeof(Block) : block_size;
+
+  static void DeleteList( Block* block )
+  {
+    while( block )
+    {
+      Block* next = block->next;
+      ::operator delete(block);
+      block = next;
+    }
+  }
+
+  struct Cache
+  {
+    Cache() : blocks(nullptr), returned(nullptr), returned_tail(nullptr), returned_count(0) {}
+    ~Cache() { DeleteList(blocks); DeleteList(returned); }
+
+    Block* blocks;
+    // recently freed blocks, handed to the shared list once there are enough of them
+    Block* returned;
+    Block* returned_tail;
+    size_t returned_count;
+  };
+
+  struct SharedBlocks
+  {
+    SharedBlocks() : blocks(nullptr) {}
+    ~SharedBlocks() { DeleteList(blocks.exchange(nullptr)); }
+
+    std::atomic<Block*> blocks;
+  };
+
+  static Cache& LocalCache()
+  {
+    static thread_local Cache cache;
+    return cache;
+  }
+
+  static SharedBlocks& Shared()
+  {
+    static SharedBlocks shared;
+    return shared;
+  }
+};
+
+} // namespace Eople
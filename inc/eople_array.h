@@ -0,0 +1,484 @@
+#pragma once
+//
+// Array storage
+//
+// Arrays of ints, floats and bools keep their elements unboxed, in a contiguous buffer of
+// int_t, float_t or packed bits. Arrays of structs keep the members of every element inline,
+// one struct after the other. Arrays of anything else keep objects. The element type is
+// known after type inference, so code generation picks typed opcodes that go straight to
+// the buffer (eg. ArraySubscriptI), and builtins that take any array look at the kind.
+//
+// The elements are kept in a reference counted buffer. A copy of an array (pushed onto an array
+// of arrays, read back with top, or the value of a reply) shares the buffer of the original, and
+// whichever of them changes first takes a copy of its own (MakeWritable). The count is atomic,
+// so copies in different processes can share a buffer too.
+//
+// A slice of an array of ints or floats (slice builtin) is a view: it shares the buffer of the
+// array and reads a range of it, so taking one or sending it to another process copies nothing.
+// Code that reads the elements goes through IntRange and FloatRange, which know about views. A
+// view that changes takes a copy of its range first, like any other shared array. Slices of
+// other arrays are copies.
+//
+// An array of ints, floats or bools can be frozen (freeze builtin). A frozen array never changes
+// again, so processes share it instead of copying it into every message; it is reference
+// counted and the last process to let go of it destroys it, see Heap.
+//
+#include "eople_object.h"
+#include "eople_struct.h"
+
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <cassert>
+
+namespace Eople
+{
+
+enum class ArrayKind : u8
+{
+  OBJECT,
+  INT,
+  FLOAT,
+  BOOL,
+  STRUCT,
+};
+
+// elements of an array, and of its copies until they change
+template <class T>
+struct ArrayBuffer
+{
+  ArrayBuffer() { ref_count.store(1, std::memory_order_relaxed); }
+  explicit ArrayBuffer( const std::vector<T>& in_values ) : values(in_values) { ref_count.store(1, std::memory_order_relaxed); }
+  template <class It>
+  ArrayBuffer( It first, It last ) : values(first, last) { ref_count.store(1, std::memory_order_relaxed); }
+
+  bool IsShared() const { return ref_count.load(std::memory_order_acquire) != 1; }
+  void AddRef() { ref_count.fetch_add(1, std::memory_order_relaxed); }
+  void Release()
+  {
+    if( ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1 )
+    {
+      delete this;
+    }
+  }
+
+  // buffer, replaced by a copy of its own if it is shared
+  static void Own( ArrayBuffer*& buffer )
+  {
+    if( buffer->IsShared() )
+    {
+      ArrayBuffer* own = new ArrayBuffer(buffer->values);
+      buffer->Release();
+      buffer = own;
+    }
+  }
+
+  std::vector<T>   values;
+  std::atomic<u32> ref_count;
+
+private:
+  ArrayBuffer(const ArrayBuffer&);
+  ArrayBuffer& operator=(const ArrayBuffer&);
+};
+
+// elements to read, contiguous: all of an array or the range of a slice
+template <class T>
+struct ArrayRange
+{
+  ArrayRange( const T* in_data, size_t in_size ) : m_data(in_data), m_size(in_size) {}
+
+  const T* data() const { return m_data; }
+  size_t   size() const { return m_size; }
+  const T& operator[]( size_t i ) const { return m_data[i]; }
+  const T* begin() const { return m_data; }
+  const T* end() const { return m_data + m_size; }
+
+private:
+  const T* m_data;
+  size_t   m_size;
+};
+
+template <class T, ArrayKind array_kind> struct TypedArray;
+typedef TypedArray<Object,  ArrayKind::OBJECT> ObjectArray;
+typedef TypedArray<int_t,   ArrayKind::INT>    IntArray;
+typedef TypedArray<float_t, ArrayKind::FLOAT>  FloatArray;
+typedef TypedArray<bool,    ArrayKind::BOOL>   BoolArray;
+struct StructArray;
+
+struct Array
+{
+  // storage used for arrays of element_type
+  static ArrayKind KindOf( type_t element_type );
+  static Array*    Create( ArrayKind kind );
+  // also works for arrays of structs, which need to know their element type
+  static Array*    Create( type_t element_type );
+  static void      Destroy( Array* array );
+  // destroys array, or drops a reference to it if it is frozen
+  static void      Release( Array* array );
+
+  array_t&              Objects();
+  // the whole buffer, to change after MakeWritable; slices are read through the ranges
+  std::vector<int_t>&   Ints();
+  std::vector<float_t>& Floats();
+  std::vector<bool>&    Bools();
+  StructArray*          Structs();
+  ArrayRange<int_t>     IntRange();
+  ArrayRange<float_t>   FloatRange();
+
+  size_t size() const;
+  bool   empty() const { return size() == 0; }
+  void   clear();
+  void   pop_back();
+  // element i, as an object
+  Object Get( size_t i );
+  // copy of the array, with the same kind, sharing its elements until one of them changes. The
+  // copy isn't frozen.
+  Array* Copy();
+  // count elements from first, which must be in bounds: a view for ints and floats, a copy
+  // for the others
+  Array* Slice( size_t first, size_t count );
+  // call before changing the elements (and before taking references to them to change): throws
+  // if the array is frozen, and gives it elements of its own if they are shared with a copy
+  void MakeWritable();
+
+  // arrays of ints, floats and bools only
+  static bool CanFreeze( ArrayKind kind ) { return kind == ArrayKind::INT || kind == ArrayKind::FLOAT || kind == ArrayKind::BOOL; }
+  void Freeze();
+  void AddRef() { ref_count.fetch_add(1, std::memory_order_relaxed); }
+
+  const ArrayKind kind;
+  bool            frozen;
+  // a slice sharing the buffer of another array
+  bool            view;
+  // references held by processes (and messages), once frozen
+  std::atomic<u32> ref_count;
+
+protected:
+  Array( ArrayKind in_kind ) : kind(in_kind), frozen(false), view(false)
+  {
+    ref_count.store(1, std::memory_order_relaxed);
+  }
+
+private:
+  Array(const Array&);
+  Array& operator=(const Array&);
+};
+
+template <class T, ArrayKind array_kind>
+struct TypedArray : public Array
+{
+  TypedArray() : Array(array_kind), buffer(new ArrayBuffer<T>()), view_first(0), view_size(0) {}
+  // shares the elements of other
+  explicit TypedArray( const TypedArray* other )
+    : Array(array_kind), buffer(other->buffer), view_first(other->view_first), view_size(other->view_size)
+  {
+    view = other->view;
+    buffer->AddRef();
+  }
+  // view of count elements of other, from first
+  TypedArray( const TypedArray* other, size_t first, size_t count )
+    : Array(array_kind), buffer(other->buffer), view_first(other->view_first + first), view_size(count)
+  {
+    view = true;
+    buffer->AddRef();
+  }
+  ~TypedArray() { buffer->Release(); }
+
+  std::vector<T>& values() { return buffer->values; }
+  const std::vector<T>& values() const { return buffer->values; }
+  // the elements can be changed in place
+  bool IsWritable() const { return !frozen && !view && !buffer->IsShared(); }
+
+  size_t size() const { return view ? view_size : buffer->values.size(); }
+  ArrayRange<T> Range() const
+  {
+    return view ? ArrayRange<T>(buffer->values.data() + view_first, view_size)
+                : ArrayRange<T>(buffer->values.data(), buffer->values.size());
+  }
+
+  // buffer of its own, holding just the elements of the view
+  void Own()
+  {
+    if( view )
+    {
+      auto first = buffer->values.begin() + view_first;
+      ArrayBuffer<T>* own = new ArrayBuffer<T>(first, first + view_size);
+      buffer->Release();
+      buffer = own;
+      view = false;
+      view_first = 0;
+      view_size = 0;
+      return;
+    }
+    ArrayBuffer<T>::Own(buffer);
+  }
+
+  ArrayBuffer<T>* buffer;
+  size_t          view_first;
+  size_t          view_size;
+};
+
+struct StructArray : public Array
+{
+  // memberless structs still take a slot, so every element has one
+  StructArray( StructType* in_type )
+    : Array(ArrayKind::STRUCT), buffer(new ArrayBuffer<Object>()), type(in_type),
+      stride(in_type->member_names.empty() ? 1 : in_type->member_names.size()) {}
+  // shares the elements of other
+  explicit StructArray( const StructArray* other )
+    : Array(ArrayKind::STRUCT), buffer(other->buffer), type(other->type), stride(other->stride) { buffer->AddRef(); }
+  ~StructArray() { buffer->Release(); }
+
+  // members of every element, stride objects apart
+  std::vector<Object>& values() { return buffer->values; }
+  const std::vector<Object>& values() const { return buffer->values; }
+  bool IsWritable() const { return !frozen && !buffer->IsShared(); }
+
+  Object* Members( size_t i ) { return &buffer->values[i * stride]; }
+
+  void Push( Struct* element )
+  {
+    MakeWritable();
+    Object* members = element->Members();
+    values().insert( values().end(), members, members + element->size() );
+    values().resize( values().size() + stride - element->size() );
+  }
+
+  void Store( size_t i, Struct* element )
+  {
+    MakeWritable();
+    std::copy( element->Members(), element->Members() + element->size(), Members(i) );
+  }
+
+  ArrayBuffer<Object>* buffer;
+  StructType* const    type;
+  const size_t         stride;
+};
+
+inline ArrayKind Array::KindOf( type_t element_type )
+{
+  switch( element_type->type )
+  {
+    case ValueType::INT:    return ArrayKind::INT;
+    case ValueType::FLOAT:  return ArrayKind::FLOAT;
+    case ValueType::BOOL:   return ArrayKind::BOOL;
+    case ValueType::STRUCT: return ArrayKind::STRUCT;
+    default:                return ArrayKind::OBJECT;
+  }
+}
+
+inline Array* Array::Create( ArrayKind kind )
+{
+  assert( kind != ArrayKind::STRUCT );
+  switch( kind )
+  {
+    case ArrayKind::INT:   return new IntArray();
+    case ArrayKind::FLOAT: return new FloatArray();
+    case ArrayKind::BOOL:  return new BoolArray();
+    default:               return new ObjectArray();
+  }
+}
+
+inline Array* Array::Create( type_t element_type )
+{
+  if( element_type->type == ValueType::STRUCT )
+  {
+    return new StructArray(static_cast<StructType*>(element_type));
+  }
+  return Create(KindOf(element_type));
+}
+
+inline void Array::Destroy( Array* array )
+{
+  // no virtual destructor, the kind tells what to delete
+  switch( array->kind )
+  {
+    case ArrayKind::INT:    delete static_cast<IntArray*>(array);    break;
+    case ArrayKind::FLOAT:  delete static_cast<FloatArray*>(array);  break;
+    case ArrayKind::BOOL:   delete static_cast<BoolArray*>(array);   break;
+    case ArrayKind::STRUCT: delete static_cast<StructArray*>(array); break;
+    default:                delete static_cast<ObjectArray*>(array); break;
+  }
+}
+
+inline void Array::Release( Array* array )
+{
+  if( array->frozen && array->ref_count.fetch_sub(1, std::memory_order_acq_rel) != 1 )
+  {
+    return;
+  }
+  Destroy(array);
+}
+
+inline void Array::Freeze()
+{
+  if( !CanFreeze(kind) )
+  {
+    throw std::runtime_error("Only arrays of ints, floats or bools can be frozen.");
+  }
+  frozen = true;
+}
+
+inline array_t& Array::Objects()
+{
+  assert( kind == ArrayKind::OBJECT );
+  return static_cast<ObjectArray*>(this)->values();
+}
+
+inline std::vector<int_t>& Array::Ints()
+{
+  assert( kind == ArrayKind::INT && !view );
+  return static_cast<IntArray*>(this)->values();
+}
+
+inline std::vector<float_t>& Array::Floats()
+{
+  assert( kind == ArrayKind::FLOAT && !view );
+  return static_cast<FloatArray*>(this)->values();
+}
+
+inline std::vector<bool>& Array::Bools()
+{
+  assert( kind == ArrayKind::BOOL );
+  return static_cast<BoolArray*>(this)->values();
+}
+
+inline StructArray* Array::Structs()
+{
+  assert( kind == ArrayKind::STRUCT );
+  return static_cast<StructArray*>(this);
+}
+
+inline ArrayRange<int_t> Array::IntRange()
+{
+  assert( kind == ArrayKind::INT );
+  return static_cast<IntArray*>(this)->Range();
+}
+
+inline ArrayRange<float_t> Array::FloatRange()
+{
+  assert( kind == ArrayKind::FLOAT );
+  return static_cast<FloatArray*>(this)->Range();
+}
+
+inline size_t Array::size() const
+{
+  switch( kind )
+  {
+    case ArrayKind::INT:   return static_cast<const IntArray*>(this)->size();
+    case ArrayKind::FLOAT: return static_cast<const FloatArray*>(this)->size();
+    case ArrayKind::BOOL:  return static_cast<const BoolArray*>(this)->values().size();
+    case ArrayKind::STRUCT:
+    {
+      auto structs = static_cast<const StructArray*>(this);
+      return structs->values().size() / structs->stride;
+    }
+    default:               return static_cast<const ObjectArray*>(this)->values().size();
+  }
+}
+
+inline void Array::clear()
+{
+  MakeWritable();
+  switch( kind )
+  {
+    case ArrayKind::INT:    Ints().clear();               break;
+    case ArrayKind::FLOAT:  Floats().clear();             break;
+    case ArrayKind::BOOL:   Bools().clear();              break;
+    case ArrayKind::STRUCT: Structs()->values().clear(); break;
+    default:                Objects().clear();            break;
+  }
+}
+
+inline void Array::pop_back()
+{
+  MakeWritable();
+  switch( kind )
+  {
+    case ArrayKind::INT:   Ints().pop_back();    break;
+    case ArrayKind::FLOAT: Floats().pop_back();  break;
+    case ArrayKind::BOOL:  Bools().pop_back();   break;
+    case ArrayKind::STRUCT:
+    {
+      auto &values = Structs()->values();
+      values.resize( values.size() - Structs()->stride );
+      break;
+    }
+    default:               Objects().pop_back(); break;
+  }
+}
+
+inline Object Array::Get( size_t i )
+{
+  switch( kind )
+  {
+    case ArrayKind::INT:    return Object::BuildInt(IntRange()[i]);
+    case ArrayKind::FLOAT:  return Object::BuildFloat(FloatRange()[i]);
+    case ArrayKind::BOOL:   return Object::BuildBool(Bools()[i]);
+    // a copy, the elements themselves live inline
+    case ArrayKind::STRUCT: return Object::BuildStruct(Struct::Create(Structs()->type, Structs()->Members(i)));
+    default:                return Objects()[i];
+  }
+}
+
+inline Array* Array::Copy()
+{
+  switch( kind )
+  {
+    case ArrayKind::INT:    return new IntArray(static_cast<IntArray*>(this));
+    case ArrayKind::FLOAT:  return new FloatArray(static_cast<FloatArray*>(this));
+    case ArrayKind::BOOL:   return new BoolArray(static_cast<BoolArray*>(this));
+    case ArrayKind::STRUCT: return new StructArray(Structs());
+    default:                return new ObjectArray(static_cast<ObjectArray*>(this));
+  }
+}
+
+inline Array* Array::Slice( size_t first, size_t count )
+{
+  assert( first + count <= size() );
+  switch( kind )
+  {
+    case ArrayKind::INT:   return new IntArray(static_cast<IntArray*>(this), first, count);
+    case ArrayKind::FLOAT: return new FloatArray(static_cast<FloatArray*>(this), first, count);
+    case ArrayKind::BOOL:
+    {
+      auto slice = new BoolArray();
+      auto begin = Bools().begin() + first;
+      slice->values().assign( begin, begin + count );
+      return slice;
+    }
+    case ArrayKind::STRUCT:
+    {
+      auto slice = new StructArray(Structs()->type);
+      auto begin = Structs()->values().begin() + first * Structs()->stride;
+      slice->values().assign( begin, begin + count * Structs()->stride );
+      return slice;
+    }
+    default:
+    {
+      auto slice = new ObjectArray();
+      auto begin = Objects().begin() + first;
+      slice->values().assign( begin, begin + count );
+      return slice;
+    }
+  }
+}
+
+inline void Array::MakeWritable()
+{
+  if( frozen )
+  {
+    throw std::runtime_error("Frozen arrays can't be changed.");
+  }
+  switch( kind )
+  {
+    case ArrayKind::INT:    static_cast<IntArray*>(this)->Own();                               break;
+    case ArrayKind::FLOAT:  static_cast<FloatArray*>(this)->Own();                             break;
+    case ArrayKind::BOOL:   ArrayBuffer<bool>::Own(static_cast<BoolArray*>(this)->buffer);     break;
+    case ArrayKind::STRUCT: ArrayBuffer<Object>::Own(Structs()->buffer);                       break;
+    default:                ArrayBuffer<Object>::Own(static_cast<ObjectArray*>(this)->buffer); break;
+  }
+}
+
+} // namespace Eople
@@ -0,0 +1,60 @@
+#pragma once
+//
+// Numeric kernels for array<int> and array<float> builtins (sum, min, max, dot, scale, add, mul, axpy)
+//
+// Every kernel has a scalar version, and SSE2/AVX2 versions on x86-64 where the instruction set
+// has something to offer (there's no 64 bit integer multiply before AVX-512, so int products stay
+// scalar). The best set for the cpu is picked once, with cpuid.
+//
+// Reductions run several lanes in parallel, so float sums and dot products may differ from a
+// sequential loop in the last bits. Elementwise kernels round exactly like the interpreter.
+//
+#include "primitive_types.h"
+#include "eople_types.h"
+
+namespace Eople
+{
+namespace ArrayMath
+{
+
+enum class Isa : u8
+{
+  SCALAR,
+  SSE2,
+  AVX2,
+};
+
+// min/max expect n > 0, binary kernels expect equally sized inputs. out may alias an input.
+struct Kernels
+{
+  Isa isa;
+
+  float_t (*sum_f)( const float_t* x, size_t n );
+  float_t (*min_f)( const float_t* x, size_t n );
+  float_t (*max_f)( const float_t* x, size_t n );
+  float_t (*dot_f)( const float_t* x, const float_t* y, size_t n );
+  void    (*scale_f)( float_t* out, const float_t* x, float_t k, size_t n );
+  void    (*add_f)( float_t* out, const float_t* x, const float_t* y, size_t n );
+  void    (*mul_f)( float_t* out, const float_t* x, const float_t* y, size_t n );
+  // out = x*k + y
+  void    (*axpy_f)( float_t* out, const float_t* x, float_t k, const float_t* y, size_t n );
+
+  // ints wrap around on overflow
+  int_t   (*sum_i)( const int_t* x, size_t n );
+  int_t   (*min_i)( const int_t* x, size_t n );
+  int_t   (*max_i)( const int_t* x, size_t n );
+  int_t   (*dot_i)( const int_t* x, const int_t* y, size_t n );
+  void    (*scale_i)( int_t* out, const int_t* x, int_t k, size_t n );
+  void    (*add_i)( int_t* out, const int_t* x, const int_t* y, size_t n );
+  void    (*mul_i)( int_t* out, const int_t* x, const int_t* y, size_t n );
+  void    (*axpy_i)( int_t* out, const int_t* x, int_t k, const int_t* y, size_t n );
+};
+
+// fastest kernels supported by this cpu
+const Kernels& Best();
+// kernels for a specific instruction set, nullptr if this cpu (or build) doesn't support it
+const Kernels* ForIsa( Isa isa );
+const char*    IsaName( Isa isa );
+
+} // namespace ArrayMath
+} // namespace Eople
@@ -259,8 +259,15 @@ namespace Node
 
     ArraySubscript* GetAsArraySubscript() { return this; }
 
+    // member of a struct: 'member' for arr[i].member, or the key for obj.member (parsed like obj['member'])
+    const std::string* GetMemberName();
+    // the struct holding the member, given the type of ident. nullptr if this isn't a member access.
+    StructType*        GetStructType( type_t container_type );
+
     ExpressionNode ident;
     ExpressionNode index;
+    // set for arr[i].member
+    std::string    member;
   };
 
   struct DictLiteral : public Expression
@@ -344,7 +351,7 @@ namespace Node
 
   struct FunctionCall : public Statement
   {
-    FunctionCall( ExpressionNode in_ident, u32 in_line ) : Statement(in_line), ident(std::move(in_ident))
+    FunctionCall( ExpressionNode in_ident, u32 in_line ) : Statement(in_line), constructs_struct(false), ident(std::move(in_ident))
     {
     }
 
@@ -371,6 +378,8 @@ namespace Node
 
     // namespace stack for the scope containing this function call, to disambiguate
     std::vector<std::string>    namespace_stack;
+    // calls a struct constructor rather than a function. the struct type is the return type.
+    bool                        constructs_struct;
   private:
     ExpressionNode ident;
   };
@@ -393,9 +402,11 @@ namespace Node
 
   struct Struct : public Statement
   {
-    Struct( std::string in_name, u32 in_line ) : Statement(in_line), name(in_name) {}
+    Struct( std::string in_name, u32 in_line ) : Statement(in_line), name(in_name), type(in_name) {}
 
     std::string                 name;
+    // the one layout of this struct. member types are filled in by type inference.
+    StructType                  type;
     SymbolTable                 symbols;
     // each specialization gets its own symbol table
     std::vector<SymbolTable>    specializations;
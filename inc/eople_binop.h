@@ -17,6 +17,17 @@ bool SubF( process_t process_ref );
 bool MulF( process_t process_ref );
 bool DivF( process_t process_ref );
 
+bool MulAddI( process_t process_ref );
+bool MulAddF( process_t process_ref );
+
+bool AddIK( process_t process_ref );
+bool SubIK( process_t process_ref );
+bool MulIK( process_t process_ref );
+bool AddFK( process_t process_ref );
+bool SubFK( process_t process_ref );
+bool MulFK( process_t process_ref );
+bool DivFK( process_t process_ref );
+
 bool ShiftLeft( process_t process_ref );
 bool ShiftRight( process_t process_ref );
 bool BAnd( process_t process_ref );
@@ -24,6 +35,7 @@ bool BXor( process_t process_ref );
 bool BOr( process_t process_ref );
 
 bool ConcatS( process_t process_ref );
+bool ConcatN( process_t process_ref );
 bool EqualS( process_t process_ref );
 bool NotEqualS( process_t process_ref );
 
@@ -45,11 +57,19 @@ bool And( process_t process_ref );
 bool Or( process_t process_ref );
 
 bool Store( process_t process_ref );
+bool StoreK( process_t process_ref );
 bool StoreArrayElement( process_t process_ref );
 bool StoreArrayStringElement( process_t process_ref );
+bool StoreArrayElementI( process_t process_ref );
+bool StoreArrayElementF( process_t process_ref );
+bool StoreArrayElementB( process_t process_ref );
+bool StoreStructMember( process_t process_ref );
+bool StoreStructArrayMember( process_t process_ref );
 bool StringCopy( process_t process_ref );
 
 bool SpawnProcess( process_t process_ref );
+bool NewStruct( process_t process_ref );
+bool CopyLiteral( process_t process_ref );
 
 } // namespace Instruction
 } // namespace Eople
@@ -24,10 +24,31 @@ bool JumpEQ( process_t process_ref );
 bool JumpNEQ( process_t process_ref );
 bool JumpLEQ( process_t process_ref );
 bool JumpGEQ( process_t process_ref );
+bool JumpNotGTF( process_t process_ref );
+bool JumpNotLTF( process_t process_ref );
+bool JumpNotEQF( process_t process_ref );
+bool JumpNotNEQF( process_t process_ref );
+bool JumpNotLEQF( process_t process_ref );
+bool JumpNotGEQF( process_t process_ref );
+bool JumpGTK( process_t process_ref );
+bool JumpLTK( process_t process_ref );
+bool JumpEQK( process_t process_ref );
+bool JumpNEQK( process_t process_ref );
+bool JumpLEQK( process_t process_ref );
+bool JumpGEQK( process_t process_ref );
+bool JumpNotGTFK( process_t process_ref );
+bool JumpNotLTFK( process_t process_ref );
+bool JumpNotEQFK( process_t process_ref );
+bool JumpNotNEQFK( process_t process_ref );
+bool JumpNotLEQFK( process_t process_ref );
+bool JumpNotGEQFK( process_t process_ref );
 bool Return( process_t process_ref );
 bool ReturnValue( process_t process_ref );
+bool ReturnValueK( process_t process_ref );
 bool FunctionCall( process_t process_ref );
+bool TailCall( process_t process_ref );
 bool ProcessMessage( process_t process_ref );
+bool ProcessMessageNoReply( process_t process_ref );
 
 } // namespace Instruction
 } // namespace Eople
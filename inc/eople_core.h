@@ -3,13 +3,20 @@
 
 #include "eople_types.h"
 #include "eople_object.h"
+#include "eople_array.h"
+#include "eople_dict.h"
+#include "eople_string.h"
+#include "eople_heap.h"
 #include "eople_log.h"
+#include "mpsc_queue.h"
+#include "block_pool.h"
 
 #include <new>
 #include <atomic>
 #include <map>
 #include <unordered_map>
 #include <memory>
+#include <algorithm>
 
 #include <cassert>
 #include <cstring>
@@ -19,9 +26,20 @@ namespace Eople
 
 typedef u16 Operand;
 
+// Threaded (computed goto) dispatch requires the gcc/clang labels-as-values extension.
+// Can be overridden at build time with -DEOPLE_THREADED_DISPATCH=0/1.
+#ifndef EOPLE_THREADED_DISPATCH
+  #if defined(__GNUC__) || defined(__clang__)
+    #define EOPLE_THREADED_DISPATCH 1
+  #else
+    #define EOPLE_THREADED_DISPATCH 0
+  #endif
+#endif
+
 // opcodes must be 1 to 1 with Instruction::opcode
 // mapping defined in eople_vm.cpp::OpcodeToInstruction
-enum class Opcode
+// order matters: eople_dispatch.cpp::DispatchThreaded jump table
+enum class Opcode : u8
 {
   AddI,
   SubI,
@@ -38,6 +56,7 @@ enum class Opcode
   BXor,
   BOr,
   ConcatS,
+  ConcatN,
   EqualS,
   NotEqualS,
   ForI,
@@ -46,6 +65,7 @@ enum class Opcode
   While,
   Return,
   ReturnValue,
+  ReturnValueK,
   PrintI,
   PrintF,
   PrintIArr,
@@ -54,8 +74,32 @@ enum class Opcode
   PrintSPromise,
   PrintDict,
   FunctionCall,
+  // FunctionCall in tail position (return f(...)), the function takes over the caller's frame
+  TailCall,
   ArraySubscript,
+  ArraySubscriptI,
+  ArraySubscriptF,
+  ArraySubscriptB,
+  // arithmetic fused by the peephole pass (see Peephole in eople_vmcode_gen.cpp)
+  AddSubscriptI,
+  MulSubscriptI,
+  AddSubscriptF,
+  MulSubscriptF,
+  MulAddI,
+  MulAddF,
+  // operand b indexes the function's constants (see ReferenceConstants in eople_vmcode_gen.cpp)
+  AddIK,
+  SubIK,
+  MulIK,
+  AddFK,
+  SubFK,
+  MulFK,
+  DivFK,
+  DictSubscript,
+  StructMember,
+  StructArrayMember,
   ProcessMessage,
+  ProcessMessageNoReply,
   GreaterThanI,
   LessThanI,
   EqualI,
@@ -71,10 +115,17 @@ enum class Opcode
   And,
   Or,
   Store,
+  StoreK,
   StoreArrayElement,
   StoreArrayStringElement,
+  StoreArrayElementI,
+  StoreArrayElementF,
+  StoreArrayElementB,
+  StoreStructMember,
+  StoreStructArrayMember,
   StringCopy,
   SpawnProcess,
+  NewStruct,
   WhenRegister,
   WheneverRegister,
   When,
@@ -87,6 +138,28 @@ enum class Opcode
   JumpNEQ,
   JumpLEQ,
   JumpGEQ,
+  // jump unless the comparison holds, so unordered (NaN) operands jump like a failed condition
+  JumpNotGTF,
+  JumpNotLTF,
+  JumpNotEQF,
+  JumpNotNEQF,
+  JumpNotLEQF,
+  JumpNotGEQF,
+  // operand c indexes the function's constants
+  JumpGTK,
+  JumpLTK,
+  JumpEQK,
+  JumpNEQK,
+  JumpLEQK,
+  JumpGEQK,
+  JumpNotGTFK,
+  JumpNotLTFK,
+  JumpNotEQFK,
+  JumpNotNEQFK,
+  JumpNotLEQFK,
+  JumpNotGEQFK,
+  // call through VMCode::instruction (c functions)
+  CCall,
   NOP,
 };
 
@@ -98,41 +171,91 @@ std::string InstructionToString( InstructionImpl instruction );
 struct VMCode
 {
   VMCode( Opcode in_func )
-    : instruction(OpcodeToInstruction(in_func)), a(0), b(0), c(0), d(0)
+    : instruction(OpcodeToInstruction(in_func)), a(0), b(0), c(0), d(0), opcode(in_func), moves(0)
   {
   }
 
   VMCode( InstructionImpl cfunction )
-    : instruction(cfunction), a(0), b(0), c(0), d(0)
+    : instruction(cfunction), a(0), b(0), c(0), d(0), opcode(Opcode::CCall), moves(0)
   {
   }
 
   VMCode() {}
 
+  // replace instruction, keeping operands
+  void SetOpcode( Opcode in_func )
+  {
+    instruction = OpcodeToInstruction(in_func);
+    opcode = in_func;
+  }
+
   // function pointer to instruction implementation
   InstructionImpl instruction;
-  // operands are indices into the process stack
+  // operands are indices into the process stack, or into the function's constants where the
+  // opcode says so (eg. operand a of FunctionCall)
   Operand a;
   Operand b;
   Operand c;
   Operand d;
+  // compact opcode, used by threaded dispatch
+  Opcode opcode;
+  // message send arguments (in this instruction) that aren't read after the send, one bit per
+  // operand from a, see Process::MoveObject
+  u8     moves;
 };
 
+struct WhenBlock;
+
+// A promise is reference counted, like a frozen array. The heap of its owner holds one
+// reference, and so does the heap of every process it was sent to, each released when a
+// collection of that process finds nothing referring to it any more (see Heap). Copies of it
+// in messages and replies hold one each until they are adopted. A message carrying the promise
+// holds another, from the send until the owner has handled the reply.
 struct Promise
 {
-  Promise( process_t in_owner ) : owner(in_owner), value(), is_ready(false), is_timer(false) {}
+  Promise( process_t in_owner )
+    : owner(in_owner), value(), is_ready(false), is_timer(false)
+  {
+    ref_count.store(1, std::memory_order_relaxed);
+  }
+
+  // allocated from a per core pool, with a single reference
+  static promise_t Create( process_t in_owner )
+  {
+    return new (BlockPool<sizeof(Promise)>::Allocate()) Promise(in_owner);
+  }
+
+  void AddRef()
+  {
+    ref_count.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void Release()
+  {
+    if( ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1 )
+    {
+      // the reply was exported by the process that sent it, see Heap::Export
+      Heap::FreeExported(value);
+      this->~Promise();
+      BlockPool<sizeof(Promise)>::Free(this);
+    }
+  }
 
   process_t owner;
   Object   value;
   bool     is_ready;
   bool     is_timer;
+  std::atomic<u32> ref_count;
+  // when/whenever blocks of the owner to evaluate once this completes
+  std::vector<WhenBlock*> continuations;
 };
 
 struct Function
 {
   Function()
     : reuse_context(false), constants(nullptr), updated_function(nullptr),
-      temp_end(0), return_type(TypeBuilder::GetNilType()), is_constructor(false), is_when_eval(false)
+      temp_end(0), return_type(TypeBuilder::GetNilType()), is_constructor(false), is_when_eval(false),
+      constants_on_stack(true), when_polls(true), inlined_storage(0)
   {
   }
 
@@ -160,11 +283,16 @@ struct Function
 
   u32 locals_start;
   u32 locals_count() const { return (temp_start - locals_start); }
+  // locals that may be read before they are written, cleared on entry
+  u32 cleared_locals_start;
+  u32 cleared_locals_end;
 
   u32 temp_start;
   u32 temp_end;
 
   u32 storage_requirement;
+  // stack used above the frame by the code of inlined calls
+  u32 inlined_storage;
 
   type_t return_type;
   bool   reuse_context;
@@ -172,6 +300,13 @@ struct Function
   bool   is_repl;
   // this function is the evaluation function of a when block
   bool   is_when_eval;
+  // some instruction reads a constant from its stack slot, so they are copied there on entry
+  bool   constants_on_stack;
+  // when eval: closure slots of the promises the condition checks
+  std::vector<Operand> when_promise_slots;
+  // when eval: the condition reads something other than those promises (members, function
+  // calls), so it has to be evaluated after every message
+  bool   when_polls;
 private:
   Function& operator=( const Function & );
 };
@@ -223,14 +358,21 @@ struct ClosureState
 
 struct WhenBlock
 {
-  WhenBlock( Function* in_eval, ClosureState &&state )
-    : eval(in_eval), closure_state(std::move(state))
+  WhenBlock( Function* in_eval, ClosureState &&state, bool in_is_whenever = false )
+    : eval(in_eval), closure_state(std::move(state)), polls(true), is_whenever(in_is_whenever), index(0)
   {
   }
 
   // when block to evaluate
   Function* eval;
   ClosureState closure_state;
+  // promises of this process the block waits on. it is evaluated when one of them completes.
+  std::vector<promise_t> promises;
+  // evaluated after every message, see Function::when_polls
+  bool   polls;
+  bool   is_whenever;
+  // position in Process::when_blocks, whenever_blocks or waiting_blocks
+  size_t index;
 };
 
 // Stack layout for a single process looks like:
@@ -238,7 +380,7 @@ struct WhenBlock
 struct ProcessStack
 {
   ProcessStack() : stack(nullptr), stack_end(nullptr), stack_base(nullptr),
-                   stack_top(nullptr), temporaries(nullptr)
+                   stack_top(nullptr), temporaries(nullptr), constants(nullptr)
   {
   }
 
@@ -251,10 +393,12 @@ struct ProcessStack
     }
   }
 
+  // the caller's state, saved when a function is entered
   struct StackFrame
   {
-    StackFrame( size_t base, size_t top, size_t temp )
-      : bp(base), sp(top), tp(temp)
+    StackFrame( size_t base, size_t top, size_t temp, const Object* in_constants,
+                const VMCode* in_ip, size_t in_loop_base )
+      : bp(base), sp(top), tp(temp), constants(in_constants), ip(in_ip), loop_base(in_loop_base)
     {
     }
 
@@ -262,28 +406,45 @@ struct ProcessStack
     size_t bp;
     size_t sp;
     size_t tp;
+    const Object* constants;
+    // the instruction that made the call
+    const VMCode* ip;
+    // loops entered by the threaded interpreter before the call, see DispatchThreaded
+    size_t loop_base;
   };
 
-  void PushStackFrame()
+  void PushStackFrame( const VMCode* ip, size_t loop_base )
   {
-    stack_frame.push_back(StackFrame(stack_base-stack, stack_top-stack, temporaries-stack));
+    // Most processes never call a function from their constructor or messages, so only the
+    // first call reserves frames. After that, calls don't allocate until they nest deeper.
+    if( stack_frame.size() == 1 && stack_frame.capacity() < 16 )
+    {
+      stack_frame.reserve(16);
+    }
+    stack_frame.emplace_back(stack_base-stack, stack_top-stack, temporaries-stack, constants, ip, loop_base);
   }
 
-  void PopStackFrame()
+  // restores the caller's frame and its ip, false if there is none
+  bool PopStackFrame( const VMCode*& ip )
   {
-    if( !stack_frame.empty() )
+    if( stack_frame.empty() )
     {
-      StackFrame frame = stack_frame.back(); stack_frame.pop_back();
-      stack_base  = stack + frame.bp;
-      stack_top   = stack + frame.sp;
-      temporaries = stack + frame.tp;
+      return false;
     }
+    const StackFrame& frame = stack_frame.back();
+    stack_base  = stack + frame.bp;
+    stack_top   = stack + frame.sp;
+    temporaries = stack + frame.tp;
+    constants   = frame.constants;
+    ip          = frame.ip;
+    stack_frame.pop_back();
+    return true;
   }
 
-  void SetupStackFrame( const Function* function )
+  void SetupStackFrame( const Function* function, const VMCode* ip, size_t loop_base )
   {
     // preserve caller's stack frame
-    PushStackFrame();
+    PushStackFrame(ip, loop_base);
 
     //
     // Allocate stack space for new active function.
@@ -297,25 +458,61 @@ struct ProcessStack
     //   e.g. its closure, which is restored + space for additional temporaries
     stack_top = function->is_when_eval ? stack_base + function->temp_end : stack_top + function->storage_requirement;
     temporaries = function->temp_start + (function->reuse_context ? stack : stack_base);
+    constants = function->constants;
 
     // if there's not enough room, grow the stack
     //   + 1 so there is space for ccalls to store return values.
     // TODO: refactor to remove need for special handling of ccalls
-    if( (stack_top+1) > stack_end )
+    if( (stack_top + std::max<u32>(1, function->inlined_storage)) > stack_end )
     {
-      ReallocStack( stack_top - stack );
+      // at least double, so deep recursion doesn't reallocate on every call
+      ReallocStack( std::max<size_t>(stack_top - stack + function->inlined_storage, 2 * (stack_end - stack)) );
     }
   }
 
+  // The active frame becomes function's, called with the args of the TailCall at caller_ip. Its
+  // caller still gets the return value at the frame's base.
+  void ReuseStackFrame( const Function* function, const VMCode* caller_ip )
+  {
+    size_t parameter_count = function->parameter_count();
+    size_t base = stack_base - stack;
+    size_t scratch = stack_top - stack;
+    size_t top = base + function->storage_requirement;
+    size_t needed = std::max(scratch + parameter_count, top + std::max<u32>(1, function->inlined_storage));
+    if( (stack + needed) > stack_end )
+    {
+      ReallocStack( std::max<size_t>(needed, 2 * (stack_end - stack)) );
+    }
+
+    // the args may be where the parameters go, so they are gathered above the frame first
+    Object* args = stack + scratch;
+    for( size_t i = 0; i < parameter_count; ++i )
+    {
+      // b to d of the call, then a to d of the NOPs after it
+      const VMCode& holder = i < 3 ? caller_ip[0] : caller_ip[1 + (i - 3) / 4];
+      const Operand operands[] = { holder.a, holder.b, holder.c, holder.d };
+      args[i] = stack_base[i < 3 ? operands[i + 1] : operands[(i - 3) % 4]];
+    }
+    memmove( stack_base + function->parameters_start, args, parameter_count * sizeof(Object) );
+
+    stack_top   = stack + top;
+    temporaries = stack_base + function->temp_start;
+    constants   = function->constants;
+  }
+
   void InitializeLocals( const Function* function )
   {
     // TODO: only necessary because of how string/array memory management is currently implemented
-    assert( (stack_base + function->locals_start + function->locals_count()) <= stack_end );
-    memset( stack_base + function->locals_start, 0, function->locals_count() * sizeof(Object) );
+    assert( (stack_base + function->cleared_locals_end) <= stack_end );
+    memset( stack_base + function->cleared_locals_start, 0, (function->cleared_locals_end - function->cleared_locals_start) * sizeof(Object) );
   }
 
   void PushConstants( const Function* function )
   {
+    if( !function->constants_on_stack )
+    {
+      return;
+    }
     assert( (stack_base + function->constants_start + function->constant_count()) <= stack_end );
     memcpy( stack_base + function->constants_start, function->constants, function->constant_count() * sizeof(Object) );
   }
@@ -453,6 +650,12 @@ struct ProcessStack
     return &stack_base[offset];
   }
 
+  // constant of the active function, for operands that index its constants
+  const Object* GetConstant( u16 index )
+  {
+    return &constants[index];
+  }
+
   void PushObjectAtOffset( const Object &object, u16 offset )
   {
     assert( (stack_base+offset) < stack_end );
@@ -487,6 +690,94 @@ struct ProcessStack
     Object*    ccall_return_val;
   };
   Object*    temporaries;
+  // constants of the active function
+  const Object* constants;
+};
+
+struct CallData
+{
+  CallData(const Function* in_function, process_t in_process_ref, const Object* in_args=nullptr,
+    promise_t return_value=nullptr, HighResClock::time_point when=HighResClock::time_point())
+    : function(in_function), process_ref(in_process_ref), args(in_args), promise(return_value), time(when)
+  {
+  }
+
+  CallData() {}
+
+  // argument blocks for messages, pooled per core in a few size classes
+  static Object* AllocateArgs( size_t count )
+  {
+    switch( ArgsSizeClass(count) )
+    {
+      case 0: return nullptr;
+      case 1: return (Object*)BlockPool<sizeof(Object)*2>::Allocate();
+      case 2: return (Object*)BlockPool<sizeof(Object)*4>::Allocate();
+      case 3: return (Object*)BlockPool<sizeof(Object)*8>::Allocate();
+      default: return new Object[count];
+    }
+  }
+
+  // count must match the AllocateArgs call
+  static void FreeArgs( const Object* args, size_t count )
+  {
+    void* block = (void*)args;
+    switch( ArgsSizeClass(count) )
+    {
+      case 0: break;
+      case 1: BlockPool<sizeof(Object)*2>::Free(block); break;
+      case 2: BlockPool<sizeof(Object)*4>::Free(block); break;
+      case 3: BlockPool<sizeof(Object)*8>::Free(block); break;
+      default: delete[] args; break;
+    }
+  }
+
+  const Function* function;
+  const Object*   args;
+  process_t        process_ref;
+  // to store return value
+  promise_t       promise;
+  // when set, the message is held back until this time (see VirtualMachine::TimerMain)
+  HighResClock::time_point time;
+
+private:
+  static u32 ArgsSizeClass( size_t count )
+  {
+    return count == 0 ? 0 : count <= 2 ? 1 : count <= 4 ? 2 : count <= 8 ? 3 : 4;
+  }
+};
+
+// one per process, unpadded
+typedef MPSCQueue<CallData, false> MessageQueue;
+
+enum class LoopKind : u8
+{
+  ForI,
+  ForF,
+  ForA,
+  ForAI,
+  ForAF,
+  ForAB,
+  ForAS,
+  WhileCondition,
+  WhileBody,
+};
+
+// A loop being run by the threaded interpreter (see DispatchThreaded). Kept in the process,
+// so a preempted message can resume in the middle of it.
+struct LoopState
+{
+  LoopKind      kind;
+  Operand       counter;
+  Operand       condition;
+  const VMCode* start;
+  const VMCode* body;
+  const VMCode* end;
+  union
+  {
+    struct { int_t   i, stop, step; } int_loop;
+    struct { float_t i, stop, step; } float_loop;
+    struct { array_ptr_t array; size_t i; } array_loop;
+  };
 };
 
 // Runtime instance for lightweight asynchronous process.
@@ -495,9 +786,19 @@ struct Process
 {
   Process( u32 in_process, VirtualMachine* in_vm, Process* old_list_head )
     : process_id(in_process), vm(in_vm), next(old_list_head), incremental_ip_offset(0), incremental_locals_offset(0),
-      incremental_constants_offset(0), ip(nullptr)
+      incremental_constants_offset(0), ip(nullptr), loop_depth(0), interpreted_calls(0), reductions(0), is_suspended(false),
+      in_string_region(false), message_base(0)
   {
     lock.store(0);
+    is_scheduled.store(false);
+  }
+
+  ~Process()
+  {
+    for( auto text : free_strings )
+    {
+      delete text;
+    }
   }
 
   Object* OperandA()
@@ -520,6 +821,21 @@ struct Process
     return stack.GetObjectAtOffset(ip->d);
   }
 
+  const Object* ConstantA()
+  {
+    return stack.GetConstant(ip->a);
+  }
+
+  const Object* ConstantB()
+  {
+    return stack.GetConstant(ip->b);
+  }
+
+  const Object* ConstantC()
+  {
+    return stack.GetConstant(ip->c);
+  }
+
   Object* CCallReturnVal()
   {
     return stack.ccall_return_val;
@@ -530,41 +846,194 @@ struct Process
     return stack.IsTemporary( object );
   }
 
-  // Free memory from temp string (if it's actually a temp)
-  void TryCollectTempString( Object* temp )
+  // If destination is a temporary, this makes sure it's initialized so that values left over
+  //     from other (non-string) temporaries are not misinterpreted as pointers.
+  void TryInitTempString( Object* temp )
   {
     if( stack.IsTemporary(temp) )
     {
-      delete temp->string_ref;
+      temp->SetString(NewString());
     }
   }
 
-  // If destination is a temporary, this makes sure it's initialized so that values left over
-  //     from other (non-string) temporaries are not misinterpreted as pointers.
-  void TryInitTempString( Object* temp )
+  // empty string. While a message runs it comes from the string region, see StringRegion.
+  string_t NewString()
   {
-    if( stack.IsTemporary(temp) )
+    if( in_string_region )
     {
-      temp->string_ref = new std::string();
+      if( string_t text = string_region.Allocate() )
+      {
+        return text;
+      }
     }
+    return NewHeapString();
+  }
+
+  // empty string in this process's heap, which may outlive the current message. Recycled from
+  // the strings freed by the last collection when there are any.
+  string_t NewHeapString()
+  {
+    if( free_strings.empty() )
+    {
+      return heap.Add(new std::string());
+    }
+    string_t text = free_strings.back();
+    free_strings.pop_back();
+    text->clear();
+    return heap.Add(text);
+  }
+
+  // a string of its own with the same text. Interned strings never change, so they are shared.
+  string_t CopyString( string_t text )
+  {
+    if( StringTable::IsInterned(text) )
+    {
+      return text;
+    }
+    string_t copy = NewHeapString();
+    *copy = *text;
+    return copy;
+  }
+
+  // a string object about to outlive the message gets a heap copy of a region string
+  void PromoteString( Object* object )
+  {
+    if( string_region.Contains(object->string_ref) )
+    {
+      string_t text = NewHeapString();
+      *text = *object->string_ref;
+      object->SetString(text);
+    }
+  }
+
+  // members, and anything else below the stack frame of the running message, outlive it
+  bool OutlivesMessage( const Object* object )
+  {
+    return object < stack.stack + message_base;
+  }
+
+  // the stack frame for a message to function was just set up
+  void SetMessageBase( const Function* function )
+  {
+    message_base = (stack.stack_base - stack.stack) + function->parameters_start;
+  }
+
+  // the message is done, take back all of its strings
+  void ResetStringRegion()
+  {
+    string_region.Reset();
+    message_base = 0;
   }
 
   void PopStackFrame()
   {
-    stack.PopStackFrame();
-    if( !callstack.empty() )
+    stack.PopStackFrame(ip);
+  }
+
+  // new promise for a result this process is waiting on, owned by this process and held by its heap
+  promise_t NewPromise()
+  {
+    // called at message sends and timers, everything live is on the stack like at a loop back-edge
+    MaybeCollectGarbage();
+    return heap.Add(Promise::Create(this));
+  }
+
+  // call before a copy of object leaves this process
+  // an object about to be reachable from outside this message, stored in a container
+  void ShareObject( Object& object )
+  {
+    if( object.object_type == (u8)ValueType::STRING )
+    {
+      PromoteString(&object);
+    }
+  }
+
+  // element i of array. A whole struct read out of an array is a new struct in the heap.
+  Object ArrayElement( array_ptr_t array, size_t i )
+  {
+    Object element = array->Get(i);
+    if( array->kind == ArrayKind::STRUCT )
     {
-      ip = callstack.back(); callstack.pop_back();
+      heap.Add(element.struct_ref);
     }
+    return element;
+  }
+
+  // an object about to leave this process, in a message or reply: replaced by a deep copy that
+  // the receiver adopts, see Heap
+  void SendObject( Object& object )
+  {
+    ShareObject(object);
+    object = heap.Export(object);
   }
 
-  void SetupStackFrame( const Function* function )
+  // a message argument that nothing reads after the send (see VMCode::moves), in source. A large
+  // array leaves the heap as it is if nothing else refers to it, anything else is sent as a copy.
+  void MoveObject( Object& object, Object& source );
+
+  // a copy of a value exported by another process (eg. a reply), in this process's heap
+  Object ImportObject( const Object& object )
+  {
+    Object value = Heap::CopyExported(object);
+    heap.Adopt(value);
+    return value;
+  }
+
+  // free what nothing in this process refers to any more, see Heap
+  void CollectGarbage();
+  void MarkRoots( bool ccall_slot );
+
+  void MaybeCollectGarbage()
   {
-    stack.SetupStackFrame(function);
-    callstack.push_back(ip);
+    if( heap.ShouldCollect() )
+    {
+      CollectGarbage();
+    }
+  }
+
+  // register a block for the when eval function, capturing the active frame
+  void AddWhenBlock( Function* eval, bool is_whenever );
+  void RemoveWhenBlock( WhenBlock* block );
+  // from now on, evaluate the block after every message
+  void PollWhenBlock( WhenBlock* block );
+
+  void SetupStackFrame( const Function* function, size_t loop_base = 0 )
+  {
+    stack.SetupStackFrame(function, ip, loop_base);
     ip = function->code.data();
   }
 
+  // call function from the FunctionCall at ip, which holds the args
+  void EnterFunction( const Function* function, size_t loop_base = 0 )
+  {
+    const VMCode* caller_ip = ip;
+    // must be an offset since the stack may be reallocated
+    size_t src_offset = stack.stack_base - stack.stack;
+    SetupStackFrame( function, loop_base );
+    PushArgsToStack( function, caller_ip, stack.stack + src_offset );
+    PushConstantsToStack( function );
+    InitializeLocalsOnStack( function );
+  }
+
+  // replace the active function with function, called from the TailCall at ip
+  void TailCall( const Function* function )
+  {
+    stack.ReuseStackFrame( function, ip );
+    ip = function->code.data();
+    PushConstantsToStack( function );
+    InitializeLocalsOnStack( function );
+  }
+
+  // drop the calls and loops the interpreter entered above the given depths (after an exception)
+  void UnwindCalls( size_t call_depth, size_t in_loop_depth )
+  {
+    for( ; interpreted_calls > call_depth; --interpreted_calls )
+    {
+      PopStackFrame();
+    }
+    loop_depth = in_loop_depth;
+  }
+
   void InitializeLocalsOnStack( const Function* function )
   {
     stack.InitializeLocals( function );
@@ -625,8 +1094,11 @@ struct Process
   }
 
   ProcessStack stack;
-  std::vector<const VMCode*> callstack;
   std::atomic<int> lock;
+  // pending messages, consumed only by the core the process is scheduled on
+  MessageQueue     mailbox;
+  // set while the process is in a run queue or running, so it is scheduled at most once
+  std::atomic<bool> is_scheduled;
   const int  process_id;
   Process*    next;
 
@@ -638,10 +1110,36 @@ struct Process
   size_t incremental_constants_offset;
   size_t incremental_locals_offset;
 
+  // loops entered by the threaded interpreter. the first loop_depth entries are active.
+  std::vector<LoopState> loops;
+  size_t                 loop_depth;
+  // calls the threaded interpreter made without recursing, the top frames of the stack
+  size_t                 interpreted_calls;
+  // loop back-edges and calls left before the process is preempted
+  i32                    reductions;
+  // a preempted message, resumed before any other message is handled
+  CallData               suspended_message;
+  bool                   is_suspended;
+
   VirtualMachine* vm;
 
-  std::vector<WhenBlock> when_blocks;
-  std::vector<WhenBlock> whenever_blocks;
+  // blocks evaluated after every message
+  std::vector<std::unique_ptr<WhenBlock>> when_blocks;
+  std::vector<std::unique_ptr<WhenBlock>> whenever_blocks;
+  // blocks only evaluated when a promise they wait on completes
+  std::vector<std::unique_ptr<WhenBlock>> waiting_blocks;
+
+  // strings, arrays, dicts, structs and promises of this process
+  Heap                   heap;
+  // strings for NewHeapString to reuse
+  static const size_t    MAX_FREE_STRINGS = 256;
+  std::vector<string_t>  free_strings;
+  // temporary strings of the running message, see StringRegion. NewString only uses the region
+  // while in_string_region is set (by the vm, around running a message).
+  StringRegion           string_region;
+  bool                   in_string_region;
+  // stack offset of the running message's frame, see OutlivesMessage
+  size_t                 message_base;
 };
 
 } // namespace Eople
@@ -0,0 +1,126 @@
+#pragma once
+//
+// Dict storage
+//
+// Entries are kept in a dense vector, in insertion order, and found through an open addressing
+// table of 32 bit hash tags and entry indices (linear probing, at most 3/4 full). A lookup
+// touches one small slot array and, on a tag match, the entry itself.
+//
+// Keys are interned: every dict shares one DictKey per distinct string, with its hash computed
+// once. Keys known at compile time (eg. dict literals) are interned during code generation, so
+// lookups and inserts with them never hash or compare strings.
+//
+#include "eople_object.h"
+
+#include <string>
+#include <vector>
+
+namespace Eople
+{
+
+struct DictKey
+{
+  std::string text;
+  u64         hash;
+};
+
+class Dict
+{
+public:
+  struct Entry
+  {
+    const DictKey* key;
+    Object         value;
+  };
+
+  // the one key for text, created on first use. Keys are never freed.
+  static const DictKey* Intern( const std::string &text );
+  static u64            Hash( const std::string &text );
+
+  Dict() : m_slots(nullptr), m_mask(0) {}
+  ~Dict() { delete[] m_slots; }
+
+  // same entries, in the same order. Values are copied as they are.
+  Dict* Copy() const;
+
+  // nullptr if the key is missing
+  Object* Find( const DictKey* key );
+  Object* Find( const std::string &text );
+
+  // inserts a nil value if the key is missing
+  Object& operator[]( const DictKey* key );
+  Object& operator[]( const std::string &text ) { return (*this)[Intern(text)]; }
+
+  size_t size() const  { return m_entries.size(); }
+  bool   empty() const { return m_entries.empty(); }
+
+  // entries in insertion order
+  std::vector<Entry>::const_iterator begin() const { return m_entries.begin(); }
+  std::vector<Entry>::const_iterator end() const   { return m_entries.end(); }
+
+private:
+  struct Slot
+  {
+    // upper half of the key hash, to skip most mismatches without touching the entry
+    u32 tag;
+    // entry index + 1, 0 when empty
+    u32 entry;
+  };
+
+  static u32 Tag( u64 hash ) { return (u32)(hash >> 32); }
+
+  void Grow();
+
+  std::vector<Entry> m_entries;
+  Slot*              m_slots;
+  size_t             m_mask;
+
+  Dict(const Dict&);
+  Dict& operator=(const Dict&);
+};
+
+inline Object* Dict::Find( const DictKey* key )
+{
+  if( !m_slots )
+  {
+    return nullptr;
+  }
+  u32 tag = Tag(key->hash);
+  for( size_t i = key->hash & m_mask;; i = (i + 1) & m_mask )
+  {
+    const Slot &slot = m_slots[i];
+    if( !slot.entry )
+    {
+      return nullptr;
+    }
+    // keys are interned, so the same key is the same pointer
+    if( slot.tag == tag && m_entries[slot.entry - 1].key == key )
+    {
+      return &m_entries[slot.entry - 1].value;
+    }
+  }
+}
+
+inline Object* Dict::Find( const std::string &text )
+{
+  if( !m_slots )
+  {
+    return nullptr;
+  }
+  u64 hash = Hash(text);
+  u32 tag  = Tag(hash);
+  for( size_t i = hash & m_mask;; i = (i + 1) & m_mask )
+  {
+    const Slot &slot = m_slots[i];
+    if( !slot.entry )
+    {
+      return nullptr;
+    }
+    if( slot.tag == tag && m_entries[slot.entry - 1].key->text == text )
+    {
+      return &m_entries[slot.entry - 1].value;
+    }
+  }
+}
+
+} // namespace Eople
@@ -14,13 +14,17 @@ namespace Eople
 class ExecutionEnvironment
 {
 public:
-  ExecutionEnvironment();
+  ExecutionEnvironment( const VirtualMachineConfig& vm_config = VirtualMachineConfig() );
   ~ExecutionEnvironment();
   void Shutdown();
   bool ImportModuleFromFile( std::string file_name );
   bool ExecuteBuffer( std::string buffer );
   bool ExecuteFunction( std::string entry_function, bool spawn_in_new_process );
   void ListImportedFunctions();
+  // see VirtualMachine::HeapBytes
+  size_t HeapBytes() { return m_vm.HeapBytes(); }
+  // see VirtualMachine::OpcodePairs
+  OpcodePairCounts* OpcodePairs() { return m_vm.OpcodePairs(); }
 
 private:
   void ImportBuiltins();
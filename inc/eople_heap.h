@@ -0,0 +1,132 @@
+#pragma once
+//
+// Process heap
+//
+// Strings, arrays, dicts and structs belong to the heap of the process that made them. Objects
+// don't own what they point to, so nothing is freed when an object is overwritten or a frame is
+// popped. Instead the process is collected now and then (Process::CollectGarbage): a mark and
+// sweep over its own stack, loops and when blocks. It runs on the thread running the process,
+// between messages or at a loop back-edge of the threaded interpreter, and never stops another
+// core.
+//
+// Marking is conservative: an object of any type tag that points at something in the heap keeps
+// it, since stale stack slots and type tags can't be trusted. Whatever is marked is traced through
+// array elements, dict values and struct members.
+//
+// Values leaving the process (message args, replies, spawn args) are deep copied outside of any
+// heap (Export), and the receiving process adopts the copy into its own heap (Adopt). Only what
+// is found in the heap is copied, so an exported value refers to nothing but its own copies and
+// interned strings. A reply sits in its promise until the promise is released (FreeExported),
+// each reader takes a copy of its own (CopyExported). Interned strings and the literals in
+// function constants never belong to a heap.
+//
+// The copy of an array of ints, floats or bools shares the elements of the original until one
+// side changes them (see Array). Two kinds of arrays aren't even copied. A frozen array is shared:
+// every heap and message holding it holds a reference. And a large array of ints, floats or bools
+// passed to a message send after its last use is detached from the heap and moved into the
+// message (Process::MoveObject), once marking shows that nothing else in the process refers to it.
+//
+// Promises aren't copied either, they are shared like frozen arrays: the heaps of the owner and of
+// every process it was sent to each hold a reference, and so does every exported copy until a
+// process adopts it.
+//
+#include "eople_object.h"
+
+#include <atomic>
+#include <vector>
+
+namespace Eople
+{
+
+class Heap
+{
+public:
+  Heap();
+  ~Heap();
+
+  string_t Add( string_t text )   { Insert(text, ValueType::STRING); return text; }
+  Array*   Add( Array* array )    { Insert(array, ValueType::ARRAY); return array; }
+  Dict*    Add( Dict* dict )      { Insert(dict, ValueType::DICT); return dict; }
+  Struct*  Add( Struct* value )   { Insert(value, ValueType::STRUCT); return value; }
+  // takes over the promise's reference
+  promise_t Add( promise_t promise ) { Insert(promise, ValueType::PROMISE); return promise; }
+
+  // the value, and everything it refers to that isn't in this heap yet
+  void Adopt( const Object& value );
+
+  // something has been added since the last collection, enough to be worth another: as many
+  // values or as many bytes (eg. large arrays from messages) as survived it. Promises come one
+  // per message sent, so they are collected sooner, keeping the table small.
+  bool ShouldCollect() const
+  {
+    return m_added >= m_collect_threshold || m_added_bytes >= m_collect_bytes ||
+           m_added_promises >= m_promise_threshold;
+  }
+
+  // mark phase, call for every root. Then Sweep frees whatever wasn't marked.
+  void Mark( const Object* begin, const Object* end );
+  void Mark( const void* pointer );
+  // strings that are freed are handed to recycle (up to recycle_limit of them) instead of deleted
+  void Sweep( std::vector<string_t>& recycle, size_t recycle_limit );
+
+  // an array worth moving into a message instead of copying it: in this heap, not frozen, refers
+  // to nothing else, and large enough to pay for marking the process to see that it is unused
+  bool CanDetach( const Array* array );
+  // take a value out of the heap, the caller owns it now
+  void Detach( const void* pointer );
+  // after Mark, without Sweep: whether a value in the heap was reached. ClearMarks undoes Mark.
+  bool IsMarked( const void* pointer );
+  void ClearMarks();
+
+  // values in the heap
+  size_t count() const { return m_count; }
+  // approximate bytes used by the values that survived the last collection. may be read by
+  // other threads.
+  size_t live_bytes() const { return m_live_bytes.load(std::memory_order_relaxed); }
+  size_t collections() const { return m_collections; }
+
+  // deep copy of what value refers to in this heap, outside of any heap
+  Object        Export( const Object& value );
+  // deep copy of a value from Export, outside of any heap
+  static Object CopyExported( const Object& value );
+  // free a value from Export that no process adopted
+  static void   FreeExported( const Object& value );
+
+private:
+  struct Entry
+  {
+    const void* pointer;
+    ValueType   type;
+    bool        marked;
+  };
+
+  static const size_t MIN_COLLECT_THRESHOLD = 4096;
+  static const size_t MIN_PROMISE_THRESHOLD = 64;
+  static const size_t MIN_COLLECT_BYTES     = 8 * 1024 * 1024;
+  static const size_t MIN_DETACH_BYTES      = 64 * 1024;
+
+  void   Insert( const void* pointer, ValueType type );
+  Entry* Find( const void* pointer );
+  void   Resize( size_t capacity );
+  void   Trace( const Entry& entry );
+  void   MarkObject( const Object& object );
+
+  // open addressing, linear probing, at most half full
+  std::vector<Entry>  m_table;
+  size_t              m_count;
+  std::vector<Entry*> m_marking;
+  size_t              m_added;
+  size_t              m_collect_threshold;
+  // bytes added since the last collection, as big as values were when they were added
+  size_t              m_added_bytes;
+  size_t              m_collect_bytes;
+  size_t              m_added_promises;
+  size_t              m_promise_threshold;
+  size_t              m_collections;
+  std::atomic<size_t> m_live_bytes;
+
+  Heap(const Heap&);
+  Heap& operator=(const Heap&);
+};
+
+} // namespace Eople
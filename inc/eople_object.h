@@ -2,12 +2,160 @@
 #include "core.h"
 #include "eople_types.h"
 
+#include <cstring>
+#include <type_traits>
+
+// 8 byte NaN-boxed objects instead of a union plus a type byte (16 bytes with padding).
+// Can be set at build time with -DEOPLE_NAN_BOXING=0/1.
+#ifndef EOPLE_NAN_BOXING
+  #define EOPLE_NAN_BOXING 0
+#endif
+
 namespace Eople
 {
 
+#if EOPLE_NAN_BOXING
+//
+// NaN-boxing
+// -http://wingolog.org/archives/2011/05/18/value-representation-in-javascript-implementations
+//
+// The top 16 bits of an object tell its type:
+//   0x0000, 0xFFFF   int, stored as is. ints are 48 bit, and wrap.
+//   0x0001..0xFFF1   float, stored plus 2^48. every NaN is first turned into the one quiet NaN.
+//   0xFFF2..0xFFFE   0xFFF2 + ValueType of anything else, the low 48 bits hold the value.
+//
+// Reading an int is free, floats and pointers cost one add or and. Zeroed memory reads as
+// int 0, or a null pointer. Pointers must fit in 48 bits.
+//
+// Each field wraps the same 8 bytes, and reads and writes like the plain union member it
+// replaces. Writing a field sets the type.
+//
+namespace NanBox
+{
+  const u64 payload_mask  = (u64(1) << 48) - 1;
+  const u64 float_offset  = u64(1) << 48;
+  const u64 tag_base      = 0xFFF2;
+  const u64 canonical_nan = u64(0x7FF8) << 48;
+
+  inline u64 Tag( ValueType type )
+  {
+    return (tag_base + (u64)type) << 48;
+  }
+
+  inline int_t SignExtend( u64 bits )
+  {
+    return (int_t)(bits << 16) >> 16;
+  }
+
+  inline u8 TypeOf( u64 bits )
+  {
+    u64 top = bits >> 48;
+    if( top == 0 || top == 0xFFFF )
+    {
+      return (u8)ValueType::INT;
+    }
+    return top < tag_base ? (u8)ValueType::FLOAT : (u8)(top - tag_base);
+  }
+
+  struct IntField
+  {
+    u64 bits;
+
+    operator int_t() const { return (int_t)bits; }
+    IntField& operator=( int_t val ) { bits = (u64)SignExtend((u64)val); return *this; }
+  };
+
+  struct BoolField
+  {
+    u64 bits;
+
+    operator bool_t() const { return (bool_t)bits; }
+    BoolField& operator=( bool_t val ) { bits = Tag(ValueType::BOOL) | val; return *this; }
+  };
+
+  struct FloatField
+  {
+    u64 bits;
+
+    operator float_t() const
+    {
+      u64 raw = bits - float_offset;
+      float_t val;
+      memcpy( &val, &raw, sizeof(val) );
+      return val;
+    }
+
+    FloatField& operator=( float_t val )
+    {
+      u64 raw = canonical_nan;
+      if( val == val )
+      {
+        memcpy( &raw, &val, sizeof(val) );
+      }
+      bits = raw + float_offset;
+      return *this;
+    }
+  };
+
+  template <class P, ValueType type>
+  struct PointerField
+  {
+    u64 bits;
+
+    operator P() const { return (P)(uintptr_t)(bits & payload_mask); }
+    P operator->() const { return *this; }
+    typename std::remove_pointer<P>::type& operator*() const { return *(P)*this; }
+    PointerField& operator=( P val ) { bits = Tag(type) | (u64)(uintptr_t)val; return *this; }
+  };
+
+  // changing the type keeps the low 48 bits
+  struct TypeField
+  {
+    u64 bits;
+
+    operator u8() const { return TypeOf(bits); }
+    TypeField& operator=( u8 type )
+    {
+      u64 payload = bits & payload_mask;
+      switch( (ValueType)type )
+      {
+        case ValueType::INT:   bits = (u64)SignExtend(payload); break;
+        case ValueType::FLOAT: bits = payload + float_offset;   break;
+        default:               bits = Tag((ValueType)type) | payload;
+      }
+      return *this;
+    }
+  };
+} // namespace NanBox
+#endif
+
 // An Eople::Object is a lightweight runtime instance of a type
 struct Object
 {
+#if EOPLE_NAN_BOXING
+  union
+  {
+    u64 bits;
+    NanBox::PointerField<function_t,  ValueType::FUNCTION> function;
+    NanBox::PointerField<process_t,   ValueType::PROCESS>  process_ref;
+    NanBox::PointerField<promise_t,   ValueType::PROMISE>  promise;
+    NanBox::PointerField<string_t,    ValueType::STRING>   string_ref;
+    NanBox::PointerField<array_ptr_t, ValueType::ARRAY>    array_ref;
+    NanBox::PointerField<dict_t,      ValueType::DICT>     dict_ref;
+    NanBox::PointerField<struct_t,    ValueType::STRUCT>   struct_ref;
+    NanBox::PointerField<type_t,      ValueType::TYPE>     type;
+    NanBox::FloatField  float_val;
+    NanBox::IntField    int_val;
+    NanBox::IntField    jump_offset;
+    NanBox::BoolField   bool_val;
+    // the type of the value, decoded from the bits
+    NanBox::TypeField   object_type;
+  };
+
+  Object() : bits(NanBox::Tag(ValueType::NIL))
+  {
+  }
+#else
   union
   {
     // These typedefs defined in eople_types.h
@@ -17,6 +165,7 @@ struct Object
     string_t      string_ref;
     array_ptr_t       array_ref;
     dict_t        dict_ref;
+    struct_t      struct_ref;
     type_t        type;
     // concrete (non-pointer) primitive types
     float_t       float_val;
@@ -30,6 +179,7 @@ struct Object
   Object() : object_type((u8)ValueType::NIL)
   {
   }
+#endif
 
   void SetInt( int_t val )
   {
@@ -90,29 +240,16 @@ struct Object
     dict_ref = val;
   }
 
-  static Object BuildArray( array_ptr_t val_ptr )
-  {
-    Object array_object;
-    array_object.SetArray(val_ptr);
-
-    return array_object;
-  }
-
-  static Object BuildArray( const array_t &val )
+  void SetStruct( struct_t val )
   {
-    Object array_object;
-    array_object.array_ref = new std::vector<Object>();
-    *array_object.array_ref = val;
-    array_object.object_type = (u8)ValueType::ARRAY;
-
-    return array_object;
+    object_type = (u8)ValueType::STRUCT;
+    struct_ref = val;
   }
 
-  static Object BuildArray()
+  static Object BuildArray( array_ptr_t val_ptr )
   {
     Object array_object;
-    array_object.array_ref = new std::vector<Object>();
-    array_object.object_type = (u8)ValueType::ARRAY;
+    array_object.SetArray(val_ptr);
 
     return array_object;
   }
@@ -125,13 +262,12 @@ struct Object
     return dict_object;
   }
 
-  static Object BuildDict()
+  static Object BuildStruct( struct_t val )
   {
-    Object dict_object;
-    dict_object.dict_ref = new std::unordered_map<std::string, Object>();
-    dict_object.object_type = (u8)ValueType::DICT;
+    Object struct_object;
+    struct_object.SetStruct(val);
 
-    return dict_object;
+    return struct_object;
   }
 
   static Object BuildInt( int_t val )
@@ -207,4 +343,8 @@ struct Object
   }
 };
 
+#if EOPLE_NAN_BOXING
+static_assert( sizeof(Object) == 8, "NaN-boxed objects must be 8 bytes" );
+#endif
+
 } // namespace Eople
@@ -75,7 +75,7 @@ private:
   ExpressionNode   ParseParExpression();
   ExpressionNode   ParseBaseFunctionCall( ExpressionNode ident_node, bool need_terminator );
   ExpressionNode   ParseFunctionCallExpression( std::string ident );
-  ExpressionNode   ParseStructMember();
+  bool             ParseStructMember( Node::ArraySubscript* array_subscript );
   StatementNode    ParseProcessMessage( ExpressionNode ident_node );
   StatementNode    ParseStatement();
   StatementNode    ParseIf();
@@ -92,6 +92,7 @@ private:
   FunctionNode     ParseClass();
   FunctionNode     ParseFunction( bool is_constructor );
   StructNode       ParseStruct();
+  Node::Struct*    FindStruct( const std::string &name );
   bool             ParseNamespace();
   bool             ParseImport();
 
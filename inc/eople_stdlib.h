@@ -18,6 +18,9 @@ bool PrintObject( process_t process_ref );
 bool GetLine( process_t process_ref );
 bool ArrayConstructor( process_t process_ref );
 bool ArrayPush( process_t process_ref );
+bool ArrayPushInt( process_t process_ref );
+bool ArrayPushFloat( process_t process_ref );
+bool ArrayPushBool( process_t process_ref );
 bool ArrayPushArray( process_t process_ref );
 bool ArrayPushString( process_t process_ref );
 bool ArraySize( process_t process_ref );
@@ -26,7 +29,35 @@ bool ArrayTopArray( process_t process_ref );
 bool ArrayTopString( process_t process_ref );
 bool ArrayPop( process_t process_ref );
 bool ArrayClear( process_t process_ref );
+bool ArrayFreeze( process_t process_ref );
+bool ArraySlice( process_t process_ref );
 bool ArraySubscript( process_t process_ref );
+bool ArraySubscriptI( process_t process_ref );
+bool ArraySubscriptF( process_t process_ref );
+bool ArraySubscriptB( process_t process_ref );
+bool AddSubscriptI( process_t process_ref );
+bool MulSubscriptI( process_t process_ref );
+bool AddSubscriptF( process_t process_ref );
+bool MulSubscriptF( process_t process_ref );
+bool DictSubscript( process_t process_ref );
+bool StructMember( process_t process_ref );
+bool StructArrayMember( process_t process_ref );
+bool ArraySumF( process_t process_ref );
+bool ArrayMinF( process_t process_ref );
+bool ArrayMaxF( process_t process_ref );
+bool ArrayDotF( process_t process_ref );
+bool ArrayScaleF( process_t process_ref );
+bool ArrayAddF( process_t process_ref );
+bool ArrayMulF( process_t process_ref );
+bool ArrayAxpyF( process_t process_ref );
+bool ArraySumI( process_t process_ref );
+bool ArrayMinI( process_t process_ref );
+bool ArrayMaxI( process_t process_ref );
+bool ArrayDotI( process_t process_ref );
+bool ArrayScaleI( process_t process_ref );
+bool ArrayAddI( process_t process_ref );
+bool ArrayMulI( process_t process_ref );
+bool ArrayAxpyI( process_t process_ref );
 bool GetTime( process_t process_ref );
 bool Timer( process_t process_ref );
 bool SleepMilliseconds( process_t process_ref );
@@ -38,6 +69,9 @@ bool IntToString( process_t process_ref );
 bool FloatToString( process_t process_ref );
 bool PromiseToString( process_t process_ref );
 
+bool StringBuilder( process_t process_ref );
+bool StringAppend( process_t process_ref );
+
 bool GetURL( process_t process_ref );
 bool GetURL_USERPWD( process_t process_ref );
 
@@ -0,0 +1,94 @@
+#pragma once
+//
+// String table
+//
+// String literals are interned: every distinct text is stored once, in one fixed block of
+// strings, and is never changed or freed. An interned string is recognised by its address, so
+// two interned strings are equal exactly when they are the same pointer, and code that appends
+// to or frees strings can leave them alone with a range check.
+//
+// Strings for temporaries are recycled per process (Process::NewString). std::string keeps short
+// text inline, so a recycled string holds a short tag or key without touching the heap.
+//
+// While a process runs a message, its temporary strings come from a StringRegion instead: one
+// block of strings, handed out in order and all taken back when the message is done, including
+// the ones that would otherwise leak with a popped stack frame. A region string that is about to
+// outlive the message (stored in a member, container, message or promise) is copied to the heap
+// first, see Process::ShareObject.
+//
+#include "eople_types.h"
+
+#include <string>
+#include <type_traits>
+
+namespace Eople
+{
+
+class StringTable
+{
+public:
+  static const size_t CAPACITY = 1 << 16;
+
+  // the one interned copy of text. Once the table is full, a new (ordinary) string.
+  static string_t Intern( const std::string &text );
+
+  static bool IsInterned( const std::string* text )
+  {
+    uintptr_t address = (uintptr_t)text;
+    return address >= (uintptr_t)&s_strings[0] && address < (uintptr_t)&s_strings[CAPACITY];
+  }
+
+  static bool Equal( const std::string* a, const std::string* b )
+  {
+    if( a == b )
+    {
+      return true;
+    }
+    // distinct interned strings never hold the same text
+    if( IsInterned(a) && IsInterned(b) )
+    {
+      return false;
+    }
+    return *a == *b;
+  }
+
+private:
+  typedef std::aligned_storage<sizeof(std::string), alignof(std::string)>::type Storage;
+  static Storage s_strings[CAPACITY];
+};
+
+class StringRegion
+{
+public:
+  static const size_t CAPACITY = 256;
+
+  StringRegion() : m_strings(nullptr), m_used(0), m_constructed(0), m_allocations(0) {}
+  ~StringRegion();
+
+  // an empty string, nullptr once the region is full
+  string_t Allocate();
+
+  // take back every string. Strings that grew large give their memory back.
+  void Reset();
+
+  bool Contains( const std::string* text ) const
+  {
+    return text >= m_strings && text < m_strings + m_constructed;
+  }
+
+  // strings handed out since the region was created
+  size_t allocations() const { return m_allocations; }
+
+private:
+  static const size_t MAX_KEPT_CAPACITY = 256;
+
+  std::string*          m_strings;
+  size_t                m_used;
+  size_t                m_constructed;
+  size_t                m_allocations;
+
+  StringRegion(const StringRegion&);
+  StringRegion& operator=(const StringRegion&);
+};
+
+} // namespace Eople
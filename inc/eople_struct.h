@@ -0,0 +1,76 @@
+#pragma once
+//
+// Struct storage
+//
+// A struct is a fixed block of objects, one per member, in declaration order, allocated in one
+// piece right behind a small header. Member positions are known after type inference, so code
+// generation turns obj.x into a load or store at a constant offset (StructMember), with no key
+// to hash or compare.
+//
+// Arrays of structs keep their members inline, one struct after the other (StructArray, in
+// eople_array.h), and arr[i].x reads the member straight out of the array.
+//
+#include "eople_object.h"
+
+#include <new>
+
+namespace Eople
+{
+
+struct Struct
+{
+  // all members nil
+  static Struct* Create( StructType* type );
+  // members copied from values
+  static Struct* Create( StructType* type, const Object* values );
+
+  size_t  size() const { return type->member_names.size(); }
+  Object* Members();
+
+  Struct* Copy() { return Create(type, Members()); }
+
+  static void Destroy( Struct* value ) { ::operator delete(value); }
+
+  StructType* const type;
+
+private:
+  Struct( StructType* in_type ) : type(in_type) {}
+
+  Struct(const Struct&);
+  Struct& operator=(const Struct&);
+};
+
+// members start at the first object aligned offset past the header
+static const size_t STRUCT_HEADER_SIZE = (sizeof(Struct) + sizeof(Object) - 1) / sizeof(Object) * sizeof(Object);
+
+inline Object* Struct::Members()
+{
+  return reinterpret_cast<Object*>(reinterpret_cast<char*>(this) + STRUCT_HEADER_SIZE);
+}
+
+inline Struct* Struct::Create( StructType* type )
+{
+  size_t count  = type->member_names.size();
+  void*  memory = ::operator new( STRUCT_HEADER_SIZE + count * sizeof(Object) );
+
+  Struct* new_struct = new (memory) Struct(type);
+  Object* members    = new_struct->Members();
+  for( size_t i = 0; i < count; ++i )
+  {
+    new (&members[i]) Object();
+  }
+  return new_struct;
+}
+
+inline Struct* Struct::Create( StructType* type, const Object* values )
+{
+  Struct* new_struct = Create(type);
+  Object* members    = new_struct->Members();
+  for( size_t i = 0; i < new_struct->size(); ++i )
+  {
+    members[i] = values[i];
+  }
+  return new_struct;
+}
+
+} // namespace Eople
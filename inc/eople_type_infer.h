@@ -60,6 +60,7 @@ private:
 //  FunctionVector FunctionFromCall( Node::FunctionCall* node );
   Node::Function* FunctionFromCall( Node::FunctionCall* node );
   Node::Function* FunctionFromProcessMessage( std::string process_name, Node::FunctionCall* node );
+  Node::Struct*   StructFromCall( Node::FunctionCall* node );
 
   InferenceState PropagateType( Node::NodeCommon*, type_t )
   {
@@ -76,6 +77,7 @@ private:
   InferenceState PropagateType( Node::ArraySubscript* array_subscript, type_t type );
   InferenceState PropagateType( Node::DictLiteral* dict_literal, type_t type );
   InferenceState PropagateType( Node::BinaryOp* binary_op, type_t type );
+  InferenceState PropagateStructConstructor( Node::FunctionCall* function_call, Node::Struct* struct_node, type_t type );
 
   void InferStatement( Node::NodeCommon* )
   {
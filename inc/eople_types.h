@@ -15,6 +15,9 @@ struct Function;
 struct Process;
 struct Promise;
 struct Type;
+struct Array;
+class Dict;
+struct Struct;
 
 typedef i64                  int_t;
 typedef f64                  float_t;
@@ -25,8 +28,9 @@ typedef Function*            function_t;
 typedef Type*                type_t;
 typedef std::string*         string_t;
 typedef std::vector<Object>  array_t;
-typedef std::vector<Object>* array_ptr_t;
-typedef std::unordered_map<std::string, Object>* dict_t;
+typedef Array*               array_ptr_t;
+typedef Dict*                dict_t;
+typedef Struct*              struct_t;
 
 
 // order matters: eople_parse.cpp:ParseType and eople_static.cpp:BuildPrimitiveTypes
@@ -179,14 +183,32 @@ struct Type
   ValueType type;
 };
 
+// every struct has a single, fixed layout: members in declaration order, with the types given
+// by its constructor calls. a member is found by its index, no name lookup at runtime.
 struct StructType : public Type
 {
+  static const size_t NOT_A_MEMBER = (size_t)-1;
+
   StructType( std::string name ) : struct_name(name), Type(ValueType::STRUCT)
   {
   }
 
-  std::string struct_name;
-  std::vector<type_t> member_names;
+  size_t MemberIndex( const std::string &name ) const
+  {
+    for( size_t i = 0; i < member_names.size(); ++i )
+    {
+      if( member_names[i] == name )
+      {
+        return i;
+      }
+    }
+    return NOT_A_MEMBER;
+  }
+
+  std::string              struct_name;
+  std::vector<std::string> member_names;
+  // nil until inferred from a constructor call
+  std::vector<type_t>      member_types;
 };
 
 struct ProcessType : public Type
@@ -1,37 +1,19 @@
 #pragma once
 #include "eople_core.h"
+#include "work_stealing_deque.h"
+#include "timer_wheel.h"
+#include "event_count.h"
 #include <unordered_map>
 #include <thread>
 #include <mutex>
 #include <atomic>
 #include <condition_variable>
-#include <queue>
 #include <memory>
 #include <iostream>
 
 namespace Eople
 {
 
-struct CallData
-{
-  CallData(const Function* in_function, process_t in_process_ref, const Object* in_args=nullptr,
-    promise_t return_value=nullptr, HighResClock::time_point when=HighResClock::now())
-    : function(in_function), process_ref(in_process_ref), args(in_args), promise(return_value), time(when)
-  {
-  }
-
-  CallData() {}
-
-  const Function* function;
-  const Object*   args;
-  process_t        process_ref;
-  // to store return value
-  promise_t       promise;
-  HighResClock::time_point time;
-};
-
-typedef std::queue<CallData> MessageQueue;
-
 struct AutoTryLock
 {
   AutoTryLock( std::atomic<int> &lock ) : try_lock(lock)
@@ -76,21 +58,54 @@ private:
   std::atomic<int> &try_lock;
 };
 
-inline void ExecutionLoop( CallData& call_data )
+#if EOPLE_THREADED_DISPATCH
+// Runs instructions starting at process_ref->ip until a return. When preemptible, it also stops
+// once the process is out of reductions, and returns true. Calling it again with resume set
+// continues where it stopped. defined in eople_dispatch.cpp
+bool DispatchThreaded( process_t process_ref, bool preemptible, bool resume );
+#else
+// Runs the instruction at process_ref->ip and moves past it, returns false at a return. A TailCall
+// leaves ip at the first instruction of the function it enters, which hasn't run yet.
+inline bool StepInstruction( process_t process_ref )
+{
+  const VMCode* &ip = process_ref->ip;
+  const bool is_tail_call = ip->opcode == Opcode::TailCall;
+  if( !ip->instruction(process_ref) )
+  {
+    return false;
+  }
+  if( !is_tail_call )
+  {
+    ++ip;
+  }
+  return true;
+}
+#endif
+
+// returns true if the process was preempted (only supported by the threaded interpreter)
+inline bool ExecutionLoop( CallData& call_data, bool preemptible = false, bool resume = false )
 {
   process_t process_ref = call_data.process_ref;
   const VMCode* &ip = process_ref->ip;
 
+  // calls and loops of whatever is running below us, if anything
+  size_t call_depth = resume ? 0 : process_ref->interpreted_calls;
+  size_t loop_depth = resume ? 0 : process_ref->loop_depth;
   try
   {
-    while( ip->instruction(process_ref) )
+#if EOPLE_THREADED_DISPATCH
+    return DispatchThreaded(process_ref, preemptible, resume);
+#else
+    while( StepInstruction(process_ref) )
     {
-      ++ip;
     }
+#endif
   } catch(std::runtime_error ex)
   {
     std::cerr << BOLD(RED("Uncaught Exception: ")) << ex.what() << std::endl;
+    process_ref->UnwindCalls(call_depth, loop_depth);
   }
+  return false;
 }
 
 inline void ExecutionLoopIncremental( CallData& call_data )
@@ -102,10 +117,13 @@ inline void ExecutionLoopIncremental( CallData& call_data )
 
   try
   {
-    while( ip->instruction(process_ref) )
+#if EOPLE_THREADED_DISPATCH
+    DispatchThreaded(process_ref, false, false);
+#else
+    while( StepInstruction(process_ref) )
     {
-      ++ip;
     }
+#endif
   } catch(std::runtime_error ex)
   {
     std::cerr << BOLD(RED("Uncaught Exception: ")) << ex.what() << std::endl;
@@ -114,10 +132,72 @@ inline void ExecutionLoopIncremental( CallData& call_data )
   process_ref->incremental_ip_offset = ip - start_ip;
 }
 
+struct VirtualMachineConfig
+{
+  VirtualMachineConfig() : core_count(0), idle_spin_rounds(64), reduction_budget(20000), string_regions(true),
+                           count_opcode_pairs(false), inline_functions(true) {}
+
+  // worker threads to run processes on. 0 picks one per hardware thread (at least 2).
+  u32 core_count;
+  // An idle core looks for work up to this many rounds (yielding in between) before parking.
+  // The actual number adapts per core: it halves when spinning finds nothing and doubles
+  // (up to this limit) when it does. 0 parks right away.
+  u32 idle_spin_rounds;
+  // Loop iterations and function calls a process may run before it is preempted, so other
+  // processes on the core get a turn. 0 lets every message run to completion.
+  u32 reduction_budget;
+  // Temporary strings of a message come from a per process region, taken back when the message
+  // is done (see StringRegion). Off, they are allocated and freed one by one.
+  bool string_regions;
+  // Count which opcode runs after which (see OpcodePairCounts). Slows every instruction down, only
+  // the threaded interpreter counts.
+  bool count_opcode_pairs;
+  // Calls to small functions are replaced by the function's code when it is generated (see
+  // InlineCalls in eople_vmcode_gen.cpp).
+  bool inline_functions;
+};
+
+// How often each opcode ran right after another one, to pick which sequences are worth fusing
+// into a single instruction (see Peephole in eople_vmcode_gen.cpp). Every thread counts into a
+// table of its own, they are only added up for printing.
+class OpcodePairCounts
+{
+public:
+  static const size_t opcode_count = (size_t)Opcode::NOP + 1;
+
+  struct Table
+  {
+    u64 counts[opcode_count][opcode_count];
+  };
+
+  struct Pair
+  {
+    Opcode first;
+    Opcode second;
+    u64    count;
+  };
+
+  OpcodePairCounts();
+
+  // table of the calling thread
+  Table& ThreadTable();
+  // most frequent first. only call once the counting threads are done.
+  std::vector<Pair> MostFrequent( size_t max_pairs );
+  void Print( size_t max_pairs );
+
+private:
+  std::mutex                          lock;
+  std::vector<std::unique_ptr<Table>> tables;
+  // tells apart tables cached by a thread for a previous instance (see ThreadTable)
+  u32                                 id;
+};
+
+typedef WorkStealingDeque<process_t> RunQueue;
+
 class VirtualMachine
 {
 public:
-  VirtualMachine();
+  VirtualMachine( const VirtualMachineConfig& config = VirtualMachineConfig() );
   ~VirtualMachine();
 
   void Run();
@@ -128,27 +208,70 @@ public:
   void SendMessage( CallData call_data );
 
   void ExecuteFunction( CallData call_data );
+  // run a function on the calling thread, in a process that may also receive messages
+  void ExecuteEntryFunction( CallData call_data );
   void ExecuteFunctionIncremental( CallData call_data );
   void ExecuteConstructor( CallData call_data, process_t caller );
 
+  // bytes held by the heaps of every process, as of their last collection. May be called while
+  // the vm runs.
+  size_t HeapBytes();
+
+  // null unless counting opcode pairs, see VirtualMachineConfig::count_opcode_pairs
+  OpcodePairCounts* OpcodePairs() { return pair_counts.get(); }
+
 private:
-  void ExecuteProcessMessage( CallData call_data );
+  // false if the message was preempted, see ResumeProcessMessage
+  bool ExecuteProcessMessage( CallData call_data );
+  bool ResumeProcessMessage( process_t process_ref );
+  bool FinishProcessMessage( CallData call_data, bool resume );
+  // make a process with pending messages runnable
+  void ScheduleProcess( process_t process_ref );
+  // run a batch of messages from the mailbox of a scheduled process
+  void RunProcess( process_t process_ref );
+  // clear is_scheduled, rescheduling if messages are waiting and the process isn't locked
+  void UnscheduleProcess( process_t process_ref );
+  // hold a process on a thread outside the cores, and reschedule it on release
+  void LockProcess( AutoTryLock &process_lock, process_t process_ref );
+  void UnlockProcess( AutoTryLock &process_lock, process_t process_ref );
+  process_t FindRunnableProcess( u32 core_index );
+  process_t TakeInjectedProcess();
+  // hold back a future dated message until it is due
+  void AddTimer( CallData call_data );
 
   // Core job loop
   friend void CoreMain( VirtualMachine* vm, u32 id );
+  // Delivers future dated messages when they are due
+  friend void TimerMain( VirtualMachine* vm );
 
   std::vector<std::thread>            cores;
-  std::vector<MessageQueue>           queues;
-  std::unique_ptr<std::atomic<int>[]> queue_locks;
-  std::condition_variable             message_waiting_event;
-  std::mutex                          idle_lock;
+  // per core runnable processes. owner pushes/pops, idle cores steal.
+  std::unique_ptr<RunQueue[]>         run_queues;
+  // processes made runnable by threads other than the cores (e.g. the main thread)
+  MPSCQueue<process_t>                injected_processes;
+  std::atomic<int>                    injected_lock;
+  std::thread                         timer_thread;
+  // timers not yet picked up by the timer thread
+  MPSCQueue<CallData>                 new_timers;
+  std::mutex                          timer_lock;
+  std::condition_variable             timer_event;
+  std::atomic<bool>                   timer_thread_waiting;
+  std::atomic<bool>                   timer_thread_exit;
+  // timers which have not been delivered yet
+  std::atomic<u32>                    timer_count;
+  // parked (idle) cores wait on this. signalled when a process becomes runnable.
+  EventCount                          idle_event;
+  std::atomic<u32>                    parked_count;
+  std::atomic<bool>                   cores_exit;
   std::mutex                          list_lock;
-  std::atomic<u32>                    idle_count;
-  std::atomic<u32>                    message_count;
   std::atomic<u32>                    ready_to_exit;
   process_t                           process_list;
   u32                                 process_count;
   u32                                 core_count;
+  u32                                 idle_spin_rounds;
+  u32                                 reduction_budget;
+  bool                                string_regions;
+  std::unique_ptr<OpcodePairCounts>   pair_counts;
 
   VirtualMachine(const VirtualMachine&);
   VirtualMachine& operator=(const VirtualMachine&);
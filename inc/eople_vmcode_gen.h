@@ -30,7 +30,8 @@ class GetTypeDispatcher;
 class VMCodeGen
 {
 public:
-  VMCodeGen();
+  // inline_functions: replace calls to small functions with their code (see InlineCalls)
+  VMCodeGen( bool inline_functions = true );
   ~VMCodeGen()
   {
   }
@@ -58,6 +59,9 @@ private:
   size_t GenExpressionTerm( Node::ArrayLiteral* array_literal, bool is_root );
   size_t GenExpressionTerm( Node::ArraySubscript* array_subscript, bool is_root );
   size_t GenExpressionTerm( Node::DictLiteral* dict_literal, bool is_root );
+  size_t GenCopyLiteral( size_t literal_index, bool is_root );
+  void   CollectConcatTerms( Node::Expression* node, std::vector<Node::Expression*> &terms );
+  size_t GenConcat( std::vector<Node::Expression*> &terms, bool is_root );
 
   size_t GenForInit( Node::ForInit* node );
 
@@ -81,7 +85,8 @@ private:
 
   void GenFunction( Node::Function* node );
   void GenFunctionCall( Node::FunctionCall* node );
-  void GenProcessMessage( Node::ProcessMessage* node );
+  bool IsTailCall( Node::FunctionCall* node );
+  void GenProcessMessage( Node::ProcessMessage* node, bool needs_result );
 
   template <class T>
   Function* GenWhen( T when_node, Opcode opcode );
@@ -136,6 +141,9 @@ private:
   // for determining size of loop/jump
   size_t           m_opcode_count;
   size_t           m_current_operand;
+  // loops the statement being generated is in, a return in one can't be a tail call
+  size_t           m_loop_depth;
+  bool             m_inline_functions;
 
   friend GenExpressionDispatcher;
   friend GenStatementDispatcher;
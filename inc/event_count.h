@@ -0,0 +1,121 @@
+#pragma once
+//
+// Event count, for parking idle threads without a lock on the notify path
+// -http://www.1024cores.net/home/lock-free-algorithms/eventcounts
+//
+// Waiter:
+//   key = ec.PrepareWait();
+//   if( condition ) { ec.CancelWait(); ... } else { ec.Wait(key); }
+// Notifier:
+//   make condition true; ec.Notify();
+//
+// Notify is a fence and a load when nobody is waiting. Waiting uses a futex on linux,
+// and a mutex/condition variable elsewhere.
+//
+#include "primitive_types.h"
+#include <atomic>
+#include <climits>
+
+#if defined(__linux__)
+  #include <linux/futex.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+#else
+  #include <mutex>
+  #include <condition_variable>
+#endif
+
+namespace Eople
+{
+
+class EventCount
+{
+public:
+  EventCount() : epoch(0), waiters(0) {}
+
+  u32 PrepareWait()
+  {
+    waiters.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return epoch.load(std::memory_order_seq_cst);
+  }
+
+  void CancelWait()
+  {
+    waiters.fetch_sub(1, std::memory_order_seq_cst);
+  }
+
+  // block until a notify after the matching PrepareWait
+  void Wait( u32 key )
+  {
+    while( epoch.load(std::memory_order_seq_cst) == key )
+    {
+#if defined(__linux__)
+      syscall( SYS_futex, (u32*)&epoch, FUTEX_WAIT_PRIVATE, key, nullptr, nullptr, 0 );
+#else
+      std::unique_lock<std::mutex> lock(mutex);
+      if( epoch.load(std::memory_order_seq_cst) == key )
+      {
+        event.wait(lock);
+      }
+#endif
+    }
+    waiters.fetch_sub(1, std::memory_order_seq_cst);
+  }
+
+  void Notify()
+  {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if( waiters.load(std::memory_order_seq_cst) == 0 )
+    {
+      return;
+    }
+    Wake(1);
+  }
+
+  void NotifyAll()
+  {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if( waiters.load(std::memory_order_seq_cst) == 0 )
+    {
+      return;
+    }
+    Wake(INT_MAX);
+  }
+
+private:
+  void Wake( int count )
+  {
+#if defined(__linux__)
+    epoch.fetch_add(1, std::memory_order_seq_cst);
+    syscall( SYS_futex, (u32*)&epoch, FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0 );
+#else
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      epoch.fetch_add(1, std::memory_order_seq_cst);
+    }
+    if( count == 1 )
+    {
+      event.notify_one();
+    }
+    else
+    {
+      event.notify_all();
+    }
+#endif
+  }
+
+  static_assert( sizeof(std::atomic<u32>) == sizeof(u32), "futex requires a plain 32 bit word" );
+
+  std::atomic<u32> epoch;
+  std::atomic<u32> waiters;
+#if !defined(__linux__)
+  std::mutex              mutex;
+  std::condition_variable event;
+#endif
+
+  EventCount(const EventCount&);
+  EventCount& operator=(const EventCount&);
+};
+
+} // namespace Eople
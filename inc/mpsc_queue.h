@@ -0,0 +1,130 @@
+#pragma once
+//
+// Unbounded lock-free multi-producer single-consumer queue
+// -http://www.1024cores.net/home/lock-free-algorithms/queues/non-intrusive-mpsc-node-based-queue
+//
+// push() may be called from any thread and never blocks or spins.
+// empty(), front() and pop() must only be called by one consumer at a time.
+//
+// Nodes are recycled through a BlockPool, so a steady stream of messages does not hit
+// the allocator.
+//
+// The producer and consumer ends are kept on separate cache lines unless padded is false,
+// for queues there are too many of to spend 128 bytes on each (process mailboxes).
+//
+#include "block_pool.h"
+#include <atomic>
+
+namespace Eople
+{
+
+template <class Node, bool padded>
+struct MPSCQueueEnds
+{
+  std::atomic<Node*> head;
+  char               pad0[64 - sizeof(std::atomic<Node*>)];
+  Node*              tail;
+  char               pad1[64 - sizeof(Node*)];
+};
+
+template <class Node>
+struct MPSCQueueEnds<Node, false>
+{
+  std::atomic<Node*> head;
+  Node*              tail;
+};
+
+template <class T, bool padded = true>
+class MPSCQueue
+{
+public:
+  MPSCQueue()
+  {
+    ends.head.store(&stub, std::memory_order_relaxed);
+    ends.tail = &stub;
+    stub.next.store(nullptr, std::memory_order_relaxed);
+  }
+
+  ~MPSCQueue()
+  {
+    // may run after thread local caches are gone, so don't recycle
+    Node* node = ends.tail->next.load(std::memory_order_acquire);
+    if( ends.tail != &stub )
+    {
+      ends.tail->~Node();
+      NodePool::Release(ends.tail);
+    }
+    DeleteList(node);
+  }
+
+  void push( const T& value )
+  {
+    Node* node = AllocateNode();
+    node->value = value;
+    node->next.store(nullptr, std::memory_order_relaxed);
+    // serialization point for producers. until prev->next is linked, the consumer
+    // sees the queue as ending at prev, which only delays delivery of this node.
+    Node* prev = ends.head.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  bool empty() const
+  {
+    return ends.tail->next.load(std::memory_order_acquire) == nullptr;
+  }
+
+  T& front()
+  {
+    return ends.tail->next.load(std::memory_order_acquire)->value;
+  }
+
+  void pop()
+  {
+    // the front node becomes the new (already consumed) tail
+    Node* next = ends.tail->next.load(std::memory_order_acquire);
+    if( ends.tail != &stub )
+    {
+      FreeNode(ends.tail);
+    }
+    ends.tail = next;
+  }
+
+private:
+  struct Node
+  {
+    T                  value;
+    std::atomic<Node*> next;
+  };
+
+  typedef BlockPool<sizeof(Node)> NodePool;
+
+  static void DeleteList( Node* node )
+  {
+    while( node )
+    {
+      Node* next = node->next.load(std::memory_order_relaxed);
+      node->~Node();
+      NodePool::Release(node);
+      node = next;
+    }
+  }
+
+  static Node* AllocateNode()
+  {
+    return new (NodePool::Allocate()) Node;
+  }
+
+  static void FreeNode( Node* node )
+  {
+    node->~Node();
+    NodePool::Free(node);
+  }
+
+  MPSCQueueEnds<Node, padded> ends;
+  Node                        stub;
+
+  MPSCQueue(const MPSCQueue&);
+  MPSCQueue& operator=(const MPSCQueue&);
+};
+
+} // namespace Eople
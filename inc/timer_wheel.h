@@ -0,0 +1,212 @@
+#pragma once
+//
+// Hierarchical timing wheel
+// -Hashed and Hierarchical Timing Wheels (Varghese, Lauck 1987)
+//
+// Four levels of 64 slots. A timer lives in the lowest level whose span covers its remaining
+// time, and moves down a level each time the level below wraps around. Add and Cancel are
+// O(1), Advance is O(1) per tick plus the timers that cascade or expire.
+//
+// Not thread safe; owned by a single thread.
+//
+#include "primitive_types.h"
+#include <cassert>
+
+namespace Eople
+{
+
+template <class T>
+class TimerWheel
+{
+public:
+  struct Timer
+  {
+    T      value;
+    u64    expiry_tick;
+    Timer* prev;
+    Timer* next;
+  };
+
+  TimerWheel( u64 start_tick = 0 )
+    : current_tick(start_tick), timer_count(0)
+  {
+    for( u32 level = 0; level < level_count; ++level )
+    {
+      for( u32 slot = 0; slot < slot_count; ++slot )
+      {
+        Timer& head = slots[level][slot];
+        head.prev = head.next = &head;
+      }
+    }
+  }
+
+  ~TimerWheel()
+  {
+    for( u32 level = 0; level < level_count; ++level )
+    {
+      for( u32 slot = 0; slot < slot_count; ++slot )
+      {
+        Timer& head = slots[level][slot];
+        while( head.next != &head )
+        {
+          Timer* timer = head.next;
+          Unlink(timer);
+          delete timer;
+        }
+      }
+    }
+  }
+
+  // expiry_tick must be in the future. returns a handle that can be cancelled until it expires.
+  Timer* Add( const T& value, u64 expiry_tick )
+  {
+    assert( expiry_tick > current_tick );
+    Timer* timer = new Timer;
+    timer->value = value;
+    timer->expiry_tick = expiry_tick;
+    Insert(timer);
+    ++timer_count;
+    return timer;
+  }
+
+  void Cancel( Timer* timer )
+  {
+    Unlink(timer);
+    delete timer;
+    --timer_count;
+  }
+
+  // move time forward, calling on_expire(value) for every timer that is due
+  template <class F>
+  void Advance( u64 to_tick, F on_expire )
+  {
+    while( current_tick < to_tick )
+    {
+      ++current_tick;
+
+      // when a level wraps around, move the next slot of the level above down
+      for( u32 level = 1; level < level_count; ++level )
+      {
+        if( (current_tick & ((u64(1) << (level * slot_bits)) - 1)) != 0 )
+        {
+          break;
+        }
+        Cascade( level, SlotIndex(current_tick, level) );
+      }
+
+      Timer& head = slots[0][SlotIndex(current_tick, 0)];
+      while( head.next != &head )
+      {
+        Timer* timer = head.next;
+        Unlink(timer);
+        --timer_count;
+        T value = timer->value;
+        delete timer;
+        on_expire(value);
+      }
+    }
+  }
+
+  // the first tick Advance has anything to do on, when a timer expires or moves down a level.
+  // the wheel must not be empty.
+  u64 NextTick() const
+  {
+    assert( !empty() );
+    u64 next = ~u64(0);
+    for( u32 slot = 1; slot <= slot_count; ++slot )
+    {
+      u64 tick = current_tick + slot;
+      if( !SlotEmpty(0, tick) )
+      {
+        next = tick;
+        break;
+      }
+    }
+    // a level's slots are cascaded in turn, one each time the level below wraps around
+    for( u32 level = 1; level < level_count; ++level )
+    {
+      u64 span = u64(1) << (level * slot_bits);
+      u64 tick = (current_tick / span + 1) * span;
+      for( u32 slot = 0; slot < slot_count && tick < next; ++slot, tick += span )
+      {
+        if( !SlotEmpty(level, tick) )
+        {
+          next = tick;
+          break;
+        }
+      }
+    }
+    return next;
+  }
+
+  u64    tick() const  { return current_tick; }
+  size_t size() const  { return timer_count; }
+  bool   empty() const { return timer_count == 0; }
+
+private:
+  static const u32 slot_bits   = 6;
+  static const u32 slot_count  = 1 << slot_bits;
+  static const u32 level_count = 4;
+
+  static u32 SlotIndex( u64 tick, u32 level )
+  {
+    return (u32)(tick >> (level * slot_bits)) & (slot_count - 1);
+  }
+
+  bool SlotEmpty( u32 level, u64 tick ) const
+  {
+    const Timer& head = slots[level][SlotIndex(tick, level)];
+    return head.next == &head;
+  }
+
+  void Insert( Timer* timer )
+  {
+    u64 delta = timer->expiry_tick - current_tick;
+    u64 tick  = timer->expiry_tick;
+    u32 level = 0;
+    while( level < level_count - 1 && delta >= (u64(1) << ((level + 1) * slot_bits)) )
+    {
+      ++level;
+    }
+    if( delta >= (u64(1) << (level_count * slot_bits)) )
+    {
+      // beyond the wheel, park it as far out as possible. it is placed again when cascaded.
+      tick = current_tick + (u64(1) << (level_count * slot_bits)) - 1;
+    }
+
+    Timer& head = slots[level][SlotIndex(tick, level)];
+    timer->next = &head;
+    timer->prev = head.prev;
+    head.prev->next = timer;
+    head.prev = timer;
+  }
+
+  void Cascade( u32 level, u32 slot )
+  {
+    Timer& head = slots[level][slot];
+    Timer* timer = head.next;
+    // detach the whole list first, timers may be placed back into this slot
+    head.prev = head.next = &head;
+    while( timer != &head )
+    {
+      Timer* next = timer->next;
+      Insert(timer);
+      timer = next;
+    }
+  }
+
+  static void Unlink( Timer* timer )
+  {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+  }
+
+  Timer  slots[level_count][slot_count];
+  u64    current_tick;
+  size_t timer_count;
+
+  TimerWheel(const TimerWheel&);
+  TimerWheel& operator=(const TimerWheel&);
+};
+
+} // namespace Eople
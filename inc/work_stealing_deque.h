@@ -0,0 +1,137 @@
+#pragma once
+//
+// Chase-Lev work stealing deque
+// -Correct and Efficient Work-Stealing for Weak Memory Models (Le, Pop, Cohen, Zappa Nardelli 2013)
+//
+// The owning thread pushes and pops at the bottom, any other thread may steal from the top.
+// T must be trivially copyable and small (e.g. a pointer); an empty result is returned as T().
+//
+#include "primitive_types.h"
+#include <atomic>
+#include <vector>
+#include <memory>
+
+namespace Eople
+{
+
+template <class T>
+class WorkStealingDeque
+{
+public:
+  WorkStealingDeque( size_t initial_capacity = 256 )
+    : top(0), bottom(0)
+  {
+    retired.push_back(std::unique_ptr<Buffer>(new Buffer(initial_capacity)));
+    buffer.store(retired.back().get(), std::memory_order_relaxed);
+  }
+
+  // owner only
+  void push( T value )
+  {
+    i64 b = bottom.load(std::memory_order_relaxed);
+    i64 t = top.load(std::memory_order_acquire);
+    Buffer* a = buffer.load(std::memory_order_relaxed);
+    if( b - t > (i64)a->capacity - 1 )
+    {
+      a = Grow(a, t, b);
+    }
+    a->Put(b, value);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+  }
+
+  // owner only
+  T pop()
+  {
+    i64 b = bottom.load(std::memory_order_relaxed) - 1;
+    Buffer* a = buffer.load(std::memory_order_relaxed);
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    i64 t = top.load(std::memory_order_relaxed);
+
+    T value = T();
+    if( t <= b )
+    {
+      value = a->Get(b);
+      if( t == b )
+      {
+        // last element, race against thieves
+        if( !top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed) )
+        {
+          value = T();
+        }
+        bottom.store(b + 1, std::memory_order_relaxed);
+      }
+    }
+    else
+    {
+      bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return value;
+  }
+
+  // any thread. may fail spuriously when racing with another thief or the owner.
+  T steal()
+  {
+    i64 t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    i64 b = bottom.load(std::memory_order_acquire);
+
+    if( t < b )
+    {
+      Buffer* a = buffer.load(std::memory_order_acquire);
+      T value = a->Get(t);
+      if( top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed) )
+      {
+        return value;
+      }
+    }
+    return T();
+  }
+
+  bool empty() const
+  {
+    return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Buffer
+  {
+    Buffer( size_t in_capacity )
+      : capacity(in_capacity), mask(in_capacity - 1), data(new std::atomic<T>[in_capacity])
+    {
+    }
+
+    T Get( i64 i ) const { return data[i & mask].load(std::memory_order_relaxed); }
+    void Put( i64 i, T value ) { data[i & mask].store(value, std::memory_order_relaxed); }
+
+    size_t capacity;
+    size_t mask;
+    std::unique_ptr<std::atomic<T>[]> data;
+  };
+
+  Buffer* Grow( Buffer* old_buffer, i64 t, i64 b )
+  {
+    Buffer* new_buffer = new Buffer(old_buffer->capacity * 2);
+    for( i64 i = t; i < b; ++i )
+    {
+      new_buffer->Put(i, old_buffer->Get(i));
+    }
+    // thieves may still be reading the old buffer, so it is kept alive until destruction
+    retired.push_back(std::unique_ptr<Buffer>(new_buffer));
+    buffer.store(new_buffer, std::memory_order_release);
+    return new_buffer;
+  }
+
+  std::atomic<i64>     top;
+  char                 pad0[64 - sizeof(std::atomic<i64>)];
+  std::atomic<i64>     bottom;
+  std::atomic<Buffer*> buffer;
+  // owner only
+  std::vector<std::unique_ptr<Buffer>> retired;
+
+  WorkStealingDeque(const WorkStealingDeque&);
+  WorkStealingDeque& operator=(const WorkStealingDeque&);
+};
+
+} // namespace Eople
@@ -0,0 +1,622 @@
+#include "eople_array_math.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+  #define EOPLE_ARRAY_MATH_X86 1
+  #include <immintrin.h>
+  #if defined(_MSC_VER) && !defined(__clang__)
+    #include <intrin.h>
+    // msvc doesn't need per function targets to use avx2 intrinsics
+    #define EOPLE_TARGET_AVX2
+  #else
+    #define EOPLE_TARGET_AVX2 __attribute__((target("avx2")))
+  #endif
+#else
+  #define EOPLE_ARRAY_MATH_X86 0
+#endif
+
+namespace Eople
+{
+namespace ArrayMath
+{
+
+namespace Scalar
+{
+
+float_t SumF( const float_t* x, size_t n )
+{
+  float_t total = 0.0;
+  for( size_t i = 0; i < n; ++i )
+  {
+    total += x[i];
+  }
+  return total;
+}
+
+float_t MinF( const float_t* x, size_t n )
+{
+  float_t result = x[0];
+  for( size_t i = 1; i < n; ++i )
+  {
+    result = x[i] < result ? x[i] : result;
+  }
+  return result;
+}
+
+float_t MaxF( const float_t* x, size_t n )
+{
+  float_t result = x[0];
+  for( size_t i = 1; i < n; ++i )
+  {
+    result = x[i] > result ? x[i] : result;
+  }
+  return result;
+}
+
+float_t DotF( const float_t* x, const float_t* y, size_t n )
+{
+  float_t total = 0.0;
+  for( size_t i = 0; i < n; ++i )
+  {
+    total += x[i] * y[i];
+  }
+  return total;
+}
+
+void ScaleF( float_t* out, const float_t* x, float_t k, size_t n )
+{
+  for( size_t i = 0; i < n; ++i )
+  {
+    out[i] = x[i] * k;
+  }
+}
+
+void AddF( float_t* out, const float_t* x, const float_t* y, size_t n )
+{
+  for( size_t i = 0; i < n; ++i )
+  {
+    out[i] = x[i] + y[i];
+  }
+}
+
+void MulF( float_t* out, const float_t* x, const float_t* y, size_t n )
+{
+  for( size_t i = 0; i < n; ++i )
+  {
+    out[i] = x[i] * y[i];
+  }
+}
+
+void AxpyF( float_t* out, const float_t* x, float_t k, const float_t* y, size_t n )
+{
+  for( size_t i = 0; i < n; ++i )
+  {
+    out[i] = x[i] * k + y[i];
+  }
+}
+
+// integer math is done unsigned, to wrap around instead of overflowing
+int_t SumI( const int_t* x, size_t n )
+{
+  u64 total = 0;
+  for( size_t i = 0; i < n; ++i )
+  {
+    total += (u64)x[i];
+  }
+  return (int_t)total;
+}
+
+int_t MinI( const int_t* x, size_t n )
+{
+  int_t result = x[0];
+  for( size_t i = 1; i < n; ++i )
+  {
+    result = x[i] < result ? x[i] : result;
+  }
+  return result;
+}
+
+int_t MaxI( const int_t* x, size_t n )
+{
+  int_t result = x[0];
+  for( size_t i = 1; i < n; ++i )
+  {
+    result = x[i] > result ? x[i] : result;
+  }
+  return result;
+}
+
+int_t DotI( const int_t* x, const int_t* y, size_t n )
+{
+  u64 total = 0;
+  for( size_t i = 0; i < n; ++i )
+  {
+    total += (u64)x[i] * (u64)y[i];
+  }
+  return (int_t)total;
+}
+
+void ScaleI( int_t* out, const int_t* x, int_t k, size_t n )
+{
+  for( size_t i = 0; i < n; ++i )
+  {
+    out[i] = (int_t)((u64)x[i] * (u64)k);
+  }
+}
+
+void AddI( int_t* out, const int_t* x, const int_t* y, size_t n )
+{
+  for( size_t i = 0; i < n; ++i )
+  {
+    out[i] = (int_t)((u64)x[i] + (u64)y[i]);
+  }
+}
+
+void MulI( int_t* out, const int_t* x, const int_t* y, size_t n )
+{
+  for( size_t i = 0; i < n; ++i )
+  {
+    out[i] = (int_t)((u64)x[i] * (u64)y[i]);
+  }
+}
+
+void AxpyI( int_t* out, const int_t* x, int_t k, const int_t* y, size_t n )
+{
+  for( size_t i = 0; i < n; ++i )
+  {
+    out[i] = (int_t)((u64)x[i] * (u64)k + (u64)y[i]);
+  }
+}
+
+} // namespace Scalar
+
+#if EOPLE_ARRAY_MATH_X86
+
+// sse2 is part of x86-64, so these need no cpu check
+namespace Sse2
+{
+
+static inline float_t HorizontalSum( __m128d v )
+{
+  return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+float_t SumF( const float_t* x, size_t n )
+{
+  __m128d total0 = _mm_setzero_pd();
+  __m128d total1 = _mm_setzero_pd();
+  size_t i = 0;
+  for( ; i + 4 <= n; i += 4 )
+  {
+    total0 = _mm_add_pd(total0, _mm_loadu_pd(x + i));
+    total1 = _mm_add_pd(total1, _mm_loadu_pd(x + i + 2));
+  }
+  float_t total = HorizontalSum(_mm_add_pd(total0, total1));
+  for( ; i < n; ++i )
+  {
+    total += x[i];
+  }
+  return total;
+}
+
+float_t MinF( const float_t* x, size_t n )
+{
+  if( n < 2 )
+  {
+    return x[0];
+  }
+  __m128d result = _mm_loadu_pd(x);
+  size_t i = 2;
+  for( ; i + 2 <= n; i += 2 )
+  {
+    result = _mm_min_pd(result, _mm_loadu_pd(x + i));
+  }
+  result = _mm_min_sd(result, _mm_unpackhi_pd(result, result));
+  float_t min = _mm_cvtsd_f64(result);
+  for( ; i < n; ++i )
+  {
+    min = x[i] < min ? x[i] : min;
+  }
+  return min;
+}
+
+float_t MaxF( const float_t* x, size_t n )
+{
+  if( n < 2 )
+  {
+    return x[0];
+  }
+  __m128d result = _mm_loadu_pd(x);
+  size_t i = 2;
+  for( ; i + 2 <= n; i += 2 )
+  {
+    result = _mm_max_pd(result, _mm_loadu_pd(x + i));
+  }
+  result = _mm_max_sd(result, _mm_unpackhi_pd(result, result));
+  float_t max = _mm_cvtsd_f64(result);
+  for( ; i < n; ++i )
+  {
+    max = x[i] > max ? x[i] : max;
+  }
+  return max;
+}
+
+float_t DotF( const float_t* x, const float_t* y, size_t n )
+{
+  __m128d total0 = _mm_setzero_pd();
+  __m128d total1 = _mm_setzero_pd();
+  size_t i = 0;
+  for( ; i + 4 <= n; i += 4 )
+  {
+    total0 = _mm_add_pd(total0, _mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+    total1 = _mm_add_pd(total1, _mm_mul_pd(_mm_loadu_pd(x + i + 2), _mm_loadu_pd(y + i + 2)));
+  }
+  float_t total = HorizontalSum(_mm_add_pd(total0, total1));
+  for( ; i < n; ++i )
+  {
+    total += x[i] * y[i];
+  }
+  return total;
+}
+
+void ScaleF( float_t* out, const float_t* x, float_t k, size_t n )
+{
+  __m128d factor = _mm_set1_pd(k);
+  size_t i = 0;
+  for( ; i + 2 <= n; i += 2 )
+  {
+    _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(x + i), factor));
+  }
+  Scalar::ScaleF(out + i, x + i, k, n - i);
+}
+
+void AddF( float_t* out, const float_t* x, const float_t* y, size_t n )
+{
+  size_t i = 0;
+  for( ; i + 2 <= n; i += 2 )
+  {
+    _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+  }
+  Scalar::AddF(out + i, x + i, y + i, n - i);
+}
+
+void MulF( float_t* out, const float_t* x, const float_t* y, size_t n )
+{
+  size_t i = 0;
+  for( ; i + 2 <= n; i += 2 )
+  {
+    _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+  }
+  Scalar::MulF(out + i, x + i, y + i, n - i);
+}
+
+void AxpyF( float_t* out, const float_t* x, float_t k, const float_t* y, size_t n )
+{
+  __m128d factor = _mm_set1_pd(k);
+  size_t i = 0;
+  for( ; i + 2 <= n; i += 2 )
+  {
+    __m128d product = _mm_mul_pd(_mm_loadu_pd(x + i), factor);
+    _mm_storeu_pd(out + i, _mm_add_pd(product, _mm_loadu_pd(y + i)));
+  }
+  Scalar::AxpyF(out + i, x + i, k, y + i, n - i);
+}
+
+int_t SumI( const int_t* x, size_t n )
+{
+  __m128i total = _mm_setzero_si128();
+  size_t i = 0;
+  for( ; i + 2 <= n; i += 2 )
+  {
+    total = _mm_add_epi64(total, _mm_loadu_si128((const __m128i*)(x + i)));
+  }
+  total = _mm_add_epi64(total, _mm_unpackhi_epi64(total, total));
+  return (int_t)((u64)_mm_cvtsi128_si64(total) + (u64)Scalar::SumI(x + i, n - i));
+}
+
+void AddI( int_t* out, const int_t* x, const int_t* y, size_t n )
+{
+  size_t i = 0;
+  for( ; i + 2 <= n; i += 2 )
+  {
+    __m128i sum = _mm_add_epi64(_mm_loadu_si128((const __m128i*)(x + i)), _mm_loadu_si128((const __m128i*)(y + i)));
+    _mm_storeu_si128((__m128i*)(out + i), sum);
+  }
+  Scalar::AddI(out + i, x + i, y + i, n - i);
+}
+
+} // namespace Sse2
+
+namespace Avx2
+{
+
+EOPLE_TARGET_AVX2 static inline float_t HorizontalSum( __m256d v )
+{
+  __m128d pair = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+  return _mm_cvtsd_f64(_mm_add_sd(pair, _mm_unpackhi_pd(pair, pair)));
+}
+
+EOPLE_TARGET_AVX2 float_t SumF( const float_t* x, size_t n )
+{
+  __m256d total0 = _mm256_setzero_pd();
+  __m256d total1 = _mm256_setzero_pd();
+  size_t i = 0;
+  for( ; i + 8 <= n; i += 8 )
+  {
+    total0 = _mm256_add_pd(total0, _mm256_loadu_pd(x + i));
+    total1 = _mm256_add_pd(total1, _mm256_loadu_pd(x + i + 4));
+  }
+  float_t total = HorizontalSum(_mm256_add_pd(total0, total1));
+  for( ; i < n; ++i )
+  {
+    total += x[i];
+  }
+  return total;
+}
+
+EOPLE_TARGET_AVX2 float_t MinF( const float_t* x, size_t n )
+{
+  if( n < 4 )
+  {
+    return Sse2::MinF(x, n);
+  }
+  __m256d result = _mm256_loadu_pd(x);
+  size_t i = 4;
+  for( ; i + 4 <= n; i += 4 )
+  {
+    result = _mm256_min_pd(result, _mm256_loadu_pd(x + i));
+  }
+  __m128d pair = _mm_min_pd(_mm256_castpd256_pd128(result), _mm256_extractf128_pd(result, 1));
+  pair = _mm_min_sd(pair, _mm_unpackhi_pd(pair, pair));
+  float_t min = _mm_cvtsd_f64(pair);
+  for( ; i < n; ++i )
+  {
+    min = x[i] < min ? x[i] : min;
+  }
+  return min;
+}
+
+EOPLE_TARGET_AVX2 float_t MaxF( const float_t* x, size_t n )
+{
+  if( n < 4 )
+  {
+    return Sse2::MaxF(x, n);
+  }
+  __m256d result = _mm256_loadu_pd(x);
+  size_t i = 4;
+  for( ; i + 4 <= n; i += 4 )
+  {
+    result = _mm256_max_pd(result, _mm256_loadu_pd(x + i));
+  }
+  __m128d pair = _mm_max_pd(_mm256_castpd256_pd128(result), _mm256_extractf128_pd(result, 1));
+  pair = _mm_max_sd(pair, _mm_unpackhi_pd(pair, pair));
+  float_t max = _mm_cvtsd_f64(pair);
+  for( ; i < n; ++i )
+  {
+    max = x[i] > max ? x[i] : max;
+  }
+  return max;
+}
+
+EOPLE_TARGET_AVX2 float_t DotF( const float_t* x, const float_t* y, size_t n )
+{
+  __m256d total0 = _mm256_setzero_pd();
+  __m256d total1 = _mm256_setzero_pd();
+  size_t i = 0;
+  for( ; i + 8 <= n; i += 8 )
+  {
+    total0 = _mm256_add_pd(total0, _mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+    total1 = _mm256_add_pd(total1, _mm256_mul_pd(_mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4)));
+  }
+  float_t total = HorizontalSum(_mm256_add_pd(total0, total1));
+  for( ; i < n; ++i )
+  {
+    total += x[i] * y[i];
+  }
+  return total;
+}
+
+EOPLE_TARGET_AVX2 void ScaleF( float_t* out, const float_t* x, float_t k, size_t n )
+{
+  __m256d factor = _mm256_set1_pd(k);
+  size_t i = 0;
+  for( ; i + 4 <= n; i += 4 )
+  {
+    _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(x + i), factor));
+  }
+  Scalar::ScaleF(out + i, x + i, k, n - i);
+}
+
+EOPLE_TARGET_AVX2 void AddF( float_t* out, const float_t* x, const float_t* y, size_t n )
+{
+  size_t i = 0;
+  for( ; i + 4 <= n; i += 4 )
+  {
+    _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+  }
+  Scalar::AddF(out + i, x + i, y + i, n - i);
+}
+
+EOPLE_TARGET_AVX2 void MulF( float_t* out, const float_t* x, const float_t* y, size_t n )
+{
+  size_t i = 0;
+  for( ; i + 4 <= n; i += 4 )
+  {
+    _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+  }
+  Scalar::MulF(out + i, x + i, y + i, n - i);
+}
+
+// multiply and add are kept separate (no fma), to round like the interpreter
+EOPLE_TARGET_AVX2 void AxpyF( float_t* out, const float_t* x, float_t k, const float_t* y, size_t n )
+{
+  __m256d factor = _mm256_set1_pd(k);
+  size_t i = 0;
+  for( ; i + 4 <= n; i += 4 )
+  {
+    __m256d product = _mm256_mul_pd(_mm256_loadu_pd(x + i), factor);
+    _mm256_storeu_pd(out + i, _mm256_add_pd(product, _mm256_loadu_pd(y + i)));
+  }
+  Scalar::AxpyF(out + i, x + i, k, y + i, n - i);
+}
+
+EOPLE_TARGET_AVX2 int_t SumI( const int_t* x, size_t n )
+{
+  __m256i total = _mm256_setzero_si256();
+  size_t i = 0;
+  for( ; i + 4 <= n; i += 4 )
+  {
+    total = _mm256_add_epi64(total, _mm256_loadu_si256((const __m256i*)(x + i)));
+  }
+  __m128i pair = _mm_add_epi64(_mm256_castsi256_si128(total), _mm256_extracti128_si256(total, 1));
+  pair = _mm_add_epi64(pair, _mm_unpackhi_epi64(pair, pair));
+  return (int_t)((u64)_mm_cvtsi128_si64(pair) + (u64)Scalar::SumI(x + i, n - i));
+}
+
+EOPLE_TARGET_AVX2 int_t MinI( const int_t* x, size_t n )
+{
+  if( n < 4 )
+  {
+    return Scalar::MinI(x, n);
+  }
+  __m256i result = _mm256_loadu_si256((const __m256i*)x);
+  size_t i = 4;
+  for( ; i + 4 <= n; i += 4 )
+  {
+    __m256i values = _mm256_loadu_si256((const __m256i*)(x + i));
+    result = _mm256_blendv_epi8(result, values, _mm256_cmpgt_epi64(result, values));
+  }
+  int_t lanes[4];
+  _mm256_storeu_si256((__m256i*)lanes, result);
+  int_t min = Scalar::MinI(lanes, 4);
+  for( ; i < n; ++i )
+  {
+    min = x[i] < min ? x[i] : min;
+  }
+  return min;
+}
+
+EOPLE_TARGET_AVX2 int_t MaxI( const int_t* x, size_t n )
+{
+  if( n < 4 )
+  {
+    return Scalar::MaxI(x, n);
+  }
+  __m256i result = _mm256_loadu_si256((const __m256i*)x);
+  size_t i = 4;
+  for( ; i + 4 <= n; i += 4 )
+  {
+    __m256i values = _mm256_loadu_si256((const __m256i*)(x + i));
+    result = _mm256_blendv_epi8(result, values, _mm256_cmpgt_epi64(values, result));
+  }
+  int_t lanes[4];
+  _mm256_storeu_si256((__m256i*)lanes, result);
+  int_t max = Scalar::MaxI(lanes, 4);
+  for( ; i < n; ++i )
+  {
+    max = x[i] > max ? x[i] : max;
+  }
+  return max;
+}
+
+EOPLE_TARGET_AVX2 void AddI( int_t* out, const int_t* x, const int_t* y, size_t n )
+{
+  size_t i = 0;
+  for( ; i + 4 <= n; i += 4 )
+  {
+    __m256i sum = _mm256_add_epi64(_mm256_loadu_si256((const __m256i*)(x + i)), _mm256_loadu_si256((const __m256i*)(y + i)));
+    _mm256_storeu_si256((__m256i*)(out + i), sum);
+  }
+  Scalar::AddI(out + i, x + i, y + i, n - i);
+}
+
+} // namespace Avx2
+
+static bool CpuHasAvx2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuid(info, 0);
+  if( info[0] < 7 )
+  {
+    return false;
+  }
+  // avx registers must be enabled by the os too
+  __cpuid(info, 1);
+  const int osxsave_avx = (1 << 27) | (1 << 28);
+  if( (info[2] & osxsave_avx) != osxsave_avx || (_xgetbv(0) & 6) != 6 )
+  {
+    return false;
+  }
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+#endif // EOPLE_ARRAY_MATH_X86
+
+static const Kernels scalar_kernels =
+{
+  Isa::SCALAR,
+  Scalar::SumF, Scalar::MinF, Scalar::MaxF, Scalar::DotF, Scalar::ScaleF, Scalar::AddF, Scalar::MulF, Scalar::AxpyF,
+  Scalar::SumI, Scalar::MinI, Scalar::MaxI, Scalar::DotI, Scalar::ScaleI, Scalar::AddI, Scalar::MulI, Scalar::AxpyI,
+};
+
+#if EOPLE_ARRAY_MATH_X86
+static const Kernels sse2_kernels =
+{
+  Isa::SSE2,
+  Sse2::SumF,   Sse2::MinF,   Sse2::MaxF,   Sse2::DotF,   Sse2::ScaleF,   Sse2::AddF, Sse2::MulF,   Sse2::AxpyF,
+  Sse2::SumI,   Scalar::MinI, Scalar::MaxI, Scalar::DotI, Scalar::ScaleI, Sse2::AddI, Scalar::MulI, Scalar::AxpyI,
+};
+
+static const Kernels avx2_kernels =
+{
+  Isa::AVX2,
+  Avx2::SumF,   Avx2::MinF,   Avx2::MaxF,   Avx2::DotF,   Avx2::ScaleF,   Avx2::AddF, Avx2::MulF,   Avx2::AxpyF,
+  Avx2::SumI,   Avx2::MinI,   Avx2::MaxI,   Scalar::DotI, Scalar::ScaleI, Avx2::AddI, Scalar::MulI, Scalar::AxpyI,
+};
+#endif
+
+const Kernels* ForIsa( Isa isa )
+{
+  switch( isa )
+  {
+    case Isa::SCALAR:
+      return &scalar_kernels;
+#if EOPLE_ARRAY_MATH_X86
+    case Isa::SSE2:
+      return &sse2_kernels;
+    case Isa::AVX2:
+    {
+      static const bool has_avx2 = CpuHasAvx2();
+      return has_avx2 ? &avx2_kernels : nullptr;
+    }
+#endif
+    default:
+      return nullptr;
+  }
+}
+
+const Kernels& Best()
+{
+  static const Kernels& best = ForIsa(Isa::AVX2) ? *ForIsa(Isa::AVX2) :
+                               ForIsa(Isa::SSE2) ? *ForIsa(Isa::SSE2) : scalar_kernels;
+  return best;
+}
+
+const char* IsaName( Isa isa )
+{
+  switch( isa )
+  {
+    case Isa::SCALAR: return "scalar";
+    case Isa::SSE2:   return "sse2";
+    case Isa::AVX2:   return "avx2";
+  }
+  return "unknown";
+}
+
+} // namespace ArrayMath
+} // namespace Eople
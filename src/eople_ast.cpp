@@ -68,6 +68,31 @@ namespace Node
     call_specializations[parent_specialization] = specialization;
   }
 
+/////////////////////
+//
+// ArraySubscript::
+//
+/////////////////////
+  const std::string* ArraySubscript::GetMemberName()
+  {
+    if( !member.empty() )
+    {
+      return &member;
+    }
+    auto key = index ? index->GetAsStringLiteral() : nullptr;
+    return key ? key->value : nullptr;
+  }
+
+  StructType* ArraySubscript::GetStructType( type_t container_type )
+  {
+    if( !member.empty() )
+    {
+      type_t element_type = container_type->type == ValueType::ARRAY ? container_type->GetVaryingType() : TypeBuilder::GetNilType();
+      return element_type->type == ValueType::STRUCT ? static_cast<StructType*>(element_type) : nullptr;
+    }
+    return container_type->type == ValueType::STRUCT ? static_cast<StructType*>(container_type) : nullptr;
+  }
+
 /////////////////////
 //
 // ProcessMessage::
@@ -338,7 +363,7 @@ namespace Node
 
     if(identifier || literal || array_literal || array_subscript || dict_literal)
     {
-      u32 match_depth;
+      u32 match_depth = 0;
       EntryId entry_id = array_subscript ? GetEntryIdForName(array_subscript->ident->GetAsIdentifier()->name, match_depth) :
                                        GetEntryId(expr, match_depth);
       if( entry_id == symbols.NOT_FOUND )
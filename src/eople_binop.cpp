@@ -95,6 +95,95 @@ bool DivF( process_t process_ref )
   return true;
 }
 
+//
+// Multiply-add, what a product and the sum taking it are fused into.
+//
+bool MulAddI( process_t process_ref )
+{
+  Object* op_a = process_ref->OperandA();
+  Object* op_b = process_ref->OperandB();
+  Object* op_c = process_ref->OperandC();
+
+  process_ref->OperandD()->int_val = op_a->int_val * op_b->int_val + op_c->int_val;
+  return true;
+}
+
+bool MulAddF( process_t process_ref )
+{
+  Object* op_a = process_ref->OperandA();
+  Object* op_b = process_ref->OperandB();
+  Object* op_c = process_ref->OperandC();
+
+  process_ref->OperandD()->float_val = op_a->float_val * op_b->float_val + op_c->float_val;
+  return true;
+}
+
+//
+// Arithmetic with a constant operand, see ReferenceConstants in eople_vmcode_gen.cpp.
+//
+bool AddIK( process_t process_ref )
+{
+  Object*       op_a = process_ref->OperandA();
+  const Object* op_b = process_ref->ConstantB();
+
+  process_ref->OperandC()->int_val = op_a->int_val + op_b->int_val;
+  return true;
+}
+
+bool SubIK( process_t process_ref )
+{
+  Object*       op_a = process_ref->OperandA();
+  const Object* op_b = process_ref->ConstantB();
+
+  process_ref->OperandC()->int_val = op_a->int_val - op_b->int_val;
+  return true;
+}
+
+bool MulIK( process_t process_ref )
+{
+  Object*       op_a = process_ref->OperandA();
+  const Object* op_b = process_ref->ConstantB();
+
+  process_ref->OperandC()->int_val = op_a->int_val * op_b->int_val;
+  return true;
+}
+
+bool AddFK( process_t process_ref )
+{
+  Object*       op_a = process_ref->OperandA();
+  const Object* op_b = process_ref->ConstantB();
+
+  process_ref->OperandC()->float_val = op_a->float_val + op_b->float_val;
+  return true;
+}
+
+bool SubFK( process_t process_ref )
+{
+  Object*       op_a = process_ref->OperandA();
+  const Object* op_b = process_ref->ConstantB();
+
+  process_ref->OperandC()->float_val = op_a->float_val - op_b->float_val;
+  return true;
+}
+
+bool MulFK( process_t process_ref )
+{
+  Object*       op_a = process_ref->OperandA();
+  const Object* op_b = process_ref->ConstantB();
+
+  process_ref->OperandC()->float_val = op_a->float_val * op_b->float_val;
+  return true;
+}
+
+bool DivFK( process_t process_ref )
+{
+  Object*       op_a = process_ref->OperandA();
+  const Object* op_b = process_ref->ConstantB();
+
+  process_ref->OperandC()->float_val = op_a->float_val / op_b->float_val;
+  return true;
+}
+
 //
 // Bitwise operators.
 //
@@ -152,39 +241,124 @@ bool ConcatS( process_t process_ref )
   Object* op_b = process_ref->OperandB();
   Object* dest = process_ref->OperandC();
 
-  bool aliasing_a = dest == op_a;
-  bool aliasing_b = dest == op_b;
-  bool aliasing = aliasing_a || aliasing_b;
+  string_t text_a = op_a->string_ref;
+  string_t text_b = op_b->string_ref;
+
+  // A temp destination always gets a fresh string: even when it is also the lhs, its string may
+  // belong to something else (eg. an array element it was read from)
+  process_ref->TryInitTempString(dest);
 
-  // If the destination is not the same as one of the source operands, initialize (if it's a temp object)
-  if( !aliasing )
+  // interned strings are never changed, so the destination gets a string of its own
+  if( !dest->string_ref || StringTable::IsInterned(dest->string_ref) )
   {
-    process_ref->TryInitTempString(dest);
+    dest->SetString( process_ref->OutlivesMessage(dest) ? process_ref->NewHeapString() : process_ref->NewString() );
   }
 
   // use much faster '+=' if destination is the same as the lhs
-  if( dest->string_ref == op_a->string_ref )
+  if( dest->string_ref == text_a )
   {
-    *dest->string_ref += *op_b->string_ref;
+    *dest->string_ref += *text_b;
   }
   else
   {
-    *dest->string_ref = *op_a->string_ref + *op_b->string_ref;
+    *dest->string_ref = *text_a + *text_b;
   }
 
 //  dest->string_ref.concatenate( op_a->string_ref, op_b->string_ref );
 
-  // if operands were temporary objects, free them right away
-  if( !aliasing_a )
+  return true;
+}
+
+// string i of a ConcatN, the first two are operands c and d and the rest follow in NOP instructions
+static Object* ConcatOperand( process_t process_ref, const VMCode* code, size_t i )
+{
+  if( i < 2 )
   {
-    process_ref->TryCollectTempString(op_a);
+    return process_ref->stack.GetObjectAtOffset( i == 0 ? code->c : code->d );
   }
+  const VMCode& operands = code[1 + (i - 2) / 4];
+  switch( (i - 2) % 4 )
+  {
+    case 0:  return process_ref->stack.GetObjectAtOffset(operands.a);
+    case 1:  return process_ref->stack.GetObjectAtOffset(operands.b);
+    case 2:  return process_ref->stack.GetObjectAtOffset(operands.c);
+    default: return process_ref->stack.GetObjectAtOffset(operands.d);
+  }
+}
+
+// a + b + c ...: operand a is the destination and operand b the number of strings (not a stack
+// slot). The result is sized once, and s = s + a + b appends to s in place.
+bool ConcatN( process_t process_ref )
+{
+  const VMCode* code  = process_ref->ip;
+  size_t        count = code->b;
+  Object*       dest  = process_ref->OperandA();
+  string_t      old_text = dest->string_ref;
 
-  if( !aliasing_b )
+  size_t length = 0;
+  bool   first_is_dest = false;
+  bool   rest_has_dest = false;
+  for( size_t i = 0; i < count; ++i )
   {
-    process_ref->TryCollectTempString(op_b);
+    string_t text = ConcatOperand(process_ref, code, i)->string_ref;
+    length += text->size();
+    if( text == old_text )
+    {
+      (i == 0 ? first_is_dest : rest_has_dest) = true;
+    }
   }
 
+  // same rules as ConcatS for where the result goes
+  process_ref->TryInitTempString(dest);
+  if( !dest->string_ref || StringTable::IsInterned(dest->string_ref) )
+  {
+    dest->SetString( process_ref->OutlivesMessage(dest) ? process_ref->NewHeapString() : process_ref->NewString() );
+  }
+  string_t text = dest->string_ref;
+
+  // a destination that is also an operand is read through its old string
+  auto operand_text = [&]( size_t i )
+  {
+    Object* operand = ConcatOperand(process_ref, code, i);
+    return operand == dest ? old_text : operand->string_ref;
+  };
+
+  if( text == old_text && first_is_dest && !rest_has_dest )
+  {
+    // grow geometrically, so appending in a loop stays linear
+    if( length > text->capacity() )
+    {
+      text->reserve( std::max(length, 2 * text->capacity()) );
+    }
+    for( size_t i = 1; i < count; ++i )
+    {
+      text->append( *operand_text(i) );
+    }
+  }
+  else if( text != old_text || !rest_has_dest )
+  {
+    text->clear();
+    text->reserve(length);
+    for( size_t i = 0; i < count; ++i )
+    {
+      text->append( *operand_text(i) );
+    }
+  }
+  else
+  {
+    // the destination shows up after the first string
+    std::string joined;
+    joined.reserve(length);
+    for( size_t i = 0; i < count; ++i )
+    {
+      joined.append( *operand_text(i) );
+    }
+    *text = std::move(joined);
+  }
+
+  // skip the NOPs holding the rest of the strings
+  process_ref->ip += (count + 1) / 4;
+
   return true;
 }
 
@@ -193,11 +367,7 @@ bool EqualS( process_t process_ref )
   Object* op_a = process_ref->OperandA();
   Object* op_b = process_ref->OperandB();
 
-  process_ref->OperandC()->bool_val = ( op_a->string_ref == op_b->string_ref || *op_a->string_ref == *op_b->string_ref );
-
-  // if operands were temporary objects, free them right away
-  process_ref->TryCollectTempString(op_a);
-  process_ref->TryCollectTempString(op_b);
+  process_ref->OperandC()->bool_val = StringTable::Equal( op_a->string_ref, op_b->string_ref );
 
   return true;
 }
@@ -207,11 +377,7 @@ bool NotEqualS( process_t process_ref )
   Object* op_a = process_ref->OperandA();
   Object* op_b = process_ref->OperandB();
 
-  process_ref->OperandC()->bool_val = *op_a->string_ref != *op_b->string_ref;
-
-  // if operands were temporary objects, free them right away
-  process_ref->TryCollectTempString(op_a);
-  process_ref->TryCollectTempString(op_b);
+  process_ref->OperandC()->bool_val = !StringTable::Equal( op_a->string_ref, op_b->string_ref );
 
   return true;
 }
@@ -355,22 +521,37 @@ bool Store( process_t process_ref )
   return true;
 }
 
+bool StoreK( process_t process_ref )
+{
+  *process_ref->OperandA() = *process_ref->ConstantB();
+  return true;
+}
+
 bool StoreArrayElement( process_t process_ref )
 {
-  auto& array_ref = *process_ref->OperandA()->array_ref;
-  int_t index = process_ref->OperandB()->int_val;
+  array_ptr_t array = process_ref->OperandA()->array_ref;
+  size_t index = (size_t)process_ref->OperandB()->int_val;
   Object* source = process_ref->OperandC();
 
-  assert(index < array_ref.size());
-  array_ref[index] = *source;
+  assert(index < array->size());
+  array->MakeWritable();
+  if( array->kind == ArrayKind::STRUCT )
+  {
+    // members are copied into the array
+    array->Structs()->Store(index, source->struct_ref);
+    return true;
+  }
+  process_ref->ShareObject(*source);
+  array->Objects()[index] = *source;
 
   return true;
 }
 
 bool StoreArrayStringElement( process_t process_ref )
 {
-  auto& array_ref = *process_ref->OperandA()->array_ref;
-  int_t index = process_ref->OperandB()->int_val;
+  process_ref->OperandA()->array_ref->MakeWritable();
+  auto& array_ref = process_ref->OperandA()->array_ref->Objects();
+  size_t index = (size_t)process_ref->OperandB()->int_val;
   Object* source = process_ref->OperandC();
 
   assert(index < array_ref.size());
@@ -378,16 +559,90 @@ bool StoreArrayStringElement( process_t process_ref )
   // if we're storing from a temp object, just steal its pointers instead of copying
   if( process_ref->IsTemporary(source) )
   {
-    if( array_ref[index].string_ref )
-    {
-      delete array_ref[index].string_ref;
-    }
-    array_ref[index].string_ref = source->string_ref;
+    array_ref[index].SetString(source->string_ref);
   }
   else
   {
     array_ref[index] = *source;
   }
+  process_ref->PromoteString(&array_ref[index]);
+
+  return true;
+}
+
+bool StoreArrayElementI( process_t process_ref )
+{
+  auto array_ref = process_ref->OperandA()->array_ref;
+  size_t index = (size_t)process_ref->OperandB()->int_val;
+
+  array_ref->MakeWritable();
+  auto& values = array_ref->Ints();
+  if( index >= values.size() )
+  {
+    throw std::runtime_error("Array index out of bounds.");
+  }
+  values[index] = process_ref->OperandC()->int_val;
+
+  return true;
+}
+
+bool StoreArrayElementF( process_t process_ref )
+{
+  auto array_ref = process_ref->OperandA()->array_ref;
+  size_t index = (size_t)process_ref->OperandB()->int_val;
+
+  array_ref->MakeWritable();
+  auto& values = array_ref->Floats();
+  if( index >= values.size() )
+  {
+    throw std::runtime_error("Array index out of bounds.");
+  }
+  values[index] = process_ref->OperandC()->float_val;
+
+  return true;
+}
+
+bool StoreArrayElementB( process_t process_ref )
+{
+  auto array_ref = process_ref->OperandA()->array_ref;
+  size_t index = (size_t)process_ref->OperandB()->int_val;
+
+  array_ref->MakeWritable();
+  auto& values = array_ref->Bools();
+  if( index >= values.size() )
+  {
+    throw std::runtime_error("Array index out of bounds.");
+  }
+  values[index] = process_ref->OperandC()->bool_val != 0;
+
+  return true;
+}
+
+bool StoreStructMember( process_t process_ref )
+{
+  Object* source = process_ref->OperandC();
+
+  process_ref->ShareObject(*source);
+  // operand b is the member index itself, not a stack slot
+  process_ref->OperandA()->struct_ref->Members()[process_ref->ip->b] = *source;
+
+  return true;
+}
+
+bool StoreStructArrayMember( process_t process_ref )
+{
+  auto structs = process_ref->OperandA()->array_ref->Structs();
+  size_t index = (size_t)process_ref->OperandB()->int_val;
+  Object* source = process_ref->OperandC();
+
+  if( index >= structs->size() )
+  {
+    throw std::runtime_error("Array index out of bounds.");
+  }
+  process_ref->ShareObject(*source);
+  structs->MakeWritable();
+  // operand d is the member index itself, not a stack slot
+  structs->Members(index)[process_ref->ip->d] = *source;
 
   return true;
 }
@@ -404,6 +659,56 @@ bool SpawnProcess( process_t process_ref )
   return true;
 }
 
+bool NewStruct( process_t process_ref )
+{
+  type_t struct_type = process_ref->OperandA()->type;
+  StructType* type = static_cast<StructType*>(struct_type);
+  Struct* new_struct = process_ref->heap.Add(Struct::Create(type));
+  Object* members = new_struct->Members();
+  size_t  count   = new_struct->size();
+
+  // members follow the type, continuing into NOP instructions past the first three
+  size_t i = 0;
+  if( i < count ) { members[i++] = *process_ref->OperandB(); }
+  if( i < count ) { members[i++] = *process_ref->OperandC(); }
+  if( i < count ) { members[i++] = *process_ref->OperandD(); }
+  while( i < count )
+  {
+    ++process_ref->ip;
+    if( i < count ) { members[i++] = *process_ref->OperandA(); }
+    if( i < count ) { members[i++] = *process_ref->OperandB(); }
+    if( i < count ) { members[i++] = *process_ref->OperandC(); }
+    if( i < count ) { members[i++] = *process_ref->OperandD(); }
+  }
+
+  for( i = 0; i < count; ++i )
+  {
+    process_ref->ShareObject(members[i]);
+  }
+
+  process_ref->CCallReturnVal()->SetStruct(new_struct);
+
+  return true;
+}
+
+// array and dict literals are constants of the function, every evaluation gets a copy of its own
+bool CopyLiteral( process_t process_ref )
+{
+  Object* literal = process_ref->OperandA();
+  Object* dest    = process_ref->OperandB();
+
+  if( literal->object_type == (u8)ValueType::DICT )
+  {
+    dest->SetDict(process_ref->heap.Add(literal->dict_ref->Copy()));
+  }
+  else
+  {
+    dest->SetArray(process_ref->heap.Add(literal->array_ref->Copy()));
+  }
+
+  return true;
+}
+
 bool StringCopy( process_t process_ref )
 {
   Object* dest   = process_ref->OperandA();
@@ -412,20 +717,21 @@ bool StringCopy( process_t process_ref )
   // if we're storing from a temp object, just steal its pointers instead of copying
   if( process_ref->IsTemporary(source) )
   {
-    if( !process_ref->IsTemporary(dest) && dest->string_ref )
-    {
-      delete dest->string_ref;
-    }
-    dest->string_ref = source->string_ref;
+    dest->SetString(source->string_ref);
 //    dest->string_ref.move( source->string_ref );
   }
   else
   {
-    process_ref->TryInitTempString(dest);
-    *dest = *source;
+    // interned strings (literals) are immutable, so they are shared rather than copied
+    dest->SetString(source->string_ref);
 //    dest->string_ref.set( source->string_ref );
   }
 
+  if( process_ref->OutlivesMessage(dest) )
+  {
+    process_ref->PromoteString(dest);
+  }
+
   return true;
 }
 
@@ -15,9 +15,7 @@ bool WhenRegister( process_t process_ref )
 {
   Function* when = process_ref->OperandA()->function;
 
-  auto when_block = WhenBlock(when, process_ref->stack.CaptureClosure(when));
-
-  process_ref->when_blocks.push_back(std::move(when_block));
+  process_ref->AddWhenBlock(when, false);
   return true;
 }
 
@@ -25,10 +23,7 @@ bool WheneverRegister( process_t process_ref )
 {
   Function* whenever = process_ref->OperandA()->function;
 
-  auto when_block = WhenBlock(whenever,
-                              process_ref->stack.CaptureClosure(whenever));
-
-  process_ref->whenever_blocks.push_back(std::move(when_block));
+  process_ref->AddWhenBlock(whenever, true);
   return true;
 }
 
@@ -64,16 +59,7 @@ bool GetValue( process_t process_ref )
   promise_t promise = process_ref->OperandA()->promise;
 
   // TODO: this is clearly a hack, and is the only reason Object::object_type exists.
-  if( promise->value.object_type == (u8)ValueType::STRING )
-  {
-    string_t string_value = new std::string(*promise->value.string_ref);
-    *process_ref->CCallReturnVal() = Object::BuildString(string_value);
-  }
-  else if( promise->value.object_type == (u8)ValueType::ARRAY )
-  {
-    *process_ref->CCallReturnVal() = Object::BuildArray(*promise->value.array_ref);
-  }
-  else if( promise->value.object_type == (u8)ValueType::PROMISE )
+  if( promise->value.object_type == (u8)ValueType::PROMISE )
   {
     promise_t child_promise = promise->value.promise;
     // recurse, to support chained promises
@@ -81,13 +67,12 @@ bool GetValue( process_t process_ref )
     {
       child_promise = child_promise->value.promise;
     }
-    *process_ref->CCallReturnVal() = child_promise->value;
-  }
-  else
-  {
-    *process_ref->CCallReturnVal() = promise->value;
+    promise = child_promise;
   }
 
+  // the value was exported by the process that replied, every reader gets its own copy
+  *process_ref->CCallReturnVal() = process_ref->ImportObject(promise->value);
+
   return true;
 }
 
@@ -106,26 +91,27 @@ bool When( process_t process_ref )
   const VMCode* condition_start = ip;
   const VMCode* condition_end   = ip + condition_i_count;
   const VMCode* body_start      = condition_end;
+  const VMCode* body_end        = body_start + body_i_count;
 
-  for( size_t i = 0; i < condition_i_count; ++i, ++ip )
+  // ip, not an index: instructions with more operands than fit skip the NOPs that hold them
+  for( ; ip != condition_end; ++ip )
   {
-    condition_start[i].instruction(process_ref);
+    ip->instruction(process_ref);
   }
 
   if( condition->bool_val )
   {
     // when body
-    ip = body_start;
-    for( size_t i = 0; i < body_i_count; ++i, ++ip )
+    for( ip = body_start; ip != body_end; ++ip )
     {
-      body_start[i].instruction(process_ref);
+      ip->instruction(process_ref);
     }
 
-    ip = body_start + body_i_count;
+    ip = body_end;
     return true;
   }
 
-  ip = body_start + body_i_count;
+  ip = body_end;
   return false;
 }
 
@@ -143,19 +129,19 @@ bool Whenever( process_t process_ref )
   const VMCode* condition_start = ip;
   const VMCode* condition_end   = ip + condition_i_count;
   const VMCode* body_start      = condition_end;
+  const VMCode* body_end        = body_start + body_i_count;
 
-  for( size_t i = 0; i < condition_i_count; ++i, ++ip )
+  for( ; ip != condition_end; ++ip )
   {
-    condition_start[i].instruction(process_ref);
+    ip->instruction(process_ref);
   }
 
   if( condition->bool_val )
   {
     // when body
-    ip = body_start;
-    for( size_t i = 0; i < body_i_count; ++i, ++ip )
+    for( ip = body_start; ip != body_end; ++ip )
     {
-      if( !body_start[i].instruction(process_ref) )
+      if( !ip->instruction(process_ref) )
       {
         // 'return'ing from a whenever stops the loop
         process_ref->CCallReturnVal()->bool_val = false;
@@ -163,12 +149,12 @@ bool Whenever( process_t process_ref )
       }
     }
 
-    ip = body_start + body_i_count;
+    ip = body_end;
     process_ref->CCallReturnVal()->bool_val = true;
     return true;
   }
 
-  ip = body_start + body_i_count;
+  ip = body_end;
   return false;
 }
 
@@ -186,30 +172,29 @@ bool While( process_t process_ref )
   const VMCode* condition_start = ip;
   const VMCode* condition_end   = ip + condition_i_count;
   const VMCode* body_start      = condition_end;
+  const VMCode* body_end        = body_start + body_i_count;
 
-  for( size_t i = 0; i < condition_i_count; ++i, ++ip )
+  for( ; ip != condition_end; ++ip )
   {
-    condition_start[i].instruction(process_ref);
+    ip->instruction(process_ref);
   }
 
   while( condition->bool_val )
   {
     // while body
-    ip = body_start;
-    for( size_t i = 0; i < body_i_count; ++i, ++ip )
+    for( ip = body_start; ip != body_end; ++ip )
     {
-      body_start[i].instruction(process_ref);
+      ip->instruction(process_ref);
     }
 
     // re-evaluate condition
-    ip = condition_start;
-    for( size_t i = 0; i < condition_i_count; ++i, ++ip )
+    for( ip = condition_start; ip != condition_end; ++ip )
     {
-      condition_start[i].instruction(process_ref);
+      ip->instruction(process_ref);
     }
   }
 
-  ip = body_start + body_i_count - 1;
+  ip = body_end - 1;
   return true;
 }
 
@@ -313,9 +298,9 @@ bool ForA( process_t process_ref )
   const VMCode* const start_ip = process_ref->ip;
   const VMCode* const end_ip   = start_ip + i_count;
 
-  for( auto thing : *array )
+  for( size_t i = 0; i < array->size(); ++i )
   {
-    *process_ref->stack.GetObjectAtOffset(element_offset) = thing;
+    *process_ref->stack.GetObjectAtOffset(element_offset) = process_ref->ArrayElement(array, i);
     for( ip = start_ip; ip != end_ip; ++ip )
     {
       ip->instruction(process_ref);
@@ -424,6 +409,240 @@ bool JumpGEQ( process_t process_ref )
   return true;
 }
 
+bool JumpNotGTF( process_t process_ref )
+{
+  // jump offsets for instruction pointer and operand pointer
+  const i32 i_count = process_ref->ip->a;
+
+  if( !(process_ref->OperandB()->float_val > process_ref->OperandC()->float_val) )
+  {
+    process_ref->ip += i_count;
+  }
+
+  return true;
+}
+
+bool JumpNotLTF( process_t process_ref )
+{
+  // jump offsets for instruction pointer and operand pointer
+  const i32 i_count = process_ref->ip->a;
+
+  if( !(process_ref->OperandB()->float_val < process_ref->OperandC()->float_val) )
+  {
+    process_ref->ip += i_count;
+  }
+
+  return true;
+}
+
+bool JumpNotEQF( process_t process_ref )
+{
+  // jump offsets for instruction pointer and operand pointer
+  const i32 i_count = process_ref->ip->a;
+
+  if( !(process_ref->OperandB()->float_val == process_ref->OperandC()->float_val) )
+  {
+    process_ref->ip += i_count;
+  }
+
+  return true;
+}
+
+bool JumpNotNEQF( process_t process_ref )
+{
+  // jump offsets for instruction pointer and operand pointer
+  const i32 i_count = process_ref->ip->a;
+
+  if( !(process_ref->OperandB()->float_val != process_ref->OperandC()->float_val) )
+  {
+    process_ref->ip += i_count;
+  }
+
+  return true;
+}
+
+bool JumpNotLEQF( process_t process_ref )
+{
+  // jump offsets for instruction pointer and operand pointer
+  const i32 i_count = process_ref->ip->a;
+
+  if( !(process_ref->OperandB()->float_val <= process_ref->OperandC()->float_val) )
+  {
+    process_ref->ip += i_count;
+  }
+
+  return true;
+}
+
+bool JumpNotGEQF( process_t process_ref )
+{
+  // jump offsets for instruction pointer and operand pointer
+  const i32 i_count = process_ref->ip->a;
+
+  if( !(process_ref->OperandB()->float_val >= process_ref->OperandC()->float_val) )
+  {
+    process_ref->ip += i_count;
+  }
+
+  return true;
+}
+
+bool JumpGTK( process_t process_ref )
+{
+  // jump offsets for instruction pointer and operand pointer
+  const i32 i_count = process_ref->ip->a;
+
+  if( process_ref->OperandB()->int_val > process_ref->ConstantC()->int_val )
+  {
+    process_ref->ip += i_count;
+  }
+
+  return true;
+}
+
+bool JumpLTK( process_t process_ref )
+{
+  // jump offsets for instruction pointer and operand pointer
+  const i32 i_count = process_ref->ip->a;
+
+  if( process_ref->OperandB()->int_val < process_ref->ConstantC()->int_val )
+  {
+    process_ref->ip += i_count;
+  }
+
+  return true;
+}
+
+bool JumpEQK( process_t process_ref )
+{
+  // jump offsets for instruction pointer and operand pointer
+  const i32 i_count = process_ref->ip->a;
+
+  if( process_ref->OperandB()->int_val == process_ref->ConstantC()->int_val )
+  {
+    process_ref->ip += i_count;
+  }
+
+  return true;
+}
+
+bool JumpNEQK( process_t process_ref )
+{
+  // jump offsets for instruction pointer and operand pointer
+  const i32 i_count = process_ref->ip->a;
+
+  if( process_ref->OperandB()->int_val != process_ref->ConstantC()->int_val )
+  {
+    process_ref->ip += i_count;
+  }
+
+  return true;
+}
+
+bool JumpLEQK( process_t process_ref )
+{
+  // jump offsets for instruction pointer and operand pointer
+  const i32 i_count = process_ref->ip->a;
+
+  if( process_ref->OperandB()->int_val <= process_ref->ConstantC()->int_val )
+  {
+    process_ref->ip += i_count;
+  }
+
+  return true;
+}
+
+bool JumpGEQK( process_t process_ref )
+{
+  // jump offsets for instruction pointer and operand pointer
+  const i32 i_count = process_ref->ip->a;
+
+  if( process_ref->OperandB()->int_val >= process_ref->ConstantC()->int_val )
+  {
+    process_ref->ip += i_count;
+  }
+
+  return true;
+}
+
+bool JumpNotGTFK( process_t process_ref )
+{
+  // jump offsets for instruction pointer and operand pointer
+  const i32 i_count = process_ref->ip->a;
+
+  if( !(process_ref->OperandB()->float_val > process_ref->ConstantC()->float_val) )
+  {
+    process_ref->ip += i_count;
+  }
+
+  return true;
+}
+
+bool JumpNotLTFK( process_t process_ref )
+{
+  // jump offsets for instruction pointer and operand pointer
+  const i32 i_count = process_ref->ip->a;
+
+  if( !(process_ref->OperandB()->float_val < process_ref->ConstantC()->float_val) )
+  {
+    process_ref->ip += i_count;
+  }
+
+  return true;
+}
+
+bool JumpNotEQFK( process_t process_ref )
+{
+  // jump offsets for instruction pointer and operand pointer
+  const i32 i_count = process_ref->ip->a;
+
+  if( !(process_ref->OperandB()->float_val == process_ref->ConstantC()->float_val) )
+  {
+    process_ref->ip += i_count;
+  }
+
+  return true;
+}
+
+bool JumpNotNEQFK( process_t process_ref )
+{
+  // jump offsets for instruction pointer and operand pointer
+  const i32 i_count = process_ref->ip->a;
+
+  if( !(process_ref->OperandB()->float_val != process_ref->ConstantC()->float_val) )
+  {
+    process_ref->ip += i_count;
+  }
+
+  return true;
+}
+
+bool JumpNotLEQFK( process_t process_ref )
+{
+  // jump offsets for instruction pointer and operand pointer
+  const i32 i_count = process_ref->ip->a;
+
+  if( !(process_ref->OperandB()->float_val <= process_ref->ConstantC()->float_val) )
+  {
+    process_ref->ip += i_count;
+  }
+
+  return true;
+}
+
+bool JumpNotGEQFK( process_t process_ref )
+{
+  // jump offsets for instruction pointer and operand pointer
+  const i32 i_count = process_ref->ip->a;
+
+  if( !(process_ref->OperandB()->float_val >= process_ref->ConstantC()->float_val) )
+  {
+    process_ref->ip += i_count;
+  }
+
+  return true;
+}
+
 bool Return( process_t /*process_ref*/ )
 {
   return false;
@@ -435,6 +654,26 @@ bool ReturnValue( process_t process_ref )
   return false;
 }
 
+bool ReturnValueK( process_t process_ref )
+{
+  *process_ref->stack.GetObjectAtOffset(0) = *process_ref->ConstantA();
+  return false;
+}
+
+// operand (0 to 3 for a to d) of the current instruction, as a message argument
+static void SendArg( process_t process_ref, Object* dest, Object* source, u8 operand )
+{
+  *dest = *source;
+  if( process_ref->ip->moves & (1 << operand) )
+  {
+    process_ref->MoveObject( *dest, *source );
+  }
+  else
+  {
+    process_ref->SendObject( *dest );
+  }
+}
+
 void CopyMessageArgs( const Function* function, process_t process_ref, Object* dest )
 {
   size_t parameter_count = function->parameter_count();
@@ -445,12 +684,12 @@ void CopyMessageArgs( const Function* function, process_t process_ref, Object* d
 
   if( parameter_count )
   {
-    *(dest++) = *process_ref->OperandC();
+    SendArg( process_ref, dest++, process_ref->OperandC(), 2 );
     --parameter_count;
   }
   if( parameter_count )
   {
-    *(dest++) = *process_ref->OperandD();
+    SendArg( process_ref, dest++, process_ref->OperandD(), 3 );
     --parameter_count;
   }
 
@@ -459,46 +698,78 @@ void CopyMessageArgs( const Function* function, process_t process_ref, Object* d
     ++process_ref->ip;
     if( parameter_count )
     {
-      *(dest++) = *process_ref->OperandA();
+      SendArg( process_ref, dest++, process_ref->OperandA(), 0 );
       --parameter_count;
     }
     if( parameter_count )
     {
-      *(dest++) = *process_ref->OperandB();
+      SendArg( process_ref, dest++, process_ref->OperandB(), 1 );
       --parameter_count;
     }
     if( parameter_count )
     {
-      *(dest++) = *process_ref->OperandC();
+      SendArg( process_ref, dest++, process_ref->OperandC(), 2 );
       --parameter_count;
     }
     if( parameter_count )
     {
-      *(dest++) = *process_ref->OperandD();
+      SendArg( process_ref, dest++, process_ref->OperandD(), 3 );
       --parameter_count;
     }
   }
 }
 
-bool ProcessMessage( process_t process_ref )
+static promise_t SendProcessMessage( process_t process_ref, bool wants_result )
 {
   process_t other_process = process_ref->OperandA()->process_ref;
   Function* function      = process_ref->OperandB()->function;
 
-  Object* args = new Object[function->parameter_count()];
+  Object* args = CallData::AllocateArgs( function->parameter_count() );
   CopyMessageArgs( function, process_ref, args );
 
-  promise_t promise = (function->return_type == TypeBuilder::GetNilType()) ? nullptr : new Promise(process_ref);
+  promise_t promise = nullptr;
+  if( wants_result && function->return_type != TypeBuilder::GetNilType() )
+  {
+    promise = process_ref->NewPromise();
+    // held by the message until the reply has been handled
+    promise->AddRef();
+  }
   process_ref->vm->SendMessage( CallData(function, other_process, args, promise) );
-  process_ref->CCallReturnVal()->promise = promise;
+  return promise;
+}
+
+bool ProcessMessage( process_t process_ref )
+{
+  promise_t promise = SendProcessMessage( process_ref, true );
+  process_ref->CCallReturnVal()->SetPromise( promise );
+  return true;
+}
+
+// result is discarded, so no promise and no reply message
+bool ProcessMessageNoReply( process_t process_ref )
+{
+  SendProcessMessage( process_ref, false );
   return true;
 }
 
 bool FunctionCall( process_t process_ref )
 {
-  const Function* const function = process_ref->OperandA()->function;
+  // the function is a constant
+  const Function* const function = process_ref->ConstantA()->function;
 
   process_ref->vm->ExecuteFunction( CallData(function, process_ref) );
+
+  // skip the NOPs holding the args past the third
+  process_ref->ip += function->parameter_count() / 4;
+  return true;
+}
+
+bool TailCall( process_t process_ref )
+{
+  const Function* const function = process_ref->ConstantA()->function;
+
+  // ip is left at the function's first instruction, the execution loop doesn't step past a TailCall
+  process_ref->TailCall( function );
   return true;
 }
 
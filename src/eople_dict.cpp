@@ -0,0 +1,88 @@
+#include "eople_dict.h"
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace Eople
+{
+
+const DictKey* Dict::Intern( const std::string &text )
+{
+  typedef std::unordered_map<std::string, std::unique_ptr<DictKey>> KeyTable;
+  static std::mutex keys_lock;
+  static KeyTable   keys;
+
+  std::lock_guard<std::mutex> lock(keys_lock);
+  auto &key = keys[text];
+  if( !key )
+  {
+    key.reset(new DictKey());
+    key->text = text;
+    key->hash = Hash(text);
+  }
+  return key.get();
+}
+
+Dict* Dict::Copy() const
+{
+  Dict* copy = new Dict();
+  for( auto &entry : m_entries )
+  {
+    (*copy)[entry.key] = entry.value;
+  }
+  return copy;
+}
+
+u64 Dict::Hash( const std::string &text )
+{
+  return (u64)std::hash<std::string>()(text);
+}
+
+Object& Dict::operator[]( const DictKey* key )
+{
+  if( Object* value = Find(key) )
+  {
+    return *value;
+  }
+  if( !m_slots || (m_entries.size() + 1) * 4 > (m_mask + 1) * 3 )
+  {
+    Grow();
+  }
+
+  Entry entry = { key, Object() };
+  m_entries.push_back(entry);
+  size_t i = key->hash & m_mask;
+  while( m_slots[i].entry )
+  {
+    i = (i + 1) & m_mask;
+  }
+  m_slots[i].tag   = Tag(key->hash);
+  m_slots[i].entry = (u32)m_entries.size();
+
+  return m_entries.back().value;
+}
+
+void Dict::Grow()
+{
+  size_t capacity = m_slots ? (m_mask + 1) * 2 : 8;
+  delete[] m_slots;
+  m_slots = new Slot[capacity]();
+  m_mask  = capacity - 1;
+
+  // hashes are cached in the keys, so rebuilding never touches the strings
+  for( size_t entry = 0; entry < m_entries.size(); ++entry )
+  {
+    const DictKey* key = m_entries[entry].key;
+    size_t i = key->hash & m_mask;
+    while( m_slots[i].entry )
+    {
+      i = (i + 1) & m_mask;
+    }
+    m_slots[i].tag   = Tag(key->hash);
+    m_slots[i].entry = (u32)entry + 1;
+  }
+}
+
+} // namespace Eople
@@ -0,0 +1,666 @@
+#include "eople_core.h"
+#include "eople_opcodes.h"
+#include "eople_vm.h"
+
+namespace Eople
+{
+
+#if EOPLE_THREADED_DISPATCH
+
+//
+// Threaded interpreter core.
+//
+// Instead of an indirect call through VMCode::instruction for every instruction, each handler
+// jumps directly to the handler of the next instruction (computed goto), with operand decode
+// inlined. Hot arithmetic, comparison, jump and loop opcodes are handled here; everything else
+// (strings, arrays, messages, c functions...) falls back to the regular instruction implementation.
+//
+// Loops and function calls are run without recursion. Loop states are kept in the process
+// (Process::loops), and calls push a regular stack frame. The end of the innermost loop block
+// is checked before every dispatch.
+//
+// Since everything lives in the process, a preemptible run can stop at any loop back-edge or
+// call once the process runs out of reductions, and pick up from there later.
+//
+// With count_pairs set, every dispatch also counts the opcode pair it completes (see
+// OpcodePairCounts). It is a separate instantiation so the regular one doesn't pay for it.
+//
+
+template <bool count_pairs>
+static bool Dispatch( process_t process_ref, bool preemptible, bool resume )
+{
+  // must match order of Opcode enum
+  static void* const dispatch_table[] =
+  {
+    &&op_AddI, &&op_SubI, &&op_MulI, &&op_DivI, &&op_ModI,
+    &&op_AddF, &&op_SubF, &&op_MulF, &&op_DivF,
+    &&op_ShiftLeft, &&op_ShiftRight, &&op_BAnd, &&op_BXor, &&op_BOr,
+    &&op_Generic, &&op_Generic, &&op_Generic, &&op_Generic,   // ConcatS, ConcatN, EqualS, NotEqualS
+    &&op_ForI, &&op_ForF, &&op_ForA, &&op_While,
+    &&op_Return, &&op_ReturnValue, &&op_ReturnValueK,
+    &&op_Generic, &&op_Generic, &&op_Generic, &&op_Generic,   // PrintI, PrintF, PrintIArr, PrintFArr
+    &&op_Generic, &&op_Generic, &&op_Generic,                 // PrintSArr, PrintSPromise, PrintDict
+    &&op_FunctionCall, &&op_TailCall,
+    &&op_Generic,                                             // ArraySubscript
+    &&op_ArraySubscriptI, &&op_ArraySubscriptF, &&op_Generic, // ArraySubscriptB
+    &&op_AddSubscriptI, &&op_MulSubscriptI, &&op_AddSubscriptF, &&op_MulSubscriptF,
+    &&op_MulAddI, &&op_MulAddF,
+    &&op_AddIK, &&op_SubIK, &&op_MulIK, &&op_AddFK, &&op_SubFK, &&op_MulFK, &&op_DivFK,
+    &&op_DictSubscript,
+    &&op_StructMember, &&op_StructArrayMember,
+    &&op_Generic, &&op_Generic,                               // ProcessMessage, ProcessMessageNoReply
+    &&op_GreaterThanI, &&op_LessThanI, &&op_EqualI, &&op_NotEqualI, &&op_LessEqualI, &&op_GreaterEqualI,
+    &&op_GreaterThanF, &&op_LessThanF, &&op_EqualF, &&op_NotEqualF, &&op_LessEqualF, &&op_GreaterEqualF,
+    &&op_And, &&op_Or,
+    &&op_Store, &&op_StoreK,
+    &&op_Generic, &&op_Generic,                               // StoreArrayElement, StoreArrayStringElement
+    &&op_StoreArrayElementI, &&op_StoreArrayElementF, &&op_Generic, // StoreArrayElementB
+    &&op_StoreStructMember, &&op_StoreStructArrayMember,
+    &&op_Generic, &&op_Generic, &&op_Generic,                 // StringCopy, SpawnProcess, NewStruct
+    &&op_Generic, &&op_Generic, &&op_Generic, &&op_Generic,   // WhenRegister, WheneverRegister, When, Whenever
+    &&op_Jump, &&op_JumpIf,
+    &&op_JumpGT, &&op_JumpLT, &&op_JumpEQ, &&op_JumpNEQ, &&op_JumpLEQ, &&op_JumpGEQ,
+    &&op_JumpNotGTF, &&op_JumpNotLTF, &&op_JumpNotEQF, &&op_JumpNotNEQF, &&op_JumpNotLEQF, &&op_JumpNotGEQF,
+    &&op_JumpGTK, &&op_JumpLTK, &&op_JumpEQK, &&op_JumpNEQK, &&op_JumpLEQK, &&op_JumpGEQK,
+    &&op_JumpNotGTFK, &&op_JumpNotLTFK, &&op_JumpNotEQFK, &&op_JumpNotNEQFK, &&op_JumpNotLEQFK, &&op_JumpNotGEQFK,
+    &&op_Generic,                                             // CCall
+    &&op_NOP,
+  };
+  static_assert( sizeof(dispatch_table)/sizeof(dispatch_table[0]) == (size_t)Opcode::NOP + 1,
+                 "dispatch table out of sync with Opcode enum" );
+
+  auto &loops  = process_ref->loops;
+  auto &calls  = process_ref->interpreted_calls;
+  auto &frames = process_ref->stack.stack_frame;
+
+  // loops and calls below these belong to whoever is running below us (if anything). a resumed
+  // run always started at the bottom.
+  const size_t loop_base = resume ? 0 : process_ref->loop_depth;
+  const size_t call_base = resume ? 0 : calls;
+  // only the bottom run can stop, nothing below it expects to be continued later
+  const bool   can_yield = preemptible && loop_base == 0 && call_base == 0;
+
+  size_t     loop_depth = process_ref->loop_depth;
+  LoopState* loop = loop_depth ? &loops[loop_depth-1] : nullptr;
+  // loops of the active function start here
+  size_t     frame_loop_base = calls > call_base ? frames.back().loop_base : loop_base;
+  i32        reductions = process_ref->reductions;
+
+  const VMCode* ip        = process_ref->ip;
+  const VMCode* block_end = nullptr;
+  Object*       base      = process_ref->stack.stack_base;
+  const Object* constants = process_ref->stack.constants;
+
+  OpcodePairCounts::Table* pairs = count_pairs ? &process_ref->vm->OpcodePairs()->ThreadTable() : nullptr;
+  // none yet
+  size_t previous_opcode = OpcodePairCounts::opcode_count;
+
+  #define OPERAND(x) (base + ip->x)
+  // operands of the K opcodes (and FunctionCall, TailCall) index the function's constants
+  #define CONSTANT(x) (constants + ip->x)
+  #define COUNT_PAIR() \
+    if( count_pairs ) \
+    { \
+      if( previous_opcode < OpcodePairCounts::opcode_count ) ++pairs->counts[previous_opcode][(u8)ip->opcode]; \
+      previous_opcode = (u8)ip->opcode; \
+    }
+  #define DISPATCH() do { if( ip == block_end ) goto loop_back; COUNT_PAIR(); goto *dispatch_table[(u8)ip->opcode]; } while(0)
+  #define NEXT() do { ++ip; DISPATCH(); } while(0)
+  // stack may have been reallocated, or the active frame changed
+  #define RELOAD() do { ip = process_ref->ip; base = process_ref->stack.stack_base; constants = process_ref->stack.constants; } while(0)
+  // end of the innermost loop block of the active function
+  #define BLOCK_END() (loop_depth > frame_loop_base ? (loop->kind == LoopKind::WhileCondition ? loop->body : loop->end) : nullptr)
+  #define PUSH_LOOP() do { if( loop_depth == loops.size() ) loops.emplace_back(); loop = &loops[loop_depth++]; } while(0)
+  // save state to the process before leaving
+  #define SAVE() do { process_ref->ip = ip; process_ref->loop_depth = loop_depth; process_ref->reductions = reductions; } while(0)
+
+  block_end = BLOCK_END();
+
+  #define BINOP(name, field, result_field, op) \
+    op_##name: \
+      OPERAND(c)->result_field = OPERAND(a)->field op OPERAND(b)->field; \
+      NEXT();
+
+  #define JUMPOP(name, op) \
+    op_##name: \
+      if( OPERAND(b)->int_val op OPERAND(c)->int_val ) \
+      { \
+        ip += ip->a; \
+      } \
+      NEXT();
+
+  #define JUMPNOTOPF(name, op) \
+    op_##name: \
+      if( !(OPERAND(b)->float_val op OPERAND(c)->float_val) ) \
+      { \
+        ip += ip->a; \
+      } \
+      NEXT();
+
+  #define BINOPK(name, field, op) \
+    op_##name: \
+      OPERAND(c)->field = OPERAND(a)->field op CONSTANT(b)->field; \
+      NEXT();
+
+  #define JUMPOPK(name, op) \
+    op_##name: \
+      if( OPERAND(b)->int_val op CONSTANT(c)->int_val ) \
+      { \
+        ip += ip->a; \
+      } \
+      NEXT();
+
+  #define JUMPNOTOPFK(name, op) \
+    op_##name: \
+      if( !(OPERAND(b)->float_val op CONSTANT(c)->float_val) ) \
+      { \
+        ip += ip->a; \
+      } \
+      NEXT();
+
+  // out of bounds falls back to the instruction, which throws
+  #define SUBSCRIPTOP(name, range, field, op) \
+    op_##name: \
+      { \
+        auto values = OPERAND(a)->array_ref->range(); \
+        size_t index = (size_t)OPERAND(b)->int_val; \
+        if( index >= values.size() ) \
+        { \
+          goto op_Generic; \
+        } \
+        OPERAND(d)->field = OPERAND(c)->field op values[index]; \
+      } \
+      NEXT();
+
+  DISPATCH();
+
+  BINOP(AddI, int_val, int_val, +)
+  BINOP(SubI, int_val, int_val, -)
+  BINOP(MulI, int_val, int_val, *)
+  BINOP(DivI, int_val, int_val, /)
+  BINOP(ModI, int_val, int_val, %)
+  BINOP(AddF, float_val, float_val, +)
+  BINOP(SubF, float_val, float_val, -)
+  BINOP(MulF, float_val, float_val, *)
+  BINOP(DivF, float_val, float_val, /)
+  BINOP(ShiftLeft, int_val, int_val, <<)
+  BINOP(ShiftRight, int_val, int_val, >>)
+  BINOP(BAnd, int_val, int_val, &)
+  BINOP(BXor, int_val, int_val, ^)
+  BINOP(BOr, int_val, int_val, |)
+  BINOP(GreaterThanI, int_val, bool_val, >)
+  BINOP(LessThanI, int_val, bool_val, <)
+  BINOP(EqualI, int_val, bool_val, ==)
+  BINOP(NotEqualI, int_val, bool_val, !=)
+  BINOP(LessEqualI, int_val, bool_val, <=)
+  BINOP(GreaterEqualI, int_val, bool_val, >=)
+  BINOP(GreaterThanF, float_val, bool_val, >)
+  BINOP(LessThanF, float_val, bool_val, <)
+  BINOP(EqualF, float_val, bool_val, ==)
+  BINOP(NotEqualF, float_val, bool_val, !=)
+  BINOP(LessEqualF, float_val, bool_val, <=)
+  BINOP(GreaterEqualF, float_val, bool_val, >=)
+  BINOP(And, bool_val, bool_val, &&)
+  BINOP(Or, bool_val, bool_val, ||)
+
+  JUMPOP(JumpGT, >)
+  JUMPOP(JumpLT, <)
+  JUMPOP(JumpEQ, ==)
+  JUMPOP(JumpNEQ, !=)
+  JUMPOP(JumpLEQ, <=)
+  JUMPOP(JumpGEQ, >=)
+
+  JUMPNOTOPF(JumpNotGTF, >)
+  JUMPNOTOPF(JumpNotLTF, <)
+  JUMPNOTOPF(JumpNotEQF, ==)
+  JUMPNOTOPF(JumpNotNEQF, !=)
+  JUMPNOTOPF(JumpNotLEQF, <=)
+  JUMPNOTOPF(JumpNotGEQF, >=)
+
+  BINOPK(AddIK, int_val, +)
+  BINOPK(SubIK, int_val, -)
+  BINOPK(MulIK, int_val, *)
+  BINOPK(AddFK, float_val, +)
+  BINOPK(SubFK, float_val, -)
+  BINOPK(MulFK, float_val, *)
+  BINOPK(DivFK, float_val, /)
+
+  JUMPOPK(JumpGTK, >)
+  JUMPOPK(JumpLTK, <)
+  JUMPOPK(JumpEQK, ==)
+  JUMPOPK(JumpNEQK, !=)
+  JUMPOPK(JumpLEQK, <=)
+  JUMPOPK(JumpGEQK, >=)
+
+  JUMPNOTOPFK(JumpNotGTFK, >)
+  JUMPNOTOPFK(JumpNotLTFK, <)
+  JUMPNOTOPFK(JumpNotEQFK, ==)
+  JUMPNOTOPFK(JumpNotNEQFK, !=)
+  JUMPNOTOPFK(JumpNotLEQFK, <=)
+  JUMPNOTOPFK(JumpNotGEQFK, >=)
+
+  SUBSCRIPTOP(AddSubscriptI, IntRange, int_val, +)
+  SUBSCRIPTOP(MulSubscriptI, IntRange, int_val, *)
+  SUBSCRIPTOP(AddSubscriptF, FloatRange, float_val, +)
+  SUBSCRIPTOP(MulSubscriptF, FloatRange, float_val, *)
+
+op_MulAddI:
+  OPERAND(d)->int_val = OPERAND(a)->int_val * OPERAND(b)->int_val + OPERAND(c)->int_val;
+  NEXT();
+
+op_MulAddF:
+  OPERAND(d)->float_val = OPERAND(a)->float_val * OPERAND(b)->float_val + OPERAND(c)->float_val;
+  NEXT();
+
+op_Store:
+  *OPERAND(a) = *OPERAND(b);
+  NEXT();
+
+op_StoreK:
+  *OPERAND(a) = *CONSTANT(b);
+  NEXT();
+
+  // out of bounds falls back to the instruction, which throws
+op_ArraySubscriptI:
+  {
+    auto values = OPERAND(a)->array_ref->IntRange();
+    size_t index = (size_t)OPERAND(b)->int_val;
+    if( index >= values.size() )
+    {
+      goto op_Generic;
+    }
+    OPERAND(c)->int_val = values[index];
+  }
+  NEXT();
+
+op_ArraySubscriptF:
+  {
+    auto values = OPERAND(a)->array_ref->FloatRange();
+    size_t index = (size_t)OPERAND(b)->int_val;
+    if( index >= values.size() )
+    {
+      goto op_Generic;
+    }
+    OPERAND(c)->float_val = values[index];
+  }
+  NEXT();
+
+op_DictSubscript:
+  {
+    Object* value = OPERAND(a)->dict_ref->Find(*OPERAND(b)->string_ref);
+    if( !value )
+    {
+      goto op_Generic;
+    }
+    *OPERAND(c) = *value;
+  }
+  NEXT();
+
+  // members are at a constant offset (operand b for structs, d for arrays of structs)
+op_StructMember:
+  *OPERAND(c) = OPERAND(a)->struct_ref->Members()[ip->b];
+  NEXT();
+
+op_StructArrayMember:
+  {
+    auto structs = OPERAND(a)->array_ref->Structs();
+    size_t index = (size_t)OPERAND(b)->int_val;
+    if( index >= structs->size() )
+    {
+      goto op_Generic;
+    }
+    *OPERAND(c) = structs->Members(index)[ip->d];
+  }
+  NEXT();
+
+op_StoreStructMember:
+  process_ref->ShareObject(*OPERAND(c));
+  OPERAND(a)->struct_ref->Members()[ip->b] = *OPERAND(c);
+  NEXT();
+
+op_StoreStructArrayMember:
+  {
+    auto structs = OPERAND(a)->array_ref->Structs();
+    size_t index = (size_t)OPERAND(b)->int_val;
+    if( index >= structs->size() || !structs->IsWritable() )
+    {
+      goto op_Generic;
+    }
+    process_ref->ShareObject(*OPERAND(c));
+    structs->Members(index)[ip->d] = *OPERAND(c);
+  }
+  NEXT();
+
+op_StoreArrayElementI:
+  {
+    auto array_ref = static_cast<IntArray*>((Array*)OPERAND(a)->array_ref);
+    auto &values = array_ref->values();
+    size_t index = (size_t)OPERAND(b)->int_val;
+    // the generic instruction throws, or copies elements shared with a copy of the array
+    if( index >= values.size() || !array_ref->IsWritable() )
+    {
+      goto op_Generic;
+    }
+    values[index] = OPERAND(c)->int_val;
+  }
+  NEXT();
+
+op_StoreArrayElementF:
+  {
+    auto array_ref = static_cast<FloatArray*>((Array*)OPERAND(a)->array_ref);
+    auto &values = array_ref->values();
+    size_t index = (size_t)OPERAND(b)->int_val;
+    if( index >= values.size() || !array_ref->IsWritable() )
+    {
+      goto op_Generic;
+    }
+    values[index] = OPERAND(c)->float_val;
+  }
+  NEXT();
+
+op_Jump:
+  ip += ip->a;
+  NEXT();
+
+op_JumpIf:
+  if( !OPERAND(b)->bool_val )
+  {
+    ip += ip->a;
+  }
+  NEXT();
+
+op_NOP:
+  NEXT();
+
+op_ReturnValueK:
+  *base = *CONSTANT(a);
+  goto op_Return;
+op_ReturnValue:
+  *base = *OPERAND(a);
+op_Return:
+  // like the instruction implementations, a return from within a loop body does not exit the loop
+  if( loop_depth > frame_loop_base )
+  {
+    NEXT();
+  }
+function_return:
+  if( calls == call_base )
+  {
+    SAVE();
+    return false;
+  }
+  // back to the FunctionCall in the caller
+  --calls;
+  process_ref->PopStackFrame();
+  frame_loop_base = calls > call_base ? frames.back().loop_base : loop_base;
+  RELOAD();
+  block_end = BLOCK_END();
+  NEXT();
+
+op_FunctionCall:
+  if( can_yield && --reductions < 0 )
+  {
+    goto yield;
+  }
+  process_ref->ip = ip;
+  process_ref->EnterFunction( CONSTANT(a)->function, loop_depth );
+  ++calls;
+  frame_loop_base = loop_depth;
+  block_end = nullptr;
+  RELOAD();
+  DISPATCH();
+
+op_TailCall:
+  if( can_yield && --reductions < 0 )
+  {
+    goto yield;
+  }
+  // never in a loop body, the frame's loops are all done
+  process_ref->ip = ip;
+  process_ref->TailCall( CONSTANT(a)->function );
+  block_end = nullptr;
+  RELOAD();
+  DISPATCH();
+
+op_Generic:
+  process_ref->ip = ip;
+  if( !ip->instruction(process_ref) && loop_depth == frame_loop_base )
+  {
+    RELOAD();
+    goto function_return;
+  }
+  RELOAD();
+  NEXT();
+
+op_ForI:
+  PUSH_LOOP();
+  loop->kind = LoopKind::ForI;
+  loop->counter = ip->a;
+  loop->int_loop.i    = OPERAND(a)->int_val;
+  loop->int_loop.stop = OPERAND(b)->int_val;
+  loop->int_loop.step = OPERAND(c)->int_val;
+  loop->start = ip + 1;
+  loop->end   = loop->start + ip->d;
+  if( loop->int_loop.step >= 0 ? loop->int_loop.i >= loop->int_loop.stop : loop->int_loop.i <= loop->int_loop.stop )
+  {
+    goto loop_exit;
+  }
+  base[loop->counter].int_val = loop->int_loop.i;
+  ip = loop->start;
+  block_end = loop->end;
+  DISPATCH();
+
+op_ForF:
+  PUSH_LOOP();
+  loop->kind = LoopKind::ForF;
+  loop->counter = ip->a;
+  loop->float_loop.i    = OPERAND(a)->float_val;
+  loop->float_loop.stop = OPERAND(b)->float_val;
+  loop->float_loop.step = OPERAND(c)->float_val;
+  loop->start = ip + 1;
+  loop->end   = loop->start + ip->d;
+  if( loop->float_loop.step >= 0 ? loop->float_loop.i >= loop->float_loop.stop : loop->float_loop.i <= loop->float_loop.stop )
+  {
+    goto loop_exit;
+  }
+  base[loop->counter].float_val = loop->float_loop.i;
+  ip = loop->start;
+  block_end = loop->end;
+  DISPATCH();
+
+op_ForA:
+  PUSH_LOOP();
+  loop->counter = ip->a;
+  loop->array_loop.array = OPERAND(b)->array_ref;
+  loop->array_loop.i     = 0;
+  loop->start = ip + 1;
+  loop->end   = loop->start + ip->d;
+  if( loop->array_loop.array->empty() )
+  {
+    goto loop_exit;
+  }
+  switch( loop->array_loop.array->kind )
+  {
+    case ArrayKind::INT:    loop->kind = LoopKind::ForAI; break;
+    case ArrayKind::FLOAT:  loop->kind = LoopKind::ForAF; break;
+    case ArrayKind::BOOL:   loop->kind = LoopKind::ForAB; break;
+    case ArrayKind::STRUCT: loop->kind = LoopKind::ForAS; break;
+    default:                loop->kind = LoopKind::ForA;  break;
+  }
+  base[loop->counter] = process_ref->ArrayElement(loop->array_loop.array, 0);
+  ip = loop->start;
+  block_end = loop->end;
+  DISPATCH();
+
+op_While:
+  PUSH_LOOP();
+  loop->kind = LoopKind::WhileCondition;
+  loop->condition = ip->a;
+  loop->start = ip + 1;
+  loop->body  = loop->start + ip->b;
+  loop->end   = loop->body + ip->c;
+  ip = loop->start;
+  block_end = loop->body;
+  DISPATCH();
+
+loop_back:
+  // reached the end of the innermost loop block
+  if( can_yield && --reductions < 0 )
+  {
+    goto yield;
+  }
+  if( process_ref->heap.ShouldCollect() )
+  {
+    // a safe point, everything live is on the stack or in the loops
+    SAVE();
+    process_ref->CollectGarbage();
+  }
+  switch( loop->kind )
+  {
+    case LoopKind::ForI:
+    {
+      auto &state = loop->int_loop;
+      state.i += state.step;
+      if( state.step >= 0 ? state.i < state.stop : state.i > state.stop )
+      {
+        base[loop->counter].int_val = state.i;
+        ip = loop->start;
+        DISPATCH();
+      }
+      break;
+    }
+    case LoopKind::ForF:
+    {
+      auto &state = loop->float_loop;
+      state.i += state.step;
+      if( state.step >= 0 ? state.i < state.stop : state.i > state.stop )
+      {
+        base[loop->counter].float_val = state.i;
+        ip = loop->start;
+        DISPATCH();
+      }
+      break;
+    }
+    case LoopKind::ForA:
+    {
+      auto &state = loop->array_loop;
+      auto &values = state.array->Objects();
+      if( ++state.i < values.size() )
+      {
+        base[loop->counter] = values[state.i];
+        ip = loop->start;
+        DISPATCH();
+      }
+      break;
+    }
+    case LoopKind::ForAI:
+    {
+      auto &state = loop->array_loop;
+      auto values = state.array->IntRange();
+      if( ++state.i < values.size() )
+      {
+        base[loop->counter].int_val = values[state.i];
+        ip = loop->start;
+        DISPATCH();
+      }
+      break;
+    }
+    case LoopKind::ForAF:
+    {
+      auto &state = loop->array_loop;
+      auto values = state.array->FloatRange();
+      if( ++state.i < values.size() )
+      {
+        base[loop->counter].float_val = values[state.i];
+        ip = loop->start;
+        DISPATCH();
+      }
+      break;
+    }
+    case LoopKind::ForAB:
+    {
+      auto &state = loop->array_loop;
+      auto &values = state.array->Bools();
+      if( ++state.i < values.size() )
+      {
+        base[loop->counter].bool_val = values[state.i];
+        ip = loop->start;
+        DISPATCH();
+      }
+      break;
+    }
+    case LoopKind::ForAS:
+    {
+      // the element is a copy, like any other read of a whole struct out of an array
+      auto &state = loop->array_loop;
+      if( ++state.i < state.array->size() )
+      {
+        base[loop->counter] = process_ref->ArrayElement(state.array, state.i);
+        ip = loop->start;
+        DISPATCH();
+      }
+      break;
+    }
+    case LoopKind::WhileCondition:
+    {
+      if( base[loop->condition].bool_val )
+      {
+        loop->kind = LoopKind::WhileBody;
+        ip = loop->body;
+        block_end = loop->end;
+        DISPATCH();
+      }
+      break;
+    }
+    case LoopKind::WhileBody:
+    {
+      loop->kind = LoopKind::WhileCondition;
+      ip = loop->start;
+      block_end = loop->body;
+      DISPATCH();
+    }
+  }
+
+loop_exit:
+  // continue after the loop, in the enclosing block (if any)
+  ip = loop->end;
+  --loop_depth;
+  loop = loop_depth ? &loops[loop_depth-1] : nullptr;
+  block_end = BLOCK_END();
+  DISPATCH();
+
+yield:
+  // out of reductions. ip is left on the back-edge or call, which is run again on resume.
+  SAVE();
+  return true;
+
+  #undef OPERAND
+  #undef CONSTANT
+  #undef COUNT_PAIR
+  #undef DISPATCH
+  #undef NEXT
+  #undef RELOAD
+  #undef BLOCK_END
+  #undef PUSH_LOOP
+  #undef SAVE
+  #undef BINOP
+  #undef JUMPOP
+  #undef JUMPNOTOPF
+  #undef BINOPK
+  #undef JUMPOPK
+  #undef JUMPNOTOPFK
+  #undef SUBSCRIPTOP
+}
+
+bool DispatchThreaded( process_t process_ref, bool preemptible, bool resume )
+{
+  if( process_ref->vm->OpcodePairs() )
+  {
+    return Dispatch<true>(process_ref, preemptible, resume);
+  }
+  return Dispatch<false>(process_ref, preemptible, resume);
+}
+
+#endif // EOPLE_THREADED_DISPATCH
+
+} // namespace Eople
@@ -43,7 +43,40 @@ static std::string GetLine(std::string prefix="")
   return line;
 }
 
-static int Eve( std::string filename, std::string entry_function, bool verbose )
+struct Arg : public option::Arg
+{
+  static option::ArgStatus Numeric( const option::Option& option, bool msg )
+  {
+    char* endptr = nullptr;
+    if( option.arg != nullptr && strtol(option.arg, &endptr, 10) > 0 && *endptr == 0 )
+    {
+      return option::ARG_OK;
+    }
+
+    if( msg )
+    {
+      std::cout << "Option '" << std::string(option.name, option.namelen) << "' requires a positive number\n";
+    }
+    return option::ARG_ILLEGAL;
+  }
+
+  static option::ArgStatus NonNegative( const option::Option& option, bool msg )
+  {
+    char* endptr = nullptr;
+    if( option.arg != nullptr && strtol(option.arg, &endptr, 10) >= 0 && *endptr == 0 && endptr != option.arg )
+    {
+      return option::ARG_OK;
+    }
+
+    if( msg )
+    {
+      std::cout << "Option '" << std::string(option.name, option.namelen) << "' requires a number\n";
+    }
+    return option::ARG_ILLEGAL;
+  }
+};
+
+static int Eve( std::string filename, std::string entry_function, bool verbose, const Eople::VirtualMachineConfig& vm_config )
 {
   if( verbose )
   {
@@ -54,7 +87,7 @@ static int Eve( std::string filename, std::string entry_function, bool verbose )
     Eople::Log::SetVerbosityLevel(Eople::Log::VerbosityLevel::NO_DEBUG);
   }
 
-  Eople::ExecutionEnvironment ee;
+  Eople::ExecutionEnvironment ee(vm_config);
 
   if( filename.empty() )
   {
@@ -191,6 +224,10 @@ static int Eve( std::string filename, std::string entry_function, bool verbose )
     ee.ImportModuleFromFile( filename );
     ee.ExecuteFunction( entry_function, false );
     ee.Shutdown();
+    if( auto opcode_pairs = ee.OpcodePairs() )
+    {
+      opcode_pairs->Print(40);
+    }
     return 0;
   }
   catch(const char* s)
@@ -205,7 +242,7 @@ int main(int argc, char* argv[])
   InitReadlineHistory();
   std::atexit(SaveReadlineHistory);
 
-  enum  optionIndex { UNKNOWN, HELP, VERBOSE, VERSION };
+  enum  optionIndex { UNKNOWN, HELP, VERBOSE, VERSION, CORES, IDLE_SPIN, REDUCTIONS, OPCODE_PAIRS, NO_INLINE };
   const option::Descriptor usage[] =
   {
     {UNKNOWN, 0, "", "",option::Arg::None, "USAGE: eople [options] [file] [entry_function]\n\n"
@@ -213,6 +250,11 @@ int main(int argc, char* argv[])
     {HELP, 0,"", "help",option::Arg::None, "  --help  \tPrint usage and exit." },
     {VERSION, 0,"V","version",option::Arg::None, "  --version, -V  \tDisplay version info." },
     {VERBOSE, 0,"v","verbose",option::Arg::None, "  --verbose, -v  \tEnable verbose output from eople runtime." },
+    {CORES, 0,"","cores",Arg::Numeric, "  --cores=<n>  \tNumber of cores (threads) to run processes on. Defaults to hardware threads." },
+    {IDLE_SPIN, 0,"","idle-spin",Arg::NonNegative, "  --idle-spin=<n>  \tRounds an idle core looks for work before parking. 0 parks right away." },
+    {REDUCTIONS, 0,"","reductions",Arg::NonNegative, "  --reductions=<n>  \tLoop iterations and calls a process runs before it is preempted. 0 never preempts." },
+    {OPCODE_PAIRS, 0,"","opcode-pairs",option::Arg::None, "  --opcode-pairs  \tCount which opcode runs after which, and print the most frequent pairs on exit." },
+    {NO_INLINE, 0,"","no-inline",option::Arg::None, "  --no-inline  \tCall small functions instead of inlining them." },
     {UNKNOWN, 0, "", "",option::Arg::None, "\nExamples:\n"
                                   "  eople hello.eop\n"
                                   "  eople --version\n"
@@ -244,6 +286,28 @@ int main(int argc, char* argv[])
 
   bool verbose = options[VERBOSE] ? true : false;
 
+  Eople::VirtualMachineConfig vm_config;
+  if( options[CORES] )
+  {
+    vm_config.core_count = (Eople::u32)strtol(options[CORES].arg, nullptr, 10);
+  }
+  if( options[IDLE_SPIN] )
+  {
+    vm_config.idle_spin_rounds = (Eople::u32)strtol(options[IDLE_SPIN].arg, nullptr, 10);
+  }
+  if( options[REDUCTIONS] )
+  {
+    vm_config.reduction_budget = (Eople::u32)strtol(options[REDUCTIONS].arg, nullptr, 10);
+  }
+  if( options[OPCODE_PAIRS] )
+  {
+    vm_config.count_opcode_pairs = true;
+  }
+  if( options[NO_INLINE] )
+  {
+    vm_config.inline_functions = false;
+  }
+
   bool unknown_options = false;
   for (option::Option* opt = options[UNKNOWN]; opt; opt = opt->next())
     std::cout << "Unknown option: " << std::string(opt->name,opt->namelen) << "\n";
@@ -258,5 +322,5 @@ int main(int argc, char* argv[])
   std::string filename = parse.nonOptionsCount() > 0 ? parse.nonOption(0) : "";
   std::string entry_function = parse.nonOptionsCount() > 1 ? parse.nonOption(1) : "main";
 
-  return Eve(filename, entry_function, verbose);
+  return Eve(filename, entry_function, verbose, vm_config);
 }
@@ -73,9 +73,9 @@ bool loadFile( std::string file_name, const char* &buffer, const char* &buffer_e
   return true;
 }
 
-ExecutionEnvironment::ExecutionEnvironment()
+ExecutionEnvironment::ExecutionEnvironment( const VirtualMachineConfig& vm_config )
 :
-  m_type_infer(), m_code_gen(), m_parser(), m_builtins("builtins"), m_repl_module("repl")
+  m_vm(vm_config), m_type_infer(), m_code_gen(vm_config.inline_functions), m_parser(), m_builtins("builtins"), m_repl_module("repl")
 {
   curl_global_init(CURL_GLOBAL_ALL);
 
@@ -112,7 +112,7 @@ void ExecutionEnvironment::ImportBuiltins()
   auto array_string_type   = TypeBuilder::GetArrayType(string_type);
   auto array_int_type      = TypeBuilder::GetArrayType(int_type);
   auto array_float_type    = TypeBuilder::GetArrayType(float_type);
-  //auto array_bool_type     = TypeBuilder::GetArrayType(bool_type);
+  auto array_bool_type     = TypeBuilder::GetArrayType(bool_type);
   auto array_array_type    = TypeBuilder::GetArrayType(array_type);
 
   auto print_func = m_builtins.AddFunction( "print", Instruction::PrintF, TypeBuilder::GetPrimitiveType(ValueType::FLOAT),
@@ -136,8 +136,35 @@ void ExecutionEnvironment::ImportBuiltins()
   auto push_func = m_builtins.AddFunction( "push", Instruction::ArrayPushString, array_string_type, string_type,
                                                           TypeBuilder::GetNilType() );
   m_builtins.AddFunctionSpecialization( push_func, Instruction::ArrayPushArray, array_array_type, array_type );
+  m_builtins.AddFunctionSpecialization( push_func, Instruction::ArrayPushInt, array_int_type, int_type );
+  m_builtins.AddFunctionSpecialization( push_func, Instruction::ArrayPushFloat, array_float_type, float_type );
+  m_builtins.AddFunctionSpecialization( push_func, Instruction::ArrayPushBool, array_bool_type, bool_type );
   m_builtins.AddFunctionSpecialization( push_func, Instruction::ArrayPush, array_type, any_type );
 
+  // numeric array builtins; the return type follows the array, see TypeInfer::PropagateType( FunctionCall )
+  auto sum_func = m_builtins.AddFunction( "sum", Instruction::ArraySumF, array_float_type, float_type );
+  m_builtins.AddFunctionSpecialization( sum_func, Instruction::ArraySumI, array_int_type );
+  auto min_func = m_builtins.AddFunction( "min", Instruction::ArrayMinF, array_float_type, float_type );
+  m_builtins.AddFunctionSpecialization( min_func, Instruction::ArrayMinI, array_int_type );
+  auto max_func = m_builtins.AddFunction( "max", Instruction::ArrayMaxF, array_float_type, float_type );
+  m_builtins.AddFunctionSpecialization( max_func, Instruction::ArrayMaxI, array_int_type );
+  auto dot_func = m_builtins.AddFunction( "dot", Instruction::ArrayDotF, array_float_type, array_float_type, float_type );
+  m_builtins.AddFunctionSpecialization( dot_func, Instruction::ArrayDotI, array_int_type, array_int_type );
+  auto scale_func = m_builtins.AddFunction( "scale", Instruction::ArrayScaleF, array_float_type, float_type, array_float_type );
+  m_builtins.AddFunctionSpecialization( scale_func, Instruction::ArrayScaleI, array_int_type, int_type );
+  auto add_func = m_builtins.AddFunction( "add", Instruction::ArrayAddF, array_float_type, array_float_type, array_float_type );
+  m_builtins.AddFunctionSpecialization( add_func, Instruction::ArrayAddI, array_int_type, array_int_type );
+  auto mul_func = m_builtins.AddFunction( "mul", Instruction::ArrayMulF, array_float_type, array_float_type, array_float_type );
+  m_builtins.AddFunctionSpecialization( mul_func, Instruction::ArrayMulI, array_int_type, array_int_type );
+  auto axpy_func = m_builtins.AddFunction( "axpy", Instruction::ArrayAxpyF, array_float_type, float_type, array_float_type,
+                                           array_float_type );
+  m_builtins.AddFunctionSpecialization( axpy_func, Instruction::ArrayAxpyI, array_int_type, int_type, array_int_type );
+
+  // arrays of ints, floats and bools only, others throw
+  m_builtins.AddFunction( "freeze", Instruction::ArrayFreeze, array_type, array_type );
+  // elements [start, end): shares the elements of arrays of ints and floats, copies the others
+  m_builtins.AddFunction( "slice", Instruction::ArraySlice, array_type, int_type, int_type, array_type );
+
   m_builtins.AddFunction( "clear", Instruction::ArrayClear, array_type, TypeBuilder::GetNilType() );
   m_builtins.AddFunction( "pop", Instruction::ArrayPop, array_type, TypeBuilder::GetNilType() );
   m_builtins.AddFunction( "size", Instruction::ArraySize, array_type, TypeBuilder::GetPrimitiveType(ValueType::INT) );
@@ -152,6 +179,8 @@ void ExecutionEnvironment::ImportBuiltins()
                                                               string_type );
   m_builtins.AddFunctionSpecialization( to_string_func, Instruction::FloatToString, TypeBuilder::GetPrimitiveType(ValueType::FLOAT) );
   m_builtins.AddFunctionSpecialization( to_string_func, Instruction::PromiseToString, promise_type );
+  m_builtins.AddFunction( "string_builder", Instruction::StringBuilder, TypeBuilder::GetPrimitiveType(ValueType::INT), string_type );
+  m_builtins.AddFunction( "append", Instruction::StringAppend, string_type, string_type, TypeBuilder::GetNilType() );
 
   m_builtins.AddFunction( "get_url", Instruction::GetURL, dict_type, dict_type );
   m_builtins.AddFunction( "get_url_creds", Instruction::GetURL_USERPWD, string_type, string_type, string_type );
@@ -432,7 +461,7 @@ bool ExecutionEnvironment::ExecuteFunction( std::string function_name, bool spaw
     else
     {
       // execute entry function in the current process
-      m_vm.ExecuteFunction( CallData(function, m_main_process) );
+      m_vm.ExecuteEntryFunction( CallData(function, m_main_process) );
     }
     auto total_ms = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start_time).count();
     Log::Debug("\neve> Execution completed in %f seconds.\n", (f64)total_ms/1000000.0 );
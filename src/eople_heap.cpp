@@ -0,0 +1,595 @@
+#include "eople_heap.h"
+#include "eople_core.h"
+#include "eople_array.h"
+#include "eople_dict.h"
+#include "eople_string.h"
+#include "eople_struct.h"
+
+namespace Eople
+{
+
+static size_t HashPointer( const void* pointer )
+{
+  // allocations are at least 16 byte aligned, the low bits say nothing
+  return (size_t)(((u64)(uintptr_t)pointer >> 4) * 0x9E3779B97F4A7C15ull >> 20);
+}
+
+// bytes a value takes, roughly
+static size_t Footprint( const void* pointer, ValueType type )
+{
+  switch( type )
+  {
+    case ValueType::STRING:
+    {
+      auto text = (const std::string*)pointer;
+      // short text is kept inside the string itself
+      return sizeof(std::string) + (text->capacity() >= sizeof(std::string) ? text->capacity() + 1 : 0);
+    }
+    case ValueType::ARRAY:
+    {
+      auto array = (Array*)pointer;
+      switch( array->kind )
+      {
+        // a view counts the elements it reads, not the buffer it shares
+        case ArrayKind::INT:    return sizeof(IntArray)   + (array->view ? array->size() : array->Ints().capacity()) * sizeof(int_t);
+        case ArrayKind::FLOAT:  return sizeof(FloatArray) + (array->view ? array->size() : array->Floats().capacity()) * sizeof(float_t);
+        case ArrayKind::BOOL:   return sizeof(BoolArray)  + array->Bools().capacity() / 8;
+        case ArrayKind::STRUCT: return sizeof(StructArray) + array->Structs()->values().capacity() * sizeof(Object);
+        default:                return sizeof(ObjectArray) + array->Objects().capacity() * sizeof(Object);
+      }
+    }
+    case ValueType::DICT:
+    {
+      // an entry, and about two slots per entry
+      return sizeof(Dict) + ((const Dict*)pointer)->size() * (sizeof(Dict::Entry) + 2 * sizeof(u64));
+    }
+    case ValueType::STRUCT:
+    {
+      return STRUCT_HEADER_SIZE + ((const Struct*)pointer)->size() * sizeof(Object);
+    }
+    case ValueType::PROMISE:
+    {
+      return sizeof(Promise);
+    }
+    default:
+      return 0;
+  }
+}
+
+static void Free( const void* pointer, ValueType type )
+{
+  switch( type )
+  {
+    case ValueType::STRING: delete (std::string*)pointer;        break;
+    case ValueType::ARRAY:  Array::Release((Array*)pointer);     break;
+    case ValueType::DICT:   delete (Dict*)pointer;               break;
+    case ValueType::STRUCT: Struct::Destroy((Struct*)pointer);   break;
+    case ValueType::PROMISE: ((Promise*)pointer)->Release();     break;
+    default:                                                     break;
+  }
+}
+
+// pointer held by an object, whatever its type tag says
+static const void* PointerOf( const Object& object )
+{
+  return (const void*)object.string_ref;
+}
+
+Heap::Heap()
+  : m_count(0), m_added(0), m_collect_threshold(MIN_COLLECT_THRESHOLD), m_added_bytes(0),
+    m_collect_bytes(MIN_COLLECT_BYTES), m_added_promises(0), m_promise_threshold(MIN_PROMISE_THRESHOLD),
+    m_collections(0)
+{
+  m_live_bytes.store(0, std::memory_order_relaxed);
+}
+
+Heap::~Heap()
+{
+  for( auto &entry : m_table )
+  {
+    if( entry.pointer )
+    {
+      Free(entry.pointer, entry.type);
+    }
+  }
+}
+
+void Heap::Insert( const void* pointer, ValueType type )
+{
+  if( (m_count + 1) * 2 > m_table.size() )
+  {
+    Resize( m_table.empty() ? 64 : m_table.size() * 2 );
+  }
+  size_t mask = m_table.size() - 1;
+  size_t i = HashPointer(pointer) & mask;
+  while( m_table[i].pointer )
+  {
+    if( m_table[i].pointer == pointer )
+    {
+      return;
+    }
+    i = (i + 1) & mask;
+  }
+  Entry entry = { pointer, type, false };
+  m_table[i] = entry;
+  ++m_count;
+  ++m_added;
+  m_added_bytes += Footprint(pointer, type);
+  m_added_promises += type == ValueType::PROMISE;
+}
+
+Heap::Entry* Heap::Find( const void* pointer )
+{
+  if( !pointer || m_table.empty() )
+  {
+    return nullptr;
+  }
+  size_t mask = m_table.size() - 1;
+  for( size_t i = HashPointer(pointer) & mask; m_table[i].pointer; i = (i + 1) & mask )
+  {
+    if( m_table[i].pointer == pointer )
+    {
+      return &m_table[i];
+    }
+  }
+  return nullptr;
+}
+
+void Heap::Resize( size_t capacity )
+{
+  std::vector<Entry> old_table;
+  old_table.swap(m_table);
+  m_table.resize(capacity, Entry());
+
+  size_t mask = capacity - 1;
+  for( auto &entry : old_table )
+  {
+    if( entry.pointer )
+    {
+      size_t i = HashPointer(entry.pointer) & mask;
+      while( m_table[i].pointer )
+      {
+        i = (i + 1) & mask;
+      }
+      m_table[i] = entry;
+    }
+  }
+}
+
+void Heap::Adopt( const Object& value )
+{
+  const void* pointer = PointerOf(value);
+  switch( (ValueType)(u8)value.object_type )
+  {
+    case ValueType::STRING:
+    {
+      if( StringTable::IsInterned(value.string_ref) || Find(pointer) )
+      {
+        return;
+      }
+      Add(value.string_ref);
+      return;
+    }
+    case ValueType::ARRAY:
+    {
+      if( Find(pointer) )
+      {
+        // already holds a reference to it
+        if( value.array_ref->frozen )
+        {
+          Array::Release(value.array_ref);
+        }
+        return;
+      }
+      Array* array = Add(value.array_ref);
+      if( array->kind == ArrayKind::OBJECT )
+      {
+        for( auto &element : array->Objects() )
+        {
+          Adopt(element);
+        }
+      }
+      else if( array->kind == ArrayKind::STRUCT )
+      {
+        for( auto &member : array->Structs()->values() )
+        {
+          Adopt(member);
+        }
+      }
+      return;
+    }
+    case ValueType::DICT:
+    {
+      if( Find(pointer) )
+      {
+        return;
+      }
+      for( auto &entry : *Add(value.dict_ref) )
+      {
+        Adopt(entry.value);
+      }
+      return;
+    }
+    case ValueType::STRUCT:
+    {
+      if( Find(pointer) )
+      {
+        return;
+      }
+      Struct* adopted = Add(value.struct_ref);
+      for( size_t i = 0; i < adopted->size(); ++i )
+      {
+        Adopt(adopted->Members()[i]);
+      }
+      return;
+    }
+    case ValueType::PROMISE:
+    {
+      if( Find(pointer) )
+      {
+        // already holds a reference to it
+        value.promise->Release();
+        return;
+      }
+      Add(value.promise);
+      return;
+    }
+    default:
+      return;
+  }
+}
+
+bool Heap::CanDetach( const Array* array )
+{
+  Entry* entry = Find(array);
+  if( !entry || entry->type != ValueType::ARRAY || array->frozen || !Array::CanFreeze(array->kind) )
+  {
+    return false;
+  }
+  // marking may visit every value in the heap
+  size_t bytes = Footprint(array, ValueType::ARRAY);
+  return bytes >= MIN_DETACH_BYTES && bytes >= m_count * sizeof(Entry) * 4;
+}
+
+void Heap::Detach( const void* pointer )
+{
+  Entry* entry = Find(pointer);
+  if( !entry )
+  {
+    return;
+  }
+  // shift back the entries that probed past the one removed, so lookups still find them
+  size_t mask = m_table.size() - 1;
+  size_t hole = entry - m_table.data();
+  for( size_t i = (hole + 1) & mask; m_table[i].pointer; i = (i + 1) & mask )
+  {
+    size_t home = HashPointer(m_table[i].pointer) & mask;
+    if( ((i - home) & mask) >= ((i - hole) & mask) )
+    {
+      m_table[hole] = m_table[i];
+      hole = i;
+    }
+  }
+  m_table[hole] = Entry();
+  --m_count;
+}
+
+bool Heap::IsMarked( const void* pointer )
+{
+  Entry* entry = Find(pointer);
+  return entry && entry->marked;
+}
+
+void Heap::ClearMarks()
+{
+  for( auto &entry : m_table )
+  {
+    entry.marked = false;
+  }
+}
+
+void Heap::MarkObject( const Object& object )
+{
+  Entry* entry = Find(PointerOf(object));
+  if( entry && !entry->marked )
+  {
+    entry->marked = true;
+    m_marking.push_back(entry);
+  }
+}
+
+void Heap::Mark( const Object* begin, const Object* end )
+{
+  for( const Object* object = begin; object != end; ++object )
+  {
+    MarkObject(*object);
+  }
+  while( !m_marking.empty() )
+  {
+    Entry* entry = m_marking.back();
+    m_marking.pop_back();
+    Trace(*entry);
+  }
+}
+
+void Heap::Mark( const void* pointer )
+{
+  Object object;
+  object.SetArray((array_ptr_t)pointer);
+  Mark(&object, &object + 1);
+}
+
+void Heap::Trace( const Entry& entry )
+{
+  switch( entry.type )
+  {
+    case ValueType::ARRAY:
+    {
+      auto array = (Array*)entry.pointer;
+      if( array->kind == ArrayKind::OBJECT )
+      {
+        for( auto &element : array->Objects() )
+        {
+          MarkObject(element);
+        }
+      }
+      else if( array->kind == ArrayKind::STRUCT )
+      {
+        for( auto &member : array->Structs()->values() )
+        {
+          MarkObject(member);
+        }
+      }
+      break;
+    }
+    case ValueType::DICT:
+    {
+      for( auto &dict_entry : *(const Dict*)entry.pointer )
+      {
+        MarkObject(dict_entry.value);
+      }
+      break;
+    }
+    case ValueType::STRUCT:
+    {
+      auto value = (Struct*)entry.pointer;
+      for( size_t i = 0; i < value->size(); ++i )
+      {
+        MarkObject(value->Members()[i]);
+      }
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+void Heap::Sweep( std::vector<string_t>& recycle, size_t recycle_limit )
+{
+  static const size_t MAX_RECYCLED_CAPACITY = 256;
+
+  size_t live_count = 0;
+  size_t live_bytes = 0;
+  for( auto &entry : m_table )
+  {
+    if( !entry.pointer )
+    {
+      continue;
+    }
+    if( entry.marked )
+    {
+      entry.marked = false;
+      ++live_count;
+      live_bytes += Footprint(entry.pointer, entry.type);
+      continue;
+    }
+    auto text = (string_t)entry.pointer;
+    if( entry.type == ValueType::STRING && recycle.size() < recycle_limit && text->capacity() <= MAX_RECYCLED_CAPACITY )
+    {
+      recycle.push_back(text);
+    }
+    else
+    {
+      Free(entry.pointer, entry.type);
+    }
+    entry.pointer = nullptr;
+  }
+
+  // rebuild without the holes, at most half full
+  size_t capacity = 64;
+  while( capacity < live_count * 4 )
+  {
+    capacity *= 2;
+  }
+  m_count = live_count;
+  Resize(capacity);
+
+  m_added = 0;
+  m_collect_threshold = Max<size_t>( MIN_COLLECT_THRESHOLD, live_count );
+  m_added_bytes = 0;
+  m_collect_bytes = Max<size_t>( MIN_COLLECT_BYTES, live_bytes );
+  m_added_promises = 0;
+  m_promise_threshold = Max<size_t>( MIN_PROMISE_THRESHOLD, live_count );
+  ++m_collections;
+  m_live_bytes.store(live_bytes, std::memory_order_relaxed);
+}
+
+// an object that isn't copied but keeps pointing at the same thing (an interned string that
+// overflowed the table), or an int whose type tag is stale. Either way the receiver must not
+// take it for a value of its own.
+static Object Unowned( const Object& value )
+{
+  Object result = value;
+  result.object_type = (u8)ValueType::NIL;
+  return result;
+}
+
+// deep copy of value, of everything owned says is to be copied
+template <class Owned>
+static Object Clone( const Object& value, const Owned& owned )
+{
+  switch( (ValueType)(u8)value.object_type )
+  {
+    case ValueType::STRING:
+    {
+      if( StringTable::IsInterned(value.string_ref) )
+      {
+        return value;
+      }
+      if( !owned(value) )
+      {
+        return Unowned(value);
+      }
+      return Object::BuildString(new std::string(*value.string_ref));
+    }
+    case ValueType::ARRAY:
+    {
+      if( !owned(value) )
+      {
+        return Unowned(value);
+      }
+      if( value.array_ref->frozen )
+      {
+        value.array_ref->AddRef();
+        return value;
+      }
+      // ints, floats and bools are shared until either side changes them, elements referring to
+      // anything else are copied
+      Array* copy = value.array_ref->Copy();
+      if( copy->kind == ArrayKind::OBJECT || copy->kind == ArrayKind::STRUCT )
+      {
+        copy->MakeWritable();
+      }
+      if( copy->kind == ArrayKind::OBJECT )
+      {
+        for( auto &element : copy->Objects() )
+        {
+          element = Clone(element, owned);
+        }
+      }
+      else if( copy->kind == ArrayKind::STRUCT )
+      {
+        for( auto &member : copy->Structs()->values() )
+        {
+          member = Clone(member, owned);
+        }
+      }
+      return Object::BuildArray(copy);
+    }
+    case ValueType::DICT:
+    {
+      if( !owned(value) )
+      {
+        return Unowned(value);
+      }
+      Dict* copy = value.dict_ref->Copy();
+      for( auto &entry : *value.dict_ref )
+      {
+        (*copy)[entry.key] = Clone(entry.value, owned);
+      }
+      return Object::BuildDict(copy);
+    }
+    case ValueType::STRUCT:
+    {
+      if( !owned(value) )
+      {
+        return Unowned(value);
+      }
+      Struct* copy = value.struct_ref->Copy();
+      for( size_t i = 0; i < copy->size(); ++i )
+      {
+        copy->Members()[i] = Clone(copy->Members()[i], owned);
+      }
+      return Object::BuildStruct(copy);
+    }
+    case ValueType::PROMISE:
+    {
+      if( !owned(value) )
+      {
+        return Unowned(value);
+      }
+      value.promise->AddRef();
+      return value;
+    }
+    default:
+      return value;
+  }
+}
+
+Object Heap::Export( const Object& value )
+{
+  // type tags of stale slots can't be trusted, only what is found in the heap with the same type
+  return Clone( value, [this]( const Object& object )
+  {
+    Entry* entry = Find(PointerOf(object));
+    return entry && entry->type == (ValueType)(u8)object.object_type;
+  });
+}
+
+Object Heap::CopyExported( const Object& value )
+{
+  return Clone( value, []( const Object& ) { return true; } );
+}
+
+void Heap::FreeExported( const Object& value )
+{
+  switch( (ValueType)(u8)value.object_type )
+  {
+    case ValueType::STRING:
+    {
+      if( !StringTable::IsInterned(value.string_ref) )
+      {
+        delete value.string_ref;
+      }
+      break;
+    }
+    case ValueType::ARRAY:
+    {
+      Array* array = value.array_ref;
+      if( array->kind == ArrayKind::OBJECT )
+      {
+        for( auto &element : array->Objects() )
+        {
+          FreeExported(element);
+        }
+      }
+      else if( array->kind == ArrayKind::STRUCT )
+      {
+        for( auto &member : array->Structs()->values() )
+        {
+          FreeExported(member);
+        }
+      }
+      Array::Release(array);
+      break;
+    }
+    case ValueType::DICT:
+    {
+      for( auto &entry : *value.dict_ref )
+      {
+        FreeExported(entry.value);
+      }
+      delete value.dict_ref;
+      break;
+    }
+    case ValueType::STRUCT:
+    {
+      Struct* exported = value.struct_ref;
+      for( size_t i = 0; i < exported->size(); ++i )
+      {
+        FreeExported(exported->Members()[i]);
+      }
+      Struct::Destroy(exported);
+      break;
+    }
+    case ValueType::PROMISE:
+    {
+      value.promise->Release();
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+} // namespace Eople
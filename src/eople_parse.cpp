@@ -310,6 +310,7 @@ StructNode Parser::ParseStruct()
   auto member = ParseIdentifier();
   while( member )
   {
+    struct_node->type.member_names.push_back( member->GetAsIdentifier()->name );
     struct_node->members.push_back( std::move(member) );
 
     // consume leading newlines between args
@@ -667,9 +668,54 @@ ExpressionNode Parser::ParseArraySubscript( std::string ident )
     Log::Error("(%d): Parse Error: Array dereference missing closing ']'.\n", m_last_error_line );
   }
 
+  ParseStructMember( array_subscript );
+
   return array_subscript_node;
 }
 
+// innermost namespace first
+Node::Struct* Parser::FindStruct( const std::string &name )
+{
+  for( size_t i = m_namespace_stack.size(); i > 0; --i )
+  {
+    for( auto &struct_node : m_current_module->structs )
+    {
+      if( struct_node->name == m_namespace_stack[i-1] + name )
+      {
+        return struct_node.get();
+      }
+    }
+  }
+  for( auto &struct_node : m_current_module->structs )
+  {
+    if( struct_node->name == name )
+    {
+      return struct_node.get();
+    }
+  }
+  return nullptr;
+}
+
+// optional '.member' after an array subscript, for arrays of structs
+bool Parser::ParseStructMember( Node::ArraySubscript* array_subscript )
+{
+  if( !ConsumeExpected(TOK_STRUCT_CALL) )
+  {
+    return false;
+  }
+
+  std::string member = m_lex->GetString();
+  if( !ConsumeExpected(TOK_IDENTIFIER) )
+  {
+    BumpError();
+    Log::Error("(%d): Parse Error: Expected member name after '.'.\n", m_last_error_line );
+    return false;
+  }
+
+  array_subscript->member = member;
+  return true;
+}
+
 // Used by both expression and statement flavors
 ExpressionNode Parser::ParseBaseFunctionCall( ExpressionNode ident_node, bool need_terminator )
 {
@@ -808,6 +854,13 @@ ExpressionNode Parser::ParseType()
     return nullptr;
   }
 
+  // a struct declared earlier in this module
+  if( Node::Struct* struct_node = FindStruct(ident) )
+  {
+    ident += " type";
+    return NodeBuilder::GetTypeNode( &struct_node->type, m_function->symbols.GetTableEntryIndex(ident, true), ident, m_last_line );
+  }
+
   static const char* type_list[] = { "float", "int", "bool", "string", "dict", "struct", "process", "function", "promise" };
   static const size_t type_count = _countof(type_list);
 
@@ -848,6 +901,8 @@ ExpressionNode Parser::ParseArrayLiteral()
 
   auto array_node = NodeBuilder::GetArrayNode(NodeBuilder::GetIdentifierNode( array_literal_label, symbol_id, m_last_line ), m_last_line);
   auto array = array_node->GetAsArrayLiteral();
+  // for the copy made at each evaluation
+  ++m_temp_count;
 
   auto element = ParseExpression();
   while( element )
@@ -892,6 +947,8 @@ ExpressionNode Parser::ParseDictLiteral()
 
   auto dict_node = NodeBuilder::GetDictNode(NodeBuilder::GetIdentifierNode( dict_literal_label, symbol_id, m_last_line ), m_last_line);
   auto dict = dict_node->GetAsDictLiteral();
+  // for the copy made at each evaluation
+  ++m_temp_count;
 
   std::string text = m_lex->GetString();
   if( !ConsumeExpected(TOK_IDENTIFIER) )
@@ -1823,6 +1880,11 @@ StatementNode Parser::ParseFunctionCall( ExpressionNode ident_node, bool need_te
   }
 
   auto function_call = function_call_node->GetAsFunctionCall();
+  // obj.member parses as a subscript, so this is a member assignment
+  if( !function_call && function_call_node->GetAsArraySubscript() && m_current_token == '=' )
+  {
+    return ParseAssignment( std::move(function_call_node) );
+  }
   if( !function_call )
   {
     BumpError();
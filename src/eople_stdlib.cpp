@@ -1,5 +1,6 @@
 #include "eople_core.h"
 #include "eople_stdlib.h"
+#include "eople_array_math.h"
 #include "eople_vm.h"
 
 #include <curl/curl.h>
@@ -35,8 +36,6 @@ bool PrintS( process_t process_ref )
   Object* text = process_ref->OperandA();
   std::cout << *text->string_ref << std::endl;
 
-  process_ref->TryCollectTempString(text);
-
   return true;
 }
 
@@ -52,12 +51,13 @@ bool PrintSArr( process_t process_ref )
 {
   auto array_ref = process_ref->OperandA()->array_ref;
   assert(array_ref);
+  auto &elements = array_ref->Objects();
 
   std::cout << "[";
 
-  for( size_t i = 0; i < array_ref->size(); ++i )
+  for( size_t i = 0; i < elements.size(); ++i )
   {
-    auto element = (*array_ref)[i];
+    auto element = elements[i];
 
     if( i != 0 )
     {
@@ -74,18 +74,17 @@ bool PrintFArr( process_t process_ref )
 {
   auto array_ref = process_ref->OperandA()->array_ref;
   assert(array_ref);
+  auto elements = array_ref->FloatRange();
 
   std::cout << "[";
 
-  for( size_t i = 0; i < array_ref->size(); ++i )
+  for( size_t i = 0; i < elements.size(); ++i )
   {
-    auto element = (*array_ref)[i];
-
     if( i != 0 )
     {
       std::cout << ", ";
     }
-    std::cout << element.float_val;
+    std::cout << elements[i];
   }
   std::cout << "]" << std::endl;
 
@@ -96,18 +95,17 @@ bool PrintIArr( process_t process_ref )
 {
   auto array_ref = process_ref->OperandA()->array_ref;
   assert(array_ref);
+  auto elements = array_ref->IntRange();
 
   std::cout << "[";
 
-  for( size_t i = 0; i < array_ref->size(); ++i )
+  for( size_t i = 0; i < elements.size(); ++i )
   {
-    auto element = (*array_ref)[i];
-
     if( i != 0 )
     {
       std::cout << ", ";
     }
-    std::cout << element.int_val;
+    std::cout << elements[i];
   }
   std::cout << "]" << std::endl;
 
@@ -122,24 +120,24 @@ bool PrintDict( process_t process_ref )
   std::cout << "{";
 
   size_t i = 0;
-  for( auto it : *dict_ref )
+  for( auto &entry : *dict_ref )
   {
     if( i != 0 )
     {
       std::cout << ", ";
     }
-    std::cout << it.first << ":";
-    if( it.second.object_type == (u8)ValueType::STRING )
+    std::cout << entry.key->text << ":";
+    if( entry.value.object_type == (u8)ValueType::STRING )
     {
-      std::cout << "\"" << *it.second.string_ref << "\"";
+      std::cout << "\"" << *entry.value.string_ref << "\"";
     }
-    else if( it.second.object_type == (u8)ValueType::INT )
+    else if( entry.value.object_type == (u8)ValueType::INT )
     {
-      std::cout << it.second.int_val;
+      std::cout << entry.value.int_val;
     }
-    else if( it.second.object_type == (u8)ValueType::FLOAT )
+    else if( entry.value.object_type == (u8)ValueType::FLOAT )
     {
-      std::cout << it.second.float_val;
+      std::cout << entry.value.float_val;
     }
 
     ++i;
@@ -149,6 +147,34 @@ bool PrintDict( process_t process_ref )
   return true;
 }
 
+// members are printed by their inferred type, values computed into temporaries don't always carry one
+static void PrintStruct( std::ostream &stream, StructType* type, Object* members )
+{
+  stream << type->struct_name << "(";
+  for( size_t i = 0; i < type->member_names.size(); ++i )
+  {
+    if( i != 0 )
+    {
+      stream << ", ";
+    }
+    Object &member = members[i];
+    switch( type->member_types[i]->type )
+    {
+      case ValueType::INT:    stream << member.int_val;                       break;
+      case ValueType::FLOAT:  stream << member.float_val;                     break;
+      case ValueType::BOOL:   stream << (member.bool_val ? "true" : "false"); break;
+      case ValueType::STRING: stream << "\'" << *member.string_ref << "\'";   break;
+      case ValueType::STRUCT:
+      {
+        PrintStruct( stream, member.struct_ref->type, member.struct_ref->Members() );
+        break;
+      }
+      default:                stream << "?";                                  break;
+    }
+  }
+  stream << ")";
+}
+
 bool PrintObject( process_t process_ref )
 {
   auto obj_ref = process_ref->OperandA();
@@ -167,6 +193,24 @@ bool PrintObject( process_t process_ref )
   {
     string_stream << obj_ref->float_val;
   }
+  else if( obj_ref->object_type == (u8)ValueType::STRUCT )
+  {
+    PrintStruct( string_stream, obj_ref->struct_ref->type, obj_ref->struct_ref->Members() );
+  }
+  else if( obj_ref->object_type == (u8)ValueType::ARRAY && obj_ref->array_ref->kind == ArrayKind::STRUCT )
+  {
+    auto structs = obj_ref->array_ref->Structs();
+    string_stream << "[";
+    for( size_t i = 0; i < structs->size(); ++i )
+    {
+      if( i != 0 )
+      {
+        string_stream << ", ";
+      }
+      PrintStruct( string_stream, structs->type, structs->Members(i) );
+    }
+    string_stream << "]";
+  }
 
   std::cout << string_stream.str() << std::endl;
 
@@ -175,8 +219,8 @@ bool PrintObject( process_t process_ref )
 
 bool GetLine( process_t process_ref )
 {
-  string_t &new_string = process_ref->CCallReturnVal()->string_ref;
-  new_string = new std::string();
+  string_t new_string = process_ref->NewString();
+  process_ref->CCallReturnVal()->SetString(new_string);
 
   std::getline(std::cin, *new_string);
 
@@ -185,7 +229,8 @@ bool GetLine( process_t process_ref )
 
 bool ArrayConstructor( process_t process_ref )
 {
-  process_ref->CCallReturnVal()->array_ref = new std::vector<Object>();
+  // ints, floats and bools are stored unboxed, struct members inline
+  process_ref->CCallReturnVal()->SetArray(process_ref->heap.Add(Array::Create(process_ref->OperandA()->type)));
 
   return true;
 }
@@ -195,7 +240,44 @@ bool ArrayPush( process_t process_ref )
   auto array_ref = process_ref->OperandA()->array_ref;
   Object* object = process_ref->OperandB();
 
-  array_ref->push_back(*object);
+  process_ref->ShareObject(*object);
+  if( array_ref->kind == ArrayKind::STRUCT )
+  {
+    // members are copied into the array
+    array_ref->Structs()->Push(object->struct_ref);
+  }
+  else
+  {
+    array_ref->MakeWritable();
+    array_ref->Objects().push_back(*object);
+  }
+
+  return true;
+}
+
+bool ArrayPushInt( process_t process_ref )
+{
+  auto array_ref = process_ref->OperandA()->array_ref;
+  array_ref->MakeWritable();
+  array_ref->Ints().push_back(process_ref->OperandB()->int_val);
+
+  return true;
+}
+
+bool ArrayPushFloat( process_t process_ref )
+{
+  auto array_ref = process_ref->OperandA()->array_ref;
+  array_ref->MakeWritable();
+  array_ref->Floats().push_back(process_ref->OperandB()->float_val);
+
+  return true;
+}
+
+bool ArrayPushBool( process_t process_ref )
+{
+  auto array_ref = process_ref->OperandA()->array_ref;
+  array_ref->MakeWritable();
+  array_ref->Bools().push_back(process_ref->OperandB()->bool_val != 0);
 
   return true;
 }
@@ -205,8 +287,11 @@ bool ArrayPushArray( process_t process_ref )
   auto array_ref = process_ref->OperandA()->array_ref;
   Object* object = process_ref->OperandB();
 
-  // push a copy
-  array_ref->push_back(Object::BuildArray(*object->array_ref));
+  // push a copy, sharing the elements until either changes. array may be the one pushed, so it is
+  // made writable after the copy.
+  Array* copy = process_ref->heap.Add(object->array_ref->Copy());
+  array_ref->MakeWritable();
+  array_ref->Objects().push_back(Object::BuildArray(copy));
 
   return true;
 }
@@ -217,8 +302,9 @@ bool ArrayPushString( process_t process_ref )
   Object* object = process_ref->OperandB();
 
   // push a copy
-  string_t string_value = new std::string(*object->string_ref);
-  array_ref->push_back(Object::BuildString(string_value));
+  string_t string_value = process_ref->CopyString(object->string_ref);
+  array_ref->MakeWritable();
+  array_ref->Objects().push_back(Object::BuildString(string_value));
 
   return true;
 }
@@ -232,27 +318,28 @@ bool ArraySize( process_t process_ref )
 
 bool ArrayTop( process_t process_ref )
 {
-  *process_ref->CCallReturnVal() = process_ref->OperandA()->array_ref->back();
+  auto array_ref = process_ref->OperandA()->array_ref;
+  *process_ref->CCallReturnVal() = process_ref->ArrayElement(array_ref, array_ref->size() - 1);
 
   return true;
 }
 
 bool ArrayTopArray( process_t process_ref )
 {
-  Object &object = process_ref->OperandA()->array_ref->back();
+  Object &object = process_ref->OperandA()->array_ref->Objects().back();
 
-  // return a copy
-  *process_ref->CCallReturnVal() = Object::BuildArray(*object.array_ref);
+  // return a copy, sharing the elements until either changes
+  *process_ref->CCallReturnVal() = Object::BuildArray(process_ref->heap.Add(object.array_ref->Copy()));
 
   return true;
 }
 
 bool ArrayTopString( process_t process_ref )
 {
-  Object &object = process_ref->OperandA()->array_ref->back();
+  Object &object = process_ref->OperandA()->array_ref->Objects().back();
 
   // return a copy
-  string_t string_value = new std::string(*object.string_ref);
+  string_t string_value = process_ref->CopyString(object.string_ref);
   *process_ref->CCallReturnVal() = Object::BuildString(string_value);
 
   return true;
@@ -272,33 +359,375 @@ bool ArrayClear( process_t process_ref )
   return true;
 }
 
+bool ArrayFreeze( process_t process_ref )
+{
+  // in place: the array is the same, it just can't change any more
+  Object* object = process_ref->OperandA();
+  object->array_ref->Freeze();
+  *process_ref->CCallReturnVal() = *object;
+
+  return true;
+}
+
+bool ArraySlice( process_t process_ref )
+{
+  Array* array_ref = process_ref->OperandA()->array_ref;
+  int_t start = process_ref->OperandB()->int_val;
+  int_t end = process_ref->OperandC()->int_val;
+
+  if( start < 0 || end < start || (size_t)end > array_ref->size() )
+  {
+    throw std::runtime_error("Slice out of bounds.");
+  }
+  Array* slice = array_ref->Slice( (size_t)start, (size_t)(end - start) );
+  *process_ref->CCallReturnVal() = Object::BuildArray(process_ref->heap.Add(slice));
+
+  return true;
+}
+
 bool ArraySubscript( process_t process_ref )
 {
   auto object = process_ref->OperandA();
   if(object->object_type == (u8)ValueType::ARRAY)
   {
     auto& array_ref = *process_ref->OperandA()->array_ref;
-    int_t index = process_ref->OperandB()->int_val;
+    size_t index = (size_t)process_ref->OperandB()->int_val;
     auto result = process_ref->OperandC();
 
     if( index >= array_ref.size() )
     {
       throw std::runtime_error("Array index out of bounds.");
     }
-    *result = array_ref[index];
+    *result = process_ref->ArrayElement(&array_ref, index);
   }
   else if(object->object_type == (u8)ValueType::DICT)
   {
-    auto& dict_ref = *process_ref->OperandA()->dict_ref;
-    std::string key = *process_ref->OperandB()->string_ref;
-    auto result = process_ref->OperandC();
+    return DictSubscript(process_ref);
+  }
 
-    if( dict_ref.find(key) == dict_ref.end() )
-    {
-      throw std::runtime_error(std::string("No such key: ") + key);
-    }
-    *result = dict_ref[key];
+  return true;
+}
+
+bool DictSubscript( process_t process_ref )
+{
+  auto& key = *process_ref->OperandB()->string_ref;
+  Object* value = process_ref->OperandA()->dict_ref->Find(key);
+
+  if( !value )
+  {
+    throw std::runtime_error(std::string("No such key: ") + key);
+  }
+  *process_ref->OperandC() = *value;
+
+  return true;
+}
+
+bool StructMember( process_t process_ref )
+{
+  // operand b is the member index itself, not a stack slot
+  *process_ref->OperandC() = process_ref->OperandA()->struct_ref->Members()[process_ref->ip->b];
+
+  return true;
+}
+
+bool StructArrayMember( process_t process_ref )
+{
+  auto structs = process_ref->OperandA()->array_ref->Structs();
+  size_t index = (size_t)process_ref->OperandB()->int_val;
+
+  if( index >= structs->size() )
+  {
+    throw std::runtime_error("Array index out of bounds.");
+  }
+  // operand d is the member index itself, not a stack slot
+  *process_ref->OperandC() = structs->Members(index)[process_ref->ip->d];
+
+  return true;
+}
+
+bool ArraySubscriptI( process_t process_ref )
+{
+  auto values = process_ref->OperandA()->array_ref->IntRange();
+  size_t index = (size_t)process_ref->OperandB()->int_val;
+
+  if( index >= values.size() )
+  {
+    throw std::runtime_error("Array index out of bounds.");
+  }
+  process_ref->OperandC()->int_val = values[index];
+
+  return true;
+}
+
+bool ArraySubscriptF( process_t process_ref )
+{
+  auto values = process_ref->OperandA()->array_ref->FloatRange();
+  size_t index = (size_t)process_ref->OperandB()->int_val;
+
+  if( index >= values.size() )
+  {
+    throw std::runtime_error("Array index out of bounds.");
+  }
+  process_ref->OperandC()->float_val = values[index];
+
+  return true;
+}
+
+// ArraySubscriptI/F fused with the + or * taking the element, d = c op a[b]
+bool AddSubscriptI( process_t process_ref )
+{
+  auto values = process_ref->OperandA()->array_ref->IntRange();
+  size_t index = (size_t)process_ref->OperandB()->int_val;
+
+  if( index >= values.size() )
+  {
+    throw std::runtime_error("Array index out of bounds.");
+  }
+  process_ref->OperandD()->int_val = process_ref->OperandC()->int_val + values[index];
+
+  return true;
+}
+
+bool MulSubscriptI( process_t process_ref )
+{
+  auto values = process_ref->OperandA()->array_ref->IntRange();
+  size_t index = (size_t)process_ref->OperandB()->int_val;
+
+  if( index >= values.size() )
+  {
+    throw std::runtime_error("Array index out of bounds.");
+  }
+  process_ref->OperandD()->int_val = process_ref->OperandC()->int_val * values[index];
+
+  return true;
+}
+
+bool AddSubscriptF( process_t process_ref )
+{
+  auto values = process_ref->OperandA()->array_ref->FloatRange();
+  size_t index = (size_t)process_ref->OperandB()->int_val;
+
+  if( index >= values.size() )
+  {
+    throw std::runtime_error("Array index out of bounds.");
+  }
+  process_ref->OperandD()->float_val = process_ref->OperandC()->float_val + values[index];
+
+  return true;
+}
+
+bool MulSubscriptF( process_t process_ref )
+{
+  auto values = process_ref->OperandA()->array_ref->FloatRange();
+  size_t index = (size_t)process_ref->OperandB()->int_val;
+
+  if( index >= values.size() )
+  {
+    throw std::runtime_error("Array index out of bounds.");
   }
+  process_ref->OperandD()->float_val = process_ref->OperandC()->float_val * values[index];
+
+  return true;
+}
+
+bool ArraySubscriptB( process_t process_ref )
+{
+  auto& values = process_ref->OperandA()->array_ref->Bools();
+  size_t index = (size_t)process_ref->OperandB()->int_val;
+
+  if( index >= values.size() )
+  {
+    throw std::runtime_error("Array index out of bounds.");
+  }
+  process_ref->OperandC()->bool_val = values[index];
+
+  return true;
+}
+
+static void CheckNotEmpty( size_t size, const char* function_name )
+{
+  if( size == 0 )
+  {
+    throw std::runtime_error(std::string(function_name) + " of an empty array.");
+  }
+}
+
+static void CheckSameSize( size_t a, size_t b, const char* function_name )
+{
+  if( a != b )
+  {
+    throw std::runtime_error(std::string(function_name) + " of arrays with different sizes.");
+  }
+}
+
+bool ArraySumF( process_t process_ref )
+{
+  auto x = process_ref->OperandA()->array_ref->FloatRange();
+  process_ref->CCallReturnVal()->float_val = ArrayMath::Best().sum_f(x.data(), x.size());
+
+  return true;
+}
+
+bool ArrayMinF( process_t process_ref )
+{
+  auto x = process_ref->OperandA()->array_ref->FloatRange();
+  CheckNotEmpty(x.size(), "min");
+  process_ref->CCallReturnVal()->float_val = ArrayMath::Best().min_f(x.data(), x.size());
+
+  return true;
+}
+
+bool ArrayMaxF( process_t process_ref )
+{
+  auto x = process_ref->OperandA()->array_ref->FloatRange();
+  CheckNotEmpty(x.size(), "max");
+  process_ref->CCallReturnVal()->float_val = ArrayMath::Best().max_f(x.data(), x.size());
+
+  return true;
+}
+
+bool ArrayDotF( process_t process_ref )
+{
+  auto x = process_ref->OperandA()->array_ref->FloatRange();
+  auto y = process_ref->OperandB()->array_ref->FloatRange();
+  CheckSameSize(x.size(), y.size(), "dot");
+  process_ref->CCallReturnVal()->float_val = ArrayMath::Best().dot_f(x.data(), y.data(), x.size());
+
+  return true;
+}
+
+bool ArrayScaleF( process_t process_ref )
+{
+  auto x = process_ref->OperandA()->array_ref->FloatRange();
+  auto result = new FloatArray();
+  result->values().resize(x.size());
+  ArrayMath::Best().scale_f(result->values().data(), x.data(), process_ref->OperandB()->float_val, x.size());
+  *process_ref->CCallReturnVal() = Object::BuildArray(process_ref->heap.Add(result));
+
+  return true;
+}
+
+bool ArrayAddF( process_t process_ref )
+{
+  auto x = process_ref->OperandA()->array_ref->FloatRange();
+  auto y = process_ref->OperandB()->array_ref->FloatRange();
+  CheckSameSize(x.size(), y.size(), "add");
+  auto result = new FloatArray();
+  result->values().resize(x.size());
+  ArrayMath::Best().add_f(result->values().data(), x.data(), y.data(), x.size());
+  *process_ref->CCallReturnVal() = Object::BuildArray(process_ref->heap.Add(result));
+
+  return true;
+}
+
+bool ArrayMulF( process_t process_ref )
+{
+  auto x = process_ref->OperandA()->array_ref->FloatRange();
+  auto y = process_ref->OperandB()->array_ref->FloatRange();
+  CheckSameSize(x.size(), y.size(), "mul");
+  auto result = new FloatArray();
+  result->values().resize(x.size());
+  ArrayMath::Best().mul_f(result->values().data(), x.data(), y.data(), x.size());
+  *process_ref->CCallReturnVal() = Object::BuildArray(process_ref->heap.Add(result));
+
+  return true;
+}
+
+bool ArrayAxpyF( process_t process_ref )
+{
+  auto x = process_ref->OperandA()->array_ref->FloatRange();
+  auto y = process_ref->OperandC()->array_ref->FloatRange();
+  CheckSameSize(x.size(), y.size(), "axpy");
+  auto result = new FloatArray();
+  result->values().resize(x.size());
+  ArrayMath::Best().axpy_f(result->values().data(), x.data(), process_ref->OperandB()->float_val, y.data(), x.size());
+  *process_ref->CCallReturnVal() = Object::BuildArray(process_ref->heap.Add(result));
+
+  return true;
+}
+
+bool ArraySumI( process_t process_ref )
+{
+  auto x = process_ref->OperandA()->array_ref->IntRange();
+  process_ref->CCallReturnVal()->int_val = ArrayMath::Best().sum_i(x.data(), x.size());
+
+  return true;
+}
+
+bool ArrayMinI( process_t process_ref )
+{
+  auto x = process_ref->OperandA()->array_ref->IntRange();
+  CheckNotEmpty(x.size(), "min");
+  process_ref->CCallReturnVal()->int_val = ArrayMath::Best().min_i(x.data(), x.size());
+
+  return true;
+}
+
+bool ArrayMaxI( process_t process_ref )
+{
+  auto x = process_ref->OperandA()->array_ref->IntRange();
+  CheckNotEmpty(x.size(), "max");
+  process_ref->CCallReturnVal()->int_val = ArrayMath::Best().max_i(x.data(), x.size());
+
+  return true;
+}
+
+bool ArrayDotI( process_t process_ref )
+{
+  auto x = process_ref->OperandA()->array_ref->IntRange();
+  auto y = process_ref->OperandB()->array_ref->IntRange();
+  CheckSameSize(x.size(), y.size(), "dot");
+  process_ref->CCallReturnVal()->int_val = ArrayMath::Best().dot_i(x.data(), y.data(), x.size());
+
+  return true;
+}
+
+bool ArrayScaleI( process_t process_ref )
+{
+  auto x = process_ref->OperandA()->array_ref->IntRange();
+  auto result = new IntArray();
+  result->values().resize(x.size());
+  ArrayMath::Best().scale_i(result->values().data(), x.data(), process_ref->OperandB()->int_val, x.size());
+  *process_ref->CCallReturnVal() = Object::BuildArray(process_ref->heap.Add(result));
+
+  return true;
+}
+
+bool ArrayAddI( process_t process_ref )
+{
+  auto x = process_ref->OperandA()->array_ref->IntRange();
+  auto y = process_ref->OperandB()->array_ref->IntRange();
+  CheckSameSize(x.size(), y.size(), "add");
+  auto result = new IntArray();
+  result->values().resize(x.size());
+  ArrayMath::Best().add_i(result->values().data(), x.data(), y.data(), x.size());
+  *process_ref->CCallReturnVal() = Object::BuildArray(process_ref->heap.Add(result));
+
+  return true;
+}
+
+bool ArrayMulI( process_t process_ref )
+{
+  auto x = process_ref->OperandA()->array_ref->IntRange();
+  auto y = process_ref->OperandB()->array_ref->IntRange();
+  CheckSameSize(x.size(), y.size(), "mul");
+  auto result = new IntArray();
+  result->values().resize(x.size());
+  ArrayMath::Best().mul_i(result->values().data(), x.data(), y.data(), x.size());
+  *process_ref->CCallReturnVal() = Object::BuildArray(process_ref->heap.Add(result));
+
+  return true;
+}
+
+bool ArrayAxpyI( process_t process_ref )
+{
+  auto x = process_ref->OperandA()->array_ref->IntRange();
+  auto y = process_ref->OperandC()->array_ref->IntRange();
+  CheckSameSize(x.size(), y.size(), "axpy");
+  auto result = new IntArray();
+  result->values().resize(x.size());
+  ArrayMath::Best().axpy_i(result->values().data(), x.data(), process_ref->OperandB()->int_val, y.data(), x.size());
+  *process_ref->CCallReturnVal() = Object::BuildArray(process_ref->heap.Add(result));
 
   return true;
 }
@@ -308,10 +737,12 @@ bool Timer( process_t process_ref )
   Object* duration = process_ref->OperandA();
 
   auto future_time = HighResClock::now() + std::chrono::milliseconds(duration->int_val);
-  promise_t promise = new Promise(process_ref);
+  promise_t promise = process_ref->NewPromise();
   promise->is_timer = true;
+  // held by the timer message until it has been delivered
+  promise->AddRef();
   process_ref->vm->SendMessage( CallData(nullptr, process_ref, nullptr, promise, future_time) );
-  process_ref->CCallReturnVal()->promise = promise;
+  process_ref->CCallReturnVal()->SetPromise( promise );
   return true;
 }
 
@@ -349,7 +780,7 @@ bool IntToString( process_t process_ref )
 {
   std::ostringstream string_stream;
   string_stream << process_ref->OperandA()->int_val;
-  process_ref->CCallReturnVal()->string_ref = new std::string();
+  process_ref->CCallReturnVal()->SetString(process_ref->NewString());
   *process_ref->CCallReturnVal()->string_ref = string_stream.str();
 
   return true;
@@ -359,7 +790,7 @@ bool FloatToString( process_t process_ref )
 {
   std::ostringstream string_stream;
   string_stream << process_ref->OperandA()->float_val;
-  process_ref->CCallReturnVal()->string_ref = new std::string();
+  process_ref->CCallReturnVal()->SetString(process_ref->NewString());
   *process_ref->CCallReturnVal()->string_ref = string_stream.str();
   return true;
 }
@@ -382,11 +813,36 @@ bool PromiseToString( process_t process_ref )
     string_stream << promise->value.float_val;
   }
 
-  process_ref->CCallReturnVal()->string_ref = new std::string();
+  process_ref->CCallReturnVal()->SetString(process_ref->NewString());
   *process_ref->CCallReturnVal()->string_ref = string_stream.str();
   return true;
 }
 
+// empty string with room for capacity characters, to append to. A builder is often filled by
+// more than one message, so it lives in the heap rather than the string region.
+bool StringBuilder( process_t process_ref )
+{
+  int_t capacity = process_ref->OperandA()->int_val;
+  string_t text = process_ref->NewHeapString();
+  text->reserve( capacity > 0 ? (size_t)capacity : 0 );
+  process_ref->CCallReturnVal()->SetString(text);
+
+  return true;
+}
+
+// in place, so a string built up in a loop grows geometrically instead of being copied every time
+bool StringAppend( process_t process_ref )
+{
+  Object* builder = process_ref->OperandA();
+  if( StringTable::IsInterned(builder->string_ref) )
+  {
+    throw std::runtime_error("Can't append to a string literal, start from string_builder.");
+  }
+  builder->string_ref->append( *process_ref->OperandB()->string_ref );
+
+  return true;
+}
+
 size_t CurlStoreString(void* contents, size_t size, size_t nmemb, std::string* out_string)
 {
   *out_string += (char*)contents;
@@ -399,18 +855,26 @@ bool GetURL( process_t process_ref )
   assert(dict_ref);
 
   auto &request = *dict_ref;
+  static const DictKey* url_key    = Dict::Intern("url");
+  static const DictKey* creds_key  = Dict::Intern("creds");
+  static const DictKey* status_key = Dict::Intern("status");
+  static const DictKey* body_key   = Dict::Intern("body");
 
-  Object* text_obj = process_ref->OperandA();
-  auto text = request["url"].string_ref->c_str();
+  Object* url = request.Find(url_key);
+  if( !url )
+  {
+    throw std::runtime_error("No such key: url");
+  }
+  auto text = url->string_ref->c_str();
 
   CURL* curl = curl_easy_init();
   std::string body;
   std::string status = "OK";
   std::string usr_pwd;
 
-  if( request.find("creds") != request.end() )
+  if( Object* creds = request.Find(creds_key) )
   {
-    usr_pwd = *request["creds"].string_ref;
+    usr_pwd = *creds->string_ref;
   }
   if(curl)
   {
@@ -436,12 +900,11 @@ bool GetURL( process_t process_ref )
       curl_easy_cleanup(curl);
   }
 
-  process_ref->CCallReturnVal()->dict_ref = new std::unordered_map<std::string, Object>;
-  auto &dict = *process_ref->CCallReturnVal()->dict_ref;
-  dict["status"] = Object::BuildString(new std::string());
-  *dict["status"].string_ref = status;
-  dict["body"] = Object::BuildString(new std::string());
-  *dict["body"].string_ref = body;
+  Dict* result = new Dict();
+  (*result)[status_key] = Object::BuildString(new std::string(std::move(status)));
+  (*result)[body_key]   = Object::BuildString(new std::string(std::move(body)));
+  *process_ref->CCallReturnVal() = Object::BuildDict(result);
+  process_ref->heap.Adopt(*process_ref->CCallReturnVal());
 
   return true;
 }
@@ -476,11 +939,9 @@ bool GetURL_USERPWD( process_t process_ref )
       curl_easy_cleanup(curl);
   }
 
-  process_ref->CCallReturnVal()->string_ref = new std::string();
+  process_ref->CCallReturnVal()->SetString(process_ref->NewString());
   *process_ref->CCallReturnVal()->string_ref = response;
 
-  process_ref->TryCollectTempString(text_obj);
-
   return true;
 }
 
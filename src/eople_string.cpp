@@ -0,0 +1,75 @@
+#include "eople_string.h"
+
+#include <mutex>
+#include <new>
+#include <unordered_map>
+
+namespace Eople
+{
+
+StringTable::Storage StringTable::s_strings[StringTable::CAPACITY];
+
+string_t StringTable::Intern( const std::string &text )
+{
+  static std::mutex                                strings_lock;
+  static std::unordered_map<std::string, string_t> strings;
+
+  std::lock_guard<std::mutex> lock(strings_lock);
+  auto &interned = strings[text];
+  if( !interned )
+  {
+    if( strings.size() > CAPACITY )
+    {
+      strings.erase(text);
+      return new std::string(text);
+    }
+    // slots are handed out in order, the table only grows
+    interned = new (&s_strings[strings.size() - 1]) std::string(text);
+  }
+  return interned;
+}
+
+StringRegion::~StringRegion()
+{
+  for( size_t i = 0; i < m_constructed; ++i )
+  {
+    m_strings[i].~basic_string();
+  }
+  ::operator delete(m_strings);
+}
+
+string_t StringRegion::Allocate()
+{
+  if( m_used == CAPACITY )
+  {
+    return nullptr;
+  }
+  if( !m_strings )
+  {
+    // the block comes once per process
+    m_strings = (std::string*)::operator new( CAPACITY * sizeof(std::string) );
+  }
+  // strings stay constructed across resets, with whatever memory they already had
+  if( m_used == m_constructed )
+  {
+    new (&m_strings[m_constructed++]) std::string();
+  }
+  string_t text = &m_strings[m_used++];
+  text->clear();
+  ++m_allocations;
+  return text;
+}
+
+void StringRegion::Reset()
+{
+  for( size_t i = 0; i < m_used; ++i )
+  {
+    if( m_strings[i].capacity() > MAX_KEPT_CAPACITY )
+    {
+      std::string().swap(m_strings[i]);
+    }
+  }
+  m_used = 0;
+}
+
+} // namespace Eople
@@ -2,6 +2,96 @@
 #include "catch.hpp"
 
 #include "eople_symbol_table.h"
+#include "eople_vm.h"
+#include "eople_exec_env.h"
+#include "eople_log.h"
+#include "timer_wheel.h"
+#include "eople_array_math.h"
+#include "eople_string.h"
+#include "eople_heap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <atomic>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <limits>
+#include <new>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+// count heap allocations, for the allocation benchmarks
+static std::atomic<size_t> s_heap_bytes(0);
+static std::atomic<size_t> s_heap_allocations(0);
+
+void* operator new( size_t size ) {
+    s_heap_bytes.fetch_add(size, std::memory_order_relaxed);
+    s_heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    if( void* memory = malloc(size ? size : 1) ) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete( void* memory ) noexcept {
+    free(memory);
+}
+
+// A script written to the working directory and imported into an ExecutionEnvironment of its own,
+// the file is removed again with it. Run runs its functions in turn, as processes or called
+// directly, shuts the environment down and returns what they printed. What they printed to
+// std::cerr is kept in errors, ee is left for what the test checks after.
+struct Script {
+    Script( const char* file_name, const std::string& source,
+            const Eople::VirtualMachineConfig& config = Eople::VirtualMachineConfig() )
+        : file_name(file_name), ee(config) {
+        std::ofstream(file_name) << source;
+        Eople::Log::SetVerbosityLevel(Eople::Log::VerbosityLevel::NO_DEBUG);
+        REQUIRE( ee.ImportModuleFromFile(file_name) );
+    }
+
+    ~Script() {
+        remove(file_name);
+    }
+
+    std::string Run( std::initializer_list<const char*> functions = { "main" }, bool spawn = true ) {
+        std::stringstream output;
+        std::stringstream error_output;
+        auto old_buffer = std::cout.rdbuf(output.rdbuf());
+        auto old_errors = std::cerr.rdbuf(error_output.rdbuf());
+        for( auto function : functions ) {
+            ee.ExecuteFunction(function, spawn);
+        }
+        ee.Shutdown();
+        std::cout.rdbuf(old_buffer);
+        std::cerr.rdbuf(old_errors);
+        errors = error_output.str();
+        return output.str();
+    }
+
+    const char* file_name;
+    std::string errors;
+    Eople::ExecutionEnvironment ee;
+};
+
+// Runs main of a Script and returns what it printed, calls is set to how many times FunctionCall
+// ran. Only the threaded interpreter counts them, calls is 0 otherwise.
+static std::string RunScript( const char* file_name, const std::string& source,
+                              Eople::VirtualMachineConfig config, size_t* calls ) {
+    config.count_opcode_pairs = true;
+    Script script(file_name, source, config);
+    std::string output = script.Run();
+
+    *calls = 0;
+#if EOPLE_THREADED_DISPATCH
+    for( auto &pair : script.ee.OpcodePairs()->MostFrequent((size_t)-1) ) {
+        *calls += pair.first == Eople::Opcode::FunctionCall ? (size_t)pair.count : 0;
+    }
+#endif
+    return output;
+}
 
 SCENARIO( "symbol table allows constants to be pushed", "[symbol_table]" ) {
 
@@ -29,3 +119,3112 @@ SCENARIO( "symbol table allows constants to be pushed", "[symbol_table]" ) {
         }
     }
 }
+
+// Feeds queue from several producer threads while a single consumer drains it, true if every
+// producer's messages arrived in the order it sent them.
+template <class Queue>
+static bool DrainsInProducerOrder( Queue& queue ) {
+    const int producer_count = 4;
+    const int per_producer   = 10000;
+
+    std::vector<std::thread> producers;
+    for( int p = 0; p < producer_count; ++p ) {
+        producers.push_back(std::thread([&queue, p]() {
+            for( int i = 0; i < per_producer; ++i ) {
+                queue.push(std::make_pair(p, i));
+            }
+        }));
+    }
+
+    std::vector<int> next(producer_count, 0);
+    int received = 0;
+    bool in_order = true;
+    while( received < producer_count * per_producer ) {
+        if( queue.empty() ) {
+            std::this_thread::yield();
+            continue;
+        }
+        auto value = queue.front();
+        queue.pop();
+        in_order = in_order && value.second == next[value.first];
+        next[value.first] = value.second + 1;
+        ++received;
+    }
+    for( auto &producer : producers ) {
+        producer.join();
+    }
+    return in_order;
+}
+
+SCENARIO( "mpsc queue delivers every message in per-producer order", "[mpsc_queue]" ) {
+
+    GIVEN( "A queue fed by several producer threads" ) {
+        Eople::MPSCQueue<std::pair<int,int>> queue;
+
+        WHEN( "a single consumer drains it" ) {
+            bool in_order = DrainsInProducerOrder(queue);
+
+            THEN( "nothing is lost or reordered" ) {
+                REQUIRE( in_order );
+                REQUIRE( queue.empty() );
+            }
+        }
+    }
+
+    GIVEN( "An unpadded queue, as each process has for its mailbox" ) {
+        Eople::MPSCQueue<std::pair<int,int>, false> queue;
+
+        WHEN( "a single consumer drains it" ) {
+            bool in_order = DrainsInProducerOrder(queue);
+
+            THEN( "nothing is lost or reordered, and its ends share a cache line" ) {
+                REQUIRE( in_order );
+                REQUIRE( queue.empty() );
+                REQUIRE( sizeof(Eople::MessageQueue) < 64 + sizeof(Eople::CallData) );
+            }
+        }
+    }
+}
+
+SCENARIO( "work stealing deque hands out every item exactly once", "[work_stealing_deque]" ) {
+
+    GIVEN( "A deque whose owner pushes while thieves steal" ) {
+        const int item_count  = 100000;
+        const int thief_count = 3;
+        // items are 1-based, 0 means empty
+        Eople::WorkStealingDeque<intptr_t> deque(16);
+        std::vector<std::atomic<int>> taken(item_count + 1);
+        std::atomic<bool> done(false);
+
+        std::vector<std::thread> thieves;
+        for( int t = 0; t < thief_count; ++t ) {
+            thieves.push_back(std::thread([&]() {
+                while( !done ) {
+                    if( intptr_t item = deque.steal() ) {
+                        ++taken[item];
+                    }
+                }
+            }));
+        }
+
+        WHEN( "the owner pushes and pops concurrently" ) {
+            for( intptr_t i = 1; i <= item_count; ++i ) {
+                deque.push(i);
+                if( (i % 3) == 0 ) {
+                    if( intptr_t item = deque.pop() ) {
+                        ++taken[item];
+                    }
+                }
+            }
+            while( intptr_t item = deque.pop() ) {
+                ++taken[item];
+            }
+            done = true;
+            for( auto &thief : thieves ) {
+                thief.join();
+            }
+
+            THEN( "no item is lost or taken twice" ) {
+                bool exactly_once = true;
+                for( int i = 1; i <= item_count; ++i ) {
+                    exactly_once = exactly_once && taken[i] == 1;
+                }
+                REQUIRE( exactly_once );
+            }
+        }
+    }
+}
+
+SCENARIO( "timer wheel expires timers in order, across levels", "[timer_wheel]" ) {
+
+    GIVEN( "A wheel with timers near and far, one of them cancelled" ) {
+        Eople::TimerWheel<int> wheel;
+        const Eople::u64 expiries[] = { 5, 63, 64, 65, 4095, 4097, 300000, 20000000 };
+        for( auto expiry : expiries ) {
+            wheel.Add((int)expiry, expiry);
+        }
+        auto cancelled = wheel.Add(-1, 70);
+        wheel.Cancel(cancelled);
+
+        REQUIRE( wheel.size() == sizeof(expiries)/sizeof(expiries[0]) );
+
+        WHEN( "time advances past every expiry" ) {
+            std::vector<std::pair<Eople::u64, int>> fired;
+            for( Eople::u64 tick = 0; tick < 20000010; tick += 1000 ) {
+                wheel.Advance(tick + 1000, [&]( int value ) { fired.push_back(std::make_pair(wheel.tick(), value)); });
+            }
+
+            THEN( "each timer fires once, on its tick" ) {
+                REQUIRE( fired.size() == sizeof(expiries)/sizeof(expiries[0]) );
+                bool on_time = true;
+                for( size_t i = 0; i < fired.size(); ++i ) {
+                    on_time = on_time && fired[i].first == expiries[i] && fired[i].second == (int)expiries[i];
+                }
+                REQUIRE( on_time );
+                REQUIRE( wheel.empty() );
+            }
+        }
+
+        WHEN( "time advances straight to each tick the wheel says it has work on" ) {
+            std::vector<std::pair<Eople::u64, int>> fired;
+            size_t advances = 0;
+            while( !wheel.empty() ) {
+                Eople::u64 next = wheel.NextTick();
+                REQUIRE( next > wheel.tick() );
+                wheel.Advance(next, [&]( int value ) { fired.push_back(std::make_pair(wheel.tick(), value)); });
+                ++advances;
+            }
+
+            THEN( "each timer still fires on its tick, after a few advances instead of one per tick" ) {
+                REQUIRE( fired.size() == sizeof(expiries)/sizeof(expiries[0]) );
+                bool on_time = true;
+                for( size_t i = 0; i < fired.size(); ++i ) {
+                    on_time = on_time && fired[i].first == expiries[i] && fired[i].second == (int)expiries[i];
+                }
+                REQUIRE( on_time );
+                REQUIRE( advances < 200 );
+            }
+        }
+    }
+}
+
+SCENARIO( "a process releases promises it no longer refers to", "[promise]" ) {
+
+    GIVEN( "A process with promises kept by a when block, stored in an array, passed to another process, or dropped" ) {
+        Eople::VirtualMachine vm;
+        auto process  = vm.GenerateUniqueProcess();
+        auto receiver = vm.GenerateUniqueProcess();
+
+        auto kept   = process->NewPromise();
+        auto stored = process->NewPromise();
+        auto array  = process->heap.Add(Eople::Array::Create(Eople::ArrayKind::OBJECT));
+        array->Objects().push_back(Eople::Object::BuildPromise(stored));
+        Eople::ClosureState closure(0, 2);
+        closure.state[0].SetPromise(kept);
+        closure.state[1].SetArray(array);
+        process->when_blocks.push_back(std::unique_ptr<Eople::WhenBlock>(new Eople::WhenBlock(nullptr, std::move(closure))));
+
+        // passed as a message argument: exported by the sender, adopted by the receiver
+        auto sent = process->NewPromise();
+        Eople::Object arg = Eople::Object::BuildPromise(sent);
+        process->SendObject(arg);
+        receiver->heap.Adopt(arg);
+
+        // a stale object must not be mistaken for a promise
+        Eople::Object stale;
+        stale.SetInt(12345);
+        stale.object_type = (Eople::u8)Eople::ValueType::PROMISE;
+        process->SendObject(stale);
+
+        for( int i = 0; i < 100; ++i ) {
+            process->NewPromise();
+        }
+
+        // held by the test, to see what the processes still hold
+        kept->AddRef();
+        stored->AddRef();
+        sent->AddRef();
+
+        WHEN( "the process collects its heap" ) {
+            process->CollectGarbage();
+
+            THEN( "only the promises it still refers to are kept, and the receiver holds its own reference" ) {
+                REQUIRE( process->heap.count() == 3 );
+                REQUIRE( kept->ref_count == 2 );
+                REQUIRE( stored->ref_count == 2 );
+                REQUIRE( sent->ref_count == 2 );
+                REQUIRE( stale.object_type == (Eople::u8)Eople::ValueType::NIL );
+            }
+
+            AND_WHEN( "the receiver no longer refers to the promise passed to it either" ) {
+                receiver->CollectGarbage();
+
+                THEN( "the promise is freed" ) {
+                    REQUIRE( receiver->heap.count() == 0 );
+                    REQUIRE( sent->ref_count == 1 );
+                }
+            }
+        }
+        kept->Release();
+        stored->Release();
+        sent->Release();
+    }
+}
+
+SCENARIO( "when blocks run once their promises are kept", "[when]" ) {
+
+    GIVEN( "Nested when blocks on promises kept in either order, by calls, and already kept" ) {
+        // a is kept after b and c before d, r's condition calls twice() and so is polled, the
+        // inner when r is registered after r was kept and the whenever waits on a new count each round
+        const char* source =
+            "class Server():\n"
+            "    def Slow(n):\n"
+            "        total = 0\n"
+            "        for i in 0 to 200000:\n"
+            "            total = total + i % 7\n"
+            "        end\n"
+            "        return n\n"
+            "    end\n"
+            "\n"
+            "    def Fast(n):\n"
+            "        return n\n"
+            "    end\n"
+            "end\n"
+            "\n"
+            "def twice(n):\n"
+            "    return n * 2\n"
+            "end\n"
+            "\n"
+            "def main():\n"
+            "    first = Server()\n"
+            "    second = Server()\n"
+            "    a = first->Slow(1)\n"
+            "    b = second->Fast(2)\n"
+            "    when a and b:\n"
+            "        print(\"slow first: \" + to_string(a.get_value() + b.get_value()))\n"
+            "        c = first->Fast(3)\n"
+            "        d = second->Slow(4)\n"
+            "        when c and d:\n"
+            "            print(\"slow second: \" + to_string(c.get_value() + d.get_value()))\n"
+            "            r = first->Slow(3)\n"
+            "            when r and twice(r.get_value()) == 6:\n"
+            "                print(\"polled: \" + to_string(twice(r.get_value())))\n"
+            "                when r:\n"
+            "                    print(\"already resolved: \" + to_string(r.get_value()))\n"
+            "                    rounds = 0\n"
+            "                    count = second->Fast(0)\n"
+            "                    whenever count and rounds < 3:\n"
+            "                        rounds = rounds + 1\n"
+            "                        print(\"round \" + to_string(rounds))\n"
+            "                        count = second->Fast(rounds)\n"
+            "                    end\n"
+            "                end\n"
+            "            end\n"
+            "        end\n"
+            "    end\n"
+            "end\n";
+
+        WHEN( "it runs" ) {
+            THEN( "each block runs once its condition holds, the whenever while it still holds" ) {
+                REQUIRE( Script("when_test.eop", source).Run() ==
+                    "slow first: 3\n"
+                    "slow second: 7\n"
+                    "polled: 6\n"
+                    "already resolved: 3\n"
+                    "round 1\n"
+                    "round 2\n"
+                    "round 3\n" );
+            }
+        }
+    }
+
+    GIVEN( "A process with a when block on a promise another process keeps" ) {
+        const char* source =
+            "class Server():\n"
+            "    def Get(n):\n"
+            "        return n\n"
+            "    end\n"
+            "end\n"
+            "\n"
+            "class Watcher(p):\n"
+            "    when p:\n"
+            "        print(\"watched \" + to_string(p.get_value()))\n"
+            "    end\n"
+            "\n"
+            "    def Poke():\n"
+            "    end\n"
+            "end\n"
+            "\n"
+            "def main():\n"
+            "    server = Server()\n"
+            "    a = server->Get(7)\n"
+            "    watcher = Watcher(a)\n"
+            "    when a:\n"
+            "        watcher->Poke()\n"
+            "    end\n"
+            "end\n";
+
+        WHEN( "it runs" ) {
+            THEN( "the block runs in the process that registered it" ) {
+                REQUIRE( Script("when_test.eop", source).Run() == "watched 7\n" );
+            }
+        }
+    }
+}
+
+SCENARIO( "a preempted message resumes where it stopped", "[preemption]" ) {
+
+    GIVEN( "A message with nested loops, calls and recursion" ) {
+        const char* source =
+            "def fib(n):\n"
+            "    if n < 2:\n"
+            "        return n\n"
+            "    end\n"
+            "    return fib(n-1) + fib(n-2)\n"
+            "end\n"
+            "\n"
+            "def grid(n):\n"
+            "    total = 0\n"
+            "    for i in 0 to n:\n"
+            "        j = 0\n"
+            "        while j < 10:\n"
+            "            total = total + i * j\n"
+            "            j = j + 1\n"
+            "        end\n"
+            "    end\n"
+            "    return total\n"
+            "end\n"
+            "\n"
+            "class Worker():\n"
+            "    def Run(n):\n"
+            "        total = 0\n"
+            "        elements = [1,2,3]\n"
+            "        for element in elements:\n"
+            "            total = total + element\n"
+            "        end\n"
+            "        for f in 1.0 to 3.0 by 0.5:\n"
+            "            total = total + to_int(f)\n"
+            "        end\n"
+            "        return fib(n) + grid(100) + total\n"
+            "    end\n"
+            "end\n"
+            "\n"
+            "def main():\n"
+            "    worker = Worker()\n"
+            "    a = worker->Run(15)\n"
+            "    b = worker->Run(10)\n"
+            "    when a and b:\n"
+            "        print(to_string(a.get_value()) + \" \" + to_string(b.get_value()))\n"
+            "    end\n"
+            "end\n";
+        auto run = [source]( Eople::u32 budget ) {
+            Eople::VirtualMachineConfig config;
+            config.reduction_budget = budget;
+            return Script("preemption_test.eop", source, config).Run();
+        };
+
+        WHEN( "it is preempted at every loop back-edge and call" ) {
+            THEN( "it computes the same results as when it runs to completion" ) {
+                REQUIRE( run(0) == "223372 222817\n" );
+                REQUIRE( run(1) == "223372 222817\n" );
+                REQUIRE( run(7) == "223372 222817\n" );
+            }
+        }
+    }
+}
+
+SCENARIO( "objects keep their values and types", "[object]" ) {
+
+    GIVEN( "Objects built from values at the edges of their type" ) {
+        const Eople::int_t int_min = -(Eople::int_t(1) << 47);
+        const Eople::int_t int_max = (Eople::int_t(1) << 47) - 1;
+        std::string text("text");
+        Eople::ObjectArray elements;
+
+        Eople::Object nil;
+        auto low      = Eople::Object::BuildInt(int_min);
+        auto high     = Eople::Object::BuildInt(int_max);
+        auto neg_zero = Eople::Object::BuildFloat(-0.0);
+        auto neg_inf  = Eople::Object::BuildFloat(-std::numeric_limits<double>::infinity());
+        auto nan      = Eople::Object::BuildFloat(-std::numeric_limits<double>::quiet_NaN());
+        auto truth    = Eople::Object::BuildBool(1);
+        auto string   = Eople::Object::BuildString(&text);
+        auto array    = Eople::Object::BuildArray(&elements);
+
+        THEN( "their values read back unchanged" ) {
+            REQUIRE( (Eople::int_t)low.int_val == int_min );
+            REQUIRE( (Eople::int_t)high.int_val == int_max );
+            REQUIRE( (Eople::float_t)neg_zero.float_val == 0.0 );
+            REQUIRE( std::signbit((Eople::float_t)neg_zero.float_val) );
+            REQUIRE( (Eople::float_t)neg_inf.float_val == -std::numeric_limits<double>::infinity() );
+            REQUIRE( std::isnan((Eople::float_t)nan.float_val) );
+            REQUIRE( (Eople::bool_t)truth.bool_val == 1 );
+            REQUIRE( (Eople::string_t)string.string_ref == &text );
+            REQUIRE( (Eople::array_ptr_t)array.array_ref == &elements );
+        }
+
+        THEN( "their types read back unchanged" ) {
+            REQUIRE( nil.object_type == (Eople::u8)Eople::ValueType::NIL );
+            REQUIRE( low.object_type == (Eople::u8)Eople::ValueType::INT );
+            REQUIRE( high.object_type == (Eople::u8)Eople::ValueType::INT );
+            REQUIRE( neg_zero.object_type == (Eople::u8)Eople::ValueType::FLOAT );
+            REQUIRE( neg_inf.object_type == (Eople::u8)Eople::ValueType::FLOAT );
+            REQUIRE( nan.object_type == (Eople::u8)Eople::ValueType::FLOAT );
+            REQUIRE( truth.object_type == (Eople::u8)Eople::ValueType::BOOL );
+            REQUIRE( string.object_type == (Eople::u8)Eople::ValueType::STRING );
+            REQUIRE( array.object_type == (Eople::u8)Eople::ValueType::ARRAY );
+        }
+    }
+
+    GIVEN( "Int arithmetic past 48 bits" ) {
+        const char* source =
+            "def main():\n"
+            "    high = 140737488355327\n"
+            "    low = 0 - high - 1\n"
+            "    print(high + 1)\n"
+            "    print(low - 1)\n"
+            "    print(high * 2)\n"
+            "end\n";
+        std::string output = Script("int_wrap_test.eop", source).Run();
+
+        THEN( "NaN-boxed ints wrap at 48 bits, others keep all 64" ) {
+#if EOPLE_NAN_BOXING
+            REQUIRE( output == "-140737488355328\n140737488355327\n-2\n" );
+#else
+            REQUIRE( output == "140737488355328\n-140737488355329\n281474976710654\n" );
+#endif
+        }
+    }
+}
+
+SCENARIO( "typed arrays hold their elements unboxed", "[array]" ) {
+
+    GIVEN( "Arrays of ints, floats, bools and strings" ) {
+        const char* source =
+            "def main():\n"
+            "    ints = [1, 2, 3]\n"
+            "    ints.push(4)\n"
+            "    ints[0] = ints[1] * 10\n"
+            "    print(ints)\n"
+            "    print(ints[3] + 1)\n"
+            "    floats = array(:float)\n"
+            "    floats.push(1.5)\n"
+            "    floats.push(2.5)\n"
+            "    floats[1] = floats[0] * 2.0\n"
+            "    print(floats)\n"
+            "    bools = [true, false]\n"
+            "    bools.push(true)\n"
+            "    bools[1] = true\n"
+            "    count = 0\n"
+            "    for b in bools:\n"
+            "        if b:\n"
+            "            count = count + 1\n"
+            "        end\n"
+            "    end\n"
+            "    print(count)\n"
+            "    ints.pop()\n"
+            "    print(ints.top())\n"
+            "    total = 0\n"
+            "    for i in ints:\n"
+            "        total = total + i\n"
+            "    end\n"
+            "    print(total + ints.size())\n"
+            "    strings = [\"a\", \"b\"]\n"
+            "    strings.push(\"c\")\n"
+            "    strings[0] = \"z\"\n"
+            "    print(strings)\n"
+            "end\n";
+        WHEN( "they are built, grown, indexed, stored to and iterated" ) {
+            Script script("typed_array_test.eop", source);
+            std::string output = script.Run();
+
+            THEN( "every builtin sees the same elements" ) {
+                REQUIRE( output == "[20, 2, 3, 4]\n5\n[1.5, 3]\n3\n3\n28\n['z', 'b', 'c']\n" );
+            }
+        }
+    }
+}
+
+SCENARIO( "copies of an array share its elements until one of them changes", "[array_cow]" ) {
+
+    GIVEN( "An array of ints and a copy of it" ) {
+        Eople::Array* original = Eople::Array::Create(Eople::ArrayKind::INT);
+        original->Ints() = { 1, 2, 3 };
+        Eople::Array* copy = original->Copy();
+
+        THEN( "they share the same elements, and neither can change them in place" ) {
+            REQUIRE( copy->Ints().data() == original->Ints().data() );
+            REQUIRE( !static_cast<Eople::IntArray*>(original)->IsWritable() );
+            REQUIRE( !static_cast<Eople::IntArray*>(copy)->IsWritable() );
+        }
+        WHEN( "the copy changes" ) {
+            copy->MakeWritable();
+            copy->Ints()[0] = 10;
+            copy->Ints().push_back(4);
+
+            THEN( "it has elements of its own, and the original is untouched" ) {
+                REQUIRE( copy->Ints().data() != original->Ints().data() );
+                REQUIRE( copy->Ints() == std::vector<Eople::int_t>({ 10, 2, 3, 4 }) );
+                REQUIRE( original->Ints() == std::vector<Eople::int_t>({ 1, 2, 3 }) );
+                REQUIRE( static_cast<Eople::IntArray*>(original)->IsWritable() );
+            }
+        }
+        WHEN( "the original is cleared" ) {
+            original->clear();
+
+            THEN( "the copy keeps the elements" ) {
+                REQUIRE( original->empty() );
+                REQUIRE( copy->size() == 3 );
+            }
+        }
+        Eople::Array::Destroy(copy);
+        Eople::Array::Destroy(original);
+    }
+
+    GIVEN( "A copy of an array of arrays that changes" ) {
+        Eople::Array* inner = Eople::Array::Create(Eople::ArrayKind::FLOAT);
+        inner->Floats() = { 0.5 };
+        Eople::Array* outer = Eople::Array::Create(Eople::ArrayKind::OBJECT);
+        outer->Objects().push_back(Eople::Object::BuildArray(inner));
+        Eople::Array* copy = outer->Copy();
+        copy->MakeWritable();
+        copy->Objects().pop_back();
+
+        THEN( "only the outer elements are copied, the arrays in them are the same" ) {
+            REQUIRE( copy->empty() );
+            REQUIRE( outer->size() == 1 );
+            REQUIRE( outer->Objects()[0].array_ref == inner );
+        }
+        Eople::Array::Destroy(copy);
+        Eople::Array::Destroy(outer);
+        Eople::Array::Destroy(inner);
+    }
+
+    GIVEN( "A reply sharing its array with the process that sent it, and a literal changed by every call" ) {
+        const char* source =
+            "class Keeper():\n"
+            "    data = array(:int)\n"
+            "    def Fill(n):\n"
+            "        for i in 0 to n:\n"
+            "            data.push(i)\n"
+            "        end\n"
+            "        return data\n"
+            "    end\n"
+            "    def Bump():\n"
+            "        data[0] = 100\n"
+            "        return data.sum()\n"
+            "    end\n"
+            "end\n"
+            "\n"
+            "def literal():\n"
+            "    a = [1, 2, 3]\n"
+            "    a[0] = a[0] + 10\n"
+            "    return a.sum()\n"
+            "end\n"
+            "\n"
+            "def main():\n"
+            "    k = Keeper()\n"
+            "    got = k->Fill(5)\n"
+            "    s = k->Bump()\n"
+            "    when got and s:\n"
+            "        d = got.get_value()\n"
+            "        e = got.get_value()\n"
+            "        d[1] = 50\n"
+            "        print(d)\n"
+            "        print(e)\n"
+            "        print(s.get_value())\n"
+            "        print(literal())\n"
+            "        print(literal())\n"
+            "    end\n"
+            "end\n";
+        Script script("array_cow_test.eop", source);
+        std::string output = script.Run();
+
+        THEN( "every change is seen only by the array it was made to" ) {
+            REQUIRE( output ==
+                "[0, 50, 2, 3, 4]\n"
+                "[0, 1, 2, 3, 4]\n"
+                "110\n"
+                "16\n"
+                "16\n" );
+        }
+    }
+}
+
+SCENARIO( "slices of an array read its elements without copying them", "[array_slice]" ) {
+
+    GIVEN( "An array of ints and a slice of it" ) {
+        Eople::Array* parent = Eople::Array::Create(Eople::ArrayKind::INT);
+        parent->Ints() = { 0, 1, 2, 3, 4, 5 };
+        Eople::Array* slice = parent->Slice(2, 3);
+
+        THEN( "the slice reads the range from the same elements" ) {
+            REQUIRE( slice->view );
+            REQUIRE( slice->size() == 3 );
+            REQUIRE( slice->IntRange().data() == parent->Ints().data() + 2 );
+            REQUIRE( slice->Get(0).int_val == 2 );
+            REQUIRE( !static_cast<Eople::IntArray*>(slice)->IsWritable() );
+        }
+        WHEN( "the slice changes" ) {
+            slice->MakeWritable();
+            slice->Ints()[0] = 20;
+
+            THEN( "it has just its range of its own, and the parent is untouched" ) {
+                REQUIRE( !slice->view );
+                REQUIRE( slice->Ints() == std::vector<Eople::int_t>({ 20, 3, 4 }) );
+                REQUIRE( parent->Ints() == std::vector<Eople::int_t>({ 0, 1, 2, 3, 4, 5 }) );
+            }
+        }
+        WHEN( "the slice is sliced and copied" ) {
+            Eople::Array* inner = slice->Slice(1, 2);
+            Eople::Array* copy = inner->Copy();
+
+            THEN( "both read the range of the parent" ) {
+                REQUIRE( inner->IntRange().data() == parent->Ints().data() + 3 );
+                REQUIRE( copy->IntRange().data() == parent->Ints().data() + 3 );
+                REQUIRE( copy->size() == 2 );
+            }
+            Eople::Array::Destroy(copy);
+            Eople::Array::Destroy(inner);
+        }
+        WHEN( "the parent goes away" ) {
+            Eople::Array::Destroy(parent);
+            parent = nullptr;
+
+            THEN( "the slice keeps the elements" ) {
+                REQUIRE( slice->Get(2).int_val == 4 );
+            }
+        }
+        Eople::Array::Destroy(slice);
+        if( parent ) {
+            Eople::Array::Destroy(parent);
+        }
+    }
+
+    GIVEN( "Chunks of an array sent to another process, and slices of other kinds" ) {
+        const char* source =
+            "class Summer():\n"
+            "    def Sum(chunk):\n"
+            "        total = 0\n"
+            "        for x in chunk:\n"
+            "            total = total + x\n"
+            "        end\n"
+            "        return total + chunk[0] * 1000\n"
+            "    end\n"
+            "end\n"
+            "\n"
+            "def main():\n"
+            "    data = array(:int)\n"
+            "    for i in 0 to 10:\n"
+            "        data.push(i)\n"
+            "    end\n"
+            "    s = Summer()\n"
+            "    first = s->Sum(data.slice(0, 5))\n"
+            "    second = s->Sum(data.slice(5, 10))\n"
+            "    part = data.slice(2, 6)\n"
+            "    part[0] = 99\n"
+            "    print(part)\n"
+            "    print(data.size())\n"
+            "    names = [\"a\", \"b\", \"c\"]\n"
+            "    print(names.slice(1, 3))\n"
+            "    when first and second:\n"
+            "        print(first.get_value())\n"
+            "        print(second.get_value())\n"
+            "    end\n"
+            "end\n";
+        Script script("array_slice_test.eop", source);
+        std::string output = script.Run();
+
+        THEN( "every chunk reads its own range, and a changed slice leaves the array alone" ) {
+            REQUIRE( output ==
+                "[99, 3, 4, 5]\n"
+                "10\n"
+                "['b', 'c']\n"
+                "10\n"
+                "5035\n" );
+        }
+    }
+}
+
+SCENARIO( "dicts find every key they were given", "[dict]" ) {
+
+    GIVEN( "A dict grown well past its first table" ) {
+        Eople::Dict dict;
+        const int count = 1000;
+        for( int i = 0; i < count; ++i ) {
+            dict["key" + std::to_string(i)] = Eople::Object::BuildInt(i);
+        }
+
+        THEN( "keys are interned once" ) {
+            REQUIRE( Eople::Dict::Intern("key7") == Eople::Dict::Intern(std::string("key") + "7") );
+            REQUIRE( Eople::Dict::Intern("key7")->hash == Eople::Dict::Hash("key7") );
+        }
+
+        THEN( "every key is found, by interned key and by text" ) {
+            REQUIRE( dict.size() == count );
+            for( int i = 0; i < count; ++i ) {
+                std::string text = "key" + std::to_string(i);
+                Eople::Object* by_key  = dict.Find(Eople::Dict::Intern(text));
+                Eople::Object* by_text = dict.Find(text);
+                REQUIRE( by_key );
+                REQUIRE( by_key == by_text );
+                REQUIRE( (Eople::int_t)by_key->int_val == i );
+            }
+            REQUIRE( dict.Find("key") == nullptr );
+            REQUIRE( dict.Find(std::to_string(count)) == nullptr );
+        }
+
+        THEN( "entries keep their insertion order" ) {
+            int i = 0;
+            for( auto &entry : dict ) {
+                REQUIRE( entry.key->text == "key" + std::to_string(i) );
+                ++i;
+            }
+        }
+
+        WHEN( "an existing key is assigned" ) {
+            dict["key5"] = Eople::Object::BuildInt(-5);
+
+            THEN( "it is replaced in place" ) {
+                REQUIRE( dict.size() == count );
+                REQUIRE( (Eople::int_t)dict.Find("key5")->int_val == -5 );
+            }
+        }
+    }
+}
+
+SCENARIO( "struct members are read and written in place", "[struct]" ) {
+
+    GIVEN( "A program using structs on their own, in arrays and in messages" ) {
+        const char* source =
+            "struct Point(x, y)\n"
+            "struct Named(name, at)\n"
+            "\n"
+            "def get_x(p):\n"
+            "    return p.x\n"
+            "end\n"
+            "\n"
+            "def main():\n"
+            "    p = Point(1, 2.5)\n"
+            "    p.x = p.x + 6\n"
+            "    print(p)\n"
+            "    print(get_x(p))\n"
+            "    n = Named('origin', Point(0, 0.5))\n"
+            "    print(n)\n"
+            "    q = n.at\n"
+            "    print(q.y)\n"
+            "    points = array(:Point)\n"
+            "    points.push(p)\n"
+            "    points.push(Point(10, 0.25))\n"
+            "    p.x = 100\n"
+            "    i = 1\n"
+            "    points[i].x = points[i].x + 1\n"
+            "    total = 0\n"
+            "    for point in points:\n"
+            "        total = total + point.x\n"
+            "    end\n"
+            "    print(points)\n"
+            "    print(total)\n"
+            "    counter = Counter()\n"
+            "    sum = counter->Add(Point(5, 1.5))\n"
+            "    when sum:\n"
+            "        print(sum.get_value())\n"
+            "    end\n"
+            "end\n"
+            "\n"
+            "class Counter():\n"
+            "    def Add(p):\n"
+            "        return p.x\n"
+            "    end\n"
+            "end\n";
+        Script script("struct_test.eop", source);
+        std::string output = script.Run();
+
+        THEN( "members keep their values, and arrays hold copies" ) {
+            REQUIRE( output ==
+                "Point(7, 2.5)\n"
+                "7\n"
+                "Named('origin', Point(0, 0.5))\n"
+                "0.5\n"
+                "[Point(7, 2.5), Point(11, 0.25)]\n"
+                "18\n"
+                "5\n" );
+        }
+    }
+}
+
+SCENARIO( "string literals are interned and never changed", "[string]" ) {
+
+    GIVEN( "Interned strings" ) {
+        Eople::string_t a = Eople::StringTable::Intern("tag");
+        Eople::string_t b = Eople::StringTable::Intern("other");
+        std::string text("tag");
+
+        THEN( "the same text is the same string" ) {
+            REQUIRE( Eople::StringTable::Intern(std::string("tag")) == a );
+            REQUIRE( *a == "tag" );
+            REQUIRE( Eople::StringTable::IsInterned(a) );
+            REQUIRE_FALSE( Eople::StringTable::IsInterned(&text) );
+        }
+        THEN( "equality holds between interned and ordinary strings" ) {
+            REQUIRE( Eople::StringTable::Equal(a, a) );
+            REQUIRE_FALSE( Eople::StringTable::Equal(a, b) );
+            REQUIRE( Eople::StringTable::Equal(a, &text) );
+            REQUIRE( Eople::StringTable::Equal(&text, a) );
+        }
+    }
+
+    GIVEN( "A program appending to locals that start out as literals" ) {
+        const char* source =
+            "def tag(n):\n"
+            "    s = 'ab'\n"
+            "    s = s + 'c'\n"
+            "    return s\n"
+            "end\n"
+            "\n"
+            "def main():\n"
+            "    print(tag(1))\n"
+            "    print(tag(2))\n"
+            "    a = 'x'\n"
+            "    for i in 0 to 3:\n"
+            "        a = a + 'y'\n"
+            "    end\n"
+            "    print(a)\n"
+            "    print('x')\n"
+            "    if a == 'xyyy':\n"
+            "        print('equal')\n"
+            "    end\n"
+            "    if a != 'xyy':\n"
+            "        print('not equal')\n"
+            "    end\n"
+            "end\n";
+        Script script("string_test.eop", source);
+        std::string output = script.Run();
+
+        THEN( "the literals keep their text" ) {
+            REQUIRE( output == "abc\nabc\nxyyy\nx\nequal\nnot equal\n" );
+        }
+    }
+}
+
+SCENARIO( "strings that outlive a message are kept out of its string region", "[string_region]" ) {
+
+    GIVEN( "Messages that keep strings in members, arrays, structs, replies and when blocks" ) {
+        const char* source =
+            "struct Tagged(name, n)\n"
+            "\n"
+            "class Keeper():\n"
+            "    last = 'none'\n"
+            "    names = array(:string)\n"
+            "    tags = array(:Tagged)\n"
+            "\n"
+            "    def Keep(prefix, n):\n"
+            "        last = prefix + to_string(n)\n"
+            "        name = prefix + '-' + to_string(n)\n"
+            "        names.push(name)\n"
+            "        tags.push(Tagged(prefix + '#' + to_string(n), n))\n"
+            "        return 'kept ' + last\n"
+            "    end\n"
+            "\n"
+            "    def Churn(n):\n"
+            "        s = ''\n"
+            "        for i in 0 to n:\n"
+            "            s = s + 'zzzzzzzzzzzzzzzzzzzz' + to_string(i)\n"
+            "        end\n"
+            "        return n\n"
+            "    end\n"
+            "\n"
+            "    def Show():\n"
+            "        print(last)\n"
+            "        print(names)\n"
+            "        print(tags)\n"
+            "        return last + '!'\n"
+            "    end\n"
+            "end\n"
+            "\n"
+            "def main():\n"
+            "    keeper = Keeper()\n"
+            "    a = keeper->Keep('alpha', 1)\n"
+            "    b = keeper->Churn(300)\n"
+            "    c = keeper->Keep('beta', 2)\n"
+            "    d = keeper->Churn(50)\n"
+            "    e = keeper->Show()\n"
+            "    when a and c and e:\n"
+            "        print(a.get_value())\n"
+            "        print(c.get_value())\n"
+            "        print(e.get_value())\n"
+            "    end\n"
+            "end\n";
+        auto run = [source]( bool string_regions, Eople::u32 budget ) {
+            Eople::VirtualMachineConfig config;
+            config.string_regions   = string_regions;
+            config.reduction_budget = budget;
+            return Script("string_region_test.eop", source, config).Run();
+        };
+
+        const char* expected =
+            "beta2\n"
+            "['alpha-1', 'beta-2']\n"
+            "[Tagged('alpha#1', 1), Tagged('beta#2', 2)]\n"
+            "kept alpha1\n"
+            "kept beta2\n"
+            "beta2!\n";
+
+        THEN( "they survive later messages, with or without regions and preemption" ) {
+            REQUIRE( run(true, 0) == expected );
+            REQUIRE( run(true, 1) == expected );
+            REQUIRE( run(false, 0) == expected );
+        }
+    }
+}
+
+SCENARIO( "chains of + on strings are joined by one instruction", "[string_concat]" ) {
+
+    GIVEN( "A program joining strings in expressions, loops and a builder kept by a process" ) {
+        const char* source =
+            "class Journal():\n"
+            "    text = string_builder(4)\n"
+            "    def Add(n):\n"
+            "        text.append('#' + to_string(n) + ';')\n"
+            "        return 0\n"
+            "    end\n"
+            "    def Get():\n"
+            "        return text\n"
+            "    end\n"
+            "end\n"
+            "\n"
+            "def main():\n"
+            "    names = array(:string)\n"
+            "    names.push(to_string(7))\n"
+            "    print(names[0] + '!')\n"
+            "    print(names[0] + '-' + names[0] + '-')\n"
+            "    print(names)\n"
+            "    x = 3\n"
+            "    s = 'a' + to_string(x) + 'b' + ('c' + to_string(x + 1))\n"
+            "    print(s)\n"
+            "    t = ''\n"
+            "    for i in 0 to 5:\n"
+            "        t = t + to_string(i) + ','\n"
+            "    end\n"
+            "    print(t)\n"
+            "    t = '[' + t + ']' + t\n"
+            "    print(t)\n"
+            "    j = Journal()\n"
+            "    j->Add(1)\n"
+            "    j->Add(2)\n"
+            "    got = j->Get()\n"
+            "    when got:\n"
+            "        print(got.get_value())\n"
+            "    end\n"
+            "end\n";
+        Script script("string_concat_test.eop", source);
+        std::string output = script.Run();
+
+        THEN( "every string is joined in order, and the strings read are left alone" ) {
+            REQUIRE( output ==
+                "7!\n"
+                "7-7-\n"
+                "['7']\n"
+                "a3bc4\n"
+                "0,1,2,3,4,\n"
+                "[0,1,2,3,4,]0,1,2,3,4,\n"
+                "#1;#2;\n" );
+        }
+    }
+}
+
+SCENARIO( "common instruction pairs are fused into one instruction", "[peephole]" ) {
+
+    GIVEN( "A program with branches, loops, array arithmetic and a when block" ) {
+        const char* source =
+            "class Doubler():\n"
+            "    def Get(n):\n"
+            "        return n * 2\n"
+            "    end\n"
+            "end\n"
+            "\n"
+            "def classify(n):\n"
+            "    if n < 0:\n"
+            "        return 0\n"
+            "    elif n == 0:\n"
+            "        return 1\n"
+            "    elif n <= 2:\n"
+            "        return 2\n"
+            "    elif n != 5:\n"
+            "        if n >= 9:\n"
+            "            return 4\n"
+            "        end\n"
+            "        return 3\n"
+            "    else:\n"
+            "        return 5\n"
+            "    end\n"
+            "end\n"
+            "\n"
+            "def compare_floats(x, y):\n"
+            "    count = 0\n"
+            "    if x > y:\n"
+            "        count = count + 1\n"
+            "    end\n"
+            "    if x < y:\n"
+            "        count = count + 10\n"
+            "    end\n"
+            "    if x == y:\n"
+            "        count = count + 100\n"
+            "    end\n"
+            "    if x != y:\n"
+            "        count = count + 1000\n"
+            "    end\n"
+            "    if x <= y:\n"
+            "        count = count + 10000\n"
+            "    end\n"
+            "    if x >= y:\n"
+            "        count = count + 100000\n"
+            "    end\n"
+            "    return count\n"
+            "end\n"
+            "\n"
+            "def main():\n"
+            "    for i in -1 to 11:\n"
+            "        print(classify(i))\n"
+            "    end\n"
+            "    zero = 0.0\n"
+            "    nan = zero / zero\n"
+            "    print(compare_floats(1.0, 2.0))\n"
+            "    print(compare_floats(2.0, 2.0))\n"
+            "    print(compare_floats(nan, 2.0))\n"
+            "    values = array(:float)\n"
+            "    ints = array(:int)\n"
+            "    for i in 0 to 6:\n"
+            "        half = to_float(i) * 0.5\n"
+            "        values.push(half)\n"
+            "        triple = i * 3\n"
+            "        ints.push(triple)\n"
+            "    end\n"
+            "    total = 0.0\n"
+            "    product = 1.0\n"
+            "    isum = 0\n"
+            "    iproduct = 1\n"
+            "    for i in 0 to 6:\n"
+            "        total = total + values[i]\n"
+            "        total = values[i] + total\n"
+            "        product = values[i] * product\n"
+            "        isum = ints[i] + isum * 2\n"
+            "        iproduct = ints[i] * 2 * iproduct\n"
+            "        if ints[i] > 9:\n"
+            "            isum = isum + 1\n"
+            "        end\n"
+            "    end\n"
+            "    print(total)\n"
+            "    print(product)\n"
+            "    print(isum)\n"
+            "    print(iproduct)\n"
+            "    a = 3\n"
+            "    b = 4.0\n"
+            "    hi = a * 3\n"
+            "    for i in (a + 1) to hi:\n"
+            "        x = i * a + 1\n"
+            "        y = 1 + i * a\n"
+            "        z = to_float(i) * b + 0.25\n"
+            "        print(x + y)\n"
+            "        print(z)\n"
+            "    end\n"
+            "    j = 0\n"
+            "    k = 0\n"
+            "    while j * 2 < 20:\n"
+            "        if j % 3 == 0:\n"
+            "            k = k * 2 + j\n"
+            "        end\n"
+            "        j = j + 1\n"
+            "    end\n"
+            "    print(k)\n"
+            "    d = Doubler()\n"
+            "    got = d->Get(3)\n"
+            "    when got:\n"
+            "        v = got.get_value()\n"
+            "        if v > 5:\n"
+            "            print(v * 2 + 1)\n"
+            "        else:\n"
+            "            print(0)\n"
+            "        end\n"
+            "    end\n"
+            "end\n";
+        Eople::VirtualMachineConfig config;
+#if EOPLE_THREADED_DISPATCH
+        config.count_opcode_pairs = true;
+#endif
+        Script script("peephole_test.eop", source, config);
+        std::string output = script.Run();
+
+        THEN( "it computes the same as the separate instructions, NaN comparisons failing" ) {
+            REQUIRE( output ==
+                "0\n"
+                "1\n"
+                "2\n"
+                "2\n"
+                "3\n"
+                "3\n"
+                "5\n"
+                "3\n"
+                "3\n"
+                "3\n"
+                "4\n"
+                "4\n"
+                "11010\n"
+                "110100\n"
+                "1000\n"
+                "15\n"
+                "0\n"
+                "174\n"
+                "0\n"
+                "26\n"
+                "16.25\n"
+                "32\n"
+                "20.25\n"
+                "38\n"
+                "24.25\n"
+                "44\n"
+                "28.25\n"
+                "50\n"
+                "32.25\n"
+                "33\n"
+                "13\n" );
+        }
+#if EOPLE_THREADED_DISPATCH
+        THEN( "the fused instructions run instead of the pairs" ) {
+            auto pairs = script.ee.OpcodePairs()->MostFrequent((size_t)-1);
+            auto ran = [&pairs]( Eople::Opcode opcode ) {
+                return std::any_of(pairs.begin(), pairs.end(), [opcode]( const Eople::OpcodePairCounts::Pair &pair ) {
+                    return pair.first == opcode || pair.second == opcode;
+                });
+            };
+            auto ran_pair = [&pairs]( Eople::Opcode first, Eople::Opcode second ) {
+                return std::any_of(pairs.begin(), pairs.end(), [first, second]( const Eople::OpcodePairCounts::Pair &pair ) {
+                    return pair.first == first && pair.second == second;
+                });
+            };
+            REQUIRE_FALSE( ran(Eople::Opcode::JumpIf) );
+            REQUIRE_FALSE( ran_pair(Eople::Opcode::MulF, Eople::Opcode::AddF) );
+            REQUIRE( ran(Eople::Opcode::JumpGEQK) );
+            REQUIRE( ran(Eople::Opcode::JumpNotGTF) );
+            REQUIRE( ran(Eople::Opcode::AddSubscriptF) );
+            REQUIRE( ran(Eople::Opcode::MulSubscriptI) );
+            REQUIRE( ran(Eople::Opcode::MulAddI) );
+            REQUIRE( ran(Eople::Opcode::MulAddF) );
+        }
+#endif
+    }
+}
+
+SCENARIO( "constants are read in place and locals cleared only if read before written", "[constants]" ) {
+
+    GIVEN( "Functions with constants on either side of an operator, and locals read before they are written" ) {
+        const char* source =
+            "def inc(x):\n"
+            "    return x + 1\n"
+            "end\n"
+            "\n"
+            "def scale(x):\n"
+            "    return 2 * x - 1\n"
+            "end\n"
+            "\n"
+            "def half(f):\n"
+            "    return 0.5 * f / 2.0 - 0.25\n"
+            "end\n"
+            "\n"
+            "def seven():\n"
+            "    return 7\n"
+            "end\n"
+            "\n"
+            "def check(n, f):\n"
+            "    count = 0\n"
+            "    if 10 > n:\n"
+            "        count = count + 1\n"
+            "    end\n"
+            "    if n == 3:\n"
+            "        count = count + 10\n"
+            "    end\n"
+            "    if 1.5 < f:\n"
+            "        count = count + 100\n"
+            "    end\n"
+            "    if f != 2.5:\n"
+            "        count = count + 1000\n"
+            "    end\n"
+            "    return count\n"
+            "end\n"
+            "\n"
+            "def fib(n):\n"
+            "    if n < 2:\n"
+            "        return n\n"
+            "    end\n"
+            "    return fib(n - 1) + fib(n - 2)\n"
+            "end\n"
+            "\n"
+            "def dirty():\n"
+            "    a = 41\n"
+            "    b = 42\n"
+            "    return a + b\n"
+            "end\n"
+            "\n"
+            "def maybe(flag):\n"
+            "    if flag:\n"
+            "        x = 5\n"
+            "    end\n"
+            "    return x\n"
+            "end\n"
+            "\n"
+            "def tally(n):\n"
+            "    for i in 0 to n:\n"
+            "        total = total + i\n"
+            "    end\n"
+            "    return total\n"
+            "end\n"
+            "\n"
+            "def repeat(n):\n"
+            "    s = ''\n"
+            "    for i in 0 to n:\n"
+            "        s = s + 'a'\n"
+            "    end\n"
+            "    return s\n"
+            "end\n"
+            "\n"
+            "def main():\n"
+            "    print(inc(41))\n"
+            "    print(scale(5))\n"
+            "    print(half(3.0))\n"
+            "    print(seven())\n"
+            "    print(check(3, 2.0))\n"
+            "    print(check(12, 1.0))\n"
+            "    zero = 0.0\n"
+            "    nan = zero / zero\n"
+            "    print(check(0, nan))\n"
+            "    print(dirty())\n"
+            "    print(maybe(false))\n"
+            "    print(dirty())\n"
+            "    print(maybe(true))\n"
+            "    print(dirty())\n"
+            "    print(tally(4))\n"
+            "    print(fib(15))\n"
+            "    print(repeat(3))\n"
+            "end\n";
+        Eople::VirtualMachineConfig config;
+        config.count_opcode_pairs = true;
+        Script script("constants_test.eop", source, config);
+        std::string output = script.Run();
+
+        THEN( "results are the same, and locals read before written in a branch or loop read 0 after another call's locals" ) {
+            REQUIRE( output ==
+                "42\n"
+                "9\n"
+                "0.5\n"
+                "7\n"
+                "1111\n"
+                "1000\n"
+                "1001\n"
+                "83\n"
+                "0\n"
+                "83\n"
+                "5\n"
+                "83\n"
+                "6\n"
+                "610\n"
+                "aaa\n" );
+        }
+#if EOPLE_THREADED_DISPATCH
+        THEN( "the instructions read the constants themselves" ) {
+            auto pairs = script.ee.OpcodePairs()->MostFrequent((size_t)-1);
+            auto ran = [&pairs]( Eople::Opcode opcode ) {
+                return std::any_of(pairs.begin(), pairs.end(), [opcode]( const Eople::OpcodePairCounts::Pair &pair ) {
+                    return pair.first == opcode || pair.second == opcode;
+                });
+            };
+            REQUIRE( ran(Eople::Opcode::AddIK) );
+            REQUIRE( ran(Eople::Opcode::MulIK) );
+            REQUIRE( ran(Eople::Opcode::SubIK) );
+            REQUIRE( ran(Eople::Opcode::MulFK) );
+            REQUIRE( ran(Eople::Opcode::DivFK) );
+            REQUIRE( ran(Eople::Opcode::SubFK) );
+            REQUIRE( ran(Eople::Opcode::StoreK) );
+            REQUIRE( ran(Eople::Opcode::ReturnValueK) );
+            REQUIRE( ran(Eople::Opcode::JumpGEQK) );
+            REQUIRE( ran(Eople::Opcode::JumpNotGTFK) );
+            REQUIRE( ran(Eople::Opcode::JumpNotNEQFK) );
+        }
+#endif
+    }
+}
+
+SCENARIO( "calls keep their frames on one stack of frame records", "[call_frames]" ) {
+
+    GIVEN( "Deep recursion, calls from inside loops, and an exception thrown many calls deep" ) {
+        std::string source =
+            "def depth(n):\n"
+            "    if n == 0:\n"
+            "        return 0\n"
+            "    end\n"
+            "    return depth(n - 1) + 1\n"
+            "end\n"
+            "\n"
+            "def loops(n):\n"
+            "    total = 0\n"
+            "    for i in 0 to 3:\n"
+            "        if n > 0:\n"
+            "            total = total + loops(n - 1)\n"
+            "        end\n"
+            "        total = total + 1\n"
+            "    end\n"
+            "    return total\n"
+            "end\n"
+            "\n"
+            "def fail(n, a):\n"
+            "    if n == 0:\n"
+            "        return a[5]\n"
+            "    end\n"
+            "    x = fail(n - 1, a)\n"
+            "    return x\n"
+            "end\n"
+            "\n"
+            "def bad():\n"
+            "    a = [1]\n"
+            "    print(fail(50, a))\n"
+            "end\n"
+            "\n"
+            "def main():\n"
+#if EOPLE_THREADED_DISPATCH
+            // the threaded interpreter doesn't recurse on the native stack
+            "    print(depth(100000))\n"
+#else
+            "    print(depth(1000))\n"
+#endif
+            "    print(loops(3))\n"
+            "end\n";
+        Script script("call_frames_test.eop", source);
+        std::string output = script.Run({ "main", "bad", "main" }, false);
+
+        THEN( "every call returns to its caller, and the frames of the failed calls are dropped" ) {
+            REQUIRE( output ==
+#if EOPLE_THREADED_DISPATCH
+                "100000\n"
+#else
+                "1000\n"
+#endif
+                "120\n"
+#if EOPLE_THREADED_DISPATCH
+                "100000\n"
+#else
+                // each call runs its own ExecutionLoop, so only the innermost call gives up
+                "0\n"
+                "1000\n"
+#endif
+                "120\n" );
+            REQUIRE( script.errors.find("Array index out of bounds.") != std::string::npos );
+        }
+    }
+}
+
+SCENARIO( "calls to small functions are replaced by their code", "[inline]" ) {
+
+    GIVEN( "Small helpers, one writing its parameter, one calling another, and a recursive function" ) {
+        const char* source =
+            "def min(a, b):\n"
+            "    if a < b:\n"
+            "        return a\n"
+            "    end\n"
+            "    return b\n"
+            "end\n"
+            "\n"
+            "def inc(x):\n"
+            "    return x + 1\n"
+            "end\n"
+            "\n"
+            "def mix(a, b):\n"
+            "    t = a * 3\n"
+            "    u = t + b\n"
+            "    return u - 2\n"
+            "end\n"
+            "\n"
+            "def half(f):\n"
+            "    return 0.5 * f / 2.0 - 0.25\n"
+            "end\n"
+            "\n"
+            "def bump(a):\n"
+            "    a = a + 10\n"
+            "    return a * 2\n"
+            "end\n"
+            "\n"
+            "def clamp(x):\n"
+            "    return min(x, 10)\n"
+            "end\n"
+            "\n"
+            "def fact(n):\n"
+            "    if n < 2:\n"
+            "        return 1\n"
+            "    end\n"
+            "    return n * fact(n - 1)\n"
+            "end\n"
+            "\n"
+            "def main():\n"
+            "    n = 0\n"
+            "    m = 0\n"
+            "    lo = 100\n"
+            "    for i in 0 to 20:\n"
+            "        n = inc(n)\n"
+            "        m = mix(m, i)\n"
+            "        lo = min(lo, 20 - i)\n"
+            "    end\n"
+            "    print(n)\n"
+            "    print(m)\n"
+            "    print(lo)\n"
+            "    print(half(3.0))\n"
+            "    b = 1\n"
+            "    print(bump(b))\n"
+            "    print(b)\n"
+            "    print(clamp(3))\n"
+            "    print(clamp(30))\n"
+            "    print(min(7, 2) + inc(inc(1)))\n"
+            "    inc(4)\n"
+            "    print(fact(5))\n"
+            "end\n";
+        Eople::VirtualMachineConfig config;
+        size_t inlined_calls = 0;
+        size_t calls = 0;
+        std::string inlined = RunScript("inline_test.eop", source, config, &inlined_calls);
+        config.inline_functions = false;
+        std::string called = RunScript("inline_test.eop", source, config, &calls);
+
+        THEN( "results are the same as when the functions are called" ) {
+            REQUIRE( inlined ==
+                "20\n"
+                "-2615088310\n"
+                "1\n"
+                "0.5\n"
+                "22\n"
+                "1\n"
+                "3\n"
+                "10\n"
+                "5\n"
+                "120\n" );
+            REQUIRE( called == inlined );
+        }
+#if EOPLE_THREADED_DISPATCH
+        THEN( "only the recursive function is still called" ) {
+            REQUIRE( inlined_calls == 5 );
+            REQUIRE( calls > 60 );
+        }
+#endif
+    }
+}
+
+SCENARIO( "return f(...) reuses the caller's frame", "[tail_call]" ) {
+
+    GIVEN( "Tail recursion a million deep, mutual recursion, arguments swapping places, and a string result" ) {
+        const char* source =
+            "def sum(n, acc):\n"
+            "    if n == 0:\n"
+            "        return acc\n"
+            "    end\n"
+            "    return sum(n - 1, acc + n)\n"
+            "end\n"
+            "\n"
+            "def is_even(n):\n"
+            "    if n == 0:\n"
+            "        return true\n"
+            "    end\n"
+            "    return is_odd(n - 1)\n"
+            "end\n"
+            "\n"
+            "def is_odd(n):\n"
+            "    if n == 0:\n"
+            "        return false\n"
+            "    end\n"
+            "    return is_even(n - 1)\n"
+            "end\n"
+            "\n"
+            "def gcd(a, b):\n"
+            "    if b == 0:\n"
+            "        return a\n"
+            "    end\n"
+            "    return gcd(b, a % b)\n"
+            "end\n"
+            "\n"
+            "def rot(a, b, c, d, e, n):\n"
+            "    if n == 0:\n"
+            "        return a * 10000 + b * 1000 + c * 100 + d * 10 + e\n"
+            "    end\n"
+            "    return rot(e, a, b, c, d, n - 1)\n"
+            "end\n"
+            "\n"
+            "def rep(s, n):\n"
+            "    if n == 0:\n"
+            "        return s\n"
+            "    end\n"
+            "    return rep(s + \"ab\", n - 1)\n"
+            "end\n"
+            "\n"
+            "def twice(x):\n"
+            "    return x * 2\n"
+            "end\n"
+            "\n"
+            "def via(x):\n"
+            "    return twice(x + 1)\n"
+            "end\n"
+            "\n"
+            "def main():\n"
+            "    print(sum(1000000, 0))\n"
+            "    if is_odd(100001):\n"
+            "        print(\"odd\")\n"
+            "    end\n"
+            "    print(gcd(1071, 462))\n"
+            "    print(rep(\"x\", 3))\n"
+            "    print(via(20))\n"
+            "    print(rot(1, 2, 3, 4, 5, 7))\n"
+            "end\n";
+        Eople::VirtualMachineConfig config;
+        size_t inlined_calls = 0;
+        size_t calls = 0;
+        std::string inlined = RunScript("tail_call_test.eop", source, config, &inlined_calls);
+        config.inline_functions = false;
+        std::string called = RunScript("tail_call_test.eop", source, config, &calls);
+
+        THEN( "every call returns what the innermost one does" ) {
+            REQUIRE( called ==
+                "500000500000\n"
+                "odd\n"
+                "21\n"
+                "xababab\n"
+                "42\n"
+                "45123\n" );
+            REQUIRE( inlined == called );
+        }
+#if EOPLE_THREADED_DISPATCH
+        THEN( "only the calls from main push a frame" ) {
+            REQUIRE( calls == 6 );
+        }
+#endif
+    }
+}
+
+SCENARIO( "a process heap frees what nothing refers to", "[heap]" ) {
+
+    GIVEN( "A heap with a string reachable through an array, and one that isn't" ) {
+        Eople::Heap heap;
+        Eople::string_t kept    = heap.Add(new std::string("kept"));
+        Eople::string_t dropped = heap.Add(new std::string("dropped"));
+        Eople::Array*   array   = heap.Add(Eople::Array::Create(Eople::ArrayKind::OBJECT));
+        array->Objects().push_back(Eople::Object::BuildString(kept));
+        Eople::Object root = Eople::Object::BuildArray(array);
+
+        WHEN( "it is collected" ) {
+            std::vector<Eople::string_t> recycled;
+            heap.Mark(&root, &root + 1);
+            heap.Sweep(recycled, 8);
+
+            THEN( "only the unreachable string is freed, and handed back for reuse" ) {
+                REQUIRE( heap.count() == 2 );
+                REQUIRE( heap.collections() == 1 );
+                REQUIRE( heap.live_bytes() > 0 );
+                REQUIRE( recycled.size() == 1 );
+                REQUIRE( recycled[0] == dropped );
+                REQUIRE( *kept == "kept" );
+            }
+            for( auto text : recycled ) {
+                delete text;
+            }
+        }
+        WHEN( "its values are exported" ) {
+            // tagged as a string, but not one of the heap's (eg. an int left in a slot last used
+            // by a string)
+            std::string elsewhere("elsewhere");
+            array->Objects().push_back(Eople::Object::BuildString(&elsewhere));
+
+            Eople::Object exported = heap.Export(root);
+
+            THEN( "the copy shares nothing, and what the heap doesn't own isn't followed" ) {
+                REQUIRE( exported.array_ref != array );
+                REQUIRE( exported.array_ref->Objects()[0].string_ref != kept );
+                REQUIRE( *exported.array_ref->Objects()[0].string_ref == "kept" );
+                REQUIRE( exported.array_ref->Objects()[1].object_type == (Eople::u8)Eople::ValueType::NIL );
+            }
+            Eople::Heap::FreeExported(exported);
+        }
+    }
+
+    GIVEN( "A process that drops most of what its messages make" ) {
+        const char* source =
+            "struct Point(x, name)\n"
+            "\n"
+            "class Store():\n"
+            "    names = array(:string)\n"
+            "    points = array(:Point)\n"
+            "\n"
+            "    def Add(n):\n"
+            "        label = 'item-' + to_string(n)\n"
+            "        scratch = ['a', 'b']\n"
+            "        bang = label + '!'\n"
+            "        scratch.push(bang)\n"
+            "        p = Point(n, label)\n"
+            "        if n % 5000 == 0:\n"
+            "            names.push(label)\n"
+            "            points.push(p)\n"
+            "        end\n"
+            "        return label\n"
+            "    end\n"
+            "\n"
+            "    def Churn(n):\n"
+            "        kept = array(:string)\n"
+            "        for i in 0 to n:\n"
+            "            s = 'churn-' + to_string(i)\n"
+            "            extra = s + '?'\n"
+            "            parts = ['a', 'b']\n"
+            "            parts.push(extra)\n"
+            "            if i % 10000 == 0:\n"
+            "                last = parts[2]\n"
+            "                kept.push(last)\n"
+            "            end\n"
+            "        end\n"
+            "        return kept\n"
+            "    end\n"
+            "\n"
+            "    def Show():\n"
+            "        print(names)\n"
+            "        print(points[2].name)\n"
+            "        return names.size()\n"
+            "    end\n"
+            "end\n"
+            "\n"
+            "def literal():\n"
+            "    a = ['x']\n"
+            "    a.push('y')\n"
+            "    print(a)\n"
+            "end\n"
+            "\n"
+            "def main():\n"
+            "    literal()\n"
+            "    literal()\n"
+            "    store = Store()\n"
+            "    for i in 0 to 20000:\n"
+            "        store->Add(i)\n"
+            "    end\n"
+            "    kept = store->Churn(30000)\n"
+            "    count = store->Show()\n"
+            "    when kept and count:\n"
+            "        print(kept.get_value())\n"
+            "        print(to_string(count.get_value()))\n"
+            "    end\n"
+            "end\n";
+        Script script("heap_test.eop", source);
+        std::string output = script.Run();
+
+        THEN( "what is kept survives the collections, and the rest is freed" ) {
+            REQUIRE( output ==
+                "['x', 'y']\n"
+                "['x', 'y']\n"
+                "['item-0', 'item-5000', 'item-10000', 'item-15000']\n"
+                "item-10000\n"
+                "['churn-0?', 'churn-10000?', 'churn-20000?']\n"
+                "4\n" );
+            REQUIRE( script.ee.HeapBytes() > 0 );
+            REQUIRE( script.ee.HeapBytes() < 64 * 1024 );
+        }
+    }
+}
+
+SCENARIO( "large arrays are moved or shared into messages instead of copied", "[message_move]" ) {
+
+    GIVEN( "A heap with a large float array among small ones" ) {
+        Eople::Heap heap;
+        std::vector<Eople::Array*> small;
+        for( int i = 0; i < 200; ++i ) {
+            small.push_back(heap.Add(Eople::Array::Create(Eople::ArrayKind::INT)));
+        }
+        Eople::Array* large = heap.Add(Eople::Array::Create(Eople::ArrayKind::FLOAT));
+        large->Floats().resize(128 * 1024, 1.0);
+
+        THEN( "only the large one is worth detaching" ) {
+            REQUIRE( heap.CanDetach(large) );
+            REQUIRE( !heap.CanDetach(small[0]) );
+        }
+        WHEN( "it is detached" ) {
+            heap.Detach(large);
+
+            THEN( "it is no longer in the heap, and every other value still is" ) {
+                REQUIRE( heap.count() == small.size() );
+                REQUIRE( !heap.CanDetach(large) );
+                for( auto array : small ) {
+                    heap.Mark(array);
+                }
+                heap.Mark(large);
+                bool all_found = true;
+                for( auto array : small ) {
+                    all_found = all_found && heap.IsMarked(array);
+                }
+                REQUIRE( all_found );
+                REQUIRE( !heap.IsMarked(large) );
+                heap.ClearMarks();
+                REQUIRE( !heap.IsMarked(small[0]) );
+            }
+            Eople::Array::Destroy(large);
+        }
+        WHEN( "it is frozen and exported" ) {
+            large->Freeze();
+            Eople::Object root = Eople::Object::BuildArray(large);
+            Eople::Object exported = heap.Export(root);
+
+            THEN( "the export shares it, holding a reference of its own, and it can't change" ) {
+                REQUIRE( !heap.CanDetach(large) );
+                REQUIRE( exported.array_ref == large );
+                REQUIRE( large->ref_count == 2 );
+                REQUIRE_THROWS( large->MakeWritable() );
+            }
+            Eople::Heap::FreeExported(exported);
+            REQUIRE( large->ref_count == 1 );
+        }
+        WHEN( "a frozen array is adopted by a heap that already holds it" ) {
+            large->Freeze();
+            Eople::Object root = Eople::Object::BuildArray(large);
+            heap.Adopt(heap.Export(root));
+
+            THEN( "the extra reference is dropped" ) {
+                REQUIRE( large->ref_count == 1 );
+            }
+        }
+    }
+
+    GIVEN( "Messages sending arrays after their last use, still in use, and frozen" ) {
+        const char* source =
+            "class Sink():\n"
+            "    total = 0.0\n"
+            "    def Take(a):\n"
+            "        total = total + a.sum()\n"
+            "        return a.size()\n"
+            "    end\n"
+            "    def Total():\n"
+            "        return total\n"
+            "    end\n"
+            "end\n"
+            "\n"
+            "def make(n):\n"
+            "    a = array(:float)\n"
+            "    for i in 0 to n:\n"
+            "        a.push(1.0)\n"
+            "    end\n"
+            "    return a\n"
+            "end\n"
+            "\n"
+            "def send_last(sink, n):\n"
+            "    a = make(n)\n"
+            "    r = sink->Take(a)\n"
+            "    return r\n"
+            "end\n"
+            "\n"
+            "def send_kept(sink, n):\n"
+            "    a = make(n)\n"
+            "    b = a\n"
+            "    r = sink->Take(a)\n"
+            "    b.push(2.0)\n"
+            "    print(b.sum())\n"
+            "    return r\n"
+            "end\n"
+            "\n"
+            "def main():\n"
+            "    sink = Sink()\n"
+            "    r1 = send_last(sink, 20000)\n"
+            "    r2 = send_kept(sink, 20000)\n"
+            "    r3 = sink->Take(make(30000))\n"
+            "    f = freeze(make(10))\n"
+            "    r4 = sink->Take(f)\n"
+            "    r5 = sink->Take(f)\n"
+            "    print(f.sum())\n"
+            "    t = sink->Total()\n"
+            "    when r1 and r2 and r3 and r4 and r5 and t:\n"
+            "        print(r1.get_value())\n"
+            "        print(r3.get_value())\n"
+            "        print(t.get_value())\n"
+            "    end\n"
+            "end\n";
+        Script script("message_move_test.eop", source);
+        std::string output = script.Run();
+
+        THEN( "every receiver sees the whole array, and the sender's copy is untouched" ) {
+            REQUIRE( output ==
+                "20002\n"
+                "10\n"
+                "20000\n"
+                "30000\n"
+                "70020\n" );
+        }
+    }
+}
+
+SCENARIO( "array math kernels agree on every instruction set", "[array_math]" ) {
+
+    GIVEN( "Arrays with lengths around the vector widths" ) {
+        using namespace Eople::ArrayMath;
+        const Kernels* scalar = ForIsa(Isa::SCALAR);
+        REQUIRE( scalar );
+
+        for( auto isa : { Isa::SSE2, Isa::AVX2 } ) {
+            const Kernels* kernels = ForIsa(isa);
+            if( !kernels ) {
+                continue;
+            }
+            for( size_t n = 1; n < 40; ++n ) {
+                // small integers in floats keep every sum exact, whatever the order
+                std::vector<Eople::float_t> xf(n), yf(n), out_f(n), expected_f(n);
+                std::vector<Eople::int_t>   xi(n), yi(n), out_i(n), expected_i(n);
+                for( size_t i = 0; i < n; ++i ) {
+                    xi[i] = (Eople::int_t)((i * 7919) % 97) - 48;
+                    yi[i] = (Eople::int_t)((i * 104729) % 89) - 44;
+                    xf[i] = (Eople::float_t)xi[i];
+                    yf[i] = (Eople::float_t)yi[i] * 0.5;
+                }
+                xi[n / 2] = std::numeric_limits<Eople::int_t>::min();
+                xi[n / 3] = std::numeric_limits<Eople::int_t>::max();
+
+                REQUIRE( kernels->sum_f(xf.data(), n) == scalar->sum_f(xf.data(), n) );
+                REQUIRE( kernels->min_f(xf.data(), n) == scalar->min_f(xf.data(), n) );
+                REQUIRE( kernels->max_f(xf.data(), n) == scalar->max_f(xf.data(), n) );
+                REQUIRE( kernels->dot_f(xf.data(), yf.data(), n) == scalar->dot_f(xf.data(), yf.data(), n) );
+                REQUIRE( kernels->sum_i(xi.data(), n) == scalar->sum_i(xi.data(), n) );
+                REQUIRE( kernels->min_i(xi.data(), n) == scalar->min_i(xi.data(), n) );
+                REQUIRE( kernels->max_i(xi.data(), n) == scalar->max_i(xi.data(), n) );
+                REQUIRE( kernels->dot_i(xi.data(), yi.data(), n) == scalar->dot_i(xi.data(), yi.data(), n) );
+
+                kernels->scale_f(out_f.data(), xf.data(), 1.25, n);
+                scalar->scale_f(expected_f.data(), xf.data(), 1.25, n);
+                REQUIRE( out_f == expected_f );
+                kernels->add_f(out_f.data(), xf.data(), yf.data(), n);
+                scalar->add_f(expected_f.data(), xf.data(), yf.data(), n);
+                REQUIRE( out_f == expected_f );
+                kernels->mul_f(out_f.data(), xf.data(), yf.data(), n);
+                scalar->mul_f(expected_f.data(), xf.data(), yf.data(), n);
+                REQUIRE( out_f == expected_f );
+                kernels->axpy_f(out_f.data(), xf.data(), 0.1, yf.data(), n);
+                scalar->axpy_f(expected_f.data(), xf.data(), 0.1, yf.data(), n);
+                REQUIRE( out_f == expected_f );
+
+                kernels->scale_i(out_i.data(), xi.data(), 3, n);
+                scalar->scale_i(expected_i.data(), xi.data(), 3, n);
+                REQUIRE( out_i == expected_i );
+                kernels->add_i(out_i.data(), xi.data(), yi.data(), n);
+                scalar->add_i(expected_i.data(), xi.data(), yi.data(), n);
+                REQUIRE( out_i == expected_i );
+                kernels->mul_i(out_i.data(), xi.data(), yi.data(), n);
+                scalar->mul_i(expected_i.data(), xi.data(), yi.data(), n);
+                REQUIRE( out_i == expected_i );
+                kernels->axpy_i(out_i.data(), xi.data(), -2, yi.data(), n);
+                scalar->axpy_i(expected_i.data(), xi.data(), -2, yi.data(), n);
+                REQUIRE( out_i == expected_i );
+            }
+        }
+    }
+
+    GIVEN( "A program using the array builtins" ) {
+        const char* source =
+            "def main():\n"
+            "    xs = [3, 1, 4, 1, 5, 9, 2, 6]\n"
+            "    print(sum(xs) + 1)\n"
+            "    print(xs.min())\n"
+            "    print(xs.max())\n"
+            "    print(dot(xs, xs))\n"
+            "    print(axpy(xs, 2, scale(xs, 3)))\n"
+            "    print(sum(add(xs, mul(xs, xs))))\n"
+            "    fs = [0.5, -1.5, 2.0]\n"
+            "    print(fs.sum() * 2.0)\n"
+            "    print(axpy(fs, 2.0, fs))\n"
+            "end\n";
+        WHEN( "it runs" ) {
+            Script script("array_math_test.eop", source);
+            std::string output = script.Run();
+
+            THEN( "ints and floats get their own kernels and return types" ) {
+                REQUIRE( output == "32\n1\n9\n173\n[15, 5, 20, 5, 25, 45, 10, 30]\n204\n2\n[1.5, -4.5, 6]\n" );
+            }
+        }
+    }
+}
+
+// Send latency under fan-in contention. Hidden, run with: tests "[benchmark]"
+TEST_CASE( "message send latency at 1..N producers", "[.][benchmark]" ) {
+    Eople::VirtualMachine vm;
+    vm.Run();
+
+    // a few actors receiving from many senders
+    const int target_count = 4;
+    std::vector<Eople::process_t> targets;
+    for( int t = 0; t < target_count; ++t ) {
+        targets.push_back(vm.GenerateUniqueProcess());
+    }
+
+    const int sends_per_producer = 100000;
+    const int max_producers = Eople::Max<int>( 4, 2*std::thread::hardware_concurrency() );
+    for( int producer_count = 1; producer_count <= max_producers; producer_count *= 2 ) {
+        std::vector<std::vector<double>> latencies(producer_count);
+        std::vector<std::thread> producers;
+        for( int p = 0; p < producer_count; ++p ) {
+            producers.push_back(std::thread([&, p]() {
+                auto &samples = latencies[p];
+                samples.reserve(sends_per_producer);
+                for( int i = 0; i < sends_per_producer; ++i ) {
+                    auto start = Eople::HighResClock::now();
+                    vm.SendMessage(Eople::CallData(nullptr, targets[i % target_count]));
+                    auto end = Eople::HighResClock::now();
+                    samples.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+                }
+            }));
+        }
+        for( auto &producer : producers ) {
+            producer.join();
+        }
+
+        std::vector<double> all;
+        for( auto &samples : latencies ) {
+            all.insert(all.end(), samples.begin(), samples.end());
+        }
+        std::sort(all.begin(), all.end());
+        printf("%2d producers: p50 %.3f us, p99 %.3f us, max %.3f us\n", producer_count,
+            all[all.size()/2], all[all.size()*99/100], all.back());
+    }
+
+    vm.Shutdown();
+}
+
+// Many-actor ping workload at 1..N cores. Hidden, run with: tests "[benchmark]"
+TEST_CASE( "ping workload scaling", "[.][benchmark]" ) {
+    const char* source =
+        "def main():\n"
+        "    for i in 0 to 1000:\n"
+        "        process = PingClass()\n"
+        "        for j in 0 to 1000:\n"
+        "            process->Ping(j)\n"
+        "        end\n"
+        "    end\n"
+        "end\n"
+        "\n"
+        "class PingClass():\n"
+        "    total = 0\n"
+        "\n"
+        "    def Ping(n):\n"
+        "        for k in 0 to 100:\n"
+        "            total = total + n * k\n"
+        "        end\n"
+        "        return total\n"
+        "    end\n"
+        "end\n";
+    const char* file_name = "ping_benchmark.eop";
+    std::ofstream(file_name) << source;
+
+    Eople::Log::SetVerbosityLevel(Eople::Log::VerbosityLevel::NO_DEBUG);
+    const Eople::u32 max_cores = Eople::Max<Eople::u32>( 2, std::thread::hardware_concurrency() );
+    std::vector<Eople::u32> core_counts;
+    for( Eople::u32 cores = 1; cores < max_cores; cores *= 2 ) {
+        core_counts.push_back(cores);
+    }
+    core_counts.push_back(max_cores);
+
+    double single_core_ms = 0.0;
+    for( auto cores : core_counts ) {
+        Eople::VirtualMachineConfig config;
+        config.core_count = cores;
+        Eople::ExecutionEnvironment ee(config);
+        REQUIRE( ee.ImportModuleFromFile(file_name) );
+
+        // 1,000 processes, 1,000 pings each. every ping replies to the main process.
+        auto start = Eople::HighResClock::now();
+        ee.ExecuteFunction("main", false);
+        ee.Shutdown();
+        double ms = std::chrono::duration<double, std::milli>(Eople::HighResClock::now() - start).count();
+
+        single_core_ms = (cores == 1) ? ms : single_core_ms;
+        printf("%2u cores: %.1f ms, %.2fx\n", cores, ms, single_core_ms / ms);
+    }
+
+    remove(file_name);
+}
+
+// 100k outstanding timers. Hidden, run with: tests "[benchmark]"
+TEST_CASE( "100k concurrent timers", "[.][benchmark]" ) {
+    Eople::VirtualMachine vm;
+    vm.Run();
+
+    const int process_count = 100;
+    const int timer_count   = 100000;
+    std::vector<Eople::process_t> processes;
+    for( int p = 0; p < process_count; ++p ) {
+        processes.push_back(vm.GenerateUniqueProcess());
+    }
+
+    // deadlines spread over 200ms..1200ms
+    auto start = Eople::HighResClock::now();
+    std::clock_t cpu_start = std::clock();
+    std::vector<Eople::promise_t> promises;
+    for( int i = 0; i < timer_count; ++i ) {
+        auto promise = Eople::Promise::Create(processes[i % process_count]);
+        promise->is_timer = true;
+        // one reference for us, one for the timer message
+        promise->AddRef();
+        promises.push_back(promise);
+        auto when = start + std::chrono::milliseconds(200 + (i * 7919) % 1000);
+        vm.SendMessage(Eople::CallData(nullptr, promise->owner, nullptr, promise, when));
+    }
+    double insert_ms = std::chrono::duration<double, std::milli>(Eople::HighResClock::now() - start).count();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1200));
+    size_t ready = 0;
+    while( ready < promises.size() ) {
+        ready = 0;
+        for( auto promise : promises ) {
+            ready += promise->is_ready ? 1 : 0;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    double total_ms = std::chrono::duration<double, std::milli>(Eople::HighResClock::now() - start).count();
+    double cpu_ms = 1000.0 * (std::clock() - cpu_start) / CLOCKS_PER_SEC;
+
+    printf("insert: %.1f ms (%.3f us/timer), all fired after %.1f ms (last deadline 1199 ms), cpu: %.1f ms\n",
+        insert_ms, 1000.0 * insert_ms / timer_count, total_ms, cpu_ms);
+
+    vm.Shutdown();
+    for( auto promise : promises ) {
+        promise->Release();
+    }
+}
+
+// Latency from send to delivery when every core is parked. Hidden, run with: tests "[benchmark]"
+TEST_CASE( "wake latency of parked cores", "[.][benchmark]" ) {
+    Eople::VirtualMachine vm;
+    vm.Run();
+    auto process = vm.GenerateUniqueProcess();
+
+    const int sample_count = 500;
+    std::vector<double> latencies;
+    for( int i = 0; i < sample_count; ++i ) {
+        // give the cores time to park
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+
+        // timer promises are marked ready when their message is delivered
+        auto promise = Eople::Promise::Create(process);
+        promise->is_timer = true;
+        promise->AddRef();
+        auto start = Eople::HighResClock::now();
+        vm.SendMessage(Eople::CallData(nullptr, process, nullptr, promise));
+        while( !*(volatile bool*)&promise->is_ready ) {
+            std::this_thread::yield();
+        }
+        latencies.push_back(std::chrono::duration<double, std::micro>(Eople::HighResClock::now() - start).count());
+        promise->Release();
+    }
+    std::sort(latencies.begin(), latencies.end());
+    printf("wake latency: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+        latencies[latencies.size()/2], latencies[latencies.size()*99/100], latencies.back());
+
+    vm.Shutdown();
+}
+
+// Throughput of 1 MB float arrays sent to another process: copied (the sender still refers to
+// them), moved (sent after their last use) and shared (frozen). Hidden, run with: tests "[benchmark]"
+TEST_CASE( "sending 1 MB arrays", "[.][benchmark]" ) {
+    const char* source =
+        "class Sink():\n"
+        "    count = 0\n"
+        "    def Take(a):\n"
+        "        count = count + a.size()\n"
+        "        return count\n"
+        "    end\n"
+        "end\n"
+        "\n"
+        "def make():\n"
+        "    a = array(:float)\n"
+        "    for i in 0 to 131072:\n"
+        "        a.push(1.0)\n"
+        "    end\n"
+        "    return a\n"
+        "end\n"
+        "\n"
+        "def send_copy(sink, src):\n"
+        "    a = src.scale(1.0)\n"
+        "    b = a\n"
+        "    sink->Take(a)\n"
+        "    return b.size()\n"
+        "end\n"
+        "\n"
+        "def send_move(sink, src):\n"
+        "    a = src.scale(1.0)\n"
+        "    sink->Take(a)\n"
+        "    return 0\n"
+        "end\n"
+        "\n"
+        "def copied():\n"
+        "    src = make()\n"
+        "    sink = Sink()\n"
+        "    for i in 0 to 500:\n"
+        "        send_copy(sink, src)\n"
+        "    end\n"
+        "end\n"
+        "\n"
+        "def moved():\n"
+        "    src = make()\n"
+        "    sink = Sink()\n"
+        "    for i in 0 to 500:\n"
+        "        send_move(sink, src)\n"
+        "    end\n"
+        "end\n"
+        "\n"
+        "def shared():\n"
+        "    src = freeze(make())\n"
+        "    sink = Sink()\n"
+        "    for i in 0 to 500:\n"
+        "        sink->Take(src)\n"
+        "    end\n"
+        "end\n";
+    const char* file_name = "array_send_benchmark.eop";
+    std::ofstream(file_name) << source;
+    Eople::Log::SetVerbosityLevel(Eople::Log::VerbosityLevel::NO_DEBUG);
+
+    for( const char* mode : { "copied", "moved", "shared" } ) {
+        Eople::ExecutionEnvironment ee;
+        REQUIRE( ee.ImportModuleFromFile(file_name) );
+
+        // 500 sends, until the last one has been handled
+        auto start = Eople::HighResClock::now();
+        ee.ExecuteFunction(mode, false);
+        ee.Shutdown();
+        double seconds = std::chrono::duration<double>(Eople::HighResClock::now() - start).count();
+        printf("%-6s %8.1f ms, %8.1f MB/s\n", mode, seconds * 1000.0, 500.0 / seconds);
+    }
+
+    remove(file_name);
+}
+
+// Chunks of a 1 MB array sent to another process, built element by element or sliced. Hidden,
+// run with: tests "[benchmark]"
+TEST_CASE( "splitting 1 MB arrays into chunks", "[.][benchmark]" ) {
+    const char* source =
+        "class Summer():\n"
+        "    def Sum(chunk):\n"
+        "        return chunk.sum()\n"
+        "    end\n"
+        "end\n"
+        "\n"
+        "def make():\n"
+        "    a = array(:float)\n"
+        "    for i in 0 to 131072:\n"
+        "        a.push(1.0)\n"
+        "    end\n"
+        "    return a\n"
+        "end\n"
+        "\n"
+        "def pushed():\n"
+        "    src = make()\n"
+        "    s = Summer()\n"
+        "    for round in 0 to 20:\n"
+        "        for c in 0 to 16:\n"
+        "            chunk = array(:float)\n"
+        "            first = c * 8192\n"
+        "            last = first + 8192\n"
+        "            for i in first to last:\n"
+        "                chunk.push(src[i])\n"
+        "            end\n"
+        "            s->Sum(chunk)\n"
+        "        end\n"
+        "    end\n"
+        "end\n"
+        "\n"
+        "def sliced():\n"
+        "    src = make()\n"
+        "    s = Summer()\n"
+        "    for round in 0 to 20:\n"
+        "        for c in 0 to 16:\n"
+        "            first = c * 8192\n"
+        "            s->Sum(src.slice(first, first + 8192))\n"
+        "        end\n"
+        "    end\n"
+        "end\n";
+    const char* file_name = "array_slice_benchmark.eop";
+    std::ofstream(file_name) << source;
+    Eople::Log::SetVerbosityLevel(Eople::Log::VerbosityLevel::NO_DEBUG);
+
+    for( const char* mode : { "pushed", "sliced" } ) {
+        Eople::ExecutionEnvironment ee;
+        REQUIRE( ee.ImportModuleFromFile(file_name) );
+
+        // 20 rounds of 16 chunks, until the last one has been summed
+        auto start = Eople::HighResClock::now();
+        ee.ExecuteFunction(mode, false);
+        ee.Shutdown();
+        double seconds = std::chrono::duration<double>(Eople::HighResClock::now() - start).count();
+        printf("%-6s %8.1f ms\n", mode, seconds * 1000.0);
+    }
+
+    remove(file_name);
+}
+
+// Heap bytes per message, with and without replies. Hidden, run with: tests "[benchmark]"
+TEST_CASE( "heap bytes per message", "[.][benchmark]" ) {
+    const char* source =
+        "def main():\n"
+        "    process = Counter()\n"
+        "    for i in 0 to 1000000:\n"
+        "        process->Add(i)\n"
+        "    end\n"
+        "    for i in 0 to 1000000:\n"
+        "        total = process->Add(i)\n"
+        "    end\n"
+        "end\n"
+        "\n"
+        "class Counter():\n"
+        "    total = 0\n"
+        "\n"
+        "    def Add(n):\n"
+        "        total = total + n\n"
+        "        return total\n"
+        "    end\n"
+        "end\n";
+    const char* file_name = "alloc_benchmark.eop";
+    std::ofstream(file_name) << source;
+
+    Eople::Log::SetVerbosityLevel(Eople::Log::VerbosityLevel::NO_DEBUG);
+    Eople::ExecutionEnvironment ee;
+    REQUIRE( ee.ImportModuleFromFile(file_name) );
+
+    // 1,000,000 sends without a reply, then 1,000,000 whose reply is stored
+    size_t start_bytes = s_heap_bytes.load();
+    ee.ExecuteFunction("main", false);
+    ee.Shutdown();
+    size_t bytes = s_heap_bytes.load() - start_bytes;
+    printf("%zu bytes allocated, %.2f bytes per message\n", bytes, bytes / 2000000.0);
+
+    remove(file_name);
+}
+
+// Heap allocations of messages building temporary strings, with and without the per process
+// string region. Hidden, run with: tests "[benchmark]"
+TEST_CASE( "heap allocations per message with string regions", "[.][benchmark]" ) {
+    const char* source =
+        "def main():\n"
+        "    tagger = Tagger()\n"
+        "    for i in 0 to 200000:\n"
+        "        tagger->Tag(i)\n"
+        "    end\n"
+        "end\n"
+        "\n"
+        "class Tagger():\n"
+        "    count = 0\n"
+        "\n"
+        "    def Tag(n):\n"
+        "        label = 'item-' + to_string(n)\n"
+        "        path = label + '/' + label + '/' + to_string(count)\n"
+        "        count = count + 1\n"
+        "    end\n"
+        "end\n";
+    const char* file_name = "region_benchmark.eop";
+    std::ofstream(file_name) << source;
+    Eople::Log::SetVerbosityLevel(Eople::Log::VerbosityLevel::NO_DEBUG);
+
+    for( bool string_regions : { false, true } ) {
+        Eople::VirtualMachineConfig config;
+        config.string_regions = string_regions;
+        Eople::ExecutionEnvironment ee(config);
+        REQUIRE( ee.ImportModuleFromFile(file_name) );
+
+        size_t start_bytes       = s_heap_bytes.load();
+        size_t start_allocations = s_heap_allocations.load();
+        auto start = Eople::HighResClock::now();
+        ee.ExecuteFunction("main", false);
+        ee.Shutdown();
+        double ms = std::chrono::duration<double, std::milli>(Eople::HighResClock::now() - start).count();
+        size_t bytes       = s_heap_bytes.load() - start_bytes;
+        size_t allocations = s_heap_allocations.load() - start_allocations;
+        printf("string regions %-3s: %.2f allocations, %.1f bytes per message, %.1f ms\n",
+            string_regions ? "on" : "off", allocations / 200000.0, bytes / 200000.0, ms);
+    }
+
+    remove(file_name);
+}
+
+// Resident memory and process heap bytes of a long run of messages that make and drop strings,
+// arrays and structs. Both should level off. Runs for EOPLE_SOAK_SECONDS (default 5), for hours
+// if need be. Hidden, run with: tests "[benchmark]"
+TEST_CASE( "memory of a long running message workload", "[.][benchmark]" ) {
+    const char* seconds_text = getenv("EOPLE_SOAK_SECONDS");
+    const int   seconds      = seconds_text ? atoi(seconds_text) : 5;
+
+    // rounds of 2000 messages, each round sent once the last reply of the one before is in, so
+    // the mailbox doesn't grow. About 100 rounds a second on a typical machine.
+    std::stringstream source;
+    source <<
+        "struct Entry(id, name)\n"
+        "\n"
+        "class Store():\n"
+        "    recent = array(:string)\n"
+        "    entries = array(:Entry)\n"
+        "\n"
+        "    def Add(n, tags):\n"
+        "        name = 'entry-' + to_string(n)\n"
+        "        entry = Entry(n, name)\n"
+        "        if recent.size() < 100:\n"
+        "            recent.push(name)\n"
+        "            entries.push(entry)\n"
+        "        end\n"
+        "        return tags.size()\n"
+        "    end\n"
+        "end\n"
+        "\n"
+        "def send(store, count):\n"
+        "    for i in 0 to 2000:\n"
+        "        tags = ['a', 'b']\n"
+        "        tag = 'tag-' + to_string(i)\n"
+        "        tags.push(tag)\n"
+        "        count = store->Add(i, tags)\n"
+        "    end\n"
+        "    return count\n"
+        "end\n"
+        "\n"
+        "def main():\n"
+        "    store = Store()\n"
+        "    rounds = 0\n"
+        "    count = store->Add(0, ['a'])\n"
+        "    whenever count and rounds < " << seconds * 100 << ":\n"
+        "        rounds = rounds + 1\n"
+        "        count = send(store, count)\n"
+        "    end\n"
+        "end\n";
+    const char* file_name = "soak_benchmark.eop";
+    std::ofstream(file_name) << source.str();
+    Eople::Log::SetVerbosityLevel(Eople::Log::VerbosityLevel::NO_DEBUG);
+
+    Eople::ExecutionEnvironment ee;
+    REQUIRE( ee.ImportModuleFromFile(file_name) );
+
+    std::atomic<bool> done(false);
+    std::thread sampler([&]() {
+        auto start = Eople::HighResClock::now();
+        while( !done.load() ) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            size_t pages = 0, resident = 0;
+            std::ifstream("/proc/self/statm") >> pages >> resident;
+            double elapsed = std::chrono::duration<double>(Eople::HighResClock::now() - start).count();
+            printf("%7.1f s: resident %7.1f MB, process heaps %8.1f KB\n", elapsed,
+                resident * 4096.0 / (1024 * 1024), ee.HeapBytes() / 1024.0);
+        }
+    });
+
+    ee.ExecuteFunction("main", false);
+    ee.Shutdown();
+    done.store(true);
+    sampler.join();
+
+    remove(file_name);
+}
+
+// Latency of a message to one process while another keeps the only core busy, with and
+// without preemption. Hidden, run with: tests "[benchmark]"
+TEST_CASE( "latency next to a cpu bound process", "[.][benchmark]" ) {
+    const char* source =
+        "class Hog():\n"
+        "    def Spin(seconds):\n"
+        "        total = 0\n"
+        "        end_time = get_time() + seconds\n"
+        "        while get_time() < end_time:\n"
+        "            total = total + 1\n"
+        "        end\n"
+        "    end\n"
+        "end\n"
+        "\n"
+        "class Echo():\n"
+        "    worst = 0.0\n"
+        "    total = 0.0\n"
+        "    count = 0\n"
+        "\n"
+        "    def Stamp(sent):\n"
+        "        latency = (get_time() - sent) * 1000.0\n"
+        "        if latency > worst:\n"
+        "            worst = latency\n"
+        "        end\n"
+        "        total = total + latency\n"
+        "        count = count + 1\n"
+        "    end\n"
+        "\n"
+        "    def Report():\n"
+        "        print(\"  mean \" + to_string(total / to_float(count)) + \" ms, max \" + to_string(worst) + \" ms\")\n"
+        "    end\n"
+        "end\n"
+        "\n"
+        "def main():\n"
+        "    hog = Hog()\n"
+        "    echo = Echo()\n"
+        "    hog->Spin(1.0)\n"
+        "    for i in 0 to 200:\n"
+        "        echo->Stamp(get_time())\n"
+        "        sleep(4)\n"
+        "    end\n"
+        "    echo->Report()\n"
+        "end\n";
+    const char* file_name = "fairness_benchmark.eop";
+    std::ofstream(file_name) << source;
+
+    Eople::Log::SetVerbosityLevel(Eople::Log::VerbosityLevel::NO_DEBUG);
+    for( Eople::u32 budget : { 0u, 2000u, 20000u, 200000u } ) {
+        Eople::VirtualMachineConfig config;
+        config.core_count = 1;
+        config.reduction_budget = budget;
+        Eople::ExecutionEnvironment ee(config);
+        REQUIRE( ee.ImportModuleFromFile(file_name) );
+
+        // main runs on this thread, the hog and the echo process share one core
+        printf("reduction budget %u:\n", budget);
+        ee.ExecuteFunction("main", false);
+        ee.Shutdown();
+    }
+
+    remove(file_name);
+}
+
+// Replies to a process while N when blocks wait on timers. Hidden, run with: tests "[benchmark]"
+TEST_CASE( "many pending when blocks", "[.][benchmark]" ) {
+    Eople::Log::SetVerbosityLevel(Eople::Log::VerbosityLevel::NO_DEBUG);
+    const char* file_name = "when_benchmark.eop";
+    for( int block_count = 1000; block_count <= 16000; block_count *= 4 ) {
+        std::ofstream(file_name) <<
+            "def main():\n"
+            "    server = Server()\n"
+            "    for i in 0 to " << block_count << ":\n"
+            "        timeout = after(200)\n"
+            "        when timeout:\n"
+            "            server->Done()\n"
+            "        end\n"
+            "    end\n"
+            "    for i in 0 to " << block_count << ":\n"
+            "        reply = server->Get(i)\n"
+            "        when reply:\n"
+            "            server->Done()\n"
+            "        end\n"
+            "    end\n"
+            "end\n"
+            "\n"
+            "class Server():\n"
+            "    count = 0\n"
+            "    def Get(n):\n"
+            "        return n\n"
+            "    end\n"
+            "\n"
+            "    def Done():\n"
+            "        count = count + 1\n"
+            "        if count == " << 2 * block_count << ":\n"
+            "            print(\"all done\")\n"
+            "        end\n"
+            "    end\n"
+            "end\n";
+
+        Eople::ExecutionEnvironment ee;
+        REQUIRE( ee.ImportModuleFromFile(file_name) );
+
+        // main runs in its own process, so its when blocks are evaluated as replies arrive
+        auto start = Eople::HighResClock::now();
+        ee.ExecuteFunction("main", true);
+        ee.Shutdown();
+        double ms = std::chrono::duration<double, std::milli>(Eople::HighResClock::now() - start).count();
+        printf("%5d when blocks: %.1f ms\n", block_count, ms);
+    }
+    remove(file_name);
+}
+
+// Array builtins against the same work as an interpreted loop. Hidden, run with: tests "[benchmark]"
+TEST_CASE( "array math builtins vs interpreted loops", "[.][benchmark]" ) {
+    const char* source =
+        "def make(n):\n"
+        "    values = array(:float)\n"
+        "    for i in 0 to n:\n"
+        "        values.push(to_float(i) * 0.5)\n"
+        "    end\n"
+        "    return values\n"
+        "end\n"
+        "\n"
+        "def loop_sum(values, rounds):\n"
+        "    total = 0.0\n"
+        "    for r in 0 to rounds:\n"
+        "        for v in values:\n"
+        "            total = total + v\n"
+        "        end\n"
+        "    end\n"
+        "    return total\n"
+        "end\n"
+        "\n"
+        "def builtin_sum(values, rounds):\n"
+        "    total = 0.0\n"
+        "    for r in 0 to rounds:\n"
+        "        total = total + values.sum()\n"
+        "    end\n"
+        "    return total\n"
+        "end\n"
+        "\n"
+        "def loop_dot(values, rounds):\n"
+        "    total = 0.0\n"
+        "    n = values.size()\n"
+        "    for r in 0 to rounds:\n"
+        "        for i in 0 to n:\n"
+        "            total = total + values[i] * values[i]\n"
+        "        end\n"
+        "    end\n"
+        "    return total\n"
+        "end\n"
+        "\n"
+        "def builtin_dot(values, rounds):\n"
+        "    total = 0.0\n"
+        "    for r in 0 to rounds:\n"
+        "        total = total + dot(values, values)\n"
+        "    end\n"
+        "    return total\n"
+        "end\n"
+        "\n"
+        "def run(kind):\n"
+        "    values = make(100000)\n"
+        "    if kind == 0:\n"
+        "        print(loop_sum(values, 20))\n"
+        "    end\n"
+        "    if kind == 1:\n"
+        "        print(builtin_sum(values, 20))\n"
+        "    end\n"
+        "    if kind == 2:\n"
+        "        print(loop_dot(values, 20))\n"
+        "    end\n"
+        "    if kind == 3:\n"
+        "        print(builtin_dot(values, 20))\n"
+        "    end\n"
+        "end\n"
+        "\n"
+        "def loop_sum_main():\n"
+        "    run(0)\n"
+        "end\n"
+        "def builtin_sum_main():\n"
+        "    run(1)\n"
+        "end\n"
+        "def loop_dot_main():\n"
+        "    run(2)\n"
+        "end\n"
+        "def builtin_dot_main():\n"
+        "    run(3)\n"
+        "end\n";
+    const char* file_name = "array_math_benchmark.eop";
+    std::ofstream(file_name) << source;
+
+    Eople::Log::SetVerbosityLevel(Eople::Log::VerbosityLevel::NO_DEBUG);
+    Eople::ExecutionEnvironment ee;
+    REQUIRE( ee.ImportModuleFromFile(file_name) );
+
+    printf("kernels: %s, 100k floats x 20 rounds\n", Eople::ArrayMath::IsaName(Eople::ArrayMath::Best().isa));
+    for( auto name : { "loop_sum_main", "builtin_sum_main", "loop_dot_main", "builtin_dot_main" } ) {
+        auto start = Eople::HighResClock::now();
+        ee.ExecuteFunction(name, false);
+        double ms = std::chrono::duration<double, std::milli>(Eople::HighResClock::now() - start).count();
+        printf("%-17s %8.1f ms\n", name, ms);
+    }
+    ee.Shutdown();
+
+    remove(file_name);
+}
+
+// Subscripts on a record-like dict literal. Hidden, run with: tests "[benchmark]"
+TEST_CASE( "dict subscripts", "[.][benchmark]" ) {
+    const char* source =
+        "def main():\n"
+        "    config = { host: 'localhost', port: 8080, retries: 3, timeout: 2.5, name: 'worker', level: 7, ratio: 0.25, mode: 'fast' }\n"
+        "    for i in 0 to 1000000:\n"
+        "        a = config.port\n"
+        "        b = config['retries']\n"
+        "        c = config.level\n"
+        "        d = config['mode']\n"
+        "    end\n"
+        "end\n";
+    const char* file_name = "dict_benchmark.eop";
+    std::ofstream(file_name) << source;
+
+    Eople::Log::SetVerbosityLevel(Eople::Log::VerbosityLevel::NO_DEBUG);
+    Eople::ExecutionEnvironment ee;
+    REQUIRE( ee.ImportModuleFromFile(file_name) );
+
+    auto start = Eople::HighResClock::now();
+    ee.ExecuteFunction("main", false);
+    double ms = std::chrono::duration<double, std::milli>(Eople::HighResClock::now() - start).count();
+    printf("4M dict subscripts: %.1f ms\n", ms);
+    ee.Shutdown();
+
+    remove(file_name);
+}
+
+// Member reads on a struct vs keys of an equivalent dict. Hidden, run with: tests "[benchmark]"
+TEST_CASE( "struct members vs dict keys", "[.][benchmark]" ) {
+    const char* source =
+        "struct Config(host, port, retries, timeout, name, level, ratio, mode)\n"
+        "\n"
+        "def struct_main():\n"
+        "    config = Config('localhost', 8080, 3, 2.5, 'worker', 7, 0.25, 'fast')\n"
+        "    for i in 0 to 1000000:\n"
+        "        a = config.port\n"
+        "        b = config.retries\n"
+        "        c = config.level\n"
+        "        d = config.mode\n"
+        "    end\n"
+        "end\n"
+        "\n"
+        "def dict_main():\n"
+        "    config = { host: 'localhost', port: 8080, retries: 3, timeout: 2.5, name: 'worker', level: 7, ratio: 0.25, mode: 'fast' }\n"
+        "    for i in 0 to 1000000:\n"
+        "        a = config.port\n"
+        "        b = config.retries\n"
+        "        c = config.level\n"
+        "        d = config.mode\n"
+        "    end\n"
+        "end\n";
+    const char* file_name = "struct_benchmark.eop";
+    std::ofstream(file_name) << source;
+
+    Eople::Log::SetVerbosityLevel(Eople::Log::VerbosityLevel::NO_DEBUG);
+    Eople::ExecutionEnvironment ee;
+    REQUIRE( ee.ImportModuleFromFile(file_name) );
+
+    for( auto name : { "struct_main", "dict_main" } ) {
+        auto start = Eople::HighResClock::now();
+        ee.ExecuteFunction(name, false);
+        double ms = std::chrono::duration<double, std::milli>(Eople::HighResClock::now() - start).count();
+        printf("4M member reads, %-11s %8.1f ms\n", name, ms);
+    }
+    ee.Shutdown();
+
+    remove(file_name);
+}
+
+// Chains of + on strings, a string built up with + and one built with append. Hidden, run with:
+// tests "[benchmark]"
+TEST_CASE( "joining strings", "[.][benchmark]" ) {
+    const char* source =
+        "def chained():\n"
+        "    total = 0\n"
+        "    for i in 0 to 200000:\n"
+        "        line = 'key' + to_string(i) + '=' + to_string(i * 2) + ';'\n"
+        "        total = total + 1\n"
+        "    end\n"
+        "end\n"
+        "\n"
+        "def looped():\n"
+        "    s = ''\n"
+        "    for i in 0 to 200000:\n"
+        "        s = s + to_string(i) + ','\n"
+        "    end\n"
+        "end\n"
+        "\n"
+        "def built():\n"
+        "    s = string_builder(16)\n"
+        "    for i in 0 to 200000:\n"
+        "        s.append(to_string(i))\n"
+        "        s.append(',')\n"
+        "    end\n"
+        "end\n";
+    const char* file_name = "string_join_benchmark.eop";
+    std::ofstream(file_name) << source;
+    Eople::Log::SetVerbosityLevel(Eople::Log::VerbosityLevel::NO_DEBUG);
+
+    for( const char* mode : { "chained", "looped", "built" } ) {
+        Eople::ExecutionEnvironment ee;
+        REQUIRE( ee.ImportModuleFromFile(file_name) );
+
+        auto start = Eople::HighResClock::now();
+        ee.ExecuteFunction(mode, false);
+        ee.Shutdown();
+        double seconds = std::chrono::duration<double>(Eople::HighResClock::now() - start).count();
+        printf("%-7s %8.1f ms\n", mode, seconds * 1000.0);
+    }
+
+    remove(file_name);
+}
+
+// Interpreted loops, with the instructions they run (fused pairs count once, see Peephole in
+// eople_vmcode_gen.cpp). Hidden, run with: tests "[benchmark]"
+TEST_CASE( "interpreted kernels", "[.][benchmark]" ) {
+    const char* source =
+        "def sieve():\n"
+        "    flags = array(:int)\n"
+        "    for i in 0 to 1000000:\n"
+        "        flags.push(1)\n"
+        "    end\n"
+        "    count = 0\n"
+        "    for i in 2 to 1000000:\n"
+        "        if flags[i] == 1:\n"
+        "            count = count + 1\n"
+        "            j = i + i\n"
+        "            while j < 1000000:\n"
+        "                flags[j] = 0\n"
+        "                j = j + i\n"
+        "            end\n"
+        "        end\n"
+        "    end\n"
+        "end\n"
+        "\n"
+        "def sort():\n"
+        "    values = array(:int)\n"
+        "    seed = 12345\n"
+        "    for i in 0 to 2000:\n"
+        "        seed = (seed * 1103515245 + 12345) % 2147483648\n"
+        "        value = seed % 100000\n"
+        "        values.push(value)\n"
+        "    end\n"
+        "    n = values.size()\n"
+        "    for i in 0 to n:\n"
+        "        last = n - i - 1\n"
+        "        for j in 0 to last:\n"
+        "            if values[j] > values[j+1]:\n"
+        "                t = values[j]\n"
+        "                values[j] = values[j+1]\n"
+        "                values[j+1] = t\n"
+        "            end\n"
+        "        end\n"
+        "    end\n"
+        "end\n"
+        "\n"
+        "def matmul():\n"
+        "    n = 100\n"
+        "    nn = n * n\n"
+        "    a = array(:float)\n"
+        "    b = array(:float)\n"
+        "    for i in 0 to nn:\n"
+        "        x = to_float(i % 7) * 0.5\n"
+        "        y = to_float(i % 5) * 0.25\n"
+        "        a.push(x)\n"
+        "        b.push(y)\n"
+        "    end\n"
+        "    for i in 0 to n:\n"
+        "        for j in 0 to n:\n"
+        "            sum = 0.0\n"
+        "            for k in 0 to n:\n"
+        "                sum = sum + a[i*n+k] * b[k*n+j]\n"
+        "            end\n"
+        "        end\n"
+        "    end\n"
+        "end\n"
+        "\n"
+        "def spring():\n"
+        "    x = 0.0\n"
+        "    v = 1.0\n"
+        "    crossings = 0.0\n"
+        "    for i in 0 to 3000000:\n"
+        "        a = 0.0 - x * 4.0\n"
+        "        v = v + a * 0.001\n"
+        "        x = x + v * 0.001\n"
+        "        if x > 0.5:\n"
+        "            crossings = crossings + 1.0\n"
+        "        end\n"
+        "    end\n"
+        "end\n";
+    const char* file_name = "kernel_benchmark.eop";
+    std::ofstream(file_name) << source;
+    Eople::Log::SetVerbosityLevel(Eople::Log::VerbosityLevel::NO_DEBUG);
+
+    for( const char* kernel : { "sieve", "sort", "matmul", "spring" } ) {
+        Eople::ExecutionEnvironment ee;
+        REQUIRE( ee.ImportModuleFromFile(file_name) );
+        auto start = Eople::HighResClock::now();
+        ee.ExecuteFunction(kernel, false);
+        double ms = std::chrono::duration<double, std::milli>(Eople::HighResClock::now() - start).count();
+        ee.Shutdown();
+
+        unsigned long long instructions = 0;
+#if EOPLE_THREADED_DISPATCH
+        Eople::VirtualMachineConfig config;
+        config.count_opcode_pairs = true;
+        Eople::ExecutionEnvironment counted(config);
+        REQUIRE( counted.ImportModuleFromFile(file_name) );
+        counted.ExecuteFunction(kernel, false);
+        counted.Shutdown();
+        for( auto &pair : counted.OpcodePairs()->MostFrequent((size_t)-1) ) {
+            instructions += pair.count;
+        }
+#endif
+        printf("%-7s %8.1f ms, %11llu instructions\n", kernel, ms, instructions);
+    }
+
+    remove(file_name);
+}
+
+// Cost of a call to a small function: the loop calling it against the same loop with the body
+// written out, and fib, which is nothing but calls. Hidden, run with: tests "[benchmark]"
+TEST_CASE( "function call overhead", "[.][benchmark]" ) {
+    const char* source =
+        "def inc(x):\n"
+        "    return x + 1\n"
+        "end\n"
+        "\n"
+        "def mix(a, b):\n"
+        "    t = a * 3\n"
+        "    u = t + b\n"
+        "    return u - 2\n"
+        "end\n"
+        "\n"
+        "def fib(n):\n"
+        "    if n < 2:\n"
+        "        return n\n"
+        "    end\n"
+        "    return fib(n - 1) + fib(n - 2)\n"
+        "end\n"
+        "\n"
+        "def call_inc():\n"
+        "    n = 0\n"
+        "    for i in 0 to 1000000:\n"
+        "        n = inc(n)\n"
+        "    end\n"
+        "end\n"
+        "\n"
+        "def inline_inc():\n"
+        "    n = 0\n"
+        "    for i in 0 to 1000000:\n"
+        "        n = n + 1\n"
+        "    end\n"
+        "end\n"
+        "\n"
+        "def call_mix():\n"
+        "    m = 0\n"
+        "    for i in 0 to 1000000:\n"
+        "        m = mix(m, i)\n"
+        "    end\n"
+        "end\n"
+        "\n"
+        "def inline_mix():\n"
+        "    m = 0\n"
+        "    for i in 0 to 1000000:\n"
+        "        t = m * 3\n"
+        "        u = t + i\n"
+        "        m = u - 2\n"
+        "    end\n"
+        "end\n"
+        "\n"
+        "def call_fib():\n"
+        "    fib(25)\n"
+        "end\n";
+    const char* file_name = "call_benchmark.eop";
+    std::ofstream(file_name) << source;
+    Eople::Log::SetVerbosityLevel(Eople::Log::VerbosityLevel::NO_DEBUG);
+
+    // the calls themselves, not their inlined code
+    Eople::VirtualMachineConfig config;
+    config.inline_functions = false;
+    Eople::ExecutionEnvironment ee(config);
+    REQUIRE( ee.ImportModuleFromFile(file_name) );
+    // best of a few runs, in ms
+    auto time = [&ee]( const char* function ) {
+        double best = 1e9;
+        for( int run = 0; run < 5; ++run ) {
+            auto start = Eople::HighResClock::now();
+            ee.ExecuteFunction(function, false);
+            best = std::min(best, std::chrono::duration<double, std::milli>(Eople::HighResClock::now() - start).count());
+        }
+        return best;
+    };
+
+    double inc = time("call_inc") - time("inline_inc");
+    double mix = time("call_mix") - time("inline_mix");
+    // fib(25) makes 242785 calls
+    double fib = time("call_fib");
+    printf("inc: %5.1f ns per call\n", inc * 1e6 / 1000000);
+    printf("mix: %5.1f ns per call\n", mix * 1e6 / 1000000);
+    printf("fib: %5.1f ns per call\n", fib * 1e6 / 242785);
+    ee.Shutdown();
+
+    remove(file_name);
+}
+
+// Recursive calls: fib, whose calls stay a few frames deep, a chain of calls 100000 frames deep,
+// on a fresh process and again once its stack has grown, and a million tail calls reusing one
+// frame. Hidden, run with: tests "[benchmark]"
+TEST_CASE( "recursion", "[.][benchmark]" ) {
+    const char* source =
+        "def fib(n):\n"
+        "    if n < 2:\n"
+        "        return n\n"
+        "    end\n"
+        "    return fib(n - 1) + fib(n - 2)\n"
+        "end\n"
+        "\n"
+        "def depth(n):\n"
+        "    if n == 0:\n"
+        "        return 0\n"
+        "    end\n"
+        "    return depth(n - 1) + 1\n"
+        "end\n"
+        "\n"
+        "def count(n, acc):\n"
+        "    if n == 0:\n"
+        "        return acc\n"
+        "    end\n"
+        "    return count(n - 1, acc + 1)\n"
+        "end\n"
+        "\n"
+        "def call_fib():\n"
+        "    fib(27)\n"
+        "end\n"
+        "\n"
+        "def call_depth():\n"
+        "    depth(100000)\n"
+        "end\n"
+        "\n"
+        "def call_count():\n"
+        "    count(1000000, 0)\n"
+        "end\n";
+    const char* file_name = "recursion_benchmark.eop";
+    std::ofstream(file_name) << source;
+    Eople::Log::SetVerbosityLevel(Eople::Log::VerbosityLevel::NO_DEBUG);
+
+    Eople::ExecutionEnvironment ee;
+    REQUIRE( ee.ImportModuleFromFile(file_name) );
+    auto time = [&ee]( const char* function ) {
+        auto start = Eople::HighResClock::now();
+        ee.ExecuteFunction(function, false);
+        return std::chrono::duration<double, std::milli>(Eople::HighResClock::now() - start).count();
+    };
+
+    double first_depth = time("call_depth");
+    double fib = 1e9, depth = 1e9, count = 1e9;
+    for( int run = 0; run < 5; ++run ) {
+        fib   = std::min(fib, time("call_fib"));
+        depth = std::min(depth, time("call_depth"));
+        count = std::min(count, time("call_count"));
+    }
+    // fib(27) makes 635621 calls
+    printf("fib:   %5.1f ns per call\n", fib * 1e6 / 635621);
+    printf("depth: %5.1f ns per call, %5.1f on the first run\n", depth * 1e6 / 100000, first_depth * 1e6 / 100000);
+    printf("tail:  %5.1f ns per call\n", count * 1e6 / 1000000);
+    ee.Shutdown();
+
+    remove(file_name);
+}
+
+// A script made of calls to small helpers, with and without inlining. Hidden, run with: tests "[benchmark]"
+TEST_CASE( "inlining", "[.][benchmark]" ) {
+    const char* source =
+        "def min(a, b):\n"
+        "    if a < b:\n"
+        "        return a\n"
+        "    end\n"
+        "    return b\n"
+        "end\n"
+        "\n"
+        "def max(a, b):\n"
+        "    if a > b:\n"
+        "        return a\n"
+        "    end\n"
+        "    return b\n"
+        "end\n"
+        "\n"
+        "def clamp(x, lo, hi):\n"
+        "    return min(max(x, lo), hi)\n"
+        "end\n"
+        "\n"
+        "def lerp(a, b, t):\n"
+        "    return a + (b - a) * t\n"
+        "end\n"
+        "\n"
+        "def square(x):\n"
+        "    return x * x\n"
+        "end\n"
+        "\n"
+        "def main():\n"
+        "    total = 0\n"
+        "    f = 0.0\n"
+        "    for i in 0 to 1000000:\n"
+        "        total = total + clamp(i % 100, 10, 90) + square(i % 7)\n"
+        "        f = lerp(f, 1.0, 0.001)\n"
+        "    end\n"
+        "end\n";
+    const char* file_name = "inline_benchmark.eop";
+    std::ofstream(file_name) << source;
+    Eople::Log::SetVerbosityLevel(Eople::Log::VerbosityLevel::NO_DEBUG);
+
+    for( bool inline_functions : { false, true } ) {
+        Eople::VirtualMachineConfig config;
+        config.inline_functions = inline_functions;
+        Eople::ExecutionEnvironment ee(config);
+        REQUIRE( ee.ImportModuleFromFile(file_name) );
+        double best = 1e9;
+        for( int run = 0; run < 5; ++run ) {
+            auto start = Eople::HighResClock::now();
+            ee.ExecuteFunction("main", false);
+            best = std::min(best, std::chrono::duration<double, std::milli>(Eople::HighResClock::now() - start).count());
+        }
+        printf("inlining %-3s: %6.1f ms\n", inline_functions ? "on" : "off", best);
+        ee.Shutdown();
+    }
+
+    remove(file_name);
+}
+
+// Heap traffic of short string temporaries. Hidden, run with: tests "[benchmark]"
+TEST_CASE( "heap bytes per short string", "[.][benchmark]" ) {
+    const char* source =
+        "def main():\n"
+        "    for i in 0 to 1000000:\n"
+        "        tag = 'node-' + 'a'\n"
+        "        same = tag == 'node-a'\n"
+        "        key = 'k' + to_string(i % 10)\n"
+        "    end\n"
+        "end\n";
+    const char* file_name = "string_benchmark.eop";
+    std::ofstream(file_name) << source;
+
+    Eople::Log::SetVerbosityLevel(Eople::Log::VerbosityLevel::NO_DEBUG);
+    Eople::ExecutionEnvironment ee;
+    REQUIRE( ee.ImportModuleFromFile(file_name) );
+
+    size_t start_bytes = s_heap_bytes.load();
+    auto start = Eople::HighResClock::now();
+    ee.ExecuteFunction("main", false);
+    double ms = std::chrono::duration<double, std::milli>(Eople::HighResClock::now() - start).count();
+    size_t bytes = s_heap_bytes.load() - start_bytes;
+    printf("1M short string iterations: %.1f ms, %.1f heap bytes per iteration\n", ms, bytes / 1e6);
+    ee.Shutdown();
+
+    remove(file_name);
+}
+
+// Memory and speed of the object layout; compare a default build with -DEOPLE_NAN_BOXING=ON.
+// Hidden, run with: tests "[benchmark]"
+TEST_CASE( "object layout", "[.][benchmark]" ) {
+    const char* source =
+        "def fib(n):\n"
+        "    if n < 2:\n"
+        "        return n\n"
+        "    end\n"
+        "    return fib(n-1) + fib(n-2)\n"
+        "end\n"
+        "\n"
+        "def calls():\n"
+        "    fib(27)\n"
+        "end\n"
+        "\n"
+        "def ints():\n"
+        "    total = 0\n"
+        "    for i in 0 to 3000:\n"
+        "        for j in 0 to 1000:\n"
+        "            total = total + (i * j) % 7\n"
+        "        end\n"
+        "    end\n"
+        "end\n"
+        "\n"
+        "def floats():\n"
+        "    total = 0.0\n"
+        "    x = 0.5\n"
+        "    for i in 0 to 3000000:\n"
+        "        total = total + x * 1.0001\n"
+        "        x = x + 0.25\n"
+        "    end\n"
+        "end\n"
+        "\n"
+        "def arrays():\n"
+        "    values = [0]\n"
+        "    for i in 0 to 1000000:\n"
+        "        values.push(i)\n"
+        "    end\n"
+        "    total = 0\n"
+        "    for k in 0 to 10:\n"
+        "        for v in values:\n"
+        "            total = total + v\n"
+        "        end\n"
+        "    end\n"
+        "end\n";
+    const char* file_name = "object_benchmark.eop";
+    std::ofstream(file_name) << source;
+
+    Eople::Log::SetVerbosityLevel(Eople::Log::VerbosityLevel::NO_DEBUG);
+    Eople::ExecutionEnvironment ee;
+    REQUIRE( ee.ImportModuleFromFile(file_name) );
+
+    // every workload runs on this thread, one after the other
+    printf("sizeof(Object): %zu bytes\n", sizeof(Eople::Object));
+    for( auto name : { "calls", "ints", "floats", "arrays" } ) {
+        size_t start_bytes = s_heap_bytes.load();
+        auto start = Eople::HighResClock::now();
+        ee.ExecuteFunction(name, false);
+        double ms = std::chrono::duration<double, std::milli>(Eople::HighResClock::now() - start).count();
+        size_t bytes = s_heap_bytes.load() - start_bytes;
+        printf("%-7s %8.1f ms, %10zu bytes allocated\n", name, ms, bytes);
+    }
+    ee.Shutdown();
+
+    remove(file_name);
+}
@@ -23,6 +23,7 @@ const char* StringFromValueType( ValueType val_type )
     TOKEN_STRING_CASE(ValueType::NIL,      "nil");
     TOKEN_STRING_CASE(ValueType::STRING,   "string");
     TOKEN_STRING_CASE(ValueType::DICT,     "dict");
+    TOKEN_STRING_CASE(ValueType::STRUCT,   "struct");
     TOKEN_STRING_CASE(ValueType::PROCESS,  "process");
     TOKEN_STRING_CASE(ValueType::PROMISE,  "promise");
     TOKEN_STRING_CASE(ValueType::ARRAY,    "array");
@@ -235,8 +236,43 @@ InferenceState TypeInfer::PropagateType( Node::Identifier* identifier, type_t ty
 
 InferenceState TypeInfer::PropagateType( Node::ArraySubscript* array_subscript, type_t type )
 {
-  type_t element_type = m_function->GetExpressionType( array_subscript->ident->GetAsIdentifier() )->GetVaryingType();
+  type_t container_type = m_function->GetExpressionType( array_subscript->ident->GetAsIdentifier() );
   InferenceState state;
+  // obj.member or arr[i].member
+  if( container_type->type == ValueType::STRUCT || !array_subscript->member.empty() )
+  {
+    if( container_type->type == ValueType::NIL || (container_type->type == ValueType::ARRAY && container_type->GetVaryingType()->type == ValueType::NIL) )
+    {
+      // container not typed yet
+      return state;
+    }
+    StructType* struct_type = array_subscript->GetStructType( container_type );
+    const std::string* member_name = array_subscript->GetMemberName();
+    if( !struct_type || !member_name )
+    {
+      Log::Error("(%d): Type ERROR: Member access on a %s, expected a struct.\n", array_subscript->line,
+                                    StringFromValueType(container_type->GetVaryingType()->type));
+      BumpError();
+      return state;
+    }
+    size_t member_index = struct_type->MemberIndex( *member_name );
+    if( member_index == StructType::NOT_A_MEMBER )
+    {
+      Log::Error("(%d): Type ERROR: '%s' is not a member of struct '%s'.\n", array_subscript->line,
+                                    member_name->c_str(), struct_type->struct_name.c_str());
+      BumpError();
+      return state;
+    }
+    // member types come from the constructor calls, so this is nil until one is inferred
+    if( member_index < struct_type->member_types.size() )
+    {
+      state.type = struct_type->member_types[member_index];
+      state.clear = state.type->type != ValueType::NIL;
+    }
+    return state;
+  }
+
+  type_t element_type = container_type->GetVaryingType();
   state.type = element_type;
   state.clear = true;
   return state;
@@ -336,9 +372,83 @@ InferenceState TypeInfer::PropagateType( Node::ProcessMessage* process_call, typ
   return state;
 }
 
+// member types are set by the first typed constructor call, later calls must match
+InferenceState TypeInfer::PropagateStructConstructor( Node::FunctionCall* function_call, Node::Struct* struct_node, type_t type )
+{
+  InferenceState state;
+  StructType* struct_type = &struct_node->type;
+  if( struct_type->member_names.size() != function_call->arguments.size() )
+  {
+    Log::Error("(%d): Type ERROR: Expected %d arguments to '%s' struct constructor, got %d\n", function_call->line,
+                          struct_type->member_names.size(), struct_node->name.c_str(), function_call->arguments.size());
+    BumpError();
+    return state;
+  }
+  if( type->type != ValueType::NIL && type != struct_type )
+  {
+    Log::Error("(%d): Type ERROR: Return value for '%s' is struct, expected: %s.\n", function_call->line,
+                                                function_call->GetName().c_str(), StringFromValueType(type->type));
+    BumpError();
+    return state;
+  }
+
+  auto &member_types = struct_type->member_types;
+  member_types.resize( struct_type->member_names.size(), TypeBuilder::GetNilType() );
+  state.clear = true;
+  for( size_t i = 0; i < function_call->arguments.size(); ++i )
+  {
+    InferenceState arg_state = PropagateType( function_call->arguments[i].get(), TypeBuilder::GetNilType() );
+    if( arg_state.type->type == ValueType::NIL && member_types[i]->type != ValueType::NIL )
+    {
+      arg_state = PropagateType( function_call->arguments[i].get(), member_types[i] );
+    }
+    if( arg_state.type->type == ValueType::NIL )
+    {
+      state.clear = false;
+    }
+    else if( member_types[i]->type == ValueType::NIL )
+    {
+      member_types[i] = arg_state.type;
+    }
+    else if( member_types[i] != arg_state.type )
+    {
+      Log::Error("(%d): Type ERROR: Member '%s' of '%s' is %s, got: %s.\n", function_call->line, struct_type->member_names[i].c_str(),
+                                    struct_node->name.c_str(), StringFromValueType(member_types[i]->type), StringFromValueType(arg_state.type->type));
+      BumpError();
+    }
+  }
+
+  function_call->constructs_struct = true;
+  m_function->RegisterFunctionCall( function_call );
+  function_call->TrySetReturnType( m_function->current_specialization, struct_type );
+  state.type = struct_type;
+  return state;
+}
+
+// builtins from eople_array_math.h
+static bool IsArrayReduction( const std::string &name )
+{
+  return name == "sum" || name == "min" || name == "max" || name == "dot";
+}
+
+static bool IsArrayMathFunction( const std::string &name )
+{
+  return IsArrayReduction(name) || name == "scale" || name == "add" || name == "mul" || name == "axpy";
+}
+
+// builtins that return the array they are given, or part of it
+static bool ReturnsArrayType( const std::string &name )
+{
+  return name == "freeze" || name == "slice";
+}
+
 InferenceState TypeInfer::PropagateType( Node::FunctionCall* function_call, type_t type )
 {
   InferenceState state;
+  if( Node::Struct* struct_node = StructFromCall(function_call) )
+  {
+    return PropagateStructConstructor( function_call, struct_node, type );
+  }
   Node::Function* func = FunctionFromCall(function_call);
   if( !func )
   {
@@ -354,6 +464,17 @@ InferenceState TypeInfer::PropagateType( Node::FunctionCall* function_call, type
     assert( type == TypeBuilder::GetNilType() || promise_type == type );
     type = promise_type;
   }
+  else if( func->is_c_call && (IsArrayMathFunction(function_call->GetName()) || ReturnsArrayType(function_call->GetName())) )
+  {
+    // reductions return an element, elementwise functions return an array of the same type
+    InferenceState array_state = PropagateType( function_call->arguments[0].get(), TypeBuilder::GetNilType() );
+    if( array_state.clear && array_state.type->type == ValueType::ARRAY )
+    {
+      type_t result_type = IsArrayReduction(function_call->GetName()) ? array_state.type->GetVaryingType() : array_state.type;
+      assert( type == TypeBuilder::GetNilType() || result_type == type );
+      type = result_type;
+    }
+  }
   else if( function_call->GetName() == "array" )
   {
     // TODO: is this enforced before this point?
@@ -1067,6 +1188,42 @@ Node::Function* TypeInfer::FunctionFromCall( Node::FunctionCall* node )
   return nullptr;
 }
 
+Node::Struct* TypeInfer::StructFromCall( Node::FunctionCall* node )
+{
+  std::queue<Node::Module*> modules;
+  modules.push(m_current_module);
+
+  while( !modules.empty() )
+  {
+    auto module = modules.front(); modules.pop();
+
+    // innermost namespace first, then module scope
+    for( size_t i = node->namespace_stack.size(); i > 0; --i )
+    {
+      for( auto &struct_node : module->structs )
+      {
+        if( struct_node->name == node->namespace_stack[i-1] + node->GetName() )
+        {
+          return struct_node.get();
+        }
+      }
+    }
+    for( auto &struct_node : module->structs )
+    {
+      if( struct_node->name == node->GetName() )
+      {
+        return struct_node.get();
+      }
+    }
+    for( auto imported_module : module->imported )
+    {
+      modules.push(imported_module);
+    }
+  }
+
+  return nullptr;
+}
+
 Node::Function* TypeInfer::FunctionFromProcessMessage( std::string process_name, Node::FunctionCall* node )
 {
   std::queue<Node::Module*> modules;
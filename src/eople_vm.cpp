@@ -13,6 +13,7 @@
 #include <thread>
 #include <string>
 #include <chrono>
+#include <algorithm>
 
 namespace Eople
 {
@@ -38,6 +39,7 @@ std::string InstructionToString( InstructionImpl instruction )
   INSTRUCTION_TO_STRING(BXor)
   INSTRUCTION_TO_STRING(BOr)
   INSTRUCTION_TO_STRING(ConcatS)
+  INSTRUCTION_TO_STRING(ConcatN)
   INSTRUCTION_TO_STRING(EqualS)
   INSTRUCTION_TO_STRING(NotEqualS)
   INSTRUCTION_TO_STRING(ForI)
@@ -46,6 +48,7 @@ std::string InstructionToString( InstructionImpl instruction )
   INSTRUCTION_TO_STRING(While)
   INSTRUCTION_TO_STRING(Return)
   INSTRUCTION_TO_STRING(ReturnValue)
+  INSTRUCTION_TO_STRING(ReturnValueK)
   INSTRUCTION_TO_STRING(PrintI)
   INSTRUCTION_TO_STRING(PrintF)
   INSTRUCTION_TO_STRING(PrintIArr)
@@ -54,8 +57,29 @@ std::string InstructionToString( InstructionImpl instruction )
   INSTRUCTION_TO_STRING(PrintSPromise)
   INSTRUCTION_TO_STRING(PrintDict)
   INSTRUCTION_TO_STRING(FunctionCall)
+  INSTRUCTION_TO_STRING(TailCall)
   INSTRUCTION_TO_STRING(ArraySubscript)
+  INSTRUCTION_TO_STRING(ArraySubscriptI)
+  INSTRUCTION_TO_STRING(ArraySubscriptF)
+  INSTRUCTION_TO_STRING(ArraySubscriptB)
+  INSTRUCTION_TO_STRING(AddSubscriptI)
+  INSTRUCTION_TO_STRING(MulSubscriptI)
+  INSTRUCTION_TO_STRING(AddSubscriptF)
+  INSTRUCTION_TO_STRING(MulSubscriptF)
+  INSTRUCTION_TO_STRING(MulAddI)
+  INSTRUCTION_TO_STRING(MulAddF)
+  INSTRUCTION_TO_STRING(AddIK)
+  INSTRUCTION_TO_STRING(SubIK)
+  INSTRUCTION_TO_STRING(MulIK)
+  INSTRUCTION_TO_STRING(AddFK)
+  INSTRUCTION_TO_STRING(SubFK)
+  INSTRUCTION_TO_STRING(MulFK)
+  INSTRUCTION_TO_STRING(DivFK)
+  INSTRUCTION_TO_STRING(DictSubscript)
+  INSTRUCTION_TO_STRING(StructMember)
+  INSTRUCTION_TO_STRING(StructArrayMember)
   INSTRUCTION_TO_STRING(ProcessMessage)
+  INSTRUCTION_TO_STRING(ProcessMessageNoReply)
   INSTRUCTION_TO_STRING(GreaterThanI)
   INSTRUCTION_TO_STRING(LessThanI)
   INSTRUCTION_TO_STRING(EqualI)
@@ -71,10 +95,17 @@ std::string InstructionToString( InstructionImpl instruction )
   INSTRUCTION_TO_STRING(And)
   INSTRUCTION_TO_STRING(Or)
   INSTRUCTION_TO_STRING(Store)
+  INSTRUCTION_TO_STRING(StoreK)
   INSTRUCTION_TO_STRING(StoreArrayElement)
   INSTRUCTION_TO_STRING(StoreArrayStringElement)
+  INSTRUCTION_TO_STRING(StoreArrayElementI)
+  INSTRUCTION_TO_STRING(StoreArrayElementF)
+  INSTRUCTION_TO_STRING(StoreArrayElementB)
+  INSTRUCTION_TO_STRING(StoreStructMember)
+  INSTRUCTION_TO_STRING(StoreStructArrayMember)
   INSTRUCTION_TO_STRING(StringCopy)
   INSTRUCTION_TO_STRING(SpawnProcess)
+  INSTRUCTION_TO_STRING(NewStruct)
   INSTRUCTION_TO_STRING(WhenRegister)
   INSTRUCTION_TO_STRING(WheneverRegister)
   INSTRUCTION_TO_STRING(When)
@@ -87,6 +118,24 @@ std::string InstructionToString( InstructionImpl instruction )
   INSTRUCTION_TO_STRING(JumpNEQ)
   INSTRUCTION_TO_STRING(JumpLEQ)
   INSTRUCTION_TO_STRING(JumpGEQ)
+  INSTRUCTION_TO_STRING(JumpNotGTF)
+  INSTRUCTION_TO_STRING(JumpNotLTF)
+  INSTRUCTION_TO_STRING(JumpNotEQF)
+  INSTRUCTION_TO_STRING(JumpNotNEQF)
+  INSTRUCTION_TO_STRING(JumpNotLEQF)
+  INSTRUCTION_TO_STRING(JumpNotGEQF)
+  INSTRUCTION_TO_STRING(JumpGTK)
+  INSTRUCTION_TO_STRING(JumpLTK)
+  INSTRUCTION_TO_STRING(JumpEQK)
+  INSTRUCTION_TO_STRING(JumpNEQK)
+  INSTRUCTION_TO_STRING(JumpLEQK)
+  INSTRUCTION_TO_STRING(JumpGEQK)
+  INSTRUCTION_TO_STRING(JumpNotGTFK)
+  INSTRUCTION_TO_STRING(JumpNotLTFK)
+  INSTRUCTION_TO_STRING(JumpNotEQFK)
+  INSTRUCTION_TO_STRING(JumpNotNEQFK)
+  INSTRUCTION_TO_STRING(JumpNotLEQFK)
+  INSTRUCTION_TO_STRING(JumpNotGEQFK)
 
   return "ERR";
 }
@@ -110,6 +159,7 @@ InstructionImpl OpcodeToInstruction( Opcode opcode )
     OPCODE_TO_INSTRUCTION(BXor);
     OPCODE_TO_INSTRUCTION(BOr);
     OPCODE_TO_INSTRUCTION(ConcatS);
+    OPCODE_TO_INSTRUCTION(ConcatN);
     OPCODE_TO_INSTRUCTION(EqualS);
     OPCODE_TO_INSTRUCTION(NotEqualS);
     OPCODE_TO_INSTRUCTION(ForI);
@@ -118,6 +168,7 @@ InstructionImpl OpcodeToInstruction( Opcode opcode )
     OPCODE_TO_INSTRUCTION(While);
     OPCODE_TO_INSTRUCTION(Return);
     OPCODE_TO_INSTRUCTION(ReturnValue);
+    OPCODE_TO_INSTRUCTION(ReturnValueK);
     OPCODE_TO_INSTRUCTION(PrintI);
     OPCODE_TO_INSTRUCTION(PrintF);
     OPCODE_TO_INSTRUCTION(PrintIArr);
@@ -126,8 +177,29 @@ InstructionImpl OpcodeToInstruction( Opcode opcode )
     OPCODE_TO_INSTRUCTION(PrintSPromise);
     OPCODE_TO_INSTRUCTION(PrintDict);
     OPCODE_TO_INSTRUCTION(FunctionCall);
+    OPCODE_TO_INSTRUCTION(TailCall);
     OPCODE_TO_INSTRUCTION(ArraySubscript);
+    OPCODE_TO_INSTRUCTION(ArraySubscriptI);
+    OPCODE_TO_INSTRUCTION(ArraySubscriptF);
+    OPCODE_TO_INSTRUCTION(ArraySubscriptB);
+    OPCODE_TO_INSTRUCTION(AddSubscriptI);
+    OPCODE_TO_INSTRUCTION(MulSubscriptI);
+    OPCODE_TO_INSTRUCTION(AddSubscriptF);
+    OPCODE_TO_INSTRUCTION(MulSubscriptF);
+    OPCODE_TO_INSTRUCTION(MulAddI);
+    OPCODE_TO_INSTRUCTION(MulAddF);
+    OPCODE_TO_INSTRUCTION(AddIK);
+    OPCODE_TO_INSTRUCTION(SubIK);
+    OPCODE_TO_INSTRUCTION(MulIK);
+    OPCODE_TO_INSTRUCTION(AddFK);
+    OPCODE_TO_INSTRUCTION(SubFK);
+    OPCODE_TO_INSTRUCTION(MulFK);
+    OPCODE_TO_INSTRUCTION(DivFK);
+    OPCODE_TO_INSTRUCTION(DictSubscript);
+    OPCODE_TO_INSTRUCTION(StructMember);
+    OPCODE_TO_INSTRUCTION(StructArrayMember);
     OPCODE_TO_INSTRUCTION(ProcessMessage);
+    OPCODE_TO_INSTRUCTION(ProcessMessageNoReply);
     OPCODE_TO_INSTRUCTION(GreaterThanI);
     OPCODE_TO_INSTRUCTION(LessThanI);
     OPCODE_TO_INSTRUCTION(EqualI);
@@ -143,10 +215,17 @@ InstructionImpl OpcodeToInstruction( Opcode opcode )
     OPCODE_TO_INSTRUCTION(And);
     OPCODE_TO_INSTRUCTION(Or);
     OPCODE_TO_INSTRUCTION(Store);
+    OPCODE_TO_INSTRUCTION(StoreK);
     OPCODE_TO_INSTRUCTION(StoreArrayElement);
     OPCODE_TO_INSTRUCTION(StoreArrayStringElement);
+    OPCODE_TO_INSTRUCTION(StoreArrayElementI);
+    OPCODE_TO_INSTRUCTION(StoreArrayElementF);
+    OPCODE_TO_INSTRUCTION(StoreArrayElementB);
+    OPCODE_TO_INSTRUCTION(StoreStructMember);
+    OPCODE_TO_INSTRUCTION(StoreStructArrayMember);
     OPCODE_TO_INSTRUCTION(StringCopy);
     OPCODE_TO_INSTRUCTION(SpawnProcess);
+    OPCODE_TO_INSTRUCTION(NewStruct);
     OPCODE_TO_INSTRUCTION(WhenRegister);
     OPCODE_TO_INSTRUCTION(WheneverRegister);
     OPCODE_TO_INSTRUCTION(When);
@@ -159,181 +238,450 @@ InstructionImpl OpcodeToInstruction( Opcode opcode )
     OPCODE_TO_INSTRUCTION(JumpNEQ);
     OPCODE_TO_INSTRUCTION(JumpLEQ);
     OPCODE_TO_INSTRUCTION(JumpGEQ);
+    OPCODE_TO_INSTRUCTION(JumpNotGTF);
+    OPCODE_TO_INSTRUCTION(JumpNotLTF);
+    OPCODE_TO_INSTRUCTION(JumpNotEQF);
+    OPCODE_TO_INSTRUCTION(JumpNotNEQF);
+    OPCODE_TO_INSTRUCTION(JumpNotLEQF);
+    OPCODE_TO_INSTRUCTION(JumpNotGEQF);
+    OPCODE_TO_INSTRUCTION(JumpGTK);
+    OPCODE_TO_INSTRUCTION(JumpLTK);
+    OPCODE_TO_INSTRUCTION(JumpEQK);
+    OPCODE_TO_INSTRUCTION(JumpNEQK);
+    OPCODE_TO_INSTRUCTION(JumpLEQK);
+    OPCODE_TO_INSTRUCTION(JumpGEQK);
+    OPCODE_TO_INSTRUCTION(JumpNotGTFK);
+    OPCODE_TO_INSTRUCTION(JumpNotLTFK);
+    OPCODE_TO_INSTRUCTION(JumpNotEQFK);
+    OPCODE_TO_INSTRUCTION(JumpNotNEQFK);
+    OPCODE_TO_INSTRUCTION(JumpNotLEQFK);
+    OPCODE_TO_INSTRUCTION(JumpNotGEQFK);
   }
 
   return nullptr;
 }
 
+static std::string OpcodeName( Opcode opcode )
+{
+  switch( opcode )
+  {
+    case Opcode::CCall: return "CCall";
+    case Opcode::NOP:   return "NOP";
+    default:            return InstructionToString(OpcodeToInstruction(opcode));
+  }
+}
+
+static std::atomic<u32> s_next_pair_counts_id(1);
+
+OpcodePairCounts::OpcodePairCounts() : id(s_next_pair_counts_id++)
+{
+}
+
+OpcodePairCounts::Table& OpcodePairCounts::ThreadTable()
+{
+  thread_local u32    table_owner = 0;
+  thread_local Table* table = nullptr;
+  if( table_owner != id )
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    tables.emplace_back(new Table());
+    table = tables.back().get();
+    table_owner = id;
+  }
+  return *table;
+}
+
+std::vector<OpcodePairCounts::Pair> OpcodePairCounts::MostFrequent( size_t max_pairs )
+{
+  std::lock_guard<std::mutex> guard(lock);
+  std::vector<Pair> pairs;
+  for( size_t first = 0; first < opcode_count; ++first )
+  {
+    for( size_t second = 0; second < opcode_count; ++second )
+    {
+      u64 count = 0;
+      for( auto &table : tables )
+      {
+        count += table->counts[first][second];
+      }
+      if( count )
+      {
+        pairs.push_back( Pair{ (Opcode)first, (Opcode)second, count } );
+      }
+    }
+  }
+  std::sort( pairs.begin(), pairs.end(), []( const Pair &l, const Pair &r ) { return l.count > r.count; } );
+  if( pairs.size() > max_pairs )
+  {
+    pairs.resize(max_pairs);
+  }
+  return pairs;
+}
+
+void OpcodePairCounts::Print( size_t max_pairs )
+{
+  u64 total = 0;
+  for( auto &pair : MostFrequent((size_t)-1) )
+  {
+    total += pair.count;
+  }
+
+  Eople::Log::Print("vm> Most frequent opcode pairs, of %llu:\n", (unsigned long long)total);
+  for( auto &pair : MostFrequent(max_pairs) )
+  {
+    Eople::Log::Print("  %6.2f%%  %12llu  %s, %s\n", 100.0 * pair.count / total, (unsigned long long)pair.count,
+                      OpcodeName(pair.first).c_str(), OpcodeName(pair.second).c_str());
+  }
+}
+
+namespace
+{
+
+// identifies the core (if any) running on the current thread
+struct CoreContext
+{
+  VirtualMachine* vm;
+  u32             index;
+  u32             tick;
+};
+
+thread_local CoreContext s_current_core = { nullptr, 0, 0 };
+
+} // anonymous namespace
+
 void CoreMain( VirtualMachine* vm, u32 id )
 {
   size_t core_count  = vm->core_count;
-  size_t queue_count = vm->queues.size();
 
-  const size_t buffer_size = 16;
-  CallData messages[buffer_size];
-  std::vector<CallData> future_messages;
-  std::atomic<int>* queue_locks = vm->queue_locks.get();
+  s_current_core.vm    = vm;
+  s_current_core.index = id;
 
-  u32 tries = 0;
-  const u32 max_retries = 10;
+  const u32 spin_limit = vm->idle_spin_rounds;
+  u32 spin_rounds = spin_limit;
 
   for(;;)
   {
-    ++tries;
-    for( size_t j = 0; j < queue_count; ++j )
+    process_t process_ref = vm->FindRunnableProcess(id);
+
+    if( !process_ref && spin_rounds )
+    {
+      // Parking and waking a core is slow compared to a message, so look around a bit first.
+      for( u32 round = 0; !process_ref && round < spin_rounds; ++round )
+      {
+        std::this_thread::yield();
+        process_ref = vm->FindRunnableProcess(id);
+      }
+      // spin longer when it pays off, shorter when it doesn't
+      spin_rounds = process_ref ? Min( spin_limit, spin_rounds * 2 ) : Max( 1u, spin_rounds / 2 );
+    }
+
+    if( !process_ref )
     {
-      size_t i = (j+id) % queue_count;
+      u32 key = vm->idle_event.PrepareWait();
+      u32 parked = ++vm->parked_count;
+      // Only cores and timers can make more work once we're shutting down, so if every
+      // core is parked and no timers are left, we're done.
+      bool last_core = parked == core_count && vm->ready_to_exit.load() != 0 && vm->timer_count == 0;
 
-      AutoTryLock lock(queue_locks[i]);
-      if( lock.got_lock && !vm->queues[i].empty() )
+      // Look again, in case work arrived before PrepareWait.
+      process_ref = vm->FindRunnableProcess(id);
+      if( !process_ref )
       {
-        auto current_time = HighResClock::now();
-        CallData message = vm->queues[i].front();
-        // attempt to get process lock. first come first served.
-        AutoTryLock process_lock(message.process_ref->lock);
-        if( process_lock.got_lock )
+        if( last_core )
         {
-          process_t locked_process = message.process_ref;
-
-          int pop_count = 0;
-          bool have_message = true;
-          while( have_message && message.process_ref == locked_process && pop_count < buffer_size )
-          {
-            vm->queues[i].pop();
-            // Is this message ready to be processed?
-            if( message.time > current_time )
-            {
-              future_messages.push_back(message);
-            }
-            else
-            {
-              // If this message was a timer, mark it as ready.
-              if( message.promise && message.promise->is_timer )
-              {
-                message.promise->is_ready = true;
-              }
-              messages[pop_count++] = message;
-            }
-            have_message = false;
-            if( !vm->queues[i].empty() )
-            {
-              message = vm->queues[i].front();
-              have_message = true;
-            }
-          }
-
-          if( pop_count )
-          {
-            // Save signaling one of the messages until done processing.
-            // This way, the idle_count check below is more accurate.
-            vm->message_count -= pop_count-1;
-          }
-
-          // These messages weren't ready to be processed, so push them to the end of the queue.
-          for( auto future_message : future_messages )
-          {
-            vm->queues[i].push(future_message);
-          }
-          future_messages.clear();
-
-          // Done with the queue.
-          lock.unlock();
-
-          // Process any messages we grabbed.
-          for( int f = 0; f < pop_count; ++f )
-          {
-            if( messages[f].function && messages[f].function->updated_function.load() != nullptr )
-            {
-              messages[f].function = messages[f].function->updated_function.load();
-            }
-            vm->ExecuteProcessMessage( messages[f] );
-          }
-
-          // Done with the process.
-          process_lock.unlock();
-
-          // Adjust message count once we're done processing.
-          if( pop_count )
-          {
-            --vm->message_count;
-          }
-
-          // Reset try count if we successfully executed a job.
-          tries = pop_count ? 0 : tries;
+          // Stay counted as parked, and tell everyone to go home.
+          vm->idle_event.CancelWait();
+          vm->idle_event.NotifyAll();
+          return;
         }
+        vm->idle_event.Wait(key);
+        --vm->parked_count;
+        // a woken core spins again, unless it is never to spin
+        spin_rounds = Min( spin_limit, Max( 1u, spin_rounds ) );
+        continue;
       }
+      --vm->parked_count;
+      vm->idle_event.CancelWait();
     }
 
-    if( (tries > max_retries) )
+    vm->RunProcess(process_ref);
+  }
+}
+
+process_t VirtualMachine::FindRunnableProcess( u32 core_index )
+{
+  RunQueue& local = run_queues[core_index];
+  process_t process_ref = nullptr;
+
+  // The local queue is LIFO, which keeps a message and its reply on the same core, but a
+  // busy process that is rescheduled keeps landing on top. Every so often take the oldest
+  // local process instead, and check for processes injected from outside the cores, so
+  // nothing is starved.
+  const u32 fairness_interval = 61;
+  if( (++s_current_core.tick % fairness_interval) == 0 )
+  {
+    process_ref = TakeInjectedProcess();
+    process_ref = process_ref ? process_ref : local.steal();
+    if( process_ref )
     {
-      tries = 0;
-      // Take a mini-nap in case we're spinning, so we don't needlessly burn resources.
-      std::this_thread::sleep_for(std::chrono::microseconds(500));
-      if( vm->message_count < (core_count - vm->idle_count) )
+      return process_ref;
+    }
+  }
+
+  process_ref = local.pop();
+  process_ref = process_ref ? process_ref : TakeInjectedProcess();
+  if( process_ref )
+  {
+    return process_ref;
+  }
+
+  // nothing to do locally, steal from other cores
+  for( u32 i = 1; i < core_count; ++i )
+  {
+    process_ref = run_queues[(core_index + i) % core_count].steal();
+    if( process_ref )
+    {
+      return process_ref;
+    }
+  }
+
+  return nullptr;
+}
+
+process_t VirtualMachine::TakeInjectedProcess()
+{
+  // single consumer queue, so only one core may pop at a time
+  AutoTryLock lock(injected_lock);
+  if( lock.got_lock && !injected_processes.empty() )
+  {
+    process_t process_ref = injected_processes.front();
+    injected_processes.pop();
+    if( !injected_processes.empty() )
+    {
+      // more where that came from, get another core on it
+      idle_event.Notify();
+    }
+    return process_ref;
+  }
+  return nullptr;
+}
+
+void TimerMain( VirtualMachine* vm )
+{
+  typedef std::chrono::milliseconds tick_duration;
+  auto start_time = HighResClock::now();
+  auto to_tick = [start_time]( HighResClock::time_point time ) -> u64
+  {
+    return time <= start_time ? 0 : std::chrono::duration_cast<tick_duration>(time - start_time).count();
+  };
+
+  TimerWheel<CallData> wheel;
+  auto deliver = [vm]( const CallData& call_data )
+  {
+    vm->SendMessage( CallData(call_data.function, call_data.process_ref, call_data.args, call_data.promise) );
+    // wake cores waiting for the last timer before exiting
+    if( --vm->timer_count == 0 && vm->ready_to_exit.load() != 0 )
+    {
+      vm->idle_event.NotifyAll();
+    }
+  };
+
+  for(;;)
+  {
+    u64 now_tick = to_tick(HighResClock::now());
+    while( !vm->new_timers.empty() )
+    {
+      CallData call_data = vm->new_timers.front();
+      vm->new_timers.pop();
+
+      // round up, so a timer never fires early
+      u64 expiry_tick = to_tick(call_data.time) + 1;
+      if( expiry_tick <= Max(now_tick, wheel.tick()) )
       {
-        std::unique_lock<std::mutex> lock(vm->idle_lock);
-        // Make sure we still need to sleep before we commit to it.
-        if( vm->message_count < (core_count - vm->idle_count) )
-        {
-          ++vm->idle_count;
-          // If we're the last core to sleep and we're exiting, tell everyone to go home
-          if( vm->idle_count == core_count && vm->ready_to_exit.load() != 0 )
-          {
-            vm->message_waiting_event.notify_all();
-            return;
-          }
-          vm->message_waiting_event.wait(lock);
-          // If we get woken by the notify_all() above, it's time to go.
-          if( vm->message_count < (core_count - vm->idle_count) &&
-              vm->idle_count == core_count  && vm->ready_to_exit.load() != 0 )
-          {
-            return;
-          }
-          --vm->idle_count;
-        }
+        deliver(call_data);
+      }
+      else
+      {
+        wheel.Add(call_data, expiry_tick);
       }
     }
+    wheel.Advance(now_tick, deliver);
+
+    std::unique_lock<std::mutex> lock(vm->timer_lock);
+    if( vm->timer_thread_exit )
+    {
+      return;
+    }
+    // AddTimer only signals when we're waiting, so check for new timers again after flagging it.
+    vm->timer_thread_waiting = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if( vm->new_timers.empty() )
+    {
+      if( wheel.empty() )
+      {
+        vm->timer_event.wait(lock);
+      }
+      else
+      {
+        vm->timer_event.wait_until(lock, start_time + tick_duration(wheel.NextTick()));
+      }
+    }
+    vm->timer_thread_waiting = false;
   }
 }
 
-void VirtualMachine::Run()
+void VirtualMachine::AddTimer( CallData call_data )
 {
-  for( u32 i = 0; i < core_count; ++i )
+  ++timer_count;
+  new_timers.push(call_data);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if( timer_thread_waiting )
   {
-    cores.push_back(std::thread(CoreMain, this, i+1));
+    std::unique_lock<std::mutex> lock(timer_lock);
+    timer_event.notify_one();
   }
 }
 
-VirtualMachine::VirtualMachine()
-  : idle_count(0), message_count(0), process_count(0), process_list(nullptr), ready_to_exit(0)
+void VirtualMachine::ScheduleProcess( process_t process_ref )
 {
-  core_count = Max<u32>( 2, std::thread::hardware_concurrency() );
-  Eople::Log::Debug("vm> Initializing with %d cores.\n", core_count);
-  queue_locks = std::unique_ptr<std::atomic<int>[]>(new std::atomic<int>[core_count]);
+  if( s_current_core.vm == this )
+  {
+    run_queues[s_current_core.index].push(process_ref);
+  }
+  else
+  {
+    injected_processes.push(process_ref);
+  }
+  // wake a parked core, if there is one. just a load otherwise.
+  idle_event.Notify();
+}
+
+void VirtualMachine::RunProcess( process_t process_ref )
+{
+  const u32 batch_size = 16;
+
+  // the repl or an entry function may be executing in this process. it schedules the
+  // process again once it is done.
+  AutoTryLock process_lock(process_ref->lock);
+  if( !process_lock.got_lock )
+  {
+    UnscheduleProcess(process_ref);
+    return;
+  }
+
+  process_ref->reductions = reduction_budget ? (i32)Min<u32>( reduction_budget, INT32_MAX ) : INT32_MAX;
+  bool preempted = process_ref->is_suspended && !ResumeProcessMessage(process_ref);
 
+  auto &mailbox = process_ref->mailbox;
+  for( u32 batch = 0; !preempted && batch < batch_size && process_ref->reductions > 0 && !mailbox.empty(); ++batch )
+  {
+    CallData message = mailbox.front();
+    mailbox.pop();
+
+    // If this message was a timer, mark it as ready.
+    if( message.promise && message.promise->is_timer )
+    {
+      message.promise->is_ready = true;
+    }
+    preempted = !ExecuteProcessMessage( message );
+  }
+
+  // Done with the process.
+  process_lock.unlock();
+
+  if( preempted || (process_ref->reductions <= 0 && !mailbox.empty()) )
+  {
+    // Out of reductions. Go to the back of the line (the injected queue is FIFO, and
+    // looked at by every core), so the processes waiting behind this one get a turn.
+    injected_processes.push(process_ref);
+    idle_event.Notify();
+    return;
+  }
+
+  if( !mailbox.empty() )
+  {
+    // Used up its batch, let other processes have a turn.
+    ScheduleProcess(process_ref);
+    return;
+  }
+
+  UnscheduleProcess(process_ref);
+}
+
+void VirtualMachine::UnscheduleProcess( process_t process_ref )
+{
+  // Unschedule, unless a message arrived after the mailbox was found empty. The sender, and
+  // a thread releasing the process lock, only schedule the process if they see is_scheduled
+  // cleared. While the lock is held, rescheduling is left to the holder.
+  process_ref->is_scheduled.store(false);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if( process_ref->lock.load() == 0 && (process_ref->is_suspended || !process_ref->mailbox.empty()) &&
+      !process_ref->is_scheduled.exchange(true) )
+  {
+    ScheduleProcess(process_ref);
+  }
+}
+
+void VirtualMachine::Run()
+{
   for( u32 i = 0; i < core_count; ++i )
   {
-    queue_locks[i].store(0);
-    queues.push_back(MessageQueue());
+    cores.push_back(std::thread(CoreMain, this, i));
+  }
+  timer_thread = std::thread(TimerMain, this);
+}
+
+VirtualMachine::VirtualMachine( const VirtualMachineConfig& config )
+  : parked_count(0), process_count(0), process_list(nullptr), ready_to_exit(0)
+{
+  core_count = config.core_count ? config.core_count : Max<u32>( 2, std::thread::hardware_concurrency() );
+  idle_spin_rounds = config.idle_spin_rounds;
+  reduction_budget = config.reduction_budget;
+  string_regions = config.string_regions;
+  if( config.count_opcode_pairs )
+  {
+#if EOPLE_THREADED_DISPATCH
+    pair_counts = std::unique_ptr<OpcodePairCounts>(new OpcodePairCounts());
+#else
+    Eople::Log::Error("vm> Counting opcode pairs needs the threaded interpreter (EOPLE_THREADED_DISPATCH).\n");
+#endif
   }
+  Eople::Log::Debug("vm> Initializing with %d cores.\n", core_count);
+  run_queues = std::unique_ptr<RunQueue[]>(new RunQueue[core_count]);
+  injected_lock.store(0);
+  timer_thread_waiting.store(false);
+  timer_thread_exit.store(false);
+  timer_count.store(0);
 }
 
 void VirtualMachine::Shutdown()
 {
   ready_to_exit.store(1);
-  message_waiting_event.notify_all();
+  // parked cores need to check if they're done
+  idle_event.NotifyAll();
 
-  int mc = message_count;
-  Eople::Log::Debug("vm> Recieved shutdown signal. Waiting to deliver %d messages...\n", mc);
+  Eople::Log::Debug("vm> Recieved shutdown signal. Waiting to deliver messages...\n");
   for( u32 i = 0; i < core_count; ++i )
   {
     cores[i].join();
   }
 
-  mc = message_count;
-  if( mc > 0 )
+  // cores only exit once every timer has been delivered
   {
-    Eople::Log::Error("vm> Left %d message undelivered.\n", mc);
+    std::unique_lock<std::mutex> lock(timer_lock);
+    timer_thread_exit = true;
+    timer_event.notify_one();
+  }
+  timer_thread.join();
+
+  int undelivered = 0;
+  for( auto process_ref = process_list; process_ref; process_ref = process_ref->next )
+  {
+    undelivered += process_ref->mailbox.empty() ? 0 : 1;
+  }
+  if( undelivered > 0 )
+  {
+    Eople::Log::Error("vm> Left messages undelivered to %d processes.\n", undelivered);
   }
   Eople::Log::Debug("vm> Shutdown complete.\n");
 }
@@ -355,6 +703,17 @@ void VirtualMachine::FreeProcesses()
   process_list = nullptr;
 }
 
+size_t VirtualMachine::HeapBytes()
+{
+  std::unique_lock<std::mutex> lock(list_lock);
+  size_t bytes = 0;
+  for( auto process_ref = process_list; process_ref; process_ref = process_ref->next )
+  {
+    bytes += process_ref->heap.live_bytes();
+  }
+  return bytes;
+}
+
 process_t VirtualMachine::GenerateUniqueProcess()
 {
   std::unique_lock<std::mutex> lock(list_lock);
@@ -365,27 +724,208 @@ process_t VirtualMachine::GenerateUniqueProcess()
 
 void VirtualMachine::SendMessage( CallData call_data )
 {
-  u32 index = call_data.process_ref->process_id % queues.size();
-  AutoTryLock queue_lock(queue_locks[index]);
-  int retry_count = 0;
-  while( !queue_lock.got_lock )
+  if( call_data.time != HighResClock::time_point() )
   {
-    if( ++retry_count > 50 )
+    AddTimer(call_data);
+    return;
+  }
+
+  process_t process_ref = call_data.process_ref;
+
+  // lock-free, never waits on the consuming core
+  process_ref->mailbox.push(call_data);
+  if( !process_ref->is_scheduled.exchange(true) )
+  {
+    ScheduleProcess(process_ref);
+  }
+}
+
+void Process::CollectGarbage()
+{
+  MarkRoots(true);
+  heap.Sweep( free_strings, MAX_FREE_STRINGS );
+}
+
+void Process::MarkRoots( bool ccall_slot )
+{
+  // Conservative: every slot up to the top of the running frame, plus the slot ccalls return
+  // values in, whatever its type tag says.
+  if( stack.stack )
+  {
+    heap.Mark( stack.stack, ccall_slot ? Min(stack.stack_top + 1, stack.stack_end) : stack.stack_top );
+  }
+  for( auto blocks : { &when_blocks, &whenever_blocks, &waiting_blocks } )
+  {
+    for( auto &block : *blocks )
     {
-      std::this_thread::sleep_for(std::chrono::microseconds(500));
-      retry_count = 0;
+      heap.Mark( block->closure_state.state, block->closure_state.state + block->closure_state.object_count );
     }
-    queue_lock.try_again();
   }
-  queues[index].push(call_data);
-  queue_lock.unlock();
+  for( size_t i = 0; i < loop_depth; ++i )
+  {
+    LoopKind kind = loops[i].kind;
+    if( kind == LoopKind::ForA || kind == LoopKind::ForAI || kind == LoopKind::ForAF ||
+        kind == LoopKind::ForAB || kind == LoopKind::ForAS )
+    {
+      heap.Mark( loops[i].array_loop.array );
+    }
+  }
+}
+
+void Process::MoveObject( Object& object, Object& source )
+{
+  if( object.object_type == (u8)ValueType::ARRAY && heap.CanDetach(object.array_ref) )
+  {
+    // The ccall slot is left out: at a send it holds nothing but a result already stored
+    // elsewhere (eg. the temporary this came from). Marking doesn't trust type tags, so the
+    // source slot has to lose the pointer, not just the tag.
+    source = Object::BuildArray(nullptr);
+    MarkRoots(false);
+    bool referenced = heap.IsMarked(object.array_ref);
+    heap.ClearMarks();
+    if( !referenced )
+    {
+      heap.Detach(object.array_ref);
+      return;
+    }
+    source = object;
+  }
+  SendObject(object);
+}
+
+static std::vector<std::unique_ptr<WhenBlock>>& WhenBlockList( Process* process_ref, const WhenBlock* block )
+{
+  if( !block->polls )
+  {
+    return process_ref->waiting_blocks;
+  }
+  return block->is_whenever ? process_ref->whenever_blocks : process_ref->when_blocks;
+}
+
+static void InsertWhenBlock( Process* process_ref, std::unique_ptr<WhenBlock> block )
+{
+  auto &blocks = WhenBlockList(process_ref, block.get());
+  block->index = blocks.size();
+  blocks.push_back(std::move(block));
+}
+
+static std::unique_ptr<WhenBlock> UnlinkWhenBlock( Process* process_ref, WhenBlock* block )
+{
+  // swap with last element and pop to remove
+  auto &blocks = WhenBlockList(process_ref, block);
+  std::unique_ptr<WhenBlock> removed = std::move(blocks[block->index]);
+  if( block->index != blocks.size() - 1 )
+  {
+    blocks[block->index] = std::move(blocks.back());
+    blocks[block->index]->index = block->index;
+  }
+  blocks.pop_back();
+  return removed;
+}
+
+void Process::AddWhenBlock( Function* eval, bool is_whenever )
+{
+  std::unique_ptr<WhenBlock> block( new WhenBlock(eval, stack.CaptureClosure(eval), is_whenever) );
+
+  // the captured frame outlives the message
+  auto &closure_state = block->closure_state;
+  for( size_t i = 0; i < closure_state.object_count; ++i )
+  {
+    if( closure_state.state[i].object_type == (u8)ValueType::STRING )
+    {
+      PromoteString(&closure_state.state[i]);
+    }
+  }
+
+  // Wait on the promises the condition checks. Replies for promises of other processes go to
+  // their owner, so a block checking one of those falls back to polling.
+  bool polls = eval->when_polls;
+  for( size_t i = 0; i < eval->when_promise_slots.size() && !polls; ++i )
+  {
+    promise_t promise = stack.GetObjectAtOffset(eval->when_promise_slots[i])->promise;
+    if( !promise || promise->owner != this )
+    {
+      polls = true;
+    }
+    else if( !promise->is_ready )
+    {
+      block->promises.push_back(promise);
+    }
+  }
+  // with nothing left to wait for, it's checked after the next message like before
+  block->polls = polls || block->promises.empty();
+  if( block->polls )
+  {
+    block->promises.clear();
+  }
+  for( auto promise : block->promises )
+  {
+    promise->continuations.push_back(block.get());
+  }
+  InsertWhenBlock(this, std::move(block));
+}
+
+void Process::RemoveWhenBlock( WhenBlock* block )
+{
+  for( auto promise : block->promises )
+  {
+    auto &continuations = promise->continuations;
+    continuations.erase( std::find(continuations.begin(), continuations.end(), block) );
+  }
+  UnlinkWhenBlock(this, block);
+}
+
+void Process::PollWhenBlock( WhenBlock* block )
+{
+  if( block->polls )
+  {
+    return;
+  }
+  std::unique_ptr<WhenBlock> owned = UnlinkWhenBlock(this, block);
+  owned->polls = true;
+  InsertWhenBlock(this, std::move(owned));
+}
+
+// evaluate a when/whenever block in its captured context. returns true once it is done.
+static bool EvaluateWhenBlock( process_t process_ref, WhenBlock& block )
+{
+  if( block.eval->updated_function.load() != nullptr )
+  {
+    block.eval = block.eval->updated_function.load();
+  }
+  process_ref->SetupStackFrame( block.eval );
+  process_ref->stack.ApplyClosureState( block.eval, block.closure_state );
 
-  ++message_count;
+  bool done = false;
+  const VMCode* &ip = process_ref->ip;
+  if( ip->instruction(process_ref) )
+  {
+    if( !block.is_whenever || !process_ref->CCallReturnVal()->bool_val )
+    {
+      // when branch taken, or broke out of whenever loop
+      done = true;
+    }
+    else
+    {
+      block.closure_state = std::move(process_ref->stack.CaptureClosure(block.eval));
+    }
+  }
+  process_ref->PopStackFrame();
+  return done;
+}
 
-  std::unique_lock<std::mutex> lock(idle_lock);
-  if( message_count > (core_count - idle_count) )
+static void EvaluatePolledWhenBlocks( process_t process_ref, std::vector<std::unique_ptr<WhenBlock>>& blocks )
+{
+  for( size_t i = 0; i < blocks.size(); )
   {
-    message_waiting_event.notify_one();
+    WhenBlock* block = blocks[i].get();
+    if( EvaluateWhenBlock(process_ref, *block) )
+    {
+      process_ref->RemoveWhenBlock(block);
+      // process i again
+      continue;
+    }
+    ++i;
   }
 }
 
@@ -403,13 +943,21 @@ void VirtualMachine::ExecuteConstructor( CallData call_data, process_t caller )
   Object* src = caller->stack.stack_base;
   process_ref->PushArgsToStack( function, caller->ip, src );
 
+  // the new process now refers to any promises passed in, and has its own copy of everything
+  // else (args start after 'this')
+  for( size_t i = 0; i < function->parameter_count(); ++i )
+  {
+    caller->SendObject( process_ref->stack.stack[1 + i] );
+    process_ref->heap.Adopt( process_ref->stack.stack[1 + i] );
+  }
+
   // set 'this' process reference
   process_ref->PushThisPointer(Object::BuildProcess(call_data.process_ref));
 
   ExecutionLoop(call_data);
 }
 
-void VirtualMachine::ExecuteProcessMessage( CallData call_data )
+bool VirtualMachine::ExecuteProcessMessage( CallData call_data )
 {
   const Function* function    = call_data.function;
         process_t process_ref = call_data.process_ref;
@@ -417,123 +965,159 @@ void VirtualMachine::ExecuteProcessMessage( CallData call_data )
 
   if( function )
   {
+    // args were allocated for the function the message was sent to
+    size_t arg_count = function->parameter_count();
+    if( function->updated_function.load() != nullptr )
+    {
+      function = function->updated_function.load();
+      call_data.function = function;
+    }
+
     process_ref->SetupStackFrame( function );
+    process_ref->SetMessageBase( function );
 
-    // copy args to stack
+    // copy args to stack, they were exported by the sender
+    for( size_t i = 0; i < arg_count; ++i )
+    {
+      process_ref->heap.Adopt(args[i]);
+    }
     process_ref->PushArgsToStack(function, args);
-    delete[] args;
+    CallData::FreeArgs(args, arg_count);
 
     // copy constants to stack
     process_ref->PushConstantsToStack(function);
     process_ref->InitializeLocalsOnStack(function);
+  }
+
+  return FinishProcessMessage( call_data, false );
+}
 
-    ExecutionLoop(call_data);
+bool VirtualMachine::ResumeProcessMessage( process_t process_ref )
+{
+  process_ref->is_suspended = false;
+  return FinishProcessMessage( process_ref->suspended_message, true );
+}
+
+bool VirtualMachine::FinishProcessMessage( CallData call_data, bool resume )
+{
+  const Function* function    = call_data.function;
+        process_t process_ref = call_data.process_ref;
+
+  if( function )
+  {
+    process_ref->in_string_region = string_regions;
+    bool suspended = ExecutionLoop(call_data, reduction_budget != 0, resume);
+    process_ref->in_string_region = false;
+    if( suspended )
+    {
+      // the region keeps the message's strings until it resumes and completes
+      process_ref->suspended_message = call_data;
+      process_ref->is_suspended = true;
+      return false;
+    }
 
     // notify caller that the promise is ready
     if( call_data.promise )
     {
       call_data.promise->value = *process_ref->stack.GetObjectAtOffset(0);
+      process_ref->SendObject(call_data.promise->value);
       call_data.promise->is_ready = true;
       SendMessage( CallData( nullptr, call_data.promise->owner, nullptr, call_data.promise ) );
       call_data.promise = nullptr;
     }
 
     process_ref->PopStackFrame();
+    process_ref->ResetStringRegion();
+    process_ref->MaybeCollectGarbage();
   }
 
-  auto &when_blocks = process_ref->when_blocks;
-  for( size_t i = 0; i < when_blocks.size(); process_ref->PopStackFrame() )
+  // a completed promise wakes the blocks waiting on it
+  promise_t completed = function ? nullptr : call_data.promise;
+  if( completed && completed->owner == process_ref && !completed->continuations.empty() )
   {
-    auto &when = when_blocks[i];
-    if( when.eval->updated_function.load() != nullptr )
-    {
-      when.eval = when.eval->updated_function.load();
-    }
-    process_ref->SetupStackFrame( when.eval );
-    process_ref->stack.ApplyClosureState( when.eval, when.closure_state );
-
-    const VMCode* &ip = process_ref->ip;
-    if( ip->instruction(process_ref) )
+    std::vector<WhenBlock*> woken;
+    woken.swap(completed->continuations);
+    for( auto block : woken )
     {
-      // when branch taken. swap with last element and pop to remove.
-      when_blocks[i] = std::move(when_blocks.back());
-      when_blocks.pop_back();
-      // process i again
-      continue;
-    }
-    ++i;
-  }
-
-  auto &whenever_blocks = process_ref->whenever_blocks;
-  for( size_t i = 0; i < whenever_blocks.size(); process_ref->PopStackFrame() )
-  {
-    auto &whenever = whenever_blocks[i];
-    if( whenever.eval->updated_function.load() != nullptr )
-    {
-      whenever.eval = whenever.eval->updated_function.load();
-    }
-    process_ref->SetupStackFrame( whenever.eval );
-    process_ref->stack.ApplyClosureState( whenever.eval, whenever.closure_state );
-
-    const VMCode* &ip = process_ref->ip;
-    if( ip->instruction(process_ref) )
-    {
-      if( !process_ref->CCallReturnVal()->bool_val )
+      auto &promises = block->promises;
+      promises.erase( std::find(promises.begin(), promises.end(), completed) );
+      if( EvaluateWhenBlock(process_ref, *block) )
       {
-        // broke out of loop. swap with last element and pop to remove.
-        whenever_blocks[i] = std::move(whenever_blocks.back());
-        whenever_blocks.pop_back();
-        // process i again
-        continue;
+        process_ref->RemoveWhenBlock(block);
       }
-      else
+      else if( promises.empty() || block->eval->when_polls )
       {
-        whenever.closure_state = std::move(process_ref->stack.CaptureClosure(whenever.eval));
+        // nothing left to wait for (e.g. a chained promise), or hot swapped to a condition
+        // that reads more than promises
+        process_ref->PollWhenBlock(block);
       }
     }
-    ++i;
   }
 
-  //if( call_data.promise )
-  //{
-  //  delete call_data.promise;
-  //}
+  // the rest may depend on anything
+  EvaluatePolledWhenBlocks(process_ref, process_ref->when_blocks);
+  EvaluatePolledWhenBlocks(process_ref, process_ref->whenever_blocks);
+
+  // the reply (or timer) has been handled, drop the reference held by the message
+  if( call_data.promise )
+  {
+    call_data.promise->Release();
+  }
+  return true;
 }
 
 void VirtualMachine::ExecuteFunction( CallData call_data )
 {
-  const Function* function    = call_data.function;
-  process_t       process_ref = call_data.process_ref;
+  process_t process_ref = call_data.process_ref;
 
-  // grab ip for current instruction as it holds function call args
-  const VMCode* old_ip = process_ref->ip;
-  Object* dest = process_ref->stack.stack_base;
   // setup new stack frame, potentially growing the stack
-  process_ref->SetupStackFrame( function );
-  process_ref->PushArgsToStack( function, old_ip, dest );
-  process_ref->PushConstantsToStack( function );
-  process_ref->InitializeLocalsOnStack( function );
+  process_ref->EnterFunction( call_data.function );
 
   ExecutionLoop(call_data);
   process_ref->PopStackFrame();
 }
 
-void VirtualMachine::ExecuteFunctionIncremental( CallData call_data )
+void VirtualMachine::LockProcess( AutoTryLock &process_lock, process_t process_ref )
 {
-  const Function* function = call_data.function;
-  process_t    process_ref = call_data.process_ref;
-
-  AutoTryLock queue_lock(process_ref->lock);
   int retry_count = 0;
-  while( !queue_lock.got_lock )
+  while( !process_lock.got_lock )
   {
     if( ++retry_count > 50 )
     {
       std::this_thread::sleep_for(std::chrono::microseconds(500));
       retry_count = 0;
     }
-    queue_lock.try_again();
+    process_lock.try_again();
   }
+  // messages sent while the lock is held don't need to schedule the process
+  process_ref->is_scheduled.store(true);
+}
+
+void VirtualMachine::UnlockProcess( AutoTryLock &process_lock, process_t process_ref )
+{
+  process_lock.unlock();
+  UnscheduleProcess(process_ref);
+}
+
+void VirtualMachine::ExecuteEntryFunction( CallData call_data )
+{
+  // messages to the process wait until the function returns, so its when blocks and
+  // promises are never touched by a core while it runs
+  AutoTryLock process_lock(call_data.process_ref->lock);
+  LockProcess(process_lock, call_data.process_ref);
+
+  ExecuteFunction(call_data);
+
+  UnlockProcess(process_lock, call_data.process_ref);
+}
+
+void VirtualMachine::ExecuteFunctionIncremental( CallData call_data )
+{
+  const Function* function = call_data.function;
+  process_t    process_ref = call_data.process_ref;
+
+  AutoTryLock process_lock(process_ref->lock);
+  LockProcess(process_lock, process_ref);
 
   // setup new stack frame, potentially growing the stack
   process_ref->PopStackFrame();
@@ -724,7 +1308,7 @@ void VirtualMachine::ExecuteFunctionIncremental( CallData call_data )
 //     ++i;
 //   }
 //
-  queue_lock.unlock();
+  UnlockProcess(process_lock, process_ref);
 }
 
 } // namespace Eople
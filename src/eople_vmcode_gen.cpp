@@ -2,7 +2,9 @@
 #include "eople_control_flow.h"
 #include "eople_binop.h"
 
+#include <algorithm>
 #include <iostream>
+#include <limits>
 #include <queue>
 
 #define LOG_DEBUG 0
@@ -11,10 +13,10 @@
 namespace Eople
 {
 
-VMCodeGen::VMCodeGen()
+VMCodeGen::VMCodeGen( bool inline_functions )
   : m_current_module(nullptr), m_result_index((size_t)-1), m_function(nullptr),
     m_current_operand(0), m_current_temp(0), m_error_count(0),
-    m_base_stack_offset(0), m_opcode_count(0)
+    m_base_stack_offset(0), m_opcode_count(0), m_loop_depth(0), m_inline_functions(inline_functions)
 {
 }
 
@@ -118,7 +120,7 @@ size_t VMCodeGen::GenExpressionTerm( Node::Literal* literal, bool )
     case ValueType::STRING:
     {
       size_t stack_index = SYMBOL_TO_STACK(literal);
-      *StackObject(stack_index) = Object::BuildString(literal->GetAsStringLiteral()->value);
+      *StackObject(stack_index) = Object::BuildString(StringTable::Intern(*literal->GetAsStringLiteral()->value));
       return stack_index;
     }
     case ValueType::TYPE:
@@ -138,6 +140,17 @@ size_t VMCodeGen::GenExpressionTerm( Node::BinaryOp* binary_op, bool is_root )
 {
   Opcode opcode = Opcode::NOP;
 
+  // a + b + c ... on strings is one instruction, rather than a temp string for every +
+  if( binary_op->op == OpType::ADD && GetType(binary_op->left.get())->type == ValueType::STRING )
+  {
+    std::vector<Node::Expression*> terms;
+    CollectConcatTerms( binary_op, terms );
+    if( terms.size() > 2 )
+    {
+      return GenConcat( terms, is_root );
+    }
+  }
+
   switch( binary_op->op )
   {
     case OpType::GT:
@@ -280,6 +293,16 @@ size_t VMCodeGen::GenExpressionTerm( Node::BinaryOp* binary_op, bool is_root )
 
   size_t old_current_temp = m_current_temp;
   size_t lhs_stack_index = GenExpressionTerm( binary_op->left.get(), false );
+  size_t return_value_index = m_function->storage_requirement + m_base_stack_offset;
+  if( lhs_stack_index == return_value_index )
+  {
+    // a guard's is_ready is left where the right side's calls return (a and b), keep it in our temp
+    PushOpcode( Opcode::Store );
+    PushOperand(old_current_temp);
+    PushOperand(return_value_index);
+    lhs_stack_index = old_current_temp;
+    m_current_temp = old_current_temp + 1;
+  }
   size_t rhs_stack_index = GenExpressionTerm( binary_op->right.get(), false );
   m_current_temp = old_current_temp;
   PushOpcode( opcode );
@@ -295,6 +318,41 @@ size_t VMCodeGen::GenExpressionTerm( Node::BinaryOp* binary_op, bool is_root )
   return m_current_temp++;
 }
 
+// strings joined by a chain of +, in order. Concatenation is associative, so a + (b + c) counts too.
+void VMCodeGen::CollectConcatTerms( Node::Expression* node, std::vector<Node::Expression*> &terms )
+{
+  auto binary_op = node->GetAsBinaryOp();
+  if( binary_op && binary_op->op == OpType::ADD && GetType(binary_op->left.get())->type == ValueType::STRING )
+  {
+    CollectConcatTerms( binary_op->left.get(), terms );
+    CollectConcatTerms( binary_op->right.get(), terms );
+    return;
+  }
+  terms.push_back(node);
+}
+
+size_t VMCodeGen::GenConcat( std::vector<Node::Expression*> &terms, bool is_root )
+{
+  size_t old_current_temp = m_current_temp;
+  std::vector<size_t> term_indices;
+  for( auto term : terms )
+  {
+    term_indices.push_back( GenExpressionTerm( term, false ) );
+  }
+  m_current_temp = old_current_temp;
+
+  size_t dest = is_root ? m_result_index : m_current_temp++;
+  PushOpcode( Opcode::ConcatN );
+  PushOperand(dest);
+  // the count itself, not a stack index
+  PushOperand(terms.size());
+  for( auto index : term_indices )
+  {
+    PushOperand(index, true);
+  }
+  return dest;
+}
+
 size_t VMCodeGen::GenExpressionTerm( Node::FunctionCall* function_call, bool is_root )
 {
   GenFunctionCall(function_call);
@@ -313,7 +371,7 @@ size_t VMCodeGen::GenExpressionTerm( Node::FunctionCall* function_call, bool is_
 
 size_t VMCodeGen::GenExpressionTerm( Node::ProcessMessage* process_message, bool is_root )
 {
-  GenProcessMessage(process_message);
+  GenProcessMessage(process_message, true);
   size_t dest = is_root ? m_result_index : m_current_temp++;
 //    ValueType value_type = GetType(process_call);
   PushOpcode( Opcode::Store );
@@ -327,9 +385,52 @@ size_t VMCodeGen::GenExpressionTerm( Node::ArraySubscript* array_subscript, bool
 {
   size_t stack_index = SYMBOL_TO_STACK(array_subscript);
   auto array_subscript_obj = array_subscript->GetAsArraySubscript();
+  type_t container = GetType(array_subscript_obj->ident->GetAsIdentifier());
+
+  // struct members are at a constant offset, no key to evaluate
+  if( StructType* struct_type = array_subscript_obj->GetStructType(container) )
+  {
+    size_t member_index = struct_type->MemberIndex( *array_subscript_obj->GetMemberName() );
+    size_t dest = is_root ? m_result_index : m_current_temp++;
+    if( container->type == ValueType::STRUCT )
+    {
+      PushOpcode(Opcode::StructMember);
+      PushOperand(stack_index);
+      PushOperand(member_index);
+      PushOperand(dest);
+    }
+    else
+    {
+      size_t index_stack_index = GenExpressionTerm( array_subscript_obj->index.get(), false );
+      PushOpcode(Opcode::StructArrayMember);
+      PushOperand(stack_index);
+      PushOperand(index_stack_index);
+      PushOperand(dest);
+      PushOperand(member_index);
+    }
+    return dest;
+  }
+
   size_t index_stack_index = GenExpressionTerm( array_subscript_obj->index.get(), false );
 
-  PushOpcode(Opcode::ArraySubscript);
+  // typed arrays and dicts have their own subscripts, object arrays use the generic one
+  Opcode subscript_op = Opcode::ArraySubscript;
+  ValueType container_type = container->type;
+  if( container_type == ValueType::DICT )
+  {
+    subscript_op = Opcode::DictSubscript;
+  }
+  else if( container_type == ValueType::ARRAY )
+  {
+    switch( Array::KindOf(GetType(array_subscript)) )
+    {
+      case ArrayKind::INT:   subscript_op = Opcode::ArraySubscriptI; break;
+      case ArrayKind::FLOAT: subscript_op = Opcode::ArraySubscriptF; break;
+      case ArrayKind::BOOL:  subscript_op = Opcode::ArraySubscriptB; break;
+      default:               break;
+    }
+  }
+  PushOpcode(subscript_op);
   PushOperand(stack_index);
   PushOperand(index_stack_index);
 
@@ -343,11 +444,12 @@ size_t VMCodeGen::GenExpressionTerm( Node::ArraySubscript* array_subscript, bool
   return m_current_temp++;
 }
 
-size_t VMCodeGen::GenExpressionTerm( Node::ArrayLiteral* array_literal, bool )
+size_t VMCodeGen::GenExpressionTerm( Node::ArrayLiteral* array_literal, bool is_root )
 {
   size_t stack_index = SYMBOL_TO_STACK(array_literal);
   Object* array_object = StackObject(stack_index);
-  *array_object = Object::BuildArray();
+  auto array = Array::Create(array_literal->array_type);
+  *array_object = Object::BuildArray(array);
   switch( array_literal->array_type->type )
   {
     case ValueType::FLOAT:
@@ -356,7 +458,7 @@ size_t VMCodeGen::GenExpressionTerm( Node::ArrayLiteral* array_literal, bool )
       {
         // TODO: currently, only literals supported as elements in array literals
         assert(element->GetAsLiteral());
-        array_object->array_ref->push_back(Object::BuildFloat(element->GetAsFloatLiteral()->value));
+        array->Floats().push_back(element->GetAsFloatLiteral()->value);
       }
       break;
     }
@@ -365,7 +467,7 @@ size_t VMCodeGen::GenExpressionTerm( Node::ArrayLiteral* array_literal, bool )
       for( auto &element : array_literal->elements )
       {
         assert(element->GetAsLiteral());
-        array_object->array_ref->push_back(Object::BuildInt(element->GetAsIntLiteral()->value));
+        array->Ints().push_back(element->GetAsIntLiteral()->value);
       }
       break;
     }
@@ -374,7 +476,7 @@ size_t VMCodeGen::GenExpressionTerm( Node::ArrayLiteral* array_literal, bool )
       for( auto &element : array_literal->elements )
       {
         assert(element->GetAsLiteral());
-        array_object->array_ref->push_back(Object::BuildBool(element->GetAsBoolLiteral()->value));
+        array->Bools().push_back(element->GetAsBoolLiteral()->value);
       }
       break;
     }
@@ -383,7 +485,7 @@ size_t VMCodeGen::GenExpressionTerm( Node::ArrayLiteral* array_literal, bool )
       for( auto &element : array_literal->elements )
       {
         assert(element->GetAsLiteral());
-        array_object->array_ref->push_back(Object::BuildString(element->GetAsStringLiteral()->value));
+        array->Objects().push_back(Object::BuildString(StringTable::Intern(*element->GetAsStringLiteral()->value)));
       }
       break;
     }
@@ -392,7 +494,7 @@ size_t VMCodeGen::GenExpressionTerm( Node::ArrayLiteral* array_literal, bool )
       for( auto &element : array_literal->elements )
       {
         assert(element->GetAsLiteral());
-        array_object->array_ref->push_back(Object::BuildType(element->GetAsTypeLiteral()->type));
+        array->Objects().push_back(Object::BuildType(element->GetAsTypeLiteral()->type));
       }
       break;
     }
@@ -403,16 +505,19 @@ size_t VMCodeGen::GenExpressionTerm( Node::ArrayLiteral* array_literal, bool )
       break;
     }
   }
-  return stack_index;
+  return GenCopyLiteral(stack_index, is_root);
 }
 
-size_t VMCodeGen::GenExpressionTerm( Node::DictLiteral* dict_literal, bool )
+size_t VMCodeGen::GenExpressionTerm( Node::DictLiteral* dict_literal, bool is_root )
 {
   size_t stack_index = SYMBOL_TO_STACK(dict_literal);
   Object* dict_object = StackObject(stack_index);
-  *dict_object = Object::BuildDict();
+  Dict* dict = new Dict();
+  *dict_object = Object::BuildDict(dict);
   for( size_t i = 0; i < dict_literal->keys.size(); ++i)
   {
+    // keys are interned (and hashed) once, here
+    const DictKey* key = Dict::Intern(*dict_literal->keys[i]->GetAsStringLiteral()->value);
     auto float_literal = dict_literal->values[i]->GetAsFloatLiteral();
     auto int_literal = dict_literal->values[i]->GetAsIntLiteral();
     auto string_literal = dict_literal->values[i]->GetAsStringLiteral();
@@ -420,23 +525,33 @@ size_t VMCodeGen::GenExpressionTerm( Node::DictLiteral* dict_literal, bool )
 
     if(float_literal)
     {
-      (*dict_object->dict_ref)[*dict_literal->keys[i]->GetAsStringLiteral()->value] = Object::BuildFloat(float_literal->value);
+      (*dict)[key] = Object::BuildFloat(float_literal->value);
     }
     else if(int_literal)
     {
-      (*dict_object->dict_ref)[*dict_literal->keys[i]->GetAsStringLiteral()->value] = Object::BuildInt(int_literal->value);
+      (*dict)[key] = Object::BuildInt(int_literal->value);
     }
     else if(string_literal)
     {
-      (*dict_object->dict_ref)[*dict_literal->keys[i]->GetAsStringLiteral()->value] = Object::BuildString(string_literal->value);
+      (*dict)[key] = Object::BuildString(StringTable::Intern(*string_literal->value));
     }
     else if(bool_literal)
     {
-      (*dict_object->dict_ref)[*dict_literal->keys[i]->GetAsStringLiteral()->value] = Object::BuildBool(bool_literal->value);
+      (*dict)[key] = Object::BuildBool(bool_literal->value);
     }
   }
 
-  return stack_index;
+  return GenCopyLiteral(stack_index, is_root);
+}
+
+size_t VMCodeGen::GenCopyLiteral( size_t literal_index, bool is_root )
+{
+  // the literal itself is a constant, shared by every call
+  size_t dest = is_root ? m_result_index : m_current_temp++;
+  PushCCall( Instruction::CopyLiteral );
+  PushOperand(literal_index);
+  PushOperand(dest);
+  return dest;
 }
 
 // double dispatch support
@@ -455,7 +570,12 @@ type_t VMCodeGen::GetType( Node::Identifier* identifier )
 type_t VMCodeGen::GetType( Node::ArraySubscript* array_subscript_node )
 {
   auto array_subscript = array_subscript_node->GetAsArraySubscript();
-  return m_function_node->GetExpressionType( array_subscript->ident->GetAsIdentifier() );
+  type_t container = m_function_node->GetExpressionType( array_subscript->ident->GetAsIdentifier() );
+  if( StructType* struct_type = array_subscript->GetStructType(container) )
+  {
+    return struct_type->member_types[struct_type->MemberIndex( *array_subscript->GetMemberName() )];
+  }
+  return container->GetVaryingType();
 }
 
 type_t VMCodeGen::GetType( Node::Literal* literal )
@@ -575,6 +695,24 @@ size_t VMCodeGen::PushOpcode( Opcode opcode )
     OPCODE_CASE(Opcode::JumpNEQ)
     OPCODE_CASE(Opcode::JumpLEQ)
     OPCODE_CASE(Opcode::JumpGEQ)
+    OPCODE_CASE(Opcode::JumpNotGTF)
+    OPCODE_CASE(Opcode::JumpNotLTF)
+    OPCODE_CASE(Opcode::JumpNotEQF)
+    OPCODE_CASE(Opcode::JumpNotNEQF)
+    OPCODE_CASE(Opcode::JumpNotLEQF)
+    OPCODE_CASE(Opcode::JumpNotGEQF)
+    OPCODE_CASE(Opcode::JumpGTK)
+    OPCODE_CASE(Opcode::JumpLTK)
+    OPCODE_CASE(Opcode::JumpEQK)
+    OPCODE_CASE(Opcode::JumpNEQK)
+    OPCODE_CASE(Opcode::JumpLEQK)
+    OPCODE_CASE(Opcode::JumpGEQK)
+    OPCODE_CASE(Opcode::JumpNotGTFK)
+    OPCODE_CASE(Opcode::JumpNotLTFK)
+    OPCODE_CASE(Opcode::JumpNotEQFK)
+    OPCODE_CASE(Opcode::JumpNotNEQFK)
+    OPCODE_CASE(Opcode::JumpNotLEQFK)
+    OPCODE_CASE(Opcode::JumpNotGEQFK)
     OPCODE_CASE(Opcode::AddI)
     OPCODE_CASE(Opcode::SubI)
     OPCODE_CASE(Opcode::DivI)
@@ -590,6 +728,7 @@ size_t VMCodeGen::PushOpcode( Opcode opcode )
     OPCODE_CASE(Opcode::BXor)
     OPCODE_CASE(Opcode::BOr)
     OPCODE_CASE(Opcode::ConcatS)
+    OPCODE_CASE(Opcode::ConcatN)
     OPCODE_CASE(Opcode::EqualS)
     OPCODE_CASE(Opcode::NotEqualS)
     OPCODE_CASE(Opcode::GreaterThanI)
@@ -607,10 +746,17 @@ size_t VMCodeGen::PushOpcode( Opcode opcode )
     OPCODE_CASE(Opcode::And)
     OPCODE_CASE(Opcode::Or)
     OPCODE_CASE(Opcode::Store)
+    OPCODE_CASE(Opcode::StoreK)
     OPCODE_CASE(Opcode::StoreArrayElement)
     OPCODE_CASE(Opcode::StoreArrayStringElement)
+    OPCODE_CASE(Opcode::StoreArrayElementI)
+    OPCODE_CASE(Opcode::StoreArrayElementF)
+    OPCODE_CASE(Opcode::StoreArrayElementB)
+    OPCODE_CASE(Opcode::StoreStructMember)
+    OPCODE_CASE(Opcode::StoreStructArrayMember)
     OPCODE_CASE(Opcode::StringCopy)
     OPCODE_CASE(Opcode::SpawnProcess)
+    OPCODE_CASE(Opcode::NewStruct)
     OPCODE_CASE(Opcode::PrintI)
     OPCODE_CASE(Opcode::PrintF)
     OPCODE_CASE(Opcode::PrintIArr)
@@ -619,10 +765,32 @@ size_t VMCodeGen::PushOpcode( Opcode opcode )
     OPCODE_CASE(Opcode::PrintSPromise)
     OPCODE_CASE(Opcode::PrintDict)
     OPCODE_CASE(Opcode::FunctionCall)
+    OPCODE_CASE(Opcode::TailCall)
     OPCODE_CASE(Opcode::ArraySubscript)
+    OPCODE_CASE(Opcode::ArraySubscriptI)
+    OPCODE_CASE(Opcode::ArraySubscriptF)
+    OPCODE_CASE(Opcode::ArraySubscriptB)
+    OPCODE_CASE(Opcode::AddSubscriptI)
+    OPCODE_CASE(Opcode::MulSubscriptI)
+    OPCODE_CASE(Opcode::AddSubscriptF)
+    OPCODE_CASE(Opcode::MulSubscriptF)
+    OPCODE_CASE(Opcode::MulAddI)
+    OPCODE_CASE(Opcode::MulAddF)
+    OPCODE_CASE(Opcode::AddIK)
+    OPCODE_CASE(Opcode::SubIK)
+    OPCODE_CASE(Opcode::MulIK)
+    OPCODE_CASE(Opcode::AddFK)
+    OPCODE_CASE(Opcode::SubFK)
+    OPCODE_CASE(Opcode::MulFK)
+    OPCODE_CASE(Opcode::DivFK)
+    OPCODE_CASE(Opcode::DictSubscript)
+    OPCODE_CASE(Opcode::StructMember)
+    OPCODE_CASE(Opcode::StructArrayMember)
     OPCODE_CASE(Opcode::ProcessMessage)
+    OPCODE_CASE(Opcode::ProcessMessageNoReply)
     OPCODE_CASE(Opcode::Return)
     OPCODE_CASE(Opcode::ReturnValue)
+    OPCODE_CASE(Opcode::ReturnValueK)
     OPCODE_CASE(Opcode::NOP)
     default:
     {
@@ -722,6 +890,19 @@ void VMCodeGen::GenFunctionCall( Node::FunctionCall* node )
   // get stack index for call
   size_t call_index = SYMBOL_TO_STACK(node);
 
+  if( node->constructs_struct )
+  {
+    // the call's constant holds the struct type
+    *StackObject(call_index) = Object::BuildType(GetType(node));
+    PushOpcode( Opcode::NewStruct );
+    PushOperand(call_index);
+    for( auto arg : arg_indices )
+    {
+      PushOperand(arg, true);
+    }
+    return;
+  }
+
   // find function
   std::string func_name = node->GetName();
   Function* target_function = GetFunction( node, node->GetSpecialization(m_function_node->current_specialization) );
@@ -742,8 +923,9 @@ void VMCodeGen::GenFunctionCall( Node::FunctionCall* node )
     }
     else
     {
+      // the function is read from the constants, not the stack (see ReferenceConstants)
       PushOpcode( Opcode::FunctionCall );
-      PushOperand(call_index);
+      PushOperand(StackObject(call_index) - m_function->constants);
       // now push args
       for( auto arg : arg_indices )
       {
@@ -772,7 +954,22 @@ void VMCodeGen::GenFunctionCall( Node::FunctionCall* node )
   }
 }
 
-void VMCodeGen::GenProcessMessage( Node::ProcessMessage* call_node )
+// A call can take over the frame of the function returning its value: a plain function, returning
+// from a plain function's frame. Frames of constructors and methods are the process's, when blocks
+// and the repl run in one they share, and a return inside a loop body doesn't leave the loop.
+bool VMCodeGen::IsTailCall( Node::FunctionCall* node )
+{
+  if( m_loop_depth || node->constructs_struct || m_function->is_constructor || m_function->reuse_context ||
+      m_function->is_when_eval || m_function->is_repl || m_function->parameters_start != 0 )
+  {
+    return false;
+  }
+  const Function* target_function = GetFunction( node, node->GetSpecialization(m_function_node->current_specialization) );
+  return target_function && target_function->return_type->type != ValueType::PROCESS &&
+         !target_function->is_constructor && !target_function->reuse_context && target_function->parameters_start == 0;
+}
+
+void VMCodeGen::GenProcessMessage( Node::ProcessMessage* call_node, bool needs_result )
 {
   auto node = call_node->message->GetAsFunctionCall();
 
@@ -796,13 +993,30 @@ void VMCodeGen::GenProcessMessage( Node::ProcessMessage* call_node )
   {
     StackObject(call_index)->function = target_function;
     // push call
-    PushOpcode( Opcode::ProcessMessage );
+    PushOpcode( needs_result ? Opcode::ProcessMessage : Opcode::ProcessMessageNoReply );
     PushOperand(process_index);
     PushOperand(call_index);
-    // now push args
+    // now push args, marking the ones that may be moved into the message (see FindMovedArgs)
+    Function* function = m_function;
+    auto may_move = [function]( size_t slot )
+    {
+      if( function->is_repl || function->is_when_eval )
+      {
+        return false;
+      }
+      bool is_temp  = slot >= function->temp_start && slot < function->temp_end;
+      // constructor locals are members
+      bool is_local = (slot >= function->parameters_start && slot < function->constants_start) ||
+                      (slot >= function->locals_start && slot < function->temp_start);
+      return is_temp || (is_local && !function->is_constructor);
+    };
     for( auto arg : arg_indices )
     {
       PushOperand(arg, true);
+      if( may_move(arg) )
+      {
+        m_function->code.back().moves |= (u8)(1 << (m_current_operand - 1));
+      }
     }
     //auto ident = call_node->process->GetAsIdentifier();
     //TableEntry* entry = m_function_node->GetTableEntry(ident);
@@ -826,6 +1040,903 @@ void VMCodeGen::GenProcessMessage( Node::ProcessMessage* call_node )
   }
 }
 
+// Message args in temporaries, parameters and locals are marked as moves (VMCode::moves) when they
+// are sent. A temporary doesn't outlive its statement, so it is dead after the send. A parameter
+// or local is dead if nothing names it after the send, the send isn't in a loop, and no when
+// block of the function may read it later. Jumps only go forward, so a later instruction is the
+// only way to read it again.
+static void FindMovedArgs( Function* function )
+{
+  auto &code = function->code;
+  std::vector<bool> in_loop(code.size(), false);
+  bool has_when = false;
+  for( size_t i = 0; i < code.size(); ++i )
+  {
+    size_t body = 0;
+    switch( code[i].opcode )
+    {
+      case Opcode::ForI:
+      case Opcode::ForF:
+      case Opcode::ForA:             body = code[i].d;             break;
+      case Opcode::While:            body = code[i].b + code[i].c; break;
+      case Opcode::WhenRegister:
+      case Opcode::WheneverRegister: has_when = true;              break;
+      default:                                                     break;
+    }
+    for( size_t j = i + 1; j <= i + body && j < code.size(); ++j )
+    {
+      in_loop[j] = true;
+    }
+  }
+
+  auto named_after = [&code]( size_t i, size_t operand, Operand slot )
+  {
+    for( ; i < code.size(); ++i, operand = 0 )
+    {
+      const Operand operands[] = { code[i].a, code[i].b, code[i].c, code[i].d };
+      for( ; operand < 4; ++operand )
+      {
+        if( operands[operand] == slot )
+        {
+          return true;
+        }
+      }
+    }
+    return false;
+  };
+
+  for( size_t i = 0; i < code.size(); ++i )
+  {
+    const Operand operands[] = { code[i].a, code[i].b, code[i].c, code[i].d };
+    for( size_t operand = 0; operand < 4 && code[i].moves; ++operand )
+    {
+      u8 bit = (u8)(1 << operand);
+      Operand slot = operands[operand];
+      bool is_temp = slot >= function->temp_start && slot < function->temp_end;
+      if( (code[i].moves & bit) && !is_temp && (has_when || in_loop[i] || named_after(i, operand + 1, slot)) )
+      {
+        code[i].moves &= (u8)~bit;
+      }
+    }
+  }
+}
+
+// Fused instructions (superinstructions) replace the instruction pairs that run most often (see
+// --opcode-pairs):
+//  - a comparison into a temporary, and the JumpIf testing it, become a jump on the comparison
+//  - arithmetic into a temporary, and the Store of that temporary, become arithmetic into the
+//    Store destination
+//  - an int or float array element into a temporary, and the + or * using it, become
+//    AddSubscriptI/F or MulSubscriptI/F
+//  - a product into a temporary, and the + using it, become MulAddI/F
+// A temporary is only read by the instruction using it, so the fused one doesn't have to write it.
+// There is no instruction loading constants to fuse, operands name constant slots directly.
+static bool IsTemp( const Function* function, Operand slot )
+{
+  return slot >= function->temp_start && slot < function->temp_end;
+}
+
+static bool IsJump( Opcode opcode )
+{
+  return opcode >= Opcode::Jump && opcode <= Opcode::JumpNotGEQFK;
+}
+
+// JumpIf jumps when the condition is false, so the fused jump tests the opposite comparison
+static Opcode CompareJump( Opcode compare )
+{
+  switch( compare )
+  {
+    case Opcode::GreaterThanI:  return Opcode::JumpLEQ;
+    case Opcode::LessThanI:     return Opcode::JumpGEQ;
+    case Opcode::EqualI:        return Opcode::JumpNEQ;
+    case Opcode::NotEqualI:     return Opcode::JumpEQ;
+    case Opcode::LessEqualI:    return Opcode::JumpGT;
+    case Opcode::GreaterEqualI: return Opcode::JumpLT;
+    case Opcode::GreaterThanF:  return Opcode::JumpNotGTF;
+    case Opcode::LessThanF:     return Opcode::JumpNotLTF;
+    case Opcode::EqualF:        return Opcode::JumpNotEQF;
+    case Opcode::NotEqualF:     return Opcode::JumpNotNEQF;
+    case Opcode::LessEqualF:    return Opcode::JumpNotLEQF;
+    case Opcode::GreaterEqualF: return Opcode::JumpNotGEQF;
+    default:                    return Opcode::NOP;
+  }
+}
+
+// instructions computing a, b into c
+static bool IsBinaryOp( Opcode opcode )
+{
+  return (opcode >= Opcode::AddI && opcode <= Opcode::BOr) ||
+         (opcode >= Opcode::GreaterThanI && opcode <= Opcode::Or);
+}
+
+// the instruction computing the temporary, and the + or * taking it, fused
+static Opcode FusedArithmetic( Opcode first, Opcode second )
+{
+  if( first == Opcode::MulI )
+  {
+    return second == Opcode::AddI ? Opcode::MulAddI : Opcode::NOP;
+  }
+  if( first == Opcode::MulF )
+  {
+    return second == Opcode::AddF ? Opcode::MulAddF : Opcode::NOP;
+  }
+  if( first == Opcode::ArraySubscriptI )
+  {
+    return second == Opcode::AddI ? Opcode::AddSubscriptI : second == Opcode::MulI ? Opcode::MulSubscriptI : Opcode::NOP;
+  }
+  if( first == Opcode::ArraySubscriptF )
+  {
+    return second == Opcode::AddF ? Opcode::AddSubscriptF : second == Opcode::MulF ? Opcode::MulSubscriptF : Opcode::NOP;
+  }
+  return Opcode::NOP;
+}
+
+// fuses second into first, if they make one of the superinstructions
+static bool FusePair( const Function* function, VMCode &first, const VMCode &second )
+{
+  if( !IsTemp(function, first.c) )
+  {
+    return false;
+  }
+
+  Opcode jump = CompareJump(first.opcode);
+  if( jump != Opcode::NOP && second.opcode == Opcode::JumpIf && second.b == first.c )
+  {
+    // operand a of jumps is the offset
+    first.c = first.b;
+    first.b = first.a;
+    first.a = second.a;
+    first.SetOpcode(jump);
+    return true;
+  }
+
+  if( IsBinaryOp(first.opcode) && second.opcode == Opcode::Store && second.b == first.c )
+  {
+    first.c = second.a;
+    return true;
+  }
+
+  // + and * commute, so the temporary may be either operand
+  Opcode fused = FusedArithmetic(first.opcode, second.opcode);
+  if( fused != Opcode::NOP && (second.a == first.c) != (second.b == first.c) )
+  {
+    first.c = second.a == first.c ? second.b : second.a;
+    first.d = second.c;
+    first.SetOpcode(fused);
+    return true;
+  }
+
+  return false;
+}
+
+// the first instruction of each block, the instruction after each block and jump targets
+static std::vector<bool> BlockBoundaries( const std::vector<VMCode> &code )
+{
+  const size_t count = code.size();
+  std::vector<bool> boundary(count + 1, false);
+  for( size_t i = 0; i < count; ++i )
+  {
+    switch( code[i].opcode )
+    {
+      case Opcode::ForI:
+      case Opcode::ForF:
+      case Opcode::ForA:
+      {
+        boundary[i + 1] = boundary[i + 1 + code[i].d] = true;
+        break;
+      }
+      case Opcode::While:
+      case Opcode::When:
+      case Opcode::Whenever:
+      {
+        boundary[i + 1] = boundary[i + 1 + code[i].b] = boundary[i + 1 + code[i].b + code[i].c] = true;
+        break;
+      }
+      default:
+      {
+        if( IsJump(code[i].opcode) )
+        {
+          boundary[i + 1 + code[i].a] = true;
+        }
+        break;
+      }
+    }
+  }
+  return boundary;
+}
+
+// Fixes up jump offsets and block sizes in code rewritten from old. origin holds the old index of
+// each new instruction ((size_t)-1 for new ones, which are left alone), new_index the new index of
+// each old instruction and of the end.
+static void FixOffsets( std::vector<VMCode> &code, const std::vector<VMCode> &old,
+                        const std::vector<size_t> &origin, const std::vector<size_t> &new_index )
+{
+  for( size_t n = 0; n < code.size(); ++n )
+  {
+    if( origin[n] == (size_t)-1 )
+    {
+      continue;
+    }
+    VMCode &instr = code[n];
+    const VMCode &old_instr = old[origin[n]];
+    const size_t start = origin[n] + 1;
+    switch( instr.opcode )
+    {
+      case Opcode::ForI:
+      case Opcode::ForF:
+      case Opcode::ForA:
+      {
+        instr.d = (Operand)(new_index[start + old_instr.d] - (n + 1));
+        break;
+      }
+      case Opcode::While:
+      case Opcode::When:
+      case Opcode::Whenever:
+      {
+        instr.b = (Operand)(new_index[start + old_instr.b] - (n + 1));
+        instr.c = (Operand)(new_index[start + old_instr.b + old_instr.c] - new_index[start + old_instr.b]);
+        break;
+      }
+      default:
+      {
+        if( IsJump(instr.opcode) )
+        {
+          instr.a = (Operand)(new_index[start + old_instr.a] - (n + 1));
+        }
+        break;
+      }
+    }
+  }
+}
+
+// Post codegen pass fusing instruction pairs, see FusePair. Nothing is fused into the first
+// instruction of a block, the instruction after a block or a jump target. Fusing shortens the
+// code, so jump offsets and block sizes are fixed up after.
+static void Peephole( Function* function )
+{
+  const auto &code = function->code;
+  const size_t count = code.size();
+
+  std::vector<bool> boundary = BlockBoundaries(code);
+
+  std::vector<VMCode> fused;
+  // old index of each fused instruction (of its jump, if it is a comparison fused with one)
+  std::vector<size_t> origin;
+  // new index of each old instruction, and of the end
+  std::vector<size_t> new_index(count + 1);
+  fused.reserve(count);
+  origin.reserve(count);
+  for( size_t i = 0; i < count; ++i )
+  {
+    if( !fused.empty() && !boundary[i] && FusePair(function, fused.back(), code[i]) )
+    {
+      new_index[i] = fused.size() - 1;
+      origin.back() = i;
+      continue;
+    }
+    new_index[i] = fused.size();
+    fused.push_back(code[i]);
+    origin.push_back(i);
+  }
+  new_index[count] = fused.size();
+
+  if( fused.size() == count )
+  {
+    return;
+  }
+
+  FixOffsets(fused, code, origin, new_index);
+  function->code.swap(fused);
+}
+
+// Constants are read where they are, in Function::constants, instead of being copied to their
+// stack slots on every call. Operands naming a constant in the instructions that run most (see
+// ConstantOpcode) are replaced by its index in the constants, which the K opcodes read through
+// ProcessStack::constants. FunctionCall always finds its function there. If no other instruction
+// reads a constant slot, nothing is copied on entry (Function::constants_on_stack). Unused
+// operands are 0, so a function without parameters, whose constants start at slot 0, usually
+// still has them copied.
+static bool IsConstant( const Function* function, Operand slot )
+{
+  return slot >= function->constants_start && slot < function->locals_start;
+}
+
+// the opcode reading its last operand (see ConstantOperand) from the constants
+static Opcode ConstantOpcode( Opcode opcode )
+{
+  switch( opcode )
+  {
+    case Opcode::AddI:        return Opcode::AddIK;
+    case Opcode::SubI:        return Opcode::SubIK;
+    case Opcode::MulI:        return Opcode::MulIK;
+    case Opcode::AddF:        return Opcode::AddFK;
+    case Opcode::SubF:        return Opcode::SubFK;
+    case Opcode::MulF:        return Opcode::MulFK;
+    case Opcode::DivF:        return Opcode::DivFK;
+    case Opcode::Store:       return Opcode::StoreK;
+    case Opcode::ReturnValue: return Opcode::ReturnValueK;
+    case Opcode::JumpGT:      return Opcode::JumpGTK;
+    case Opcode::JumpLT:      return Opcode::JumpLTK;
+    case Opcode::JumpEQ:      return Opcode::JumpEQK;
+    case Opcode::JumpNEQ:     return Opcode::JumpNEQK;
+    case Opcode::JumpLEQ:     return Opcode::JumpLEQK;
+    case Opcode::JumpGEQ:     return Opcode::JumpGEQK;
+    case Opcode::JumpNotGTF:  return Opcode::JumpNotGTFK;
+    case Opcode::JumpNotLTF:  return Opcode::JumpNotLTFK;
+    case Opcode::JumpNotEQF:  return Opcode::JumpNotEQFK;
+    case Opcode::JumpNotNEQF: return Opcode::JumpNotNEQFK;
+    case Opcode::JumpNotLEQF: return Opcode::JumpNotLEQFK;
+    case Opcode::JumpNotGEQF: return Opcode::JumpNotGEQFK;
+    default:                  return Opcode::NOP;
+  }
+}
+
+// opcodes with an operand indexing the constants
+static bool IsConstantOpcode( Opcode opcode )
+{
+  return opcode == Opcode::FunctionCall || opcode == Opcode::TailCall || opcode == Opcode::ReturnValueK ||
+         opcode == Opcode::StoreK || (opcode >= Opcode::AddIK && opcode <= Opcode::DivFK) ||
+         (opcode >= Opcode::JumpGTK && opcode <= Opcode::JumpNotGEQFK);
+}
+
+// the operand indexing the constants, in a constant opcode or the one it is made from
+static int ConstantOperand( Opcode opcode )
+{
+  if( opcode == Opcode::FunctionCall || opcode == Opcode::TailCall || opcode == Opcode::ReturnValue ||
+      opcode == Opcode::ReturnValueK )
+  {
+    return 0;
+  }
+  if( opcode >= Opcode::JumpGT && opcode <= Opcode::JumpNotGEQFK )
+  {
+    return 2;
+  }
+  return 1;
+}
+
+// the opcode computing the same with the two operands it reads swapped, NOP if there isn't one
+static Opcode SwappedOpcode( Opcode opcode )
+{
+  switch( opcode )
+  {
+    case Opcode::AddI:
+    case Opcode::MulI:
+    case Opcode::AddF:
+    case Opcode::MulF:
+    case Opcode::JumpEQ:
+    case Opcode::JumpNEQ:
+    case Opcode::JumpNotEQF:
+    case Opcode::JumpNotNEQF: return opcode;
+    case Opcode::JumpGT:      return Opcode::JumpLT;
+    case Opcode::JumpLT:      return Opcode::JumpGT;
+    case Opcode::JumpLEQ:     return Opcode::JumpGEQ;
+    case Opcode::JumpGEQ:     return Opcode::JumpLEQ;
+    case Opcode::JumpNotGTF:  return Opcode::JumpNotLTF;
+    case Opcode::JumpNotLTF:  return Opcode::JumpNotGTF;
+    case Opcode::JumpNotLEQF: return Opcode::JumpNotGEQF;
+    case Opcode::JumpNotGEQF: return Opcode::JumpNotLEQF;
+    default:                  return Opcode::NOP;
+  }
+}
+
+// operands of code that are stack slots it may read or write (not offsets, counts or constants)
+static void SlotOperands( const VMCode& code, bool slots[4] )
+{
+  slots[0] = slots[1] = slots[2] = slots[3] = true;
+  if( IsConstantOpcode(code.opcode) )
+  {
+    slots[ConstantOperand(code.opcode)] = false;
+  }
+  switch( code.opcode )
+  {
+    case Opcode::Return:                 slots[0] = slots[1] = slots[2] = slots[3] = false; break;
+    case Opcode::ForI:
+    case Opcode::ForF:
+    case Opcode::ForA:                   slots[3] = false;                                  break;
+    case Opcode::While:
+    case Opcode::When:
+    case Opcode::Whenever:               slots[1] = slots[2] = false;                       break;
+    case Opcode::ConcatN:
+    case Opcode::StructMember:
+    case Opcode::StoreStructMember:      slots[1] = false;                                  break;
+    case Opcode::StructArrayMember:
+    case Opcode::StoreStructArrayMember: slots[3] = false;                                  break;
+    default:
+    {
+      if( IsJump(code.opcode) )
+      {
+        slots[0] = false;
+      }
+      break;
+    }
+  }
+}
+
+static void ReferenceConstants( Function* function )
+{
+  bool on_stack = false;
+  for( auto &code : function->code )
+  {
+    Opcode constant_opcode = ConstantOpcode(code.opcode);
+    if( constant_opcode != Opcode::NOP )
+    {
+      // binary ops read a and b, jumps b and c
+      int constant = ConstantOperand(code.opcode);
+      Operand* operands[] = { &code.a, &code.b, &code.c, &code.d };
+      Operand* last  = operands[constant];
+      Opcode swapped = SwappedOpcode(code.opcode);
+      if( swapped != Opcode::NOP && !IsConstant(function, *last) && IsConstant(function, *operands[constant - 1]) )
+      {
+        std::swap(*operands[constant - 1], *last);
+        code.SetOpcode(swapped);
+        constant_opcode = ConstantOpcode(swapped);
+      }
+      if( IsConstant(function, *last) )
+      {
+        *last = (Operand)(*last - function->constants_start);
+        code.SetOpcode(constant_opcode);
+      }
+    }
+
+    bool slots[4];
+    SlotOperands(code, slots);
+    const Operand operands[] = { code.a, code.b, code.c, code.d };
+    for( size_t i = 0; i < 4; ++i )
+    {
+      on_stack = on_stack || (slots[i] && IsConstant(function, operands[i]));
+    }
+    // when blocks read the constants from the closure they capture
+    on_stack = on_stack || code.opcode == Opcode::WhenRegister || code.opcode == Opcode::WheneverRegister;
+  }
+  function->constants_on_stack = on_stack;
+}
+
+// the operand code only writes (with a value of its own), -1 if there isn't one
+static int WrittenOperand( const VMCode& code )
+{
+  switch( code.opcode )
+  {
+    case Opcode::Store:
+    case Opcode::StoreK:          return 0;
+    case Opcode::ArraySubscriptI:
+    case Opcode::ArraySubscriptF: return 2;
+    case Opcode::AddSubscriptI:
+    case Opcode::MulSubscriptI:
+    case Opcode::AddSubscriptF:
+    case Opcode::MulSubscriptF:
+    case Opcode::MulAddI:
+    case Opcode::MulAddF:         return 3;
+    default:
+    {
+      bool is_binary = IsBinaryOp(code.opcode) || (code.opcode >= Opcode::AddIK && code.opcode <= Opcode::DivFK);
+      return is_binary ? 2 : -1;
+    }
+  }
+}
+
+// Locals are cleared on entry (ProcessStack::InitializeLocals) only if they may be read before they
+// are written. A local is written first if the first instruction naming it only writes it (see
+// WrittenOperand), and runs whenever anything after it does: it isn't in a loop or a branch a jump
+// may skip. Jumps only go forward, so nothing before it reads the local. With when blocks all
+// locals are cleared, the blocks capture them whenever they are registered.
+static void FindClearedLocals( Function* function )
+{
+  const auto &code = function->code;
+  const size_t count = code.size();
+
+  std::vector<bool> skippable(count, false);
+  for( size_t i = 0; i < count; ++i )
+  {
+    size_t skipped = 0;
+    switch( code[i].opcode )
+    {
+      case Opcode::ForI:
+      case Opcode::ForF:
+      case Opcode::ForA:             skipped = code[i].d;             break;
+      case Opcode::While:            skipped = code[i].b + code[i].c; break;
+      case Opcode::WhenRegister:
+      case Opcode::WheneverRegister: return;
+      default:                       skipped = IsJump(code[i].opcode) ? code[i].a : 0; break;
+    }
+    for( size_t j = i + 1; j <= i + skipped && j < count; ++j )
+    {
+      skippable[j] = true;
+    }
+  }
+
+  const u32 locals_count = function->locals_count();
+  // 0: not named yet, 1: written first, 2: may be read first
+  std::vector<u8> first_use(locals_count, 0);
+  for( size_t i = 0; i < count; ++i )
+  {
+    bool slots[4];
+    SlotOperands(code[i], slots);
+    const Operand operands[] = { code[i].a, code[i].b, code[i].c, code[i].d };
+    int written = skippable[i] ? -1 : WrittenOperand(code[i]);
+    for( int operand = 0; operand < 4; ++operand )
+    {
+      Operand slot = operands[operand];
+      if( !slots[operand] || slot < function->locals_start || slot >= function->temp_start )
+      {
+        continue;
+      }
+      u8 &use = first_use[slot - function->locals_start];
+      bool only_written = operand == written;
+      for( int other = 0; other < 4; ++other )
+      {
+        only_written = only_written && (other == operand || !slots[other] || operands[other] != slot);
+      }
+      if( !use )
+      {
+        use = only_written ? 1 : 2;
+      }
+    }
+  }
+
+  u32 start = function->temp_start;
+  u32 end   = function->locals_start;
+  for( u32 i = 0; i < locals_count; ++i )
+  {
+    if( first_use[i] == 2 )
+    {
+      start = std::min(start, function->locals_start + i);
+      end   = function->locals_start + i + 1;
+    }
+  }
+  function->cleared_locals_start = start < end ? start : function->locals_start;
+  function->cleared_locals_end   = start < end ? end : function->locals_start;
+}
+
+// Calls to small functions are replaced by the function's code (see InlineCalls)
+static const size_t MAX_INLINE_SIZE = 8;
+
+// operands an instruction of an inlined function uses, -1 if a function using it isn't inlined.
+// Loops, calls, strings, containers and processes all keep a function from being inlined.
+static int InlineOperandCount( Opcode opcode )
+{
+  switch( opcode )
+  {
+    case Opcode::ConcatS:
+    case Opcode::ConcatN:
+    case Opcode::EqualS:
+    case Opcode::NotEqualS:    return -1;
+    case Opcode::Return:       return 0;
+    case Opcode::ReturnValue:
+    case Opcode::ReturnValueK:
+    case Opcode::Jump:         return 1;
+    case Opcode::Store:
+    case Opcode::StoreK:
+    case Opcode::JumpIf:       return 2;
+    case Opcode::MulAddI:
+    case Opcode::MulAddF:      return 4;
+    default:
+    {
+      bool is_binary = IsBinaryOp(opcode) || (opcode >= Opcode::AddIK && opcode <= Opcode::DivFK);
+      return (is_binary || IsJump(opcode)) ? 3 : -1;
+    }
+  }
+}
+
+// a plain function, small, calling nothing (so it isn't recursive) and needing nothing done on
+// entry: no constants read from the stack, no locals to clear
+static bool IsInlinable( const Function* callee )
+{
+  if( callee->is_constructor || callee->reuse_context || callee->is_when_eval || callee->is_repl ||
+      callee->parameters_start != 0 || callee->constants_on_stack ||
+      callee->cleared_locals_start != callee->cleared_locals_end || callee->code.size() > MAX_INLINE_SIZE )
+  {
+    return false;
+  }
+  for( auto &code : callee->code )
+  {
+    if( InlineOperandCount(code.opcode) < 0 )
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Post codegen pass replacing each FunctionCall of an inlinable function (see IsInlinable) with the
+// function's code. Its slots are renumbered to where its frame would have started, just above the
+// caller's frame (Function::inlined_storage makes sure the stack has room), so a returned value
+// lands where the caller reads it. Parameters the function doesn't write are read from the
+// arguments directly, the others get a Store. Returns become a Store of the value and a Jump to the
+// end. The Store of the result after the call is folded into the returns, and the constants the
+// function reads are appended to the caller's. A TailCall keeps the function's returns, they return
+// from the caller. Functions with when blocks are left alone, their blocks share the constants and
+// layout of the frame.
+static void InlineCalls( Function* function )
+{
+  if( function->is_constructor || function->reuse_context || function->is_when_eval || function->is_repl ||
+      function->parameters_start != 0 )
+  {
+    return;
+  }
+
+  const auto &code = function->code;
+  const size_t count = code.size();
+  bool has_inlinable_call = false;
+  for( auto &instr : code )
+  {
+    if( instr.opcode == Opcode::WhenRegister || instr.opcode == Opcode::WheneverRegister )
+    {
+      return;
+    }
+    has_inlinable_call = has_inlinable_call ||
+                         ((instr.opcode == Opcode::FunctionCall || instr.opcode == Opcode::TailCall) &&
+                          IsInlinable(function->constants[instr.a].function));
+  }
+  if( !has_inlinable_call )
+  {
+    return;
+  }
+
+  const std::vector<bool> boundary = BlockBoundaries(code);
+  // the slot a callee's frame would start at
+  const u32 frame = function->storage_requirement;
+  const u32 constant_count = function->constant_count();
+  std::vector<Object> added_constants;
+  std::vector<std::pair<const Function*, u32>> constants_offsets;
+  u32 inlined_storage = function->inlined_storage;
+
+  std::vector<VMCode> inlined;
+  std::vector<size_t> origin;
+  std::vector<size_t> new_index(count + 1);
+  inlined.reserve(count);
+  origin.reserve(count);
+  for( size_t i = 0; i < count; ++i )
+  {
+    new_index[i] = inlined.size();
+    const VMCode &call = code[i];
+    const Function* callee = nullptr;
+    if( call.opcode == Opcode::FunctionCall || call.opcode == Opcode::TailCall )
+    {
+      callee = function->constants[call.a].function;
+    }
+    const bool is_tail_call = call.opcode == Opcode::TailCall;
+    const size_t parameter_count = callee ? callee->parameter_count() : 0;
+    // arguments past the third are in the NOPs after the call
+    const size_t arg_instructions = parameter_count > 3 ? (parameter_count - 3 + 3) / 4 : 0;
+    std::vector<Operand> args;
+    for( size_t arg = 0; callee && arg < parameter_count; ++arg )
+    {
+      const VMCode &holder = arg < 3 ? call : code[i + 1 + (arg - 3) / 4];
+      const Operand operands[] = { holder.a, holder.b, holder.c, holder.d };
+      args.push_back(arg < 3 ? operands[arg + 1] : operands[(arg - 3) % 4]);
+    }
+    bool inline_call = callee && IsInlinable(callee) &&
+                       frame + callee->storage_requirement + callee->inlined_storage < (u32)std::numeric_limits<Operand>::max() &&
+                       std::all_of(args.begin(), args.end(), [frame]( Operand arg ) { return arg < frame; });
+    if( !inline_call )
+    {
+      inlined.push_back(call);
+      origin.push_back(i);
+      continue;
+    }
+
+    // the result goes straight to where the caller stores it
+    const size_t next = i + 1 + arg_instructions;
+    const bool fold_store = !is_tail_call && next < count && !boundary[next] && code[next].opcode == Opcode::Store &&
+                            code[next].b == frame;
+    const Operand result = fold_store ? code[next].a : (Operand)frame;
+
+    // the callee's constants, once per callee
+    u32 constants_offset = 0;
+    auto found = std::find_if(constants_offsets.begin(), constants_offsets.end(),
+                              [callee]( const std::pair<const Function*, u32> &entry ) { return entry.first == callee; });
+    if( found != constants_offsets.end() )
+    {
+      constants_offset = found->second;
+    }
+    else
+    {
+      size_t used = 0;
+      for( auto &instr : callee->code )
+      {
+        if( IsConstantOpcode(instr.opcode) )
+        {
+          const Operand operands[] = { instr.a, instr.b, instr.c, instr.d };
+          used = std::max(used, (size_t)operands[ConstantOperand(instr.opcode)] + 1);
+        }
+      }
+      constants_offset = constant_count + (u32)added_constants.size();
+      added_constants.insert(added_constants.end(), callee->constants, callee->constants + used);
+      constants_offsets.push_back(std::make_pair(callee, constants_offset));
+    }
+
+    std::vector<bool> param_written(parameter_count, false);
+    for( auto &instr : callee->code )
+    {
+      int written = WrittenOperand(instr);
+      const Operand operands[] = { instr.a, instr.b, instr.c, instr.d };
+      if( written >= 0 && operands[written] < parameter_count )
+      {
+        param_written[operands[written]] = true;
+      }
+    }
+    auto slot = [&]( Operand callee_slot )
+    {
+      return (callee_slot < parameter_count && !param_written[callee_slot]) ? args[callee_slot] : (Operand)(frame + callee_slot);
+    };
+
+    for( size_t param = 0; param < parameter_count; ++param )
+    {
+      if( param_written[param] )
+      {
+        VMCode store(Opcode::Store);
+        store.a = (Operand)(frame + param);
+        store.b = args[param];
+        inlined.push_back(store);
+        origin.push_back((size_t)-1);
+      }
+    }
+
+    // the callee's code, with the callee index each jump goes to
+    const auto &callee_code = callee->code;
+    const std::vector<bool> callee_boundary = BlockBoundaries(callee_code);
+    const size_t body_start = inlined.size();
+    std::vector<size_t> body_index(callee_code.size() + 1);
+    std::vector<std::pair<size_t, size_t>> jumps;
+    for( size_t j = 0; j < callee_code.size(); ++j )
+    {
+      body_index[j] = inlined.size() - body_start;
+      VMCode instr = callee_code[j];
+      const bool is_last = j + 1 == callee_code.size();
+      const Opcode opcode = instr.opcode;
+      const bool is_return = opcode == Opcode::Return || opcode == Opcode::ReturnValue || opcode == Opcode::ReturnValueK;
+      if( is_return && is_tail_call )
+      {
+        if( opcode == Opcode::ReturnValue )
+        {
+          instr.a = slot(instr.a);
+        }
+        else if( opcode == Opcode::ReturnValueK )
+        {
+          instr.a = (Operand)(instr.a + constants_offset);
+        }
+        inlined.push_back(instr);
+        origin.push_back((size_t)-1);
+        continue;
+      }
+      if( is_return )
+      {
+        if( opcode == Opcode::ReturnValueK )
+        {
+          VMCode store(Opcode::StoreK);
+          store.a = result;
+          store.b = (Operand)(instr.a + constants_offset);
+          inlined.push_back(store);
+          origin.push_back((size_t)-1);
+        }
+        else if( opcode == Opcode::ReturnValue )
+        {
+          // a temporary is only read by the return, the instruction computing it can write the result
+          int written = j > 0 && !callee_boundary[j] && IsTemp(callee, instr.a) ? WrittenOperand(callee_code[j - 1]) : -1;
+          Operand* operands[] = { &inlined.back().a, &inlined.back().b, &inlined.back().c, &inlined.back().d };
+          if( written >= 0 && *operands[written] == slot(instr.a) )
+          {
+            *operands[written] = result;
+          }
+          else
+          {
+            VMCode store(Opcode::Store);
+            store.a = result;
+            store.b = slot(instr.a);
+            inlined.push_back(store);
+            origin.push_back((size_t)-1);
+          }
+        }
+        if( !is_last )
+        {
+          jumps.push_back(std::make_pair(inlined.size() - body_start, callee_code.size()));
+          inlined.push_back(VMCode(Opcode::Jump));
+          origin.push_back((size_t)-1);
+        }
+        continue;
+      }
+
+      bool slots[4];
+      SlotOperands(instr, slots);
+      Operand* operands[] = { &instr.a, &instr.b, &instr.c, &instr.d };
+      const int operand_count = InlineOperandCount(opcode);
+      for( int operand = 0; operand < operand_count; ++operand )
+      {
+        if( slots[operand] )
+        {
+          *operands[operand] = slot(*operands[operand]);
+        }
+      }
+      if( IsConstantOpcode(opcode) )
+      {
+        *operands[ConstantOperand(opcode)] += (Operand)constants_offset;
+      }
+      if( IsJump(opcode) )
+      {
+        jumps.push_back(std::make_pair(inlined.size() - body_start, j + 1 + instr.a));
+      }
+      inlined.push_back(instr);
+      origin.push_back((size_t)-1);
+    }
+    body_index[callee_code.size()] = inlined.size() - body_start;
+    for( auto &jump : jumps )
+    {
+      inlined[body_start + jump.first].a = (Operand)(body_index[jump.second] - (jump.first + 1));
+    }
+
+    inlined_storage = std::max(inlined_storage, callee->storage_requirement + callee->inlined_storage);
+    for( size_t skipped = i + 1; skipped <= next - (fold_store ? 0 : 1); ++skipped )
+    {
+      new_index[skipped] = inlined.size();
+    }
+    i = fold_store ? next : next - 1;
+  }
+  new_index[count] = inlined.size();
+
+  FixOffsets(inlined, code, origin, new_index);
+  function->code.swap(inlined);
+  function->inlined_storage = inlined_storage;
+
+  if( !added_constants.empty() )
+  {
+    // past the constant slots, only the instructions reading the constants in place see these
+    Object* constants = new Object[constant_count + added_constants.size()];
+    memcpy( constants, function->constants, constant_count * sizeof(Object) );
+    memcpy( constants + constant_count, added_constants.data(), added_constants.size() * sizeof(Object) );
+    delete[] function->constants;
+    function->constants = constants;
+  }
+
+  // arguments are read in place now, constants among them may not have to be copied on entry
+  ReferenceConstants( function );
+}
+
+// Record what a when condition depends on, so the block can be evaluated when that changes
+// instead of after every message. Checking closure promises is all it takes to wait on them,
+// anything else (members, calls) means it is evaluated after every message.
+static void FindWhenDependencies( Function* when_eval, size_t condition_start, size_t condition_count )
+{
+  // slot 0 is 'this' (or an unused operand), members follow it
+  auto is_member = [when_eval]( Operand slot ) { return slot > 0 && slot < when_eval->parameters_start; };
+  auto is_closure = [when_eval]( Operand slot ) { return slot >= when_eval->parameters_start && slot < when_eval->temp_start; };
+
+  // constructor locals are the members
+  bool polls = when_eval->is_constructor || when_eval->is_repl;
+  for( size_t i = condition_start; i < condition_start + condition_count; ++i )
+  {
+    const VMCode& code = when_eval->code[i];
+    switch( code.opcode )
+    {
+      case Opcode::CCall:
+      {
+        if( code.instruction == Instruction::Ready && is_closure(code.a) )
+        {
+          when_eval->when_promise_slots.push_back(code.a);
+        }
+        else
+        {
+          polls = true;
+        }
+        break;
+      }
+      case Opcode::FunctionCall:
+      case Opcode::ProcessMessage:
+      case Opcode::ProcessMessageNoReply:
+      case Opcode::SpawnProcess:
+      {
+        polls = true;
+        break;
+      }
+      default:
+      {
+        polls = polls || is_member(code.a) || is_member(code.b) || is_member(code.c) || is_member(code.d);
+        break;
+      }
+    }
+  }
+  when_eval->when_polls = polls;
+}
+
 template <class T>
 Function* VMCodeGen::GenWhen( T when_node, Opcode opcode )
 {
@@ -847,6 +1958,8 @@ Function* VMCodeGen::GenWhen( T when_node, Opcode opcode )
   m_function->parameters_start    = outer->parameters_start;
   m_function->constants_start     = outer->constants_start;
   m_function->locals_start        = outer->locals_start;
+  m_function->cleared_locals_start = outer->cleared_locals_start;
+  m_function->cleared_locals_end   = outer->cleared_locals_end;
   m_function->temp_start          = outer->temp_start;
   m_function->temp_end            = outer->temp_end;
   m_function->storage_requirement = outer->storage_requirement;
@@ -864,6 +1977,7 @@ Function* VMCodeGen::GenWhen( T when_node, Opcode opcode )
   size_t pre_opcount = m_opcode_count;
   size_t expr_id = GenExpressionTerm(when_node->condition.get(), false);
   size_t condition_opcount = m_opcode_count - pre_opcount;
+  FindWhenDependencies( m_function, when_id + 1, condition_opcount );
 
   pre_opcount = m_opcode_count;
 
@@ -882,6 +1996,11 @@ Function* VMCodeGen::GenWhen( T when_node, Opcode opcode )
   m_function->code[when_id].b = (Operand)condition_opcount;
   m_function->code[when_id].c = (Operand)body_opcount;
 
+  if( !m_function->is_repl )
+  {
+    Peephole( m_function );
+  }
+
   m_first_temp = old_first_temp;
   m_current_temp = old_current_temp;
   m_opcode_count = old_opcount;
@@ -912,6 +2031,24 @@ void VMCodeGen::GenStatement( Node::Return* return_statement )
   m_result_index = (size_t)-1;
   m_current_temp = m_first_temp;
 
+  // return f(...) hands the frame over to f, its return value is returned as is
+  auto function_call = return_statement->return_value ? return_statement->return_value->GetAsFunctionCall() : nullptr;
+  if( function_call && IsTailCall(function_call) )
+  {
+    size_t start = m_function->code.size();
+    GenFunctionCall( function_call );
+    // the arguments come first, the call is the last FunctionCall (more than 3 arguments continue in NOPs)
+    for( size_t i = m_function->code.size(); i-- > start; )
+    {
+      if( m_function->code[i].opcode == Opcode::FunctionCall )
+      {
+        m_function->code[i].SetOpcode(Opcode::TailCall);
+        break;
+      }
+    }
+    return;
+  }
+
   if( return_statement->return_value )
   {
     size_t expr_index = GenExpressionTerm( return_statement->return_value.get(), false );
@@ -947,16 +2084,47 @@ void VMCodeGen::GenStatement( Node::Assignment* assignment )
   }
   else if( left_array_subscript )
   {
-    m_result_index = SYMBOL_TO_STACK(left_array_subscript);
-    size_t rhs = GenExpressionTerm( assignment->right.get(), true );
-    bool rhs_is_func_call = rhs == (m_function->storage_requirement+m_base_stack_offset);
+    // the right hand side goes to a temp, the array itself is the store destination
+    size_t array_index = SYMBOL_TO_STACK(left_array_subscript);
+    size_t rhs = GenExpressionTerm( assignment->right.get(), false );
+
+    type_t container = GetType(left_array_subscript->ident->GetAsIdentifier());
+    if( StructType* struct_type = left_array_subscript->GetStructType(container) )
+    {
+      size_t member_index = struct_type->MemberIndex( *left_array_subscript->GetMemberName() );
+      if( container->type == ValueType::STRUCT )
+      {
+        PushOpcode(Opcode::StoreStructMember);
+        PushOperand(array_index);
+        PushOperand(member_index);
+        PushOperand(rhs);
+      }
+      else
+      {
+        size_t index_stack_index = GenExpressionTerm( left_array_subscript->index.get(), false );
+        PushOpcode(Opcode::StoreStructArrayMember);
+        PushOperand(array_index);
+        PushOperand(index_stack_index);
+        PushOperand(rhs);
+        PushOperand(member_index);
+      }
+      return;
+    }
 
     size_t index_stack_index = GenExpressionTerm( left_array_subscript->index.get(), false );
 
     type_t op_value_type = GetType(left_array_subscript);
-    PushOpcode( (op_value_type == TypeBuilder::GetPrimitiveType(ValueType::STRING)) ? Opcode::StoreArrayStringElement : Opcode::StoreArrayElement );
+    Opcode store_op = (op_value_type == TypeBuilder::GetPrimitiveType(ValueType::STRING)) ? Opcode::StoreArrayStringElement : Opcode::StoreArrayElement;
+    switch( Array::KindOf(op_value_type) )
+    {
+      case ArrayKind::INT:   store_op = Opcode::StoreArrayElementI; break;
+      case ArrayKind::FLOAT: store_op = Opcode::StoreArrayElementF; break;
+      case ArrayKind::BOOL:  store_op = Opcode::StoreArrayElementB; break;
+      default:               break;
+    }
+    PushOpcode(store_op);
 
-    PushOperand(m_result_index);
+    PushOperand(array_index);
     PushOperand(index_stack_index);
     PushOperand(rhs);
   }
@@ -973,7 +2141,9 @@ void VMCodeGen::GenStatement( Node::For* for_loop )
   size_t pre_opcount = m_opcode_count;
 
   // TODO: keep track of whether we branch, to allow for some loop optimizations
+  ++m_loop_depth;
   GenStatements( for_loop->body );
+  --m_loop_depth;
 
   size_t opcount = m_opcode_count - pre_opcount;
   // TODO: handle overflow
@@ -993,7 +2163,9 @@ void VMCodeGen::GenStatement( Node::While* while_loop )
   pre_opcount = m_opcode_count;
 
   // TODO: keep track of whether we branch, to allow for some loop optimizations
+  ++m_loop_depth;
   GenStatements( while_loop->body );
+  --m_loop_depth;
 
   size_t body_opcount = m_opcode_count - pre_opcount;
   // TODO: handle overflow
@@ -1034,21 +2206,9 @@ void VMCodeGen::GenStatement( Node::If* if_statement )
   m_current_temp = m_first_temp;
 
   size_t expr_id = GenExpressionTerm(if_statement->condition.get(), false);
-  size_t last_op = m_function->code.size()-1;
-  bool less_than = m_function->code[last_op].instruction == Instruction::LessThanI;
-  size_t last_jump_id = less_than ? last_op : PushOpcode( Opcode::JumpIf );
-  if( !less_than )
-  {
-    size_t jump_if_op = m_function->code.size() - 1;
-    m_function->code[jump_if_op].b = (Operand)expr_id;
-  }
-  else
-  {
-    // shift over operands (op a is jump offset in Jump* instructions)
-    m_function->code[last_op].c = m_function->code[last_op].b;
-    m_function->code[last_op].b = m_function->code[last_op].a;
-    m_function->code[last_op].instruction = Instruction::JumpGEQ;
-  }
+  // comparisons are fused with the jump later on (see Peephole)
+  size_t last_jump_id = PushOpcode( Opcode::JumpIf );
+  m_function->code[last_jump_id].b = (Operand)expr_id;
   // in case this is a nested if statement, start opcount from current
   size_t pre_op_count = m_opcode_count;
 
@@ -1082,20 +2242,8 @@ void VMCodeGen::GenStatement( Node::If* if_statement )
     size_t local_pre_op_count = m_opcode_count;
 
     size_t expr_id = GenExpressionTerm(elseif->condition.get(), false);
-    size_t last_op = m_function->code.size()-1;
-    bool less_than = m_function->code[last_op].instruction == Instruction::LessThanI;
-    last_jump_id = less_than ? last_op : PushOpcode( Opcode::JumpIf );
-    if( !less_than )
-    {
-      m_function->code[last_jump_id].b = (Operand)expr_id;
-    }
-    else
-    {
-      // shift over operands (op a is jump offset in Jump* instructions)
-      m_function->code[last_op].c = m_function->code[last_op].b;
-      m_function->code[last_op].b = m_function->code[last_op].a;
-      m_function->code[last_op].instruction = Instruction::JumpGEQ;
-    }
+    last_jump_id = PushOpcode( Opcode::JumpIf );
+    m_function->code[last_jump_id].b = (Operand)expr_id;
 
     size_t pre_op_count = m_opcode_count;
 
@@ -1172,7 +2320,8 @@ void VMCodeGen::GenStatement( Node::ProcessMessage* process_message )
   m_result_index = (size_t)-1;
   m_current_temp = m_first_temp;
 
-  GenProcessMessage(process_message);
+  // result is thrown away, so don't ask for a reply
+  GenProcessMessage(process_message, false);
 }
 
 void VMCodeGen::ImportCFunctions( ExecutableModule* executable_module, std::vector<std::vector<InstructionImpl>> &cfunctions )
@@ -1215,6 +2364,15 @@ void VMCodeGen::GenFunction( Node::Function* node )
     m_function->code.push_back(VMCode(Opcode::Return));
   }
 
+  FindMovedArgs( m_function );
+  // repl code is run as it is added, it can't move anymore
+  if( !m_function->is_repl )
+  {
+    Peephole( m_function );
+    ReferenceConstants( m_function );
+    FindClearedLocals( m_function );
+  }
+
   #if DUMP_CODE == 1
     Eople::Log::Debug("def %s\n", m_function->name.c_str());
     for( auto instr : m_function->code )
@@ -1250,6 +2408,8 @@ void VMCodeGen::InitFunction( Node::Function* node )
   u32 locals_count = ((u32)node->symbol_count - parameter_count - (u32)constant_count - this_ref);
 
   m_function->temp_start = m_function->locals_start + locals_count;
+  m_function->cleared_locals_start = m_function->locals_start;
+  m_function->cleared_locals_end = m_function->temp_start;
   m_function->temp_end = m_function->temp_start + (u32)node->temp_count;
 
   m_function->storage_requirement = (u32)node->symbol_count + (u32)node->temp_count;
@@ -1580,6 +2740,18 @@ void VMCodeGen::GenModule( ExecutableModule* module )
       }
     }
   }
+
+  // every function of the module is generated, the ones it calls can be inlined
+  if( m_inline_functions )
+  {
+    for( auto &function : m_current_module->functions )
+    {
+      if( function && !function->code.empty() )
+      {
+        InlineCalls( function.get() );
+      }
+    }
+  }
 }
 
 } // namespace Eople